@@ -5,6 +5,7 @@
 #ifndef HALFWAY_MEDIA_AGENT_EVENT_DEFINITION_H
 #define HALFWAY_MEDIA_AGENT_EVENT_DEFINITION_H
 
+#include <memory>
 #include <string>
 #include "common/frame.h"
 
@@ -16,11 +17,14 @@ enum EventType {
     EVENT_SINK_ERROR,
     EVENT_SOURCE_MESSAGE,
     EVENT_SOURCE_ERROR,
+    EVENT_SOURCE_EOS, // the source has delivered its last frame
 };
 
 struct MediaParameters {
     VideoFrameInfo *video;
     AudioFrameInfo *audio;
+    FrameFormat videoFormat = FRAME_FORMAT_H264;
+    std::shared_ptr<DataBuffer> videoExtraData; // parameter sets with start codes, VPS/SPS/PPS for H.265
 };
 
 struct StringInfo {
@@ -0,0 +1,336 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "frame_delivery_queue.h"
+#include "common/log.h"
+#include "common/utils.h"
+#include "media_frame_pipeline.h"
+#include <chrono>
+
+constexpr auto BLOCK_WAIT_SLICE = std::chrono::milliseconds(10);
+constexpr size_t POOLED_DRAIN_BATCH = 32; // frames per drain task, then the other sinks of the worker get a turn
+
+FrameQueue::FrameQueue(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    slots_ = new Slot[size];
+    for (size_t i = 0; i < size; i++) {
+        slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    mask_ = size - 1;
+}
+
+FrameQueue::~FrameQueue()
+{
+    delete[] slots_;
+}
+
+bool FrameQueue::TryPush(const std::shared_ptr<Frame> &frame)
+{
+    size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot &slot = slots_[pos & mask_];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.frame = frame;
+                slot.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool FrameQueue::TryPop(std::shared_ptr<Frame> &frame)
+{
+    size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot &slot = slots_[pos & mask_];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                frame = std::move(slot.frame);
+                slot.frame.reset();
+                slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // empty
+        } else {
+            pos = dequeuePos_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+size_t FrameQueue::Size() const
+{
+    size_t enqueue = enqueuePos_.load(std::memory_order_relaxed);
+    size_t dequeue = dequeuePos_.load(std::memory_order_relaxed);
+    return enqueue > dequeue ? enqueue - dequeue : 0;
+}
+
+SinkDeliveryWorker::SinkDeliveryWorker(const std::shared_ptr<FrameSink> &sink, const DeliveryOptions &options,
+                                       const std::string &metricsLabels)
+    : sink_(sink), policy_(options.policy), queue_(options.queueSize)
+{
+    auto registry = MetricsRegistry::GetInstance();
+    droppedMetric_ = registry->Counter("halfway_sink_queue_dropped_frames_total",
+                                       "Frames discarded by the overflow policy of the sink queue.", metricsLabels);
+    depthMetric_ = registry->Gauge("halfway_sink_queue_depth", "Frames waiting in the sink queue.", metricsLabels);
+    latencyMetric_ = registry->Histogram("halfway_sink_frame_seconds", "Time the sink takes to consume a frame.",
+                                         metricsLabels, 1e-9);
+
+    if (options.mode == DeliveryMode::POOLED && options.pool) {
+        pool_ = options.pool;
+        poolWorker_ = options.worker;
+        return;
+    }
+
+    if (options.mode == DeliveryMode::POOLED) {
+        LOGW("no worker pool, deliver on a thread of the sink");
+    }
+}
+
+SinkDeliveryWorker::~SinkDeliveryWorker()
+{
+    Stop();
+    // the last reference may be the one of the worker thread itself
+    if (workerThread_ && workerThread_->joinable()) {
+        if (workerThread_->get_id() == std::this_thread::get_id()) {
+            workerThread_->detach();
+        } else {
+            workerThread_->join();
+        }
+    }
+}
+
+void SinkDeliveryWorker::Start()
+{
+    if (pool_ || workerThread_) {
+        return;
+    }
+
+    // a sink removing itself from inside OnFrame() detaches the thread, which then must not outlive this object
+    workerThread_ = std::make_unique<std::thread>([self = shared_from_this()]() { self->Run(); });
+}
+
+void SinkDeliveryWorker::Stop()
+{
+    if (!running_.exchange(false)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        frameCond_.notify_all();
+        spaceCond_.notify_all();
+    }
+
+    if (pool_) {
+        // a drain task still queued finds running_ false; wait for one that is delivering right now
+        if (drainThread_.load() != std::this_thread::get_id()) {
+            std::lock_guard<std::mutex> lock(drainMutex_);
+        }
+        return;
+    }
+
+    if (!workerThread_) {
+        return;
+    }
+
+    if (workerThread_->get_id() == std::this_thread::get_id()) {
+        // the sink removed itself from inside OnFrame(), Run() returns after it
+        workerThread_->detach();
+    } else if (workerThread_->joinable()) {
+        workerThread_->join();
+    }
+}
+
+void SinkDeliveryWorker::Push(const std::shared_ptr<Frame> &frame)
+{
+    // the source may still hold this worker in a snapshot of its sinks after removing it
+    if (!running_) {
+        return;
+    }
+
+    bool isVideo = FrameType(frame->format) == FRAME_FORMAT_VIDEO_BASE;
+    size_t size = frame->TotalSize();
+
+    switch (policy_) {
+        case OverflowPolicy::DROP_OLDEST:
+            while (!queue_.TryPush(frame)) {
+                Drop();
+            }
+            break;
+        case OverflowPolicy::DROP_UNTIL_KEYFRAME:
+            if (isVideo && waitKeyFrame_) {
+                if (!frame->videoInfo.isKeyFrame) {
+                    CountDrop();
+                    return;
+                }
+                waitKeyFrame_ = false;
+            }
+
+            if (!queue_.TryPush(frame)) {
+                if (isVideo && frame->videoInfo.isKeyFrame) {
+                    while (!queue_.TryPush(frame)) {
+                        Drop();
+                    }
+                } else {
+                    CountDrop();
+                    if (isVideo) {
+                        waitKeyFrame_ = true;
+                    }
+                    return;
+                }
+            }
+            break;
+        case OverflowPolicy::BLOCK:
+            while (!queue_.TryPush(frame)) {
+                if (!running_) {
+                    CountDrop();
+                    return;
+                }
+
+                std::unique_lock<std::mutex> lock(mutex_);
+                producerWaiting_ = true;
+                if (queue_.Size() >= queue_.Capacity()) {
+                    spaceCond_.wait_for(lock, BLOCK_WAIT_SLICE);
+                }
+                producerWaiting_ = false;
+            }
+            break;
+    }
+
+    size_t depth = queue_.Size();
+    size_t maxDepth = maxDepth_.load(std::memory_order_relaxed);
+    while (depth > maxDepth && !maxDepth_.compare_exchange_weak(maxDepth, depth, std::memory_order_relaxed)) {
+    }
+    depthMetric_->Set(depth);
+    queuedBytes_.fetch_add(size, std::memory_order_relaxed);
+
+    if (pool_) {
+        ScheduleDrain();
+    } else {
+        WakeConsumer();
+    }
+}
+
+SinkDeliveryStats SinkDeliveryWorker::GetStats() const
+{
+    SinkDeliveryStats stats{};
+    stats.delivered = delivered_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.depth = queue_.Size();
+    stats.maxDepth = maxDepth_.load(std::memory_order_relaxed);
+    stats.queuedBytes = std::max<int64_t>(queuedBytes_.load(std::memory_order_relaxed), 0);
+    return stats;
+}
+
+void SinkDeliveryWorker::Drop()
+{
+    std::shared_ptr<Frame> oldest;
+    if (queue_.TryPop(oldest)) {
+        queuedBytes_.fetch_sub(oldest->TotalSize(), std::memory_order_relaxed);
+        CountDrop();
+    }
+}
+
+void SinkDeliveryWorker::CountDrop()
+{
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    droppedMetric_->Add();
+}
+
+void SinkDeliveryWorker::WakeConsumer()
+{
+    // pairs with the fence in Run(): either the worker sees the new frame or we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumerWaiting_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        frameCond_.notify_one();
+    }
+}
+
+void SinkDeliveryWorker::Run()
+{
+    std::shared_ptr<Frame> frame;
+    while (running_) {
+        if (!queue_.TryPop(frame)) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            consumerWaiting_ = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            frameCond_.wait(lock, [this] { return !running_ || queue_.Size() > 0; });
+            consumerWaiting_ = false;
+            continue;
+        }
+
+        if (producerWaiting_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            spaceCond_.notify_one();
+        }
+
+        Deliver(frame);
+    }
+
+    LOGD("delivery worker exited");
+}
+
+void SinkDeliveryWorker::Deliver(std::shared_ptr<Frame> &frame)
+{
+    queuedBytes_.fetch_sub(frame->TotalSize(), std::memory_order_relaxed);
+    depthMetric_->Set(queue_.Size());
+    auto sink = sink_.lock();
+    if (sink) {
+        int64_t startNs = SteadyNanoseconds();
+        sink->OnFrame(frame);
+        latencyMetric_->Observe(SteadyNanoseconds() - startNs);
+        delivered_.fetch_add(1, std::memory_order_relaxed);
+    }
+    frame.reset();
+}
+
+void SinkDeliveryWorker::ScheduleDrain()
+{
+    // pairs with the fence in Drain(): either the running task sees the new frame or we see it finished
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (drainScheduled_.exchange(true)) {
+        return;
+    }
+
+    pool_->Post(poolWorker_, [self = shared_from_this()]() { self->Drain(); });
+}
+
+void SinkDeliveryWorker::Drain()
+{
+    {
+        std::lock_guard<std::mutex> lock(drainMutex_);
+        drainThread_ = std::this_thread::get_id();
+        std::shared_ptr<Frame> frame;
+        for (size_t i = 0; i < POOLED_DRAIN_BATCH && running_ && queue_.TryPop(frame); i++) {
+            if (producerWaiting_.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> waitLock(mutex_);
+                spaceCond_.notify_one();
+            }
+            Deliver(frame);
+        }
+        drainThread_ = std::thread::id();
+    }
+
+    drainScheduled_ = false;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (running_ && queue_.Size() > 0) {
+        ScheduleDrain();
+    }
+}
@@ -0,0 +1,137 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_FRAME_DELIVERY_QUEUE_H
+#define HALFWAY_MEDIA_FRAME_DELIVERY_QUEUE_H
+
+#include "common/frame.h"
+#include "common/metrics.h"
+#include "common/worker_pool.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+enum class DeliveryMode {
+    SYNC,   // FrameSink::OnFrame() is called on the thread of FrameSource::DeliverFrame()
+    ASYNC,  // each sink has a bounded queue drained by its own worker thread
+    POOLED, // each sink has a bounded queue drained by a worker of a shared WorkerPool, no thread per sink
+};
+
+enum class OverflowPolicy {
+    DROP_OLDEST,         // make room by discarding the oldest queued frame
+    DROP_UNTIL_KEYFRAME, // discard video until the next keyframe, keyframes evict the oldest frames
+    BLOCK,               // wait in DeliverFrame() until the sink has caught up
+};
+
+struct DeliveryOptions {
+    DeliveryMode mode = DeliveryMode::SYNC;
+    size_t queueSize = 256; // rounded up to a power of two
+    OverflowPolicy policy = OverflowPolicy::DROP_OLDEST;
+    std::shared_ptr<WorkerPool> pool; // POOLED only
+    size_t worker = 0;                // POOLED only, the worker of `pool` that drains the queues
+};
+
+struct SinkDeliveryStats {
+    uint64_t delivered; // frames handed to FrameSink::OnFrame()
+    uint64_t dropped;   // frames discarded by the overflow policy
+    size_t depth;       // frames waiting in the queue
+    size_t maxDepth;    // highest depth seen
+    size_t queuedBytes; // payload of the waiting frames
+};
+
+// Bounded lock-free ring of frames (D. Vyukov's sequence-numbered slots).
+// A source delivers audio and video from different threads and DROP_OLDEST has the producer evict from the head,
+// so both ends may be used from more than one thread; in the common case it behaves like an SPSC ring.
+class FrameQueue {
+public:
+    explicit FrameQueue(size_t capacity);
+    ~FrameQueue();
+
+    FrameQueue(const FrameQueue &) = delete;
+    FrameQueue &operator=(const FrameQueue &) = delete;
+
+    bool TryPush(const std::shared_ptr<Frame> &frame);
+    bool TryPop(std::shared_ptr<Frame> &frame);
+
+    size_t Size() const;
+    size_t Capacity() const { return mask_ + 1; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        std::shared_ptr<Frame> frame;
+    };
+
+    Slot *slots_ = nullptr;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> enqueuePos_{0};
+    alignas(64) std::atomic<size_t> dequeuePos_{0};
+};
+
+class FrameSink;
+
+// Queue plus worker thread feeding one sink of a FrameSource in DeliveryMode::ASYNC.
+// In DeliveryMode::POOLED the queue is drained by tasks on a pool worker instead, a batch of frames at a time.
+class SinkDeliveryWorker : public std::enable_shared_from_this<SinkDeliveryWorker> {
+public:
+    SinkDeliveryWorker(const std::shared_ptr<FrameSink> &sink, const DeliveryOptions &options,
+                       const std::string &metricsLabels = "");
+    ~SinkDeliveryWorker();
+
+    // starts the worker thread in DeliveryMode::ASYNC, it holds a reference until it has exited
+    void Start();
+
+    void Push(const std::shared_ptr<Frame> &frame);
+    SinkDeliveryStats GetStats() const;
+
+    // returns once OnFrame() is no longer called, unless called from inside it; frames still queued are dropped
+    void Stop();
+
+private:
+    void Run();
+    void Deliver(std::shared_ptr<Frame> &frame);
+    void ScheduleDrain();
+    void Drain();
+    void Drop();
+    void CountDrop();
+    void WakeConsumer();
+
+private:
+    std::weak_ptr<FrameSink> sink_;
+    OverflowPolicy policy_;
+    FrameQueue queue_;
+
+    std::atomic<bool> running_{true};
+    std::atomic<bool> waitKeyFrame_{false};
+    std::atomic<bool> consumerWaiting_{false};
+    std::atomic<bool> producerWaiting_{false};
+    std::mutex mutex_;
+    std::condition_variable frameCond_;
+    std::condition_variable spaceCond_;
+
+    std::atomic<uint64_t> delivered_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<size_t> maxDepth_{0};
+    std::atomic<int64_t> queuedBytes_{0}; // briefly negative when a frame is popped before it is counted
+
+    std::shared_ptr<MetricCounter> droppedMetric_;
+    std::shared_ptr<MetricGauge> depthMetric_;
+    std::shared_ptr<MetricHistogram> latencyMetric_; // time the sink spends in OnFrame()
+
+    std::unique_ptr<std::thread> workerThread_;
+
+    // DeliveryMode::POOLED
+    std::shared_ptr<WorkerPool> pool_;
+    size_t poolWorker_ = 0;
+    std::atomic<bool> drainScheduled_{false};
+    std::mutex drainMutex_; // held while a drain task delivers frames
+    std::atomic<std::thread::id> drainThread_{};
+};
+
+#endif // HALFWAY_MEDIA_FRAME_DELIVERY_QUEUE_H
@@ -4,20 +4,70 @@
 
 #include "media_frame_pipeline.h"
 #include "common/log.h"
+#include "common/utils.h"
 #include <cstdint>
 #include <mutex>
+#include <string>
 #include <unordered_set>
 
+FrameSource::FrameSource()
+{
+    SetMetricsLabels(MetricLabels({{"source", std::to_string(Id())}}));
+}
+
 FrameSource::~FrameSource()
 {
     {
         std::unique_lock<std::shared_mutex> audioLock(audioSinkMutex_);
         audioSinks_.clear();
+        audioTargets_.reset();
     }
 
     {
         std::unique_lock<std::shared_mutex> videoLock(videoSinkMutex_);
         videoSinks_.clear();
+        videoTargets_.reset();
+    }
+
+    std::unordered_map<uint64_t, std::shared_ptr<SinkDeliveryWorker>> workers;
+    {
+        std::unique_lock<std::shared_mutex> lock(workerMutex_);
+        workers.swap(sinkWorkers_);
+    }
+
+    // a pooled worker may outlive the source in a queued drain task, it must not deliver any more
+    for (auto &item : workers) {
+        item.second->Stop();
+    }
+}
+
+void FrameSource::SetDeliveryOptions(const DeliveryOptions &options)
+{
+    std::unique_lock<std::shared_mutex> lock(workerMutex_);
+    deliveryOptions_ = options;
+}
+
+bool FrameSource::GetSinkDeliveryStats(uint64_t sinkId, SinkDeliveryStats &stats)
+{
+    auto worker = GetSinkWorker(sinkId);
+    if (!worker) {
+        return false;
+    }
+
+    stats = worker->GetStats();
+    return true;
+}
+
+void FrameSource::SetMetricsLabels(const std::string &labels)
+{
+    auto registry = MetricsRegistry::GetInstance();
+    metricsLabels_ = labels;
+    for (auto *item : {&audioMetrics_, &videoMetrics_}) {
+        auto media = MetricLabels(labels, {{"media", item == &audioMetrics_ ? "audio" : "video"}});
+        item->frames = registry->Counter("halfway_source_frames_total", "Frames delivered by the source.", media);
+        item->bytes = registry->Counter("halfway_source_bytes_total", "Bytes of the frames delivered.", media);
+        item->latency = registry->Histogram("halfway_source_deliver_seconds",
+                                            "Time to hand a frame to all sinks or their queues.", media, 1e-9);
     }
 }
 
@@ -26,14 +76,20 @@ void FrameSource::AddAudioSink(const std::shared_ptr<FrameSink> &sink)
     LOGD("src(%lu) add audio sink(%lu).", Id(), sink->Id());
     std::unique_lock<std::shared_mutex> lock(audioSinkMutex_);
     audioSinks_.emplace(sink->Id(), sink);
+    AddSinkWorker(sink);
+    audioTargets_ = BuildTargets(audioSinks_);
     sink->SetAudioSource(shared_from_this());
 }
 
 void FrameSource::RemoveAudioSink(const std::shared_ptr<FrameSink> &sink)
 {
-    std::unique_lock<std::shared_mutex> lock(audioSinkMutex_);
-    auto it = audioSinks_.find(sink->Id());
-    if (it != audioSinks_.end()) {
+    {
+        std::unique_lock<std::shared_mutex> lock(audioSinkMutex_);
+        auto it = audioSinks_.find(sink->Id());
+        if (it == audioSinks_.end()) {
+            return;
+        }
+
         auto src = it->second.lock();
         if (src) {
             src->UnsetAudioSource();
@@ -41,6 +97,20 @@ void FrameSource::RemoveAudioSink(const std::shared_ptr<FrameSink> &sink)
 
         LOGD("src(%lu) remove audio sink(%lu).", Id(), sink->Id());
         audioSinks_.erase(it);
+        audioTargets_ = BuildTargets(audioSinks_);
+    }
+
+    {
+        std::shared_lock<std::shared_mutex> lock(videoSinkMutex_);
+        if (videoSinks_.find(sink->Id()) != videoSinks_.end()) {
+            return;
+        }
+    }
+
+    // waits for the worker, must not hold any sink lock here
+    auto worker = TakeSinkWorker(sink->Id());
+    if (worker) {
+        worker->Stop();
     }
 }
 
@@ -49,14 +119,20 @@ void FrameSource::AddVideoSink(const std::shared_ptr<FrameSink> &sink)
     LOGD("src(%lu) add video sink(%lu).", Id(), sink->Id());
     std::unique_lock<std::shared_mutex> lock(videoSinkMutex_);
     videoSinks_.emplace(sink->Id(), sink);
+    AddSinkWorker(sink);
+    videoTargets_ = BuildTargets(videoSinks_);
     sink->SetVideoSource(shared_from_this());
 }
 
 void FrameSource::RemoveVideoSink(const std::shared_ptr<FrameSink> &sink)
 {
-    std::unique_lock<std::shared_mutex> lock(videoSinkMutex_);
-    auto it = videoSinks_.find(sink->Id());
-    if (it != videoSinks_.end()) {
+    {
+        std::unique_lock<std::shared_mutex> lock(videoSinkMutex_);
+        auto it = videoSinks_.find(sink->Id());
+        if (it == videoSinks_.end()) {
+            return;
+        }
+
         auto src = it->second.lock();
         if (src) {
             src->UnsetVideoSource();
@@ -64,30 +140,117 @@ void FrameSource::RemoveVideoSink(const std::shared_ptr<FrameSink> &sink)
 
         LOGD("src(%lu) remove video sink(%lu).", Id(), sink->Id());
         videoSinks_.erase(it);
+        videoTargets_ = BuildTargets(videoSinks_);
+    }
+
+    {
+        std::shared_lock<std::shared_mutex> lock(audioSinkMutex_);
+        if (audioSinks_.find(sink->Id()) != audioSinks_.end()) {
+            return;
+        }
+    }
+
+    // waits for the worker, must not hold any sink lock here
+    auto worker = TakeSinkWorker(sink->Id());
+    if (worker) {
+        worker->Stop();
     }
 }
 
 void FrameSource::DeliverFrame(const std::shared_ptr<Frame> &frame)
 {
+    int64_t startNs = SteadyNanoseconds();
+    DeliveryMetrics *metrics = nullptr;
     if (FrameType(frame->format) == FRAME_FORMAT_AUDIO_BASE) {
-        std::shared_lock<std::shared_mutex> lock(audioSinkMutex_);
-        for (auto &item : audioSinks_) {
-            auto sink = item.second.lock();
-            if (sink) {
-                sink->OnFrame(frame);
-            }
-        }
+        metrics = &audioMetrics_;
+        DeliverTo(frame, audioSinkMutex_, audioTargets_);
     } else if (FrameType(frame->format) == FRAME_FORMAT_VIDEO_BASE) {
-        std::shared_lock<std::shared_mutex> lock(videoSinkMutex_);
-        for (auto &item : videoSinks_) {
-            auto sink = item.second.lock();
+        metrics = &videoMetrics_;
+        DeliverTo(frame, videoSinkMutex_, videoTargets_);
+    } else {
+        LOGE("Unknown frame Type");
+        return;
+    }
+
+    metrics->frames->Add();
+    metrics->bytes->Add(frame->TotalSize());
+    metrics->latency->Observe(SteadyNanoseconds() - startNs);
+}
+
+void FrameSource::DeliverTo(const std::shared_ptr<Frame> &frame, std::shared_mutex &mutex,
+                            const std::shared_ptr<const SinkTargets> &targets)
+{
+    std::shared_ptr<const SinkTargets> current;
+    {
+        // direct sinks stay under the lock, so none is called any more once Remove*Sink() has returned
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        current = targets;
+        if (!current) {
+            return;
+        }
+
+        for (auto &item : current->direct) {
+            auto sink = item.lock();
             if (sink) {
                 sink->OnFrame(frame);
             }
         }
-    } else {
-        LOGE("Unknown frame Type");
     }
+
+    // a queue removed meanwhile is stopped and no longer hands frames to its sink
+    for (auto &worker : current->queued) {
+        worker->Push(frame);
+    }
+}
+
+std::shared_ptr<const FrameSource::SinkTargets>
+FrameSource::BuildTargets(const std::unordered_map<uint64_t, std::weak_ptr<FrameSink>> &sinks)
+{
+    auto targets = std::make_shared<SinkTargets>();
+    std::shared_lock<std::shared_mutex> lock(workerMutex_);
+    for (auto &item : sinks) {
+        auto it = sinkWorkers_.find(item.first);
+        if (it != sinkWorkers_.end()) {
+            targets->queued.push_back(it->second);
+        } else {
+            targets->direct.push_back(item.second);
+        }
+    }
+    return targets;
+}
+
+void FrameSource::AddSinkWorker(const std::shared_ptr<FrameSink> &sink)
+{
+    std::unique_lock<std::shared_mutex> lock(workerMutex_);
+    if (deliveryOptions_.mode == DeliveryMode::SYNC || sinkWorkers_.count(sink->Id())) {
+        return;
+    }
+
+    LOGD("src(%lu) deliver to sink(%lu) through a queue of size %zu.", Id(), sink->Id(),
+         deliveryOptions_.queueSize);
+    auto labels = MetricLabels(metricsLabels_, {{"sink", std::to_string(sink->Id())}});
+    auto worker = std::make_shared<SinkDeliveryWorker>(sink, deliveryOptions_, labels);
+    worker->Start();
+    sinkWorkers_.emplace(sink->Id(), worker);
+}
+
+std::shared_ptr<SinkDeliveryWorker> FrameSource::GetSinkWorker(uint64_t sinkId)
+{
+    std::shared_lock<std::shared_mutex> lock(workerMutex_);
+    auto it = sinkWorkers_.find(sinkId);
+    return it != sinkWorkers_.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<SinkDeliveryWorker> FrameSource::TakeSinkWorker(uint64_t sinkId)
+{
+    std::shared_ptr<SinkDeliveryWorker> worker;
+    std::unique_lock<std::shared_mutex> lock(workerMutex_);
+    auto it = sinkWorkers_.find(sinkId);
+    if (it != sinkWorkers_.end()) {
+        worker = std::move(it->second);
+        sinkWorkers_.erase(it);
+    }
+    return worker;
 }
 
 bool FrameSource::NotifySink(void *userdata)
@@ -6,13 +6,16 @@
 #define HALFWAY_MEDIA_MEDIA_FRAME_PIPELINE_H
 
 #include "common/frame.h"
+#include "common/metrics.h"
+#include "frame_delivery_queue.h"
 #include <shared_mutex>
 #include <unordered_map>
+#include <vector>
 
 class FrameSink;
 class FrameSource : public std::enable_shared_from_this<FrameSource> {
 public:
-    FrameSource() = default;
+    FrameSource();
     virtual ~FrameSource();
 
     void AddAudioSink(const std::shared_ptr<FrameSink> &sink);
@@ -23,17 +26,65 @@ public:
 
     uint64_t Id() { return reinterpret_cast<uint64_t>(this); }
 
+    /// Applies to sinks added afterwards. In DeliveryMode::ASYNC every sink gets its own queue and worker thread,
+    /// so a slow sink no longer stalls the source or the other sinks. DeliveryMode::POOLED does the same on a
+    /// shared WorkerPool.
+    void SetDeliveryOptions(const DeliveryOptions &options);
+    bool GetSinkDeliveryStats(uint64_t sinkId, SinkDeliveryStats &stats);
+
+    /// Labels of the metrics of this source and of the sink queues added afterwards, e.g. the session URL.
+    /// Call before the first frame is delivered.
+    void SetMetricsLabels(const std::string &labels);
+    const std::string &GetMetricsLabels() const { return metricsLabels_; }
+
     virtual void OnNotify(void *userdata) = 0;
 
 protected:
     void DeliverFrame(const std::shared_ptr<Frame> &frame);
     bool NotifySink(void *userdata);
 
+private:
+    // Sinks a frame goes to, rebuilt whenever a sink is added or removed. DeliverFrame() takes a reference under the
+    // sink lock and pushes to the queues after releasing it, so a sink blocking its producer stalls neither the
+    // other sinks nor Add/Remove*Sink().
+    struct SinkTargets {
+        std::vector<std::weak_ptr<FrameSink>> direct;            // DeliveryMode::SYNC, called under the lock
+        std::vector<std::shared_ptr<SinkDeliveryWorker>> queued; // behind a queue
+    };
+
+    // call with the lock of `sinks` held
+    std::shared_ptr<const SinkTargets>
+    BuildTargets(const std::unordered_map<uint64_t, std::weak_ptr<FrameSink>> &sinks);
+    void DeliverTo(const std::shared_ptr<Frame> &frame, std::shared_mutex &mutex,
+                   const std::shared_ptr<const SinkTargets> &targets);
+
+    void AddSinkWorker(const std::shared_ptr<FrameSink> &sink);
+    std::shared_ptr<SinkDeliveryWorker> GetSinkWorker(uint64_t sinkId);
+    std::shared_ptr<SinkDeliveryWorker> TakeSinkWorker(uint64_t sinkId);
+
 protected:
     std::shared_mutex audioSinkMutex_;
     std::shared_mutex videoSinkMutex_;
     std::unordered_map<uint64_t, std::weak_ptr<FrameSink>> audioSinks_;
     std::unordered_map<uint64_t, std::weak_ptr<FrameSink>> videoSinks_;
+
+private:
+    struct DeliveryMetrics {
+        std::shared_ptr<MetricCounter> frames;
+        std::shared_ptr<MetricCounter> bytes;
+        std::shared_ptr<MetricHistogram> latency; // time spent in DeliverFrame()
+    };
+
+    std::shared_ptr<const SinkTargets> audioTargets_; // guarded by audioSinkMutex_
+    std::shared_ptr<const SinkTargets> videoTargets_; // guarded by videoSinkMutex_
+
+    std::string metricsLabels_;
+    DeliveryMetrics audioMetrics_;
+    DeliveryMetrics videoMetrics_;
+
+    std::shared_mutex workerMutex_;
+    DeliveryOptions deliveryOptions_;
+    std::unordered_map<uint64_t, std::shared_ptr<SinkDeliveryWorker>> sinkWorkers_;
 };
 
 class FrameSink : public std::enable_shared_from_this<FrameSink> {
@@ -34,6 +34,12 @@ void MediaSink::SetMediaInfo(VideoFrameInfo *videoInfo, AudioFrameInfo *audioInf
     }
 }
 
+void MediaSink::SetVideoCodec(FrameFormat format, const std::shared_ptr<DataBuffer> &extraData)
+{
+    videoFormat_ = format;
+    videoExtraData_ = extraData;
+}
+
 void MediaSink::NotifySource(AgentEvent event)
 {
     FrameSink::NotifySource(&event);
@@ -52,6 +58,9 @@ bool MediaSink::OnNotify(void *userdata)
         case EVENT_SINK_SET_PARAMETERS:
             if (event->params) {
                 SetMediaInfo(event->params->video, event->params->audio);
+                if (event->params->video) {
+                    SetVideoCodec(event->params->videoFormat, event->params->videoExtraData);
+                }
             }
             break;
         case EVENT_SINK_INIT:
@@ -63,6 +72,9 @@ bool MediaSink::OnNotify(void *userdata)
                 LOGE("OnError: %s", event->info->info.c_str());
             }
             return Stop();
+        case EVENT_SOURCE_EOS:
+            LOGD("end of stream");
+            break;
         default:
             LOGW("unsupported event : %d", (int)event->type);
             break;
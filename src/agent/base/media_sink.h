@@ -16,6 +16,7 @@ public:
     ~MediaSink() override = default;
 
     void SetMediaInfo(VideoFrameInfo *videoInfo, AudioFrameInfo *audioInfo);
+    void SetVideoCodec(FrameFormat format, const std::shared_ptr<DataBuffer> &extraData);
 
     [[deprecated("This function will be deprecated")]] bool Notify(AgentEvent event);
 
@@ -30,6 +31,8 @@ private:
 protected:
     std::unique_ptr<VideoFrameInfo> videoInfo_;
     std::unique_ptr<AudioFrameInfo> audioInfo_;
+    FrameFormat videoFormat_ = FRAME_FORMAT_H264;
+    std::shared_ptr<DataBuffer> videoExtraData_;
 };
 
 #endif // HALFWAY_MEDIA_MEDIA_SINK_H
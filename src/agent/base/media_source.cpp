@@ -20,7 +20,7 @@ bool MediaSource::Start()
 MediaSource::~MediaSource()
 {
     running_ = false;
-    if (workerThread_->joinable()) {
+    if (workerThread_ && workerThread_->joinable()) {
         workerThread_->join();
     }
     workerThread_.reset();
@@ -0,0 +1,135 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../media_frame_pipeline.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
+
+// Checks the queued delivery modes against sinks that remove themselves or stop consuming.
+
+class TestSource : public FrameSource {
+public:
+    void OnNotify(void *userdata) override {}
+    void Deliver(const std::shared_ptr<Frame> &frame) { DeliverFrame(frame); }
+};
+
+class TestSink : public FrameSink {
+public:
+    void OnFrame(const std::shared_ptr<Frame> &frame) override
+    {
+        if (onFrame) {
+            onFrame();
+        }
+        received++;
+    }
+    bool OnNotify(void *userdata) override { return true; }
+
+    std::function<void()> onFrame;
+    std::atomic<int> received{0};
+};
+
+static std::shared_ptr<Frame> MakeVideoFrame()
+{
+    auto frame = std::make_shared<Frame>(64);
+    frame->format = FRAME_FORMAT_H264;
+    frame->videoInfo.isKeyFrame = true;
+    frame->SetSize(64);
+    return frame;
+}
+
+static void SleepMs(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// The worker of the sink is released by the removal while its thread is still inside OnFrame().
+static void TestRemoveInsideOnFrame()
+{
+    auto source = std::make_shared<TestSource>();
+    source->SetDeliveryOptions(DeliveryOptions{DeliveryMode::ASYNC, 8});
+    for (int i = 0; i < 50; i++) {
+        auto sink = std::make_shared<TestSink>();
+        std::weak_ptr<TestSink> weakSink = sink;
+        std::atomic<bool> removed{false};
+        sink->onFrame = [&source, weakSink, &removed]() {
+            auto self = weakSink.lock();
+            if (self && !removed.exchange(true)) {
+                source->RemoveVideoSink(self);
+            }
+        };
+        source->AddVideoSink(sink);
+        source->Deliver(MakeVideoFrame());
+        while (!removed) {
+            SleepMs(1);
+        }
+        sink.reset();
+    }
+    // gives the detached threads time to run off the end of their loop
+    SleepMs(50);
+}
+
+// A stuck sink with OverflowPolicy::BLOCK holds up the producer only, adding and removing sinks still works.
+static void TestBlockedProducer()
+{
+    auto source = std::make_shared<TestSource>();
+    source->SetDeliveryOptions(DeliveryOptions{DeliveryMode::ASYNC, 2, OverflowPolicy::BLOCK});
+
+    std::atomic<bool> entered{false};
+    std::atomic<bool> release{false};
+    auto stuck = std::make_shared<TestSink>();
+    stuck->onFrame = [&entered, &release]() {
+        entered = true;
+        while (!release) {
+            SleepMs(1);
+        }
+    };
+    source->AddVideoSink(stuck);
+
+    constexpr int FRAMES = 100;
+    std::atomic<int> delivered{0};
+    std::thread producer([&]() {
+        for (int i = 0; i < FRAMES; i++) {
+            source->Deliver(MakeVideoFrame());
+            delivered++;
+        }
+    });
+
+    while (!entered) {
+        SleepMs(1);
+    }
+    // the queue is full by now and the producer waits for room
+    SleepMs(50);
+    assert(delivered < FRAMES);
+
+    // the producer waits for the stuck sink outside the sink lock, so this does not wait for it
+    auto other = std::make_shared<TestSink>();
+    source->AddVideoSink(other);
+
+    std::thread releaser([&release]() {
+        SleepMs(100);
+        release = true;
+    });
+    source->RemoveVideoSink(stuck);
+    producer.join();
+    releaser.join();
+    assert(delivered == FRAMES);
+
+    while (other->received == 0) {
+        SleepMs(1);
+    }
+    source->RemoveVideoSink(other);
+}
+
+int main()
+{
+    TestRemoveInsideOnFrame();
+    TestBlockedProducer();
+    printf("frame delivery test passed\n");
+    return 0;
+}
@@ -3,6 +3,8 @@
 //
 
 #include "fake_data_source.h"
+#include "common/utils.h"
+#include <chrono>
 
 bool FakeDataSource::Init()
 {
@@ -16,6 +18,11 @@ bool FakeDataSource::Start()
 
 void FakeDataSource::ReceiveDataLoop()
 {
+    if (type_ == FakeDataType::H264_AAC) {
+        GenerateMediaLoop();
+        return;
+    }
+
     char fakeData[33] = "the fox jumps over the lazy dog\n";
     auto fakeFrame = std::make_shared<Frame>();
     fakeFrame->Append(fakeData);
@@ -25,3 +32,28 @@ void FakeDataSource::ReceiveDataLoop()
         std::this_thread::sleep_for(std::chrono::milliseconds(500));
     }
 }
+
+void FakeDataSource::GenerateMediaLoop()
+{
+    FakeMediaGenerator generator(mediaOptions_);
+    int64_t startMs = SteadyMicroseconds() / 1000;
+    uint64_t count = 0;
+    while (running_ && (frameLimit_ == 0 || count < frameLimit_)) {
+        auto frame = generator.Next();
+        if (realtime_) {
+            int64_t delayMs = (int64_t)frame->timestamp - (SteadyMicroseconds() / 1000 - startMs);
+            if (delayMs > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+            }
+        }
+
+        DeliverFrame(frame);
+        count++;
+    }
+
+    if (running_) {
+        AgentEvent event{};
+        event.type = EVENT_SOURCE_EOS;
+        NotifySink(event);
+    }
+}
@@ -6,11 +6,14 @@
 #define HALFWAY_MEDIA_FAKE_DATA_SOURCE_H
 
 #include "../base/media_source.h"
+#include "fake_media_generator.h"
+#include <cstdint>
 #include <memory>
 #include <thread>
 
 enum class FakeDataType {
     CHARACTERS = 0,
+    H264_AAC, // synthetic streams of FakeMediaGenerator
 };
 
 class FakeDataSource : public MediaSource {
@@ -26,6 +29,13 @@ public:
     bool Init() override;
     bool Start() override;
 
+    // H264_AAC only, call before Start()
+    void SetMediaOptions(const FakeMediaOptions &options) { mediaOptions_ = options; }
+    // true paces frames by their timestamps, false delivers them as fast as possible, e.g. for benchmarks
+    void SetRealtime(bool realtime) { realtime_ = realtime; }
+    // EVENT_SOURCE_EOS is sent after `count` frames, 0 never ends
+    void SetFrameLimit(uint64_t count) { frameLimit_ = count; }
+
 protected:
     // impl MediaSource
     void ReceiveDataLoop() override;
@@ -33,8 +43,13 @@ protected:
 private:
     explicit FakeDataSource(FakeDataType type = FakeDataType::CHARACTERS) : type_(type) {}
 
+    void GenerateMediaLoop();
+
 private:
     FakeDataType type_;
+    FakeMediaOptions mediaOptions_;
+    bool realtime_ = true;
+    uint64_t frameLimit_ = 0;
 };
 
 #endif // HALFWAY_MEDIA_FAKE_DATA_SOURCE_H
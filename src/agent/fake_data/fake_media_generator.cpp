@@ -0,0 +1,114 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "fake_media_generator.h"
+#include "common/frame_pool.h"
+#include "protocol/aac/adts_header.h"
+#include <algorithm>
+
+// Main profile 1280x720, as x264 writes them
+static const uint8_t H264_SPS[] = {0x67, 0x4d, 0x40, 0x1f, 0xec, 0xa0, 0x28, 0x02, 0xdd, 0x80, 0xb5, 0x01,
+                                   0x01, 0x01, 0x40, 0x00, 0x00, 0x03, 0x00, 0x40, 0x00, 0x00, 0x0c, 0xa3};
+static const uint8_t H264_PPS[] = {0x68, 0xee, 0x3c, 0x80};
+static const uint8_t START_CODE[] = {0x00, 0x00, 0x00, 0x01};
+
+// an IDR picture is about this many times larger than a P picture
+constexpr size_t IDR_SIZE_RATIO = 6;
+constexpr uint32_t AAC_FRAME_SAMPLES = 1024;
+
+FakeMediaGenerator::FakeMediaGenerator(const FakeMediaOptions &options) : options_(options)
+{
+    options_.fps = std::max<uint32_t>(options_.fps, 1);
+    options_.gop = std::max<uint32_t>(options_.gop, 1);
+    options_.sampleRate = std::max<uint32_t>(options_.sampleRate, 1);
+
+    size_t gopBytes = (uint64_t)options_.videoBitrate / 8 * options_.gop / options_.fps;
+    sliceSize_ = std::max<size_t>(gopBytes / (options_.gop - 1 + IDR_SIZE_RATIO), 16);
+    idrSize_ = sliceSize_ * IDR_SIZE_RATIO;
+    audioSize_ = std::max<size_t>((uint64_t)options_.audioBitrate / 8 * AAC_FRAME_SAMPLES / options_.sampleRate, 16);
+}
+
+std::shared_ptr<Frame> FakeMediaGenerator::Next()
+{
+    return VideoTimestamp() <= AudioTimestamp() ? NextVideo() : NextAudio();
+}
+
+std::shared_ptr<Frame> FakeMediaGenerator::NextVideo()
+{
+    bool key = videoCount_ % options_.gop == 0;
+    size_t size = key ? idrSize_ : sliceSize_;
+    size = size * 3 / 4 + Random() % (size / 2 + 1);
+
+    auto frame = FramePool::Alloc(sizeof(H264_SPS) + sizeof(H264_PPS) + sizeof(START_CODE) * 3 + size);
+    frame->format = FRAME_FORMAT_H264;
+    frame->timestamp = VideoTimestamp();
+    frame->videoInfo.framerate = options_.fps;
+    frame->videoInfo.width = options_.width;
+    frame->videoInfo.height = options_.height;
+    frame->videoInfo.isKeyFrame = key;
+    if (key) {
+        frame->Append(START_CODE, sizeof(START_CODE));
+        frame->Append(H264_SPS, sizeof(H264_SPS));
+        frame->Append(START_CODE, sizeof(START_CODE));
+        frame->Append(H264_PPS, sizeof(H264_PPS));
+    }
+    AppendPayload(frame, key ? 0x65 : 0x41, size);
+
+    videoCount_++;
+    return frame;
+}
+
+std::shared_ptr<Frame> FakeMediaGenerator::NextAudio()
+{
+    size_t size = audioSize_ * 3 / 4 + Random() % (audioSize_ / 2 + 1);
+
+    auto frame = FramePool::Alloc(sizeof(ADTSHeader) + size);
+    frame->format = FRAME_FORMAT_AAC;
+    frame->timestamp = AudioTimestamp();
+    frame->audioInfo.channels = options_.channels;
+    frame->audioInfo.nbSamples = AAC_FRAME_SAMPLES;
+    frame->audioInfo.sampleRate = options_.sampleRate;
+
+    ADTSHeader header(options_.sampleRate, options_.channels, sizeof(ADTSHeader) + size);
+    frame->Append(&header, sizeof(header));
+    AppendPayload(frame, 0x21, size);
+
+    audioCount_++;
+    return frame;
+}
+
+uint64_t FakeMediaGenerator::VideoTimestamp() const
+{
+    return videoCount_ * 1000 / options_.fps;
+}
+
+uint64_t FakeMediaGenerator::AudioTimestamp() const
+{
+    return audioCount_ * AAC_FRAME_SAMPLES * 1000 / options_.sampleRate;
+}
+
+void FakeMediaGenerator::AppendPayload(const std::shared_ptr<Frame> &frame, uint8_t header, size_t size)
+{
+    if (FrameType(frame->format) == FRAME_FORMAT_VIDEO_BASE) {
+        frame->Append(START_CODE, sizeof(START_CODE));
+    }
+
+    size_t offset = frame->Size();
+    frame->SetSize(offset + size);
+    uint8_t *data = frame->Data() + offset;
+    data[0] = header;
+    for (size_t i = 1; i < size; i++) {
+        uint8_t byte = Random() & 0xff;
+        data[i] = byte ? byte : 0xa5;
+    }
+}
+
+uint32_t FakeMediaGenerator::Random()
+{
+    // xorshift32
+    random_ ^= random_ << 13;
+    random_ ^= random_ >> 17;
+    random_ ^= random_ << 5;
+    return random_;
+}
@@ -0,0 +1,54 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_FAKE_MEDIA_GENERATOR_H
+#define HALFWAY_MEDIA_FAKE_MEDIA_GENERATOR_H
+
+#include "common/frame.h"
+#include <cstdint>
+#include <memory>
+
+struct FakeMediaOptions {
+    uint32_t fps = 25;
+    uint32_t gop = 50;               // frames from one IDR picture to the next
+    uint32_t videoBitrate = 4000000; // bits per second
+    uint16_t width = 1280;
+    uint16_t height = 720;
+    uint32_t sampleRate = 48000;
+    uint8_t channels = 2;
+    uint32_t audioBitrate = 128000;
+};
+
+/// Synthetic H.264 and AAC elementary streams at a given bitrate, without an encoder.
+/// A video frame is one Annex-B access unit: SPS, PPS and an IDR slice at the start of a GOP, a P slice otherwise,
+/// with an IDR picture several times larger than a P picture. An audio frame is an ADTS frame of 1024 samples.
+/// Payload bytes are pseudo-random and never zero, so they contain no start code.
+class FakeMediaGenerator {
+public:
+    explicit FakeMediaGenerator(const FakeMediaOptions &options = {});
+
+    /// Video and audio frames interleaved in timestamp order, timestamps in milliseconds.
+    std::shared_ptr<Frame> Next();
+
+    std::shared_ptr<Frame> NextVideo();
+    std::shared_ptr<Frame> NextAudio();
+
+private:
+    uint64_t VideoTimestamp() const;
+    uint64_t AudioTimestamp() const;
+    // `size` bytes starting with `header` at the end of `frame`, a video NAL unit gets a start code in front
+    void AppendPayload(const std::shared_ptr<Frame> &frame, uint8_t header, size_t size);
+    uint32_t Random();
+
+private:
+    FakeMediaOptions options_;
+    uint64_t videoCount_ = 0;
+    uint64_t audioCount_ = 0;
+    size_t idrSize_ = 0;
+    size_t sliceSize_ = 0;
+    size_t audioSize_ = 0;
+    uint32_t random_ = 0x9e3779b9;
+};
+
+#endif // HALFWAY_MEDIA_FAKE_MEDIA_GENERATOR_H
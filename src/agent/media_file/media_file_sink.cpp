@@ -2,10 +2,13 @@
 #include "common/log.h"
 #include "common/utils.h"
 #include <cstdint>
+#include <cstring>
 #include <netinet/in.h>
+#include <string>
 
 extern "C" {
 #include <libavcodec/packet.h>
+#include <libavutil/mem.h>
 #include <libavutil/time.h>
 }
 
@@ -14,11 +17,23 @@ MediaFileSink::~MediaFileSink()
     Stop();
 }
 
+void MediaFileSink::InitMetrics()
+{
+    auto registry = MetricsRegistry::GetInstance();
+    auto labels = MetricLabels({{"file", fileName_}});
+    framesMetric_ = registry->Counter("halfway_file_sink_frames_total", "Frames written to the file.", labels);
+    bytesMetric_ = registry->Counter("halfway_file_sink_bytes_total", "Bytes of the frames written.", labels);
+    droppedMetric_ =
+        registry->Counter("halfway_file_sink_dropped_frames_total", "Frames of unsupported formats.", labels);
+    latencyMetric_ = registry->Histogram("halfway_file_sink_frame_seconds", "Time to write a frame.", labels, 1e-9);
+}
+
 void MediaFileSink::OnFrame(const std::shared_ptr<Frame> &frame)
 {
+    int64_t startNs = SteadyNanoseconds();
     if (!avFmtCtx_) {
-        LOGE("avFmtCtx is nullptr");
-        exit(0);
+        // Init() failed, e.g. on a codec the muxer is not set up for
+        droppedMetric_->Add();
         return;
     }
 
@@ -28,10 +43,15 @@ void MediaFileSink::OnFrame(const std::shared_ptr<Frame> &frame)
 
     av_packet_unref(avPacket_);
 
-    if (frame->format == FRAME_FORMAT_H264) {
+    if (frame->format == videoFormat_ && videoStream_) {
+        // the muxer needs the NAL unit in one piece
+        frame->Flatten();
         int nalLength = frame->Size() - 4;
         LOGW("NALU size: %d", nalLength);
-        *(uint32_t *)frame->Data() = htonl(nalLength);
+        // H.265 stays in Annex B like its extradata, the muxer converts both
+        if (frame->format == FRAME_FORMAT_H264) {
+            *(uint32_t *)frame->Data() = htonl(nalLength);
+        }
 
         avPacket_->stream_index = videoStream_->index;
         avPacket_->data = frame->Data();
@@ -46,6 +66,7 @@ void MediaFileSink::OnFrame(const std::shared_ptr<Frame> &frame)
         avPacket_->flags = frame->videoInfo.isKeyFrame ? AV_PKT_FLAG_KEY : 0;
         avPacket_->pos = -1;
     } else if (frame->format == FRAME_FORMAT_AAC) {
+        frame->Flatten();
         avPacket_->stream_index = audioStream_->index;
         avPacket_->data = frame->Data() + 7;
         avPacket_->size = frame->Size() - 7;
@@ -58,11 +79,17 @@ void MediaFileSink::OnFrame(const std::shared_ptr<Frame> &frame)
         avPacket_->pos = -1;
     } else {
         LOGW("Unsupport frame format");
+        droppedMetric_->Add();
+        return;
     }
 
     // if (av_interleaved_write_frame(avFmtCtx_, avPacket_) != 0) {
     //     LOGE("av_interleaved_write_frame failed");
     // }
+
+    framesMetric_->Add();
+    bytesMetric_->Add(frame->Size());
+    latencyMetric_->Observe(SteadyNanoseconds() - startNs);
 }
 
 bool MediaFileSink::Init()
@@ -76,6 +103,23 @@ bool MediaFileSink::Init()
         return false;
     }
 
+    // checked before the file is created, a stream the muxer is not set up for must not leave an empty recording
+    AVCodecID videoCodec = AV_CODEC_ID_NONE;
+    if (videoInfo_) {
+        if (videoFormat_ == FRAME_FORMAT_H264) {
+            videoCodec = AV_CODEC_ID_H264;
+        } else if (videoFormat_ == FRAME_FORMAT_H265) {
+            videoCodec = AV_CODEC_ID_HEVC;
+        } else {
+            LOGE("unsupported video format %d", (int)videoFormat_);
+            return false;
+        }
+
+        if (videoCodec == AV_CODEC_ID_HEVC && !videoExtraData_) {
+            LOGW("no VPS/SPS/PPS in the stream description, the recording relies on the in-band parameter sets");
+        }
+    }
+
     std::string suffix;
     auto i = fileName_.find_last_of('.');
     if (i != std::string::npos) {
@@ -87,7 +131,16 @@ bool MediaFileSink::Init()
         fileName_ = fileName_ + ".mp4";
     }
 
-    int ret = avformat_alloc_output_context2(&avFmtCtx_, nullptr, nullptr, fileName_.c_str());
+    // initialized again after a stop, e.g. the source reconnected to a changed stream: name_1.mp4, name_2.mp4, ...
+    std::string fileName = fileName_;
+    if (segment_ > 0) {
+        i = fileName_.find_last_of('.');
+        fileName = fileName_.substr(0, i) + "_" + std::to_string(segment_) + fileName_.substr(i);
+        LOGD("next segment %s", fileName.c_str());
+    }
+    segment_++;
+
+    int ret = avformat_alloc_output_context2(&avFmtCtx_, nullptr, nullptr, fileName.c_str());
     if (ret < 0) {
         LOGE("Failed to alloc output ctx: %s", ff_strerror(ret));
         return false;
@@ -102,12 +155,26 @@ bool MediaFileSink::Init()
 
         LOGD("width: %d, height: %d", videoInfo_->width, videoInfo_->height);
         videoStream_->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-        videoStream_->codecpar->codec_id = AV_CODEC_ID_H264;
+        videoStream_->codecpar->codec_id = videoCodec;
         videoStream_->codecpar->width = videoInfo_->width;
         videoStream_->codecpar->height = videoInfo_->height;
         videoStream_->codecpar->format = AV_PIX_FMT_YUV420P;
         // videoStream_->codecpar->bit_rate = 1000000;
         videoStream_->time_base = (AVRational){1, 90000};
+
+        // H.264 samples are written length-prefixed without extradata, Annex B extradata would make the muxer
+        // parse them as Annex B too
+        if (videoCodec == AV_CODEC_ID_HEVC && videoExtraData_ && videoExtraData_->Size() > 0) {
+            size_t size = videoExtraData_->Size();
+            auto extraData = (uint8_t *)av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!extraData) {
+                LOGE("Failed to alloc extradata");
+                return false;
+            }
+            memcpy(extraData, videoExtraData_->Data(), size);
+            videoStream_->codecpar->extradata = extraData;
+            videoStream_->codecpar->extradata_size = (int)size;
+        }
     }
 
     if (audioInfo_) {
@@ -128,8 +195,8 @@ bool MediaFileSink::Init()
     }
 
     if (!(avFmtCtx_->flags & AVFMT_NOFILE)) {
-        if (avio_open(&avFmtCtx_->pb, fileName_.c_str(), AVIO_FLAG_WRITE) < 0) {
-            LOGE("Failed to open output file '%s'", fileName_.c_str());
+        if (avio_open(&avFmtCtx_->pb, fileName.c_str(), AVIO_FLAG_WRITE) < 0) {
+            LOGE("Failed to open output file '%s'", fileName.c_str());
             return false;
         }
     }
@@ -154,6 +221,8 @@ bool MediaFileSink::Stop()
     if (avFmtCtx_) {
         av_write_trailer(avFmtCtx_);
         avformat_close_input(&avFmtCtx_);
+        videoStream_ = nullptr;
+        audioStream_ = nullptr;
     }
 
     if (avPacket_) {
@@ -6,6 +6,7 @@
 #define HALFWAY_MEDIA_MEDIA_FILE_SINK_H
 
 #include "agent/base/media_sink.h"
+#include "common/metrics.h"
 #include <memory>
 
 extern "C" {
@@ -27,7 +28,9 @@ public:
     void OnFrame(const std::shared_ptr<Frame> &frame) override;
 
 private:
-    MediaFileSink(std::string fileName) : fileName_(std::move(fileName)) {}
+    MediaFileSink(std::string fileName) : fileName_(std::move(fileName)) { InitMetrics(); }
+
+    void InitMetrics();
 
     // impl MediaSink
     bool Init() override;
@@ -35,10 +38,16 @@ private:
 
 private:
     std::string fileName_;
+    int segment_ = 0; // files started, a restarted sink writes name_<segment>.<ext>
 
     AVFormatContext *avFmtCtx_ = nullptr;
     AVStream *videoStream_ = nullptr;
     AVStream *audioStream_ = nullptr;
     AVPacket *avPacket_ = nullptr;
+
+    std::shared_ptr<MetricCounter> framesMetric_;
+    std::shared_ptr<MetricCounter> bytesMetric_;
+    std::shared_ptr<MetricCounter> droppedMetric_;
+    std::shared_ptr<MetricHistogram> latencyMetric_; // muxing one frame
 };
 #endif // HALFWAY_MEDIA_MEDIA_FILE_SINK_H
\ No newline at end of file
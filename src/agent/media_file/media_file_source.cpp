@@ -4,8 +4,10 @@
 
 #include "media_file_source.h"
 #include "common/frame.h"
+#include "common/frame_pool.h"
 #include "common/log.h"
 #include "common/utils.h"
+#include "protocol/rtp/rtp_packet_h265.h"
 #include <memory>
 
 extern "C" {
@@ -22,6 +24,7 @@ MediaFileSource::~MediaFileSource()
 bool MediaFileSource::Init()
 {
     LOGD("enter");
+    SetMetricsLabels(MetricLabels({{"session", fileName_}}));
 
     AVDictionary *options = nullptr;
     int ret = avformat_open_input(&avFmtCtx_, fileName_.c_str(), nullptr, &options);
@@ -119,9 +122,46 @@ bool MediaFileSource::Init()
 
                 break;
             }
-            case AV_CODEC_ID_H265:
+            case AV_CODEC_ID_H265: {
                 videoFmt_ = FRAME_FORMAT_H265;
+
+                // hvcC: 22 bytes of configuration, numOfArrays, then arrays of NAL units of one type
+                uint8_t *ex = video_st->codecpar->extradata;
+                int exSize = video_st->codecpar->extradata_size;
+                int pos = 23;
+                int numOfArrays = (ex && exSize > 23) ? ex[22] : 0;
+                uint8_t startCode[4] = {0x00, 0x00, 0x00, 0x01};
+                for (int i = 0; i < numOfArrays && pos + 3 <= exSize; i++) {
+                    uint8_t type = ex[pos] & 0x3f;
+                    int numNalus = (ex[pos + 1] << 8) | ex[pos + 2];
+                    pos += 3;
+                    for (int j = 0; j < numNalus && pos + 2 <= exSize; j++) {
+                        int naluLength = (ex[pos] << 8) | ex[pos + 1];
+                        pos += 2;
+                        if (pos + naluLength > exSize) {
+                            break;
+                        }
+
+                        std::shared_ptr<Frame> *parameterSet = nullptr;
+                        if (type == HEVC_NALU_VPS) {
+                            parameterSet = &vpsFrame_;
+                        } else if (type == HEVC_NALU_SPS) {
+                            parameterSet = &spsFrame_;
+                        } else if (type == HEVC_NALU_PPS) {
+                            parameterSet = &ppsFrame_;
+                        }
+
+                        if (parameterSet && *parameterSet == nullptr) {
+                            *parameterSet = std::make_shared<Frame>(naluLength + 4);
+                            (*parameterSet)->format = FRAME_FORMAT_H265;
+                            (*parameterSet)->Assign(startCode, 4);
+                            (*parameterSet)->Append(ex + pos, naluLength);
+                        }
+                        pos += naluLength;
+                    }
+                }
                 break;
+            }
             default:
                 LOGE("Unsupported video codec");
                 break;
@@ -144,7 +184,8 @@ bool MediaFileSource::Init()
 void MediaFileSource::ReceiveDataLoop()
 {
     LOGD("enter");
-    AVStream *video_st = avFmtCtx_->streams[videoStreamIndex_];
+    // audio-only files have no video stream
+    AVStream *video_st = videoStreamIndex_ != -1 ? avFmtCtx_->streams[videoStreamIndex_] : nullptr;
     AVRational time_base_q = {1, AV_TIME_BASE};
     int64_t startTime = av_gettime();
     int64_t pts_time;
@@ -157,7 +198,8 @@ void MediaFileSource::ReceiveDataLoop()
     int cout = 1;
     uint8_t startCode[4] = {0x00, 0x00, 0x00, 0x01};
 
-    while (running_ && av_read_frame(avFmtCtx_, avPacket_) == 0) {
+    int ret = 0;
+    while (running_ && (ret = av_read_frame(avFmtCtx_, avPacket_)) == 0) {
         if (avPacket_->stream_index == videoStreamIndex_) { // pakcet is video
             LOGD("read video packet, dts: %ld, pts: %ld, size: %d", avPacket_->dts, avPacket_->pts, avPacket_->size);
 
@@ -167,18 +209,30 @@ void MediaFileSource::ReceiveDataLoop()
                 nalLength = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
                 if (nalLength > 0) {
                     bool isKeyFrame = false;
-                    if ((data[4] & 0x1f) == 0x05) {
-                        isKeyFrame = true;
-                        LOGD("frame count: %d, len = %zu, SPS", cout++, spsFrame_->Size());
-                        DeliverFrame(spsFrame_);
+                    if (videoFmt_ == FRAME_FORMAT_H265) {
+                        isKeyFrame = HEVC_IS_IRAP(HEVC_NALU_TYPE(data[4]));
+                    } else {
+                        isKeyFrame = ((data[4] & 0x1f) == 0x05);
+                    }
+
+                    if (isKeyFrame) {
+                        if (vpsFrame_) {
+                            LOGD("frame count: %d, len = %zu, VPS", cout++, vpsFrame_->Size());
+                            DeliverFrame(vpsFrame_);
+                        }
+
+                        if (spsFrame_ && ppsFrame_) {
+                            LOGD("frame count: %d, len = %zu, SPS", cout++, spsFrame_->Size());
+                            DeliverFrame(spsFrame_);
 
-                        LOGD("frame count: %d, len = %zu, PPS", cout++, ppsFrame_->Size());
-                        DeliverFrame(ppsFrame_);
+                            LOGD("frame count: %d, len = %zu, PPS", cout++, ppsFrame_->Size());
+                            DeliverFrame(ppsFrame_);
+                        }
                     }
 
-                    auto frame = std::make_shared<Frame>(nalLength + 4);
+                    auto frame = FramePool::Alloc(nalLength + 4);
                     frame->format = videoFmt_;
-                    frame->timestamp = avPacket_->pts;
+                    frame->timestamp = av_rescale_q(avPacket_->pts, video_st->time_base, msTimeBase_);
                     frame->videoInfo.width = videoInfo_.width;
                     frame->videoInfo.height = videoInfo_.height;
                     frame->videoInfo.isKeyFrame = isKeyFrame;
@@ -197,7 +251,7 @@ void MediaFileSource::ReceiveDataLoop()
 
             pts_time = av_rescale_q(avPacket_->pts, video_st->time_base, time_base_q);
             now_time = av_gettime() - startTime;
-            if (pts_time - now_time > 0) {
+            if (realtime_ && pts_time - now_time > 0) {
                 LOGD("video sleep %ld", (pts_time - now_time));
                 av_usleep(pts_time - now_time);
             }
@@ -208,7 +262,7 @@ void MediaFileSource::ReceiveDataLoop()
             avPacket_->dts = av_rescale_q(avPacket_->dts, audioStream->time_base, msTimeBase_);
             avPacket_->pts = av_rescale_q(avPacket_->pts, audioStream->time_base, msTimeBase_);
 
-            auto frame = std::make_shared<Frame>(avPacket_->size);
+            auto frame = FramePool::Alloc(avPacket_->size);
             frame->format = audioFmt_;
             frame->timestamp = avPacket_->pts;
             frame->audioInfo.channels = audioInfo_.channels;
@@ -219,9 +273,10 @@ void MediaFileSource::ReceiveDataLoop()
             LOGD("audio frame count: %d, len = %zu", ++audioCount, frame->Size());
             DeliverFrame(frame);
             AVRational time_base_q = {1, AV_TIME_BASE};
-            int64_t pts_time = av_rescale_q(avPacket_->pts, audioStream->time_base, time_base_q);
+            // pts is in milliseconds by now
+            int64_t pts_time = av_rescale_q(avPacket_->pts, msTimeBase_, time_base_q);
             int64_t now_time = av_gettime() - startTime;
-            if (pts_time > now_time) {
+            if (realtime_ && pts_time > now_time) {
                 LOGD("audio sleep %ld", (pts_time - now_time));
                 av_usleep(pts_time - now_time);
             }
@@ -232,5 +287,15 @@ void MediaFileSource::ReceiveDataLoop()
 
     av_packet_free(&avPacket_);
     //    fclose(fp);
+
+    // the input ended, rather than Stop() being called
+    if (running_) {
+        if (ret != AVERROR_EOF) {
+            LOGE("read %s failed: %s", fileName_.c_str(), ff_strerror(ret));
+        }
+        AgentEvent event{};
+        event.type = EVENT_SOURCE_EOS;
+        NotifySink(event);
+    }
     LOGD("Thread exited!");
 }
@@ -28,6 +28,9 @@ public:
     // impl MediaSource
     bool Init() override;
 
+    // true paces frames by their timestamps, false reads them as fast as possible, e.g. for benchmarks
+    void SetRealtime(bool realtime) { realtime_ = realtime; }
+
 private:
     MediaFileSource() = default;
     explicit MediaFileSource(std::string fileName) : fileName_(std::move(fileName)) {}
@@ -37,6 +40,7 @@ private:
 
 private:
     std::string fileName_;
+    bool realtime_ = true;
 
     AVFormatContext *avFmtCtx_ = nullptr;
     AVPacket *avPacket_ = nullptr;
@@ -53,6 +57,7 @@ private:
     VideoFrameInfo videoInfo_{};
     AudioFrameInfo audioInfo_{};
 
+    std::shared_ptr<Frame> vpsFrame_; // H.265 only
     std::shared_ptr<Frame> spsFrame_;
     std::shared_ptr<Frame> ppsFrame_;
 };
@@ -1,5 +1,8 @@
 #include "raw_file_sink.h"
 #include "common/log.h"
+#include <sys/uio.h>
+
+constexpr int RAW_FILE_SINK_IOV_MAX = 256;
 
 RawFileSink::~RawFileSink()
 {
@@ -10,10 +13,21 @@ RawFileSink::~RawFileSink()
 
 void RawFileSink::OnFrame(const std::shared_ptr<Frame> &frame)
 {
-    LOGD("recv frame size: %zu", frame->Size());
+    LOGD("recv frame size: %zu", frame->TotalSize());
     fflush(stdout);
     if (fileWriter_) {
-        fileWriter_->Write(frame->Data(), frame->Size());
+        if (frame->IsScattered()) {
+            struct iovec iov[RAW_FILE_SINK_IOV_MAX];
+            int count = frame->GetIoVec(iov, RAW_FILE_SINK_IOV_MAX);
+            if (count < 0) {
+                frame->Flatten();
+                fileWriter_->Write(frame->Data(), frame->Size());
+            } else {
+                fileWriter_->Write(iov, count);
+            }
+        } else {
+            fileWriter_->Write(frame->Data(), frame->Size());
+        }
         // fileWriter_->Flush();
     }
 }
@@ -3,10 +3,30 @@
 //
 
 #include "rtp_sink.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
 #include <memory>
+#include <sys/socket.h>
+#include <unistd.h>
 #include "common/log.h"
+#include "common/udp_reactor.h"
+#include "common/utils.h"
+#include "protocol/rtcp/rtcp.h"
+#include "protocol/rtp/rtp_packet_aac.h"
 
-RtpSink::~RtpSink() {}
+constexpr uint32_t RTCP_REPORT_INTERVAL_MS = 5000; // RFC 3550 6.2 minimum
+constexpr uint32_t VIDEO_CLOCK_RATE = 90000;
+
+RtpSink::~RtpSink()
+{
+    auto reactor = UdpReactor::GetInstance();
+    for (int fd : {rtcpTimerFd_, video_.rtcpFd, audio_.rtcpFd}) {
+        if (fd >= 0) {
+            reactor->RemoveSocket(fd);
+        }
+    }
+}
 
 bool RtpSink::Init()
 {
@@ -15,45 +35,237 @@ bool RtpSink::Init()
         return false;
     }
 
-    if (remoteVideoPort_ > 0) {
-        videoUdpClient_ = std::make_unique<UdpClient>(remoteIp_, remoteVideoPort_, "", localVideoPort_);
-        if (!videoUdpClient_ || !videoUdpClient_->Init()) {
-            LOGE("videoUdpClient init failed, remote %s:%d, local: ::%d", remoteIp_.c_str(), remoteVideoPort_,
-                 localVideoPort_);
-            return false;
-        }
+    cname_ = "halfway@" + HostName();
+    reactorLoop_ = UdpReactor::GetInstance()->PickLoop();
+
+    if (remoteVideoPort_ > 0 && !InitTrack(video_, localVideoPort_, remoteVideoPort_)) {
+        return false;
     }
 
-    if (remoteAudioPort_ > 0) {
-        audioUdpClient_ = std::make_unique<UdpClient>(remoteIp_, remoteAudioPort_, "", localAudioPort_);
-        if (!audioUdpClient_ || !audioUdpClient_->Init()) {
-            LOGE("audioUdpClient init failed, remote %s:%d, local: ::%d", remoteIp_.c_str(), remoteAudioPort_,
-                 localAudioPort_);
-            return false;
-        }
+    if (remoteAudioPort_ > 0 && !InitTrack(audio_, localAudioPort_, remoteAudioPort_)) {
+        return false;
+    }
+
+    if (video_.rtcpFd >= 0 || audio_.rtcpFd >= 0) {
+        rtcpTimerFd_ = UdpReactor::GetInstance()->AddTimer(reactorLoop_, RTCP_REPORT_INTERVAL_MS / 2,
+                                                           RTCP_REPORT_INTERVAL_MS, [this]() { SendSenderReports(); });
     }
 
     LOGD("RtpSink Init ok");
     return true;
 }
 
+void RtpSink::InitMetrics(Track &track, uint16_t remotePort)
+{
+    auto registry = MetricsRegistry::GetInstance();
+    auto labels = MetricLabels({{"sink", remoteIp_ + ":" + std::to_string(remotePort)}, {"media", track.name}});
+    track.framesMetric = registry->Counter("halfway_rtp_sink_frames_total", "Frames packetized.", labels);
+    track.packetsMetric = registry->Counter("halfway_rtp_sink_packets_total", "RTP packets sent.", labels);
+    track.bytesMetric = registry->Counter("halfway_rtp_sink_bytes_total", "Bytes of the RTP packets sent.", labels);
+    track.sendErrorsMetric =
+        registry->Counter("halfway_rtp_sink_send_errors_total", "Packet batches that failed to send.", labels);
+    track.latencyMetric = registry->Histogram("halfway_rtp_sink_frame_seconds",
+                                              "Time to packetize and send a frame.", labels, 1e-9);
+}
+
+bool RtpSink::InitTrack(Track &track, uint16_t localPort, uint16_t remotePort)
+{
+    // RTCP runs on the next port, without a configured port reserve an even RTP port whose successor is free and
+    // send from its socket, so that no one else can bind the port in between
+    int rtcpFd = -1;
+    if (localPort == 0) {
+        int rtpFd = -1;
+        localPort = UdpReactor::OpenPortPair(rtpFd, rtcpFd);
+        track.sender = localPort > 0 ? UdpSender::Create(rtpFd) : nullptr;
+    } else {
+        rtcpFd = UdpReactor::OpenSocket(localPort + 1);
+        track.sender = UdpSender::Create(localPort);
+    }
+
+    if (!track.sender || !track.sender->AddDestination(remoteIp_, remotePort)) {
+        LOGE("%s sender init failed, remote %s:%d, local: ::%d", track.name, remoteIp_.c_str(), remotePort,
+             localPort);
+        if (rtcpFd >= 0) {
+            close(rtcpFd);
+        }
+        return false;
+    }
+
+    if (rtcpFd < 0) {
+        LOGW("no RTCP port next to %d, %s runs without RTCP", localPort, track.name);
+        return true;
+    }
+
+    auto handler = [this, &track](std::shared_ptr<DataBuffer> buffer, const struct sockaddr_in &from) {
+        OnRtcp(track, buffer, from);
+    };
+    if (!UdpReactor::GetInstance()->AddSourceSocket(rtcpFd, reactorLoop_, std::move(handler))) {
+        close(rtcpFd);
+        return true;
+    }
+
+    track.rtcpFd = rtcpFd;
+    return true;
+}
+
+bool RtpSink::AddReceiver(const std::string &remoteIp, uint16_t remoteVideoPort, uint16_t remoteAudioPort)
+{
+    if (remoteVideoPort > 0 && (!video_.sender || !video_.sender->AddDestination(remoteIp, remoteVideoPort))) {
+        LOGE("add video receiver %s:%d failed", remoteIp.c_str(), remoteVideoPort);
+        return false;
+    }
+
+    if (remoteAudioPort > 0 && (!audio_.sender || !audio_.sender->AddDestination(remoteIp, remoteAudioPort))) {
+        LOGE("add audio receiver %s:%d failed", remoteIp.c_str(), remoteAudioPort);
+        return false;
+    }
+
+    return true;
+}
+
+void RtpSink::RemoveReceiver(const std::string &remoteIp, uint16_t remoteVideoPort, uint16_t remoteAudioPort)
+{
+    if (remoteVideoPort > 0 && video_.sender) {
+        video_.sender->RemoveDestination(remoteIp, remoteVideoPort);
+    }
+
+    if (remoteAudioPort > 0 && audio_.sender) {
+        audio_.sender->RemoveDestination(remoteIp, remoteAudioPort);
+    }
+}
+
+RtpSink::RetransmissionStats RtpSink::GetRetransmissionStats() const
+{
+    RetransmissionStats stats{};
+    stats.nacksReceived = nacksReceived_.load(std::memory_order_relaxed);
+    stats.packetsRequested = packetsRequested_.load(std::memory_order_relaxed);
+    stats.retransmitsServed = retransmitsServed_.load(std::memory_order_relaxed);
+    stats.retransmitsMissed = retransmitsMissed_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void RtpSink::OnPackets(Track &track, RtpPacketizer::PacketBatch &packets)
+{
+    track.history.Put(packets);
+    track.stats.OnRtpPackets(packets, SteadyMicroseconds());
+    if (!track.sender) {
+        return;
+    }
+
+    if (!track.sender->Send(packets)) {
+        track.sendErrorsMetric->Add();
+        return;
+    }
+
+    size_t bytes = 0;
+    for (auto &packet : packets) {
+        bytes += packet->Size();
+    }
+    track.packetsMetric->Add(packets.size());
+    track.bytesMetric->Add(bytes);
+    LOGD("send %zu %s packets", packets.size(), track.name);
+}
+
+void RtpSink::OnRtcp(Track &track, const std::shared_ptr<DataBuffer> &buffer, const struct sockaddr_in &from)
+{
+    ForEachRtcpPacket(buffer->Data(), buffer->Size(), [&](const RtcpHeader &header, const uint8_t *p, size_t size) {
+        if (header.pt == RTCP_RR) {
+            auto rr = RtcpRR::Parse(p, size);
+            if (rr) {
+                track.stats.OnReceiverReport(rr->ssrc, rr->reportBlocks, from.sin_addr, SteadyMicroseconds(),
+                                             Microseconds());
+            }
+        } else if (header.pt == RTCP_SR) {
+            // a receiver that sends media itself reports in its SR
+            auto sr = RtcpSR::Parse(p, size);
+            if (sr) {
+                track.stats.OnReceiverReport(sr->ssrc, sr->reportBlocks, from.sin_addr, SteadyMicroseconds(),
+                                             Microseconds());
+            }
+        } else if (header.pt == RTCP_BYE) {
+            auto bye = RtcpBYE::Parse(p, size);
+            if (bye) {
+                for (auto ssrc : bye->ssrcs) {
+                    track.stats.OnBye(ssrc);
+                }
+            }
+        } else if (header.pt == RTCP_RTPFB && header.subtype == RTCP_RTPFB_NACK) {
+            auto nack = RtcpRTPFB::Parse(p, size);
+            if (!nack) {
+                return;
+            }
+
+            auto lost = nack->GetLostSequences();
+            RtpPacketizer::PacketBatch packets;
+            size_t found = track.history.Get(lost, packets);
+            // runs on the event loop, a full send buffer drops the retransmissions instead of waiting
+            if (!track.sender->SendToHost(packets, from.sin_addr)) {
+                track.sendErrorsMetric->Add();
+            }
+
+            nacksReceived_.fetch_add(1, std::memory_order_relaxed);
+            packetsRequested_.fetch_add(lost.size(), std::memory_order_relaxed);
+            retransmitsServed_.fetch_add(found, std::memory_order_relaxed);
+            retransmitsMissed_.fetch_add(lost.size() - found, std::memory_order_relaxed);
+            LOGD("NACK for %zu %s packets, resend %zu", lost.size(), track.name, found);
+        }
+    });
+}
+
+void RtpSink::SendSenderReports()
+{
+    int64_t nowUs = SteadyMicroseconds();
+    uint64_t utcUs = Microseconds();
+    for (Track *track : {&video_, &audio_}) {
+        if (track->rtcpFd < 0) {
+            continue;
+        }
+
+        // compound packet: SR, then SDES with our CNAME
+        RtcpSR sr;
+        sr.padding = false;
+        sr.reportCount = 0;
+        if (!track->stats.MakeSenderReport(sr, nowUs, utcUs)) {
+            continue; // nothing sent yet
+        }
+
+        RtcpSDES sdes;
+        sdes.padding = false;
+        sdes.sdesChunks.push_back({sr.ssrc, {{RTCP_SDES_CNAME, cname_}}});
+
+        auto srData = sr.Generate();
+        auto sdesData = sdes.Generate();
+        auto data = std::make_shared<DataBuffer>(srData->Size() + sdesData->Size());
+        data->Append(srData->Data(), srData->Size());
+        data->Append(sdesData->Data(), sdesData->Size());
+
+        for (auto dest : track->sender->GetDestinations()) {
+            dest.sin_port = htons(ntohs(dest.sin_port) + 1);
+            if (sendto(track->rtcpFd, data->Data(), data->Size(), 0, (struct sockaddr *)&dest, sizeof(dest)) < 0) {
+                LOGW("send %s SR to %s failed: %s", track->name, inet_ntoa(dest.sin_addr), strerror(errno));
+            }
+        }
+    }
+}
+
 void RtpSink::OnFrame(const std::shared_ptr<Frame> &frame)
 {
-    if (frame->format == FRAME_FORMAT_H264) {
+    int64_t startNs = SteadyNanoseconds();
+    if (frame->format == FRAME_FORMAT_H264 || frame->format == FRAME_FORMAT_H265) {
         if (!videoPacketizer_) {
             videoPacketizer_ = RtpPacketizer::Create(frame->format);
             if (!videoPacketizer_) {
                 return;
             }
 
-            videoPacketizer_->SetCallback([&](std::shared_ptr<DataBuffer> packet) {
-                if (videoUdpClient_->Send(packet)) {
-                    LOGD("send video packet(size: %zu)", packet->Size());
-                }
-            });
+            video_.stats.SetClockRate(VIDEO_CLOCK_RATE);
+            videoPacketizer_->SetBatchCallback(
+                [this](RtpPacketizer::PacketBatch &packets) { OnPackets(video_, packets); });
         }
 
         videoPacketizer_->Packetize(frame);
+        video_.framesMetric->Add();
+        video_.latencyMetric->Observe(SteadyNanoseconds() - startNs);
     } else if (frame->format == FRAME_FORMAT_AAC) {
         if (!audioPacketizer_) {
             audioPacketizer_ = RtpPacketizer::Create(frame->format);
@@ -61,13 +273,14 @@ void RtpSink::OnFrame(const std::shared_ptr<Frame> &frame)
                 return;
             }
 
-            audioPacketizer_->SetCallback([&](std::shared_ptr<DataBuffer> packet) {
-                if (audioUdpClient_->Send(packet)) {
-                    LOGD("send audio packet(size: %zu)", packet->Size());
-                }
-            });
+            audio_.stats.SetClockRate(frame->audioInfo.sampleRate);
+            std::static_pointer_cast<RtpPacketizerAAC>(audioPacketizer_)->SetPacketDuration(audioPacketDurationMs_);
+            audioPacketizer_->SetBatchCallback(
+                [this](RtpPacketizer::PacketBatch &packets) { OnPackets(audio_, packets); });
         }
 
         audioPacketizer_->Packetize(frame);
+        audio_.framesMetric->Add();
+        audio_.latencyMetric->Observe(SteadyNanoseconds() - startNs);
     }
-}
\ No newline at end of file
+}
@@ -5,10 +5,17 @@
 #ifndef HALFWAY_MEDIA_RTP_SINK_H
 #define HALFWAY_MEDIA_RTP_SINK_H
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
 #include "agent/base/media_sink.h"
-#include "network/include/udp_client.h"
+#include "common/metrics.h"
+#include "common/udp_sender.h"
+#include "protocol/rtcp/rtcp_stats.h"
+#include "protocol/rtp/rtp_history.h"
 #include "protocol/rtp/rtp_packet.h"
 
 #define RtpSender RtpSink
@@ -34,24 +41,79 @@ public:
         localAudioPort_ = audioPort;
     }
 
+    // audio packets carry AUs covering about `ms` of audio, 0 (the default) sends one AU per packet
+    void SetAudioPacketDuration(uint32_t ms) { audioPacketDurationMs_ = ms; }
+
+    // fan out to another receiver, every frame still costs a few sendmmsg() calls in total
+    bool AddReceiver(const std::string &remoteIp, uint16_t remoteVideoPort, uint16_t remoteAudioPort = 0);
+    void RemoveReceiver(const std::string &remoteIp, uint16_t remoteVideoPort, uint16_t remoteAudioPort = 0);
+
+    // RTCP runs on the port after each local RTP port: NACKs are answered from the last RTP_HISTORY_SIZE packets,
+    // sender reports go to the port after each receiver's RTP port and receiver reports come back
+    struct RetransmissionStats {
+        uint64_t nacksReceived;
+        uint64_t packetsRequested;
+        uint64_t retransmitsServed; // packets sent again
+        uint64_t retransmitsMissed; // requested, but no longer in the history
+    };
+    RetransmissionStats GetRetransmissionStats() const;
+
+    // round-trip time and loss per receiver, from its latest receiver report
+    using ReceiverReport = RtcpSenderStats::ReceiverInfo;
+    std::vector<ReceiverReport> GetVideoReceiverReports() { return video_.stats.GetReceivers(); }
+    std::vector<ReceiverReport> GetAudioReceiverReports() { return audio_.stats.GetReceivers(); }
+
 private:
     explicit RtpSink(std::string remoteIp, uint16_t remoteVideoPort, uint16_t remoteAudioPort = 0)
         : remoteIp_(remoteIp), remoteVideoPort_(remoteVideoPort), remoteAudioPort_(remoteAudioPort)
     {
+        InitMetrics(video_, remoteVideoPort_);
+        InitMetrics(audio_, remoteAudioPort_);
     }
 
+    struct Track {
+        const char *name;
+        std::shared_ptr<UdpSender> sender;
+        RtpHistory history;
+        RtcpSenderStats stats;
+        int rtcpFd = -1; // owned by UdpReactor
+
+        std::shared_ptr<MetricCounter> framesMetric;
+        std::shared_ptr<MetricCounter> packetsMetric;
+        std::shared_ptr<MetricCounter> bytesMetric;
+        std::shared_ptr<MetricCounter> sendErrorsMetric;
+        std::shared_ptr<MetricHistogram> latencyMetric; // packetize and send one frame
+    };
+
+    void InitMetrics(Track &track, uint16_t remotePort);
+    bool InitTrack(Track &track, uint16_t localPort, uint16_t remotePort);
+    void OnPackets(Track &track, RtpPacketizer::PacketBatch &packets);
+    void OnRtcp(Track &track, const std::shared_ptr<DataBuffer> &buffer, const struct sockaddr_in &from);
+    void SendSenderReports();
+
 private:
     std::string remoteIp_;
     uint16_t remoteVideoPort_ = 0;
     uint16_t remoteAudioPort_ = 0;
     uint16_t localVideoPort_ = 0;
     uint16_t localAudioPort_ = 0;
+    uint32_t audioPacketDurationMs_ = 0;
 
-    std::unique_ptr<UdpClient> videoUdpClient_;
-    std::unique_ptr<UdpClient> audioUdpClient_;
+    Track video_{"video"};
+    Track audio_{"audio"};
 
     std::shared_ptr<RtpPacketizer> videoPacketizer_;
     std::shared_ptr<RtpPacketizer> audioPacketizer_;
+
+    // RTCP sockets and the report timer share one event loop
+    size_t reactorLoop_ = 0;
+    int rtcpTimerFd_ = -1;
+    std::string cname_;
+
+    std::atomic<uint64_t> nacksReceived_{0};
+    std::atomic<uint64_t> packetsRequested_{0};
+    std::atomic<uint64_t> retransmitsServed_{0};
+    std::atomic<uint64_t> retransmitsMissed_{0};
 };
 
-#endif // HALFWAY_MEDIA_RTP_SINK_H
\ No newline at end of file
+#endif // HALFWAY_MEDIA_RTP_SINK_H
@@ -0,0 +1,90 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "rtsp_reconnect_scheduler.h"
+#include "common/log.h"
+#include "common/utils.h"
+#include <algorithm>
+#include <chrono>
+
+constexpr double RECONNECT_RATE = 20;    // attempts per second
+constexpr uint32_t RECONNECT_BURST = 50; // attempts at once after a quiet period
+constexpr size_t RECONNECT_WORKERS = 4;  // attempts blocked in connect() at the same time
+
+RtspReconnectScheduler::RtspReconnectScheduler() : limiter_(RECONNECT_RATE, RECONNECT_BURST)
+{
+    workers_ = std::make_unique<WorkerPool>(RECONNECT_WORKERS);
+    throttledMetric_ = MetricsRegistry::GetInstance()->Counter(
+        "halfway_rtsp_reconnect_throttled_total", "Times the reconnect queue waited for the fleet-wide rate limit.", "");
+    thread_ = std::thread(&RtspReconnectScheduler::Run, this);
+}
+
+RtspReconnectScheduler::~RtspReconnectScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+        tasks_.clear();
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    workers_->Stop();
+}
+
+void RtspReconnectScheduler::SetRateLimit(double rate, uint32_t burst)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    limiter_.SetRate(rate, burst);
+}
+
+void RtspReconnectScheduler::Schedule(uint32_t delayMs, std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        tasks_.emplace(SteadyMicroseconds() + delayMs * 1000LL, std::move(task));
+    }
+    cond_.notify_one();
+}
+
+size_t RtspReconnectScheduler::Pending()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void RtspReconnectScheduler::Run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        if (tasks_.empty()) {
+            cond_.wait(lock);
+            continue;
+        }
+
+        int64_t nowUs = SteadyMicroseconds();
+        int64_t dueUs = tasks_.begin()->first;
+        if (dueUs > nowUs) {
+            cond_.wait_for(lock, std::chrono::microseconds(dueUs - nowUs));
+            continue;
+        }
+
+        int64_t waitUs = limiter_.Acquire(nowUs);
+        if (waitUs > 0) {
+            throttledMetric_->Add();
+            // the attempt stays first in line, a task scheduled meanwhile for earlier wakes us up again
+            cond_.wait_for(lock, std::chrono::microseconds(std::min<int64_t>(waitUs, 1000000)));
+            continue;
+        }
+
+        auto task = std::move(tasks_.begin()->second);
+        tasks_.erase(tasks_.begin());
+        workers_->Post(nextWorker_++, std::move(task));
+    }
+    LOGD("exit");
+}
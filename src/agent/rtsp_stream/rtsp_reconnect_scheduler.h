@@ -0,0 +1,56 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_RTSP_RECONNECT_SCHEDULER_H
+#define HALFWAY_MEDIA_RTSP_RECONNECT_SCHEDULER_H
+
+#include "common/metrics.h"
+#include "common/rate_limiter.h"
+#include "common/singleton.h"
+#include "common/worker_pool.h"
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/// Runs the reconnect attempts of every RtspSource in the process.
+/// An attempt runs once its backoff delay has passed and the fleet-wide rate limit admits it, so when a switch
+/// in front of a thousand cameras comes back they are dialled a few at a time instead of all at once.
+/// Attempts run on a small worker pool of their own, a connect() to a dead host never blocks an RTP event loop.
+class RtspReconnectScheduler : public Singleton<RtspReconnectScheduler> {
+    friend class Singleton<RtspReconnectScheduler>;
+
+public:
+    ~RtspReconnectScheduler() override;
+
+    /// attempts per second across the process, and how many may start at once after a quiet period
+    void SetRateLimit(double rate, uint32_t burst);
+
+    /// Runs `task` on a reconnect worker no earlier than `delayMs` from now
+    void Schedule(uint32_t delayMs, std::function<void()> task);
+
+    /// attempts waiting for their delay or the rate limit
+    size_t Pending();
+
+private:
+    RtspReconnectScheduler();
+
+    void Run();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::multimap<int64_t, std::function<void()>> tasks_; // by due time
+    RateLimiter limiter_;
+    bool running_ = true;
+    size_t nextWorker_ = 0;
+    std::unique_ptr<WorkerPool> workers_;
+    std::thread thread_;
+    std::shared_ptr<MetricCounter> throttledMetric_;
+};
+
+#endif // HALFWAY_MEDIA_RTSP_RECONNECT_SCHEDULER_H
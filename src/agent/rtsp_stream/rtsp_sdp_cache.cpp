@@ -0,0 +1,35 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "rtsp_sdp_cache.h"
+
+constexpr size_t SDP_CACHE_SIZE_MAX = 4096; // URLs, a few KiB each
+
+bool RtspSdpCache::Get(const std::string &url, Entry &entry)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(url);
+    if (it == entries_.end()) {
+        return false;
+    }
+
+    entry = it->second;
+    return true;
+}
+
+void RtspSdpCache::Put(const std::string &url, Entry entry)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.size() >= SDP_CACHE_SIZE_MAX && entries_.find(url) == entries_.end()) {
+        // any entry will do, it only costs one DESCRIBE
+        entries_.erase(entries_.begin());
+    }
+    entries_[url] = std::move(entry);
+}
+
+void RtspSdpCache::Erase(const std::string &url)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(url);
+}
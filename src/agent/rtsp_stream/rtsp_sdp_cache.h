@@ -0,0 +1,36 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_RTSP_SDP_CACHE_H
+#define HALFWAY_MEDIA_RTSP_SDP_CACHE_H
+
+#include "common/singleton.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/// Session descriptions by URL, so that connecting again to a camera can skip DESCRIBE.
+/// An entry is dropped when a SETUP built from it fails, e.g. after the camera changed its streams.
+class RtspSdpCache : public Singleton<RtspSdpCache> {
+    friend class Singleton<RtspSdpCache>;
+
+public:
+    struct Entry {
+        std::string sdp;
+        std::string baseUrl; // Content-Base of the DESCRIBE response
+    };
+
+    bool Get(const std::string &url, Entry &entry);
+    void Put(const std::string &url, Entry entry);
+    void Erase(const std::string &url);
+
+private:
+    RtspSdpCache() = default;
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+};
+
+#endif // HALFWAY_MEDIA_RTSP_SDP_CACHE_H
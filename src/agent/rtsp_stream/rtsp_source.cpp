@@ -1,17 +1,89 @@
 #include "rtsp_source.h"
+#include "rtsp_reconnect_scheduler.h"
+#include "rtsp_sdp_cache.h"
 #include "agent/base/event_definition.h"
 #include "common/frame.h"
 #include "common/log.h"
+#include "common/udp_reactor.h"
 #include "common/utils.h"
+#include "protocol/rtcp/rtcp.h"
+#include "protocol/rtp/rtp_packet_h264.h"
+#include "protocol/rtp/rtp_packet_h265.h"
 #include "protocol/rtsp/rtsp_request.h"
+#include <algorithm>
+#include <cerrno>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <netdb.h>
+#include <random>
 #include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 const char *RTSP_USER_AGENT = "HalfwatMedia/2.0";
 const char *MIME_SDP = "application/sdp";
+constexpr uint32_t RTCP_REPORT_INTERVAL_MS = 5000; // RFC 3550 6.2 minimum
+constexpr size_t INTERLEAVED_HEADER_SIZE = 4;      // '$', channel, 16-bit length
+constexpr uint32_t JITTER_POLL_INTERVAL_MS = 5;    // below the shortest hold time of RtpSorter
+constexpr uint32_t SUPERVISE_INTERVAL_MS = 1000;
+constexpr uint32_t HANDSHAKE_TIMEOUT_MS = 10000;
+constexpr int SESSION_TIMEOUT_DEFAULT = 60;       // seconds, RFC 2326 12.37
+constexpr uint32_t RECONNECT_BACKOFF_MIN_MS = 1000;
+
+// Forwards the events of one connection. Once a reconnect or Stop() has replaced it they are dropped, so a late
+// OnClose() of the old connection never tears down the new one.
+class RtspSource::ConnectionListener : public IClientListener {
+public:
+    ConnectionListener(std::weak_ptr<RtspSource> source, uint64_t generation)
+        : source_(std::move(source)), generation_(generation)
+    {
+    }
+
+    void OnReceive(std::shared_ptr<DataBuffer> buffer) override
+    {
+        auto source = Current();
+        if (!source) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(source->connectionMutex_);
+        if (source->generation_ == generation_) {
+            source->OnReceive(buffer);
+        }
+    }
+
+    void OnClose() override
+    {
+        auto source = Current();
+        if (source) {
+            source->OnClose();
+        }
+    }
+
+    void OnError(const std::string &errorInfo) override
+    {
+        auto source = Current();
+        if (source) {
+            source->OnError(errorInfo);
+        }
+    }
+
+private:
+    std::shared_ptr<RtspSource> Current()
+    {
+        auto source = source_.lock();
+        return source && source->generation_ == generation_ ? source : nullptr;
+    }
+
+private:
+    std::weak_ptr<RtspSource> source_;
+    uint64_t generation_;
+};
 
 RtspSource::~RtspSource()
 {
@@ -32,168 +104,496 @@ bool RtspSource::Init()
         return false;
     }
 
-    rtspConnectionClient_ = std::make_unique<TcpClient>(rtspUrl_.GetHostName(), rtspUrl_.GetPort());
-    rtspConnectionClient_->SetListener(std::dynamic_pointer_cast<RtspSource>(shared_from_this()));
+    SetMetricsLabels(MetricLabels({{"session", url_}}));
+    auto registry = MetricsRegistry::GetInstance();
+    auto labels = MetricLabels(GetMetricsLabels(), {{"connect", fastConnect_ ? "fast" : "full"}});
+    handshakeMetric_ =
+        registry->Histogram("halfway_rtsp_handshake_seconds", "Time from start to the PLAY response.", labels, 1e-6);
+    firstKeyframeMetric_ =
+        registry->Histogram("halfway_rtsp_first_keyframe_seconds",
+                            "Time from start to the first video keyframe, or audio frame without video.", labels, 1e-6);
+    reconnectsMetric_ = registry->Counter("halfway_rtsp_reconnects_total", "Connections set up again after a loss.",
+                                          GetMetricsLabels());
+
+    struct addrinfo hints {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *result = nullptr;
+    if (getaddrinfo(rtspUrl_.GetHostName().c_str(), nullptr, &hints, &result) == 0 && result) {
+        serverAddr_ = *(struct sockaddr_in *)result->ai_addr;
+        freeaddrinfo(result);
+    } else {
+        LOGW("resolve %s failed, no RTCP feedback", rtspUrl_.GetHostName().c_str());
+    }
 
-    if (!rtspConnectionClient_->Init()) {
-        LOGE("TcpClient init error");
+    rtcpSsrc_ = std::random_device{}();
+    cname_ = "halfway@" + HostName();
+
+    streamParser_.SetMessageHandler([this](const RtspStreamParser::Message &message) { OnMessage(message); });
+    streamParser_.SetInterleavedHandler(
+        [this](uint8_t channel, const uint8_t *data, size_t size) { OnInterleaved(channel, data, size); });
+
+    uint64_t generation = ++nextGeneration_;
+    rtspConnectionClient_ = Connect(generation, connectionListener_);
+    if (!rtspConnectionClient_) {
         return false;
     }
 
-    if (!rtspConnectionClient_->Connect()) {
+    generation_ = generation;
+    return true;
+}
+
+std::unique_ptr<TcpClient> RtspSource::Connect(uint64_t generation, std::shared_ptr<IClientListener> &listener)
+{
+    listener = std::make_shared<ConnectionListener>(std::dynamic_pointer_cast<RtspSource>(shared_from_this()),
+                                                    generation);
+    auto client = std::make_unique<TcpClient>(rtspUrl_.GetHostName(), rtspUrl_.GetPort());
+    client->SetListener(listener);
+
+    if (!client->Init()) {
+        LOGE("TcpClient init error");
+        return nullptr;
+    }
+
+    if (!client->Connect()) {
         LOGE("TcpClient Connect error");
+        return nullptr;
+    }
+
+    return client;
+}
+
+bool RtspSource::Start()
+{
+    if (!fixedReactorLoop_) {
+        reactorLoop_ = UdpReactor::GetInstance()->PickLoop();
+    }
+
+    std::lock_guard<std::mutex> lock(connectionMutex_);
+    state_ = RtspState::CONNECTING;
+    if (!StartHandshake()) {
+        state_ = RtspState::STOPPED;
         return false;
     }
 
+    // keep-alives, stall and handshake timeouts are checked on the event loop of the RTP sockets
+    superviseTimerFd_ = UdpReactor::GetInstance()->AddTimer(reactorLoop_, SUPERVISE_INTERVAL_MS,
+                                                            SUPERVISE_INTERVAL_MS, [this]() { Supervise(); });
+    if (superviseTimerFd_ < 0) {
+        LOGE("start supervise timer failed");
+    }
+
+    // everything runs on the TCP client and reactor threads, ReceiveDataLoop() would only park a thread
     return true;
 }
 
-bool RtspSource::Start()
+bool RtspSource::StartHandshake()
 {
-    if (!SendRequestOptions()) {
-        LOGE("Send OPTIONS error");
+    startUs_ = SteadyMicroseconds();
+    interleaved_ = transport_ == RtspTransport::TCP || (transport_ == RtspTransport::AUTO && udpFailed_);
+    if (!fastConnect_) {
+        if (!SendRequestOptions()) {
+            LOGE("Send OPTIONS error");
+            return false;
+        }
+        return true;
+    }
+
+    // OPTIONS only lists the methods of the server, which every server implements for a plain playback
+    RtspSdpCache::Entry entry;
+    if (RtspSdpCache::GetInstance()->Get(url_, entry) && ApplyDescription(entry.sdp, entry.baseUrl)) {
+        LOGD("sdp of %s from cache", url_.c_str());
+        sdpFromCache_ = true;
+        return SetupFirstTrack();
+    }
+
+    if (!SendRequestDescribe()) {
+        LOGE("Send DESCRIBE error");
         return false;
     }
 
-    return MediaSource::Start();
+    return true;
 }
 
 void RtspSource::Stop()
 {
-    if (videoRtpServer_) {
-        videoRtpServer_->Stop();
-        videoRtpServer_.reset();
-    }
+    // events of the connection are dropped from here on, a pending reconnect gives up
+    bool playing = state_.exchange(RtspState::STOPPED) == RtspState::PLAYING;
+    generation_ = 0;
+    std::vector<int> timers;
+    std::unique_ptr<TcpClient> client;
+    std::shared_ptr<IClientListener> listener;
+    {
+        // waits for a reconnect attempt in progress; it and CheckUdpReception() change the timers under this lock
+        std::lock_guard<std::mutex> lock(connectionMutex_);
+        // again, a reconnect that got the lock first has set up a new connection meanwhile
+        state_ = RtspState::STOPPED;
+        generation_ = 0;
+        if (playing && !session_.empty()) {
+            // best effort, the response is dropped with the events of the connection
+            RtspRequestTeardown request(baseUrl_);
+            request.SetSession(session_);
+            SendRequest(request, nullptr);
+        }
 
-    if (videoRtcpServer_) {
-        videoRtcpServer_->Stop();
-        videoRtcpServer_.reset();
+        for (int *fd : {&superviseTimerFd_, &rtcpTimerFd_, &jitterTimerFd_, &fallbackTimerFd_}) {
+            if (*fd >= 0) {
+                timers.push_back(*fd);
+                *fd = -1;
+            }
+        }
+        CloseRtpSockets();
+
+        std::lock_guard<std::mutex> requestLock(requestMutex_);
+        client = std::move(rtspConnectionClient_);
+        listener = std::move(connectionListener_);
+        responseHandlers_.clear();
+        outgoing_.clear();
     }
 
-    if (audioRtpServer_) {
-        audioRtpServer_->Stop();
-        audioRtpServer_.reset();
+    // waits for a timer handler that is running, those only try to take connectionMutex_
+    for (int fd : timers) {
+        UdpReactor::GetInstance()->RemoveSocket(fd);
     }
 
-    if (audioRtcpServer_) {
-        audioRtcpServer_->Stop();
-        audioRtcpServer_.reset();
+    // joins the thread of the connection, which takes connectionMutex_ for every receive
+    if (client) {
+        client->Close();
     }
 }
 
-void RtspSource::ReceiveDataLoop()
+void RtspSource::ResetSession()
 {
-    LOGD("enter");
+    session_.clear();
+    timeout_ = 0;
+    // the network that blocked UDP before most likely still does, no need to wait for the fallback again
+    interleaved_ = transport_ == RtspTransport::TCP || (transport_ == RtspTransport::AUTO && udpFailed_);
+    videoRtpChannel_ = 0;
+    videoRtcpChannel_ = 1;
+    audioRtpChannel_ = 2;
+    audioRtcpChannel_ = 3;
+    remoteVideoRtpPort_ = remoteVideoRtcpPort_ = 0;
+    remoteAudioRtpPort_ = remoteAudioRtcpPort_ = 0;
+    audioSetupSent_ = false;
+    playSent_ = false;
+    sdpFromCache_ = false;
+    handshakeUs_ = -1;
+    firstKeyframeUs_ = -1;
+    videoBatch_.clear();
+    audioBatch_.clear();
+    streamParser_.Reset();
 }
 
-void RtspSource::OnReceive(std::shared_ptr<DataBuffer> buffer)
+void RtspSource::Supervise()
 {
-    LOGD("%zu bytes, content:\n%s", buffer->Size(), buffer->ToString().c_str());
+    std::string lost;
+    {
+        // a response is being handled when this fails, look again on the next tick
+        std::unique_lock<std::mutex> lock(connectionMutex_, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
 
-    RtspResponse response;
-    bool res = response.Parse(buffer->ToString());
-    if (res == false) {
-        LOGE("parse response failed");
-        return;
+        int64_t nowUs = SteadyMicroseconds();
+        RtspState state = state_;
+        if (state == RtspState::CONNECTING && nowUs - startUs_ > HANDSHAKE_TIMEOUT_MS * 1000LL) {
+            lost = "handshake timeout";
+        } else if (state == RtspState::PLAYING) {
+            // keep-alive at half the session timeout, over TCP as well: RTCP does not refresh every server's session
+            int timeout = timeout_ > 0 ? timeout_ : SESSION_TIMEOUT_DEFAULT;
+            if (nowUs - lastKeepAliveUs_ >= timeout * 1000000LL / 2) {
+                SendKeepAlive();
+                lastKeepAliveUs_ = nowUs;
+            }
+
+            uint64_t received = videoStats_.GetStats().received + audioStats_.GetStats().received;
+            if (received != lastReceived_) {
+                lastReceived_ = received;
+                lastReceiveUs_ = nowUs;
+                failedAttempts_ = 0;
+            } else if (stallTimeoutMs_ > 0 && nowUs - lastReceiveUs_ > stallTimeoutMs_ * 1000LL) {
+                lost = "no media for " + std::to_string(stallTimeoutMs_) + " ms";
+            }
+        }
     }
 
-    auto handler = responseHandlers_.find(response.GetCSeq());
-    if (handler == responseHandlers_.end()) {
-        LOGE("Can't find handler for CSeq(%d)", response.GetCSeq());
+    if (!lost.empty()) {
+        OnConnectionLost(lost);
     }
+}
 
-    if (response.GetStatusCode() == StatusCode::OK) {
-        handler->second(response);
-    } else {
-        LOGE("RTSP error: (%d) %s", response.GetStatusCode(), response.GetStatusMessage().c_str());
+bool RtspSource::SendKeepAlive()
+{
+    if (keepAliveOptions_) {
+        RtspRequestOptions request(url_);
+        request.SetSession(session_);
+        return SendRequest(request, [](RtspResponse &) {});
     }
-    responseHandlers_.erase(response.GetCSeq());
+
+    RtspRequestGetParameter request(baseUrl_);
+    request.SetSession(session_);
+    return SendRequest(
+        request, [](RtspResponse &) {},
+        [this](RtspResponse &) {
+            LOGW("GET_PARAMETER refused, keep the session alive with OPTIONS");
+            keepAliveOptions_ = true;
+        });
 }
 
-void RtspSource::OnClose()
+void RtspSource::OnConnectionLost(const std::string &reason)
 {
-    LOGW("Server close connection");
-    Stop();
+    if (!reconnectEnabled_) {
+        LOGE("%s: %s", url_.c_str(), reason.c_str());
+        Stop();
+        return;
+    }
+
+    // only the first of the close, error and timeout of one connection schedules a reconnect
+    RtspState expected = RtspState::PLAYING;
+    if (!state_.compare_exchange_strong(expected, RtspState::RECONNECTING)) {
+        expected = RtspState::CONNECTING;
+        if (!state_.compare_exchange_strong(expected, RtspState::RECONNECTING)) {
+            return;
+        }
+    }
+
+    LOGW("%s: %s", url_.c_str(), reason.c_str());
+    ScheduleReconnect();
 }
 
-void RtspSource::OnError(const std::string &errorInfo)
+void RtspSource::ScheduleReconnect()
 {
-    LOGW("Server error %s", errorInfo.c_str());
-    Stop();
+    // exponential backoff, half of it random so that sessions lost together do not come back in lockstep
+    uint32_t attempt = failedAttempts_++;
+    uint64_t backoffMs = (uint64_t)RECONNECT_BACKOFF_MIN_MS << std::min(attempt, 16u);
+    backoffMs = std::min<uint64_t>(backoffMs, maxBackoffMs_);
+    static thread_local std::minstd_rand random(std::random_device{}());
+    uint32_t delayMs = backoffMs / 2 + random() % (backoffMs / 2 + 1);
+    LOGW("%s: reconnect in %u ms, attempt %u", url_.c_str(), delayMs, attempt + 1);
+
+    std::weak_ptr<RtspSource> weak = std::dynamic_pointer_cast<RtspSource>(shared_from_this());
+    RtspReconnectScheduler::GetInstance()->Schedule(delayMs, [weak]() {
+        auto source = weak.lock();
+        if (source) {
+            source->Reconnect();
+        }
+    });
 }
 
-void RtspSource::OnError(std::shared_ptr<Session> clientSession, const std::string &errorInfo)
+void RtspSource::Reconnect()
 {
-    if (clientSession->fd == 0) {
-        LOGE("Unexpected situation");
+    // runs on a reconnect worker, the old connection is shut down before dialling, connect() runs unlocked
+    std::unique_ptr<TcpClient> lostClient;
+    std::shared_ptr<IClientListener> lostListener;
+    {
+        std::lock_guard<std::mutex> lock(connectionMutex_);
+        if (state_ != RtspState::RECONNECTING) {
+            return;
+        }
+
+        generation_ = 0;
+        if (fallbackTimerFd_ >= 0) {
+            UdpReactor::GetInstance()->RemoveSocket(fallbackTimerFd_);
+            fallbackTimerFd_ = -1;
+        }
+        CloseRtpSockets();
+
+        std::lock_guard<std::mutex> requestLock(requestMutex_);
+        lostClient = std::move(rtspConnectionClient_);
+        lostListener = std::move(connectionListener_);
+        responseHandlers_.clear();
+        outgoing_.clear();
+    }
+
+    // the events of the lost client are dropped, so its thread never waits for us while it is joined here
+    if (lostClient) {
+        lostClient->Close();
+        lostClient.reset();
+    }
+
+    uint64_t generation = ++nextGeneration_;
+    std::shared_ptr<IClientListener> listener;
+    auto client = Connect(generation, listener);
+
+    std::lock_guard<std::mutex> lock(connectionMutex_);
+    if (state_ != RtspState::RECONNECTING) {
         return;
     }
 
-    if (videoRtpServer_->GetSocketFd() == clientSession->fd) {
-        LOGD("Video Rtp connection error: %s", errorInfo.c_str());
-    } else if (videoRtcpServer_->GetSocketFd() == clientSession->fd) {
-        LOGD("Video Rtcp connection error: %s", errorInfo.c_str());
-    } else if (audioRtpServer_->GetSocketFd() == clientSession->fd) {
-        LOGD("Audio Rtp connection error: %s", errorInfo.c_str());
-    } else if (audioRtcpServer_->GetSocketFd() == clientSession->fd) {
-        LOGD("Audio Rtcp connection error: %s", errorInfo.c_str());
-    } else {
-        LOGE("Unexpected situation");
+    if (!client) {
+        ScheduleReconnect();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> requestLock(requestMutex_);
+        rtspConnectionClient_ = std::move(client);
+        connectionListener_ = std::move(listener);
+    }
+
+    ResetSession();
+    segmentPending_ = newSegmentOnReconnect_;
+    generation_ = generation;
+    state_ = RtspState::CONNECTING;
+    reconnects_.fetch_add(1, std::memory_order_relaxed);
+    reconnectsMetric_->Add();
+    LOGW("%s: connected again, %llu reconnects", url_.c_str(), (unsigned long long)reconnects_.load());
+
+    if (!StartHandshake()) {
+        state_ = RtspState::RECONNECTING;
+        ScheduleReconnect();
     }
 }
 
-void RtspSource::OnReceive(std::shared_ptr<Session> clientSession, std::shared_ptr<DataBuffer> buffer)
+void RtspSource::ReceiveDataLoop()
 {
-    if (clientSession->fd == 0) {
-        LOGE("Unexpected situation");
-        return;
-    }
+    LOGD("enter");
+}
 
-    if (videoRtpServer_->GetSocketFd() == clientSession->fd) {
-        LOGD("Video Rtp recv %zu bytes", buffer->Size());
+void RtspSource::OnReceive(std::shared_ptr<DataBuffer> buffer)
+{
+    streamParser_.Input(buffer->Data(), buffer->Size());
+    FlushInterleaved();
+}
 
-        if (videoDepacketizer_) {
-            videoDepacketizer_->Depacketize(buffer);
-        }
-    } else if (videoRtcpServer_->GetSocketFd() == clientSession->fd) {
-        LOGD("Video Rtcp recv %zu bytes", buffer->Size());
+void RtspSource::OnInterleaved(uint8_t channel, const uint8_t *data, size_t size)
+{
+    if (channel == videoRtpChannel_ || channel == audioRtpChannel_) {
+        auto packet = interleavedPool_.Alloc(size);
+        packet->Append(data, size);
+        (channel == videoRtpChannel_ ? videoBatch_ : audioBatch_).push_back(packet);
+    } else if (channel == videoRtcpChannel_ || channel == audioRtcpChannel_) {
+        auto packet = std::make_shared<DataBuffer>(size);
+        packet->Append(data, size);
+        OnRtcp(channel == videoRtcpChannel_ ? VIDEO : AUDIO, packet);
+    } else {
+        LOGD("%zu bytes on unknown channel %d", size, channel);
+    }
+}
 
-    } else if (audioRtpServer_->GetSocketFd() == clientSession->fd) {
-        LOGD("Audio Rtp recv %zu bytes", buffer->Size());
+void RtspSource::FlushInterleaved()
+{
+    // the packets of one read go to the depacketizer as one batch, like a recvmmsg() batch of the UDP transport
+    int64_t nowUs = SteadyMicroseconds();
+    for (MediaType type : {VIDEO, AUDIO}) {
+        auto &batch = type == VIDEO ? videoBatch_ : audioBatch_;
+        if (batch.empty()) {
+            continue;
+        }
 
-        if (audioDepacketizer_) {
-            audioDepacketizer_->Depacketize(buffer);
+        (type == VIDEO ? videoStats_ : audioStats_).OnRtpPackets(batch, nowUs);
+        auto &depacketizer = type == VIDEO ? videoDepacketizer_ : audioDepacketizer_;
+        if (depacketizer) {
+            depacketizer->Depacketize(batch);
         }
-    } else if (audioRtcpServer_->GetSocketFd() == clientSession->fd) {
-        LOGD("Audio Rtcp recv %zu bytes", buffer->Size());
+        batch.clear();
+    }
+}
 
-    } else {
-        LOGE("Unexpected situation");
+bool RtspSource::SendInterleaved(uint8_t channel, const uint8_t *data, size_t size)
+{
+    if (size > 0xffff) {
+        return false;
     }
+
+    std::string frame(INTERLEAVED_HEADER_SIZE + size, '\0');
+    frame[0] = '$';
+    frame[1] = channel;
+    frame[2] = size >> 8;
+    frame[3] = size & 0xff;
+    memcpy(&frame[INTERLEAVED_HEADER_SIZE], data, size);
+
+    std::lock_guard<std::mutex> lock(requestMutex_);
+    return rtspConnectionClient_ && rtspConnectionClient_->Send(frame);
 }
 
-bool RtspSource::SendRequestOptions()
+bool RtspSource::SendRequest(RtspRequest &request, ResponseHandler onOk, ResponseHandler onError, bool more)
 {
-    RtspRequestOptions request(url_);
-    request.SetCSeq(++cseq_);
+    std::lock_guard<std::mutex> lock(requestMutex_);
+    int cseq = ++cseq_;
+    request.SetCSeq(cseq);
     request.SetUserAgent(RTSP_USER_AGENT);
     auto reqStr = request.Stringify();
 
-    responseHandlers_.emplace(cseq_, [this](RtspResponse &response) { HandleResponseOptions(response); });
+    responseHandlers_[cseq] = {std::move(onOk), std::move(onError)};
     LOGD("Send:\n%s", reqStr.c_str());
-    if (rtspConnectionClient_) {
-        return rtspConnectionClient_->Send(reqStr);
+    outgoing_ += reqStr;
+    if (more) {
+        return true;
     }
 
-    return false;
+    std::string data = std::move(outgoing_);
+    outgoing_.clear();
+    return rtspConnectionClient_ && rtspConnectionClient_->Send(data);
+}
+
+void RtspSource::OnMessage(const RtspStreamParser::Message &message)
+{
+    if (!message.IsResponse()) {
+        LOGW("ignore request from server: %.*s", (int)message.startLine.size(), message.startLine.data());
+        return;
+    }
+
+    LOGD("%.*s, CSeq %d, %zu bytes of body", (int)message.startLine.size(), message.startLine.data(), message.CSeq(),
+         message.body.size());
+
+    RtspResponse response;
+    if (!response.Parse(message.startLine, message.headers, message.body)) {
+        LOGE("parse response failed");
+        return;
+    }
+
+    PendingRequest pending;
+    {
+        std::lock_guard<std::mutex> lock(requestMutex_);
+        auto it = responseHandlers_.find(response.GetCSeq());
+        if (it == responseHandlers_.end()) {
+            LOGE("Can't find handler for CSeq(%d)", response.GetCSeq());
+            return;
+        }
+        pending = std::move(it->second);
+        responseHandlers_.erase(it);
+    }
+
+    if (response.GetStatusCode() == StatusCode::OK) {
+        pending.onOk(response);
+        return;
+    }
+
+    LOGE("RTSP error: (%d) %s", response.GetStatusCode(), response.GetStatusMessage().c_str());
+    if (pending.onError) {
+        pending.onError(response);
+    }
+}
+
+void RtspSource::OnClose()
+{
+    LOGW("Server close connection");
+    OnConnectionLost("connection closed");
+}
+
+void RtspSource::OnError(const std::string &errorInfo)
+{
+    LOGW("Server error %s", errorInfo.c_str());
+    OnConnectionLost("connection error " + errorInfo);
+}
+
+bool RtspSource::SendRequestOptions()
+{
+    RtspRequestOptions request(url_);
+    return SendRequest(request, [this](RtspResponse &response) { HandleResponseOptions(response); });
 }
 
 void RtspSource::HandleResponseOptions(RtspResponse &response)
 {
     RtspResponseOptions options(response);
     auto publics = options.GetPublic();
+    keepAliveOptions_ = true;
     for (auto &p : publics) {
         LOGD("Public item: %s", p.c_str());
+        if (p == GET_PARAMETER) {
+            keepAliveOptions_ = false;
+        }
     }
 
     SendRequestDescribe();
@@ -202,24 +602,13 @@ void RtspSource::HandleResponseOptions(RtspResponse &response)
 bool RtspSource::SendRequestDescribe()
 {
     RtspRequestDescribe request(url_);
-    request.SetCSeq(++cseq_);
-    request.SetUserAgent(RTSP_USER_AGENT);
     request.SetAccept(MIME_SDP);
-    auto reqStr = request.Stringify();
-
-    responseHandlers_.emplace(cseq_, [this](RtspResponse &response) { HandleResponseDescribe(response); });
-    LOGD("Send:\n%s", reqStr.c_str());
-    if (rtspConnectionClient_) {
-        return rtspConnectionClient_->Send(reqStr);
-    }
-
-    return false;
+    return SendRequest(request, [this](RtspResponse &response) { HandleResponseDescribe(response); });
 }
 
 void RtspSource::HandleResponseDescribe(RtspResponse &response)
 {
     RtspResponseDescribe describe(response);
-    baseUrl_ = describe.GetContentBaseUrl();
     if (describe.GetContentType() != MIME_SDP) {
         LOGE("Expect to receive sdp");
         return;
@@ -231,13 +620,31 @@ void RtspSource::HandleResponseDescribe(RtspResponse &response)
         LOGW("Content-Length: %d, but the actual size of the sdp is: %ld", contentLength, sdp.size());
     }
 
+    std::string baseUrl = describe.GetContentBaseUrl();
+    if (!ApplyDescription(sdp, baseUrl)) {
+        return;
+    }
+
+    if (fastConnect_) {
+        RtspSdpCache::GetInstance()->Put(url_, {sdp, baseUrl});
+    }
+
+    SetupFirstTrack();
+}
+
+bool RtspSource::ApplyDescription(const std::string &sdp, const std::string &baseUrl)
+{
+    sdp_ = RtspSdp();
     if (!sdp_.Parse(sdp)) {
         LOGE("Parse sdp failed");
-        return;
+        return false;
     }
 
+    baseUrl_ = baseUrl;
     videoTrack_ = sdp_.GetVideoTrack();
     audioTrack_ = sdp_.GetAudioTrack();
+    videoDepacketizer_.reset();
+    audioDepacketizer_.reset();
 
     if (videoTrack_) {
         InitVideoDepacketizer();
@@ -247,16 +654,22 @@ void RtspSource::HandleResponseDescribe(RtspResponse &response)
         InitAudioDepacketizer();
     }
 
-    if (videoTrack_) {
-        SendRequestSetup(VIDEO);
-    } else if (audioTrack_) {
-        SendRequestSetup(AUDIO);
-    } else {
+    if (!videoTrack_ && !audioTrack_) {
         LOGE("Can't find video & audio track from sdp");
+        return false;
     }
+
+    return true;
+}
+
+bool RtspSource::SetupFirstTrack()
+{
+    audioSetupSent_ = false;
+    playSent_ = false;
+    return SendRequestSetup(videoTrack_ ? VIDEO : AUDIO);
 }
 
-bool RtspSource::SendRequestSetup(MediaType type)
+bool RtspSource::SendRequestSetup(MediaType type, bool more)
 {
     RtspRequestSetup request;
     if (type == VIDEO) {
@@ -267,16 +680,18 @@ bool RtspSource::SendRequestSetup(MediaType type)
             request.SetUrl(baseUrl_ + "" + videoTrackUrl);
         }
 
-        uint16_t videoRtpPort = UdpServer::GetIdlePortPair();
-        videoRtpServer_ = UdpServer::Create(videoRtpPort);
-        videoRtcpServer_ = UdpServer::Create(videoRtpPort + 1);
-        videoRtpServer_->SetListener(std::dynamic_pointer_cast<RtspSource>(shared_from_this()));
-        videoRtcpServer_->SetListener(std::dynamic_pointer_cast<RtspSource>(shared_from_this()));
-
-        request.SetTransport(videoRtpPort, videoRtpPort + 1); // SET VIDEO RTP SERVER PORT
-        setupType_ = VIDEO;
+        uint16_t videoRtpPort = 0;
+        if (interleaved_) {
+            request.SetInterleavedTransport(videoRtpChannel_);
+        } else if (!OpenRtpSockets(VIDEO, videoRtpPort)) {
+            LOGE("Open video RTP sockets failed.");
+            return false;
+        } else {
+            request.SetTransport(videoRtpPort, videoRtpPort + 1); // SET VIDEO RTP SERVER PORT
+        }
 
     } else if (type == AUDIO) {
+        audioSetupSent_ = true;
         std::string audioTrackUrl = audioTrack_->GetTrackId();
         if (audioTrackUrl.find(baseUrl_) != std::string::npos) {
             request.SetUrl(audioTrackUrl);
@@ -284,38 +699,37 @@ bool RtspSource::SendRequestSetup(MediaType type)
             request.SetUrl(baseUrl_ + "" + audioTrackUrl);
         }
 
-        uint16_t audioRtpPort = UdpServer::GetIdlePortPair();
-        audioRtpServer_ = UdpServer::Create(audioRtpPort);
-        audioRtcpServer_ = UdpServer::Create(audioRtpPort + 1);
-        audioRtpServer_->SetListener(std::dynamic_pointer_cast<RtspSource>(shared_from_this()));
-        audioRtcpServer_->SetListener(std::dynamic_pointer_cast<RtspSource>(shared_from_this()));
-
-        request.SetTransport(audioRtpPort, audioRtpPort + 1); // SET AUDIO RTP SERVER PORT
-        setupType_ = AUDIO;
+        uint16_t audioRtpPort = 0;
+        if (interleaved_) {
+            request.SetInterleavedTransport(audioRtpChannel_);
+        } else if (!OpenRtpSockets(AUDIO, audioRtpPort)) {
+            LOGE("Open audio RTP sockets failed.");
+            return false;
+        } else {
+            request.SetTransport(audioRtpPort, audioRtpPort + 1); // SET AUDIO RTP SERVER PORT
+        }
         LOGD("send SETUP");
     }
 
-    request.SetCSeq(++cseq_);
-    request.SetUserAgent(RTSP_USER_AGENT);
+    // a failed first SETUP from a cached sdp most likely means the stream has changed since
+    ResponseHandler onError;
+    if (session_.empty() && sdpFromCache_) {
+        onError = [this](RtspResponse &response) { HandleStaleDescription(response); };
+    }
 
     if (!session_.empty()) {
         request.SetSession(session_);
     }
 
-    auto reqStr = request.Stringify();
-
-    responseHandlers_.emplace(cseq_, [this](RtspResponse &response) { HandleResponseSetup(response); });
-    LOGD("Send:\n%s", reqStr.c_str());
-    if (rtspConnectionClient_) {
-        return rtspConnectionClient_->Send(reqStr);
-    }
-
-    return false;
+    return SendRequest(
+        request, [this, type](RtspResponse &response) { HandleResponseSetup(response, type); }, std::move(onError),
+        more);
 }
 
-void RtspSource::HandleResponseSetup(RtspResponse &response)
+void RtspSource::HandleResponseSetup(RtspResponse &response, MediaType type)
 {
     RtspResponseSetup setup(response);
+    sdpFromCache_ = false; // the cached sdp still matches the stream
 
     session_ = setup.GetSession();
     timeout_ = setup.GetTimeout();
@@ -323,50 +737,78 @@ void RtspSource::HandleResponseSetup(RtspResponse &response)
     std::pair<uint16_t, uint16_t> sport = setup.GetServerPort();
     LOGD("server_port: %d/rtp, %d/rtcp", sport.first, sport.second);
 
-    if (setupType_ == VIDEO) {
+    // the server may pick other channels than the ones asked for
+    if (interleaved_) {
+        uint8_t rtpChannel, rtcpChannel;
+        if (setup.GetInterleaved(rtpChannel, rtcpChannel)) {
+            (type == VIDEO ? videoRtpChannel_ : audioRtpChannel_) = rtpChannel;
+            (type == VIDEO ? videoRtcpChannel_ : audioRtcpChannel_) = rtcpChannel;
+            LOGD("interleaved: %d/rtp, %d/rtcp", rtpChannel, rtcpChannel);
+        }
+    }
+
+    if (type == VIDEO) {
         remoteVideoRtpPort_ = sport.first;
+        remoteVideoRtcpPort_ = sport.second;
+    } else if (type == AUDIO) {
+        remoteAudioRtpPort_ = sport.first;
         remoteAudioRtcpPort_ = sport.second;
+    }
 
-        if (audioTrack_) {
+    if (type == VIDEO && audioTrack_ && !audioSetupSent_) {
+        if (!fastConnect_) {
             SendRequestSetup(AUDIO);
             return;
         }
-    } else if (setupType_ == AUDIO) {
-        remoteAudioRtpPort_ = sport.first;
-        remoteAudioRtcpPort_ = sport.second;
+
+        // the first SETUP has given the session id, the rest may be pipelined behind it (RFC 2326 9.1, 10.4)
+        SendRequestSetup(AUDIO, true);
     }
 
-    SendRequestPlay();
+    if (!playSent_) {
+        SendRequestPlay();
+    }
 }
 
-bool RtspSource::SendRequestPlay()
+void RtspSource::HandleStaleDescription(RtspResponse &response)
 {
-    if (!StartRtpServers()) {
-        LOGE("Start rtp server failed.");
-        return false;
-    }
+    LOGW("SETUP from cached sdp of %s failed (%d), DESCRIBE again", url_.c_str(), response.GetStatusCode());
+    RtspSdpCache::GetInstance()->Erase(url_);
+    sdpFromCache_ = false;
+    CloseRtpSockets();
+    session_.clear();
+    SendRequestDescribe();
+}
 
-    if (!InitSinks()) {
-        LOGE("Init sinks failed.");
-        return false;
+bool RtspSource::SendRequestPlay()
+{
+    // a session set up again over TCP or after a reconnect keeps writing to the same sinks, unless the stream has
+    // changed or every reconnect is to start a new segment
+    SinkParameters params{videoTrack_ != nullptr, videoFormat_,     videoWidth_,   videoHeight_,
+                          audioTrack_ != nullptr, audioSampleRate_, audioChannels_};
+    if (!sinksReady_) {
+        if (!InitSinks()) {
+            LOGE("Init sinks failed.");
+            return false;
+        }
+        sinksReady_ = true;
+    } else if (segmentPending_ || params != sinkParams_) {
+        LOGW("%s: %s, restart sinks", url_.c_str(), segmentPending_ ? "new segment" : "stream changed");
+        if (!RestartSinks()) {
+            LOGE("Restart sinks failed.");
+            return false;
+        }
     }
+    sinkParams_ = params;
+    segmentPending_ = false;
 
+    playSent_ = true;
     RtspRequestPlay request(baseUrl_);
-    request.SetCSeq(++cseq_);
-    request.SetUserAgent(RTSP_USER_AGENT);
     if (!session_.empty()) {
         request.SetSession(session_);
     }
 
-    auto reqStr = request.Stringify();
-
-    responseHandlers_.emplace(cseq_, [this](RtspResponse &response) { HandleResponsePlay(response); });
-    LOGD("Send:\n%s", reqStr.c_str());
-    if (rtspConnectionClient_) {
-        return rtspConnectionClient_->Send(reqStr);
-    }
-
-    return false;
+    return SendRequest(request, [this](RtspResponse &response) { HandleResponsePlay(response); });
 }
 
 void RtspSource::HandleResponsePlay(RtspResponse &response)
@@ -375,42 +817,151 @@ void RtspSource::HandleResponsePlay(RtspResponse &response)
 
     std::string info = play.GetRtpInfo();
     LOGD("RTP-Info: %s", info.c_str());
+
+    // also answers the PLAY after the switch to TCP, the stall timeout starts over
+    if (state_ == RtspState::CONNECTING) {
+        state_ = RtspState::PLAYING;
+    }
+    lastKeepAliveUs_ = lastReceiveUs_ = SteadyMicroseconds();
+
+    if (handshakeUs_ < 0) {
+        handshakeUs_ = SteadyMicroseconds() - startUs_;
+        handshakeMetric_->Observe(handshakeUs_);
+        LOGD("playing %lld us after start", (long long)handshakeUs_);
+    }
+
+    StartReceiverReports();
+    StartJitterPoll();
+    StartUdpFallbackTimer();
 }
 
-bool RtspSource::StartRtpServers()
+bool RtspSource::SendRequestTeardown()
 {
+    RtspRequestTeardown request(baseUrl_);
+    if (!session_.empty()) {
+        request.SetSession(session_);
+    }
 
-    if (videoRtpServer_) {
-        if (!videoRtpServer_->Init() || !videoRtpServer_->Start()) {
-            LOGE("Start video RTP server failed.");
-            return false;
-        }
+    return SendRequest(request, [this](RtspResponse &response) { HandleResponseTeardown(response); });
+}
+
+void RtspSource::HandleResponseTeardown(RtspResponse &response)
+{
+    // only sent to switch to TCP: set the same tracks up again on this connection
+    CloseRtpSockets();
+    session_.clear();
+    interleaved_ = true;
+    udpFailed_ = true;
+    SetupFirstTrack();
+}
+
+void RtspSource::RecordFirstKeyframe()
+{
+    if (firstKeyframeUs_.load(std::memory_order_relaxed) >= 0) {
+        return;
     }
 
-    if (videoRtcpServer_) {
-        if (!videoRtcpServer_->Init() || !videoRtcpServer_->Start()) {
-            LOGE("Start video RTP server failed.");
-            return false;
-        }
+    int64_t elapsedUs = SteadyMicroseconds() - startUs_;
+    int64_t expected = -1;
+    if (firstKeyframeUs_.compare_exchange_strong(expected, elapsedUs)) {
+        firstKeyframeMetric_->Observe(elapsedUs);
+        LOGD("first keyframe %lld us after start", (long long)elapsedUs);
     }
+}
 
-    if (audioRtpServer_) {
-        if (!audioRtpServer_->Init() || !audioRtpServer_->Start()) {
-            LOGE("Start video RTP server failed.");
-            return false;
-        }
+void RtspSource::StartUdpFallbackTimer()
+{
+    if (transport_ != RtspTransport::AUTO || interleaved_ || fallbackTimerFd_ >= 0) {
+        return;
     }
 
-    if (audioRtcpServer_) {
-        if (!audioRtcpServer_->Init() || !audioRtcpServer_->Start()) {
-            LOGE("Start video RTP server failed.");
-            return false;
+    udpReceivedBase_ = videoStats_.GetStats().received + audioStats_.GetStats().received;
+    fallbackTimerFd_ = UdpReactor::GetInstance()->AddTimer(reactorLoop_, udpTimeoutMs_, udpTimeoutMs_,
+                                                           [this]() { CheckUdpReception(); });
+}
+
+void RtspSource::CheckUdpReception()
+{
+    // the timer fires again when a response is being handled
+    std::unique_lock<std::mutex> lock(connectionMutex_, std::try_to_lock);
+    if (!lock.owns_lock() || fallbackTimerFd_ < 0) {
+        return;
+    }
+
+    // one shot, on the loop thread itself RemoveSocket() does not wait for this handler
+    UdpReactor::GetInstance()->RemoveSocket(fallbackTimerFd_);
+    fallbackTimerFd_ = -1;
+
+    if (state_ != RtspState::PLAYING ||
+        videoStats_.GetStats().received + audioStats_.GetStats().received > udpReceivedBase_) {
+        return;
+    }
+
+    LOGW("no RTP over UDP %u ms after PLAY, switch to TCP", udpTimeoutMs_);
+    SendRequestTeardown();
+}
+
+bool RtspSource::OpenRtpSockets(MediaType type, uint16_t &rtpPort)
+{
+    int rtpFd = -1;
+    int rtcpFd = -1;
+    rtpPort = UdpReactor::OpenPortPair(rtpFd, rtcpFd);
+    if (rtpPort == 0) {
+        return false;
+    }
+
+    auto reactor = UdpReactor::GetInstance();
+
+    // the depacketizers are created from the sdp before SETUP, hand packets to them directly
+    auto depacketizer = type == VIDEO ? videoDepacketizer_ : audioDepacketizer_;
+    auto *stats = type == VIDEO ? &videoStats_ : &audioStats_;
+    const char *name = type == VIDEO ? "Video" : "Audio";
+    UdpReactor::BatchHandler rtpHandler = [depacketizer, stats,
+                                           name](const std::vector<std::shared_ptr<DataBuffer>> &batch) {
+        stats->OnRtpPackets(batch, SteadyMicroseconds());
+        if (depacketizer) {
+            depacketizer->Depacketize(batch);
+        } else {
+            LOGD("%s Rtp recv %zu packets", name, batch.size());
         }
+    };
+    UdpReactor::Handler rtcpHandler = [this, type](std::shared_ptr<DataBuffer> buffer) { OnRtcp(type, buffer); };
+
+    if (!reactor->AddBatchSocket(rtpFd, reactorLoop_, std::move(rtpHandler))) {
+        close(rtpFd);
+        close(rtcpFd);
+        return false;
+    }
+
+    if (!reactor->AddSocket(rtcpFd, reactorLoop_, std::move(rtcpHandler))) {
+        reactor->RemoveSocket(rtpFd);
+        close(rtcpFd);
+        return false;
+    }
+
+    if (type == VIDEO) {
+        videoRtpFd_ = rtpFd;
+        videoRtcpFd_ = rtcpFd;
+    } else {
+        audioRtpFd_ = rtpFd;
+        audioRtcpFd_ = rtcpFd;
     }
 
+    LOGD("%s rtp/rtcp port %d/%d on event loop %zu", name, rtpPort, rtpPort + 1, reactorLoop_);
     return true;
 }
 
+void RtspSource::CloseRtpSockets()
+{
+    auto reactor = UdpReactor::GetInstance();
+    for (int *fd : {&videoRtpFd_, &videoRtcpFd_, &audioRtpFd_, &audioRtcpFd_}) {
+        if (*fd >= 0) {
+            reactor->RemoveSocket(*fd);
+            *fd = -1;
+        }
+    }
+}
+
 bool RtspSource::InitSinks()
 {
     AgentEvent eventSetParams{EVENT_SINK_SET_PARAMETERS};
@@ -424,6 +975,8 @@ bool RtspSource::InitSinks()
         videoInfo.width = videoWidth_;
         videoInfo.height = videoHeight_;
         mediaParams.video = &videoInfo;
+        mediaParams.videoFormat = videoFormat_;
+        mediaParams.videoExtraData = videoExtraData_;
     }
 
     if (audioTrack_) {
@@ -448,57 +1001,145 @@ bool RtspSource::InitSinks()
     return true;
 }
 
+bool RtspSource::RestartSinks()
+{
+    auto collect = [](std::shared_mutex &mutex, std::unordered_map<uint64_t, std::weak_ptr<FrameSink>> &items) {
+        std::vector<std::shared_ptr<FrameSink>> sinks;
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        for (auto &item : items) {
+            auto sink = item.second.lock();
+            if (sink) {
+                sinks.push_back(sink);
+            }
+        }
+        return sinks;
+    };
+    auto videoSinks = collect(videoSinkMutex_, videoSinks_);
+    auto audioSinks = collect(audioSinkMutex_, audioSinks_);
+
+    // removing a sink first hands it the frames still queued for it from the lost connection
+    for (auto &sink : videoSinks) {
+        RemoveVideoSink(sink);
+    }
+    for (auto &sink : audioSinks) {
+        RemoveAudioSink(sink);
+    }
+
+    AgentEvent eventStop{EVENT_SINK_STOP, nullptr};
+    std::unordered_set<uint64_t> stopped;
+    for (auto *sinks : {&videoSinks, &audioSinks}) {
+        for (auto &sink : *sinks) {
+            if (stopped.insert(sink->Id()).second) {
+                sink->OnNotify(&eventStop);
+            }
+        }
+    }
+
+    for (auto &sink : videoSinks) {
+        AddVideoSink(sink);
+    }
+    for (auto &sink : audioSinks) {
+        AddAudioSink(sink);
+    }
+
+    return InitSinks();
+}
+
 void RtspSource::InitVideoDepacketizer()
 {
     if (!videoTrack_) {
         return;
     }
 
+    videoFormat_ = FRAME_FORMAT_UNKNOWN;
     auto reso = videoTrack_->GetVideoSize();
     videoWidth_ = reso.first;
     videoHeight_ = reso.second;
 
+    int pt, clockCycle;
+    std::string format;
+    if (!videoTrack_->GetVideoConfig(pt, format, clockCycle)) {
+        return;
+    }
+
+    FrameFormat videoFormat = FRAME_FORMAT_UNKNOWN;
+    if (format == "H264" || format == "h264") {
+        videoFormat = FRAME_FORMAT_H264;
+    } else if (format == "H265" || format == "h265") {
+        videoFormat = FRAME_FORMAT_H265;
+    } else {
+        LOGE("Unsupported Video format %s", format.c_str());
+        return;
+    }
+    videoFormat_ = videoFormat;
+
+    auto vps = videoFormat == FRAME_FORMAT_H265 ? videoTrack_->GetVideoVps() : nullptr;
     auto sps = videoTrack_->GetVideoSps();
     auto pps = videoTrack_->GetVideoPps();
+    videoExtraData_.reset();
+    if (sps && pps) {
+        videoExtraData_ = DataBuffer::Create((vps ? vps->Size() : 0) + sps->Size() + pps->Size());
+        for (auto &nalu : {vps, sps, pps}) {
+            if (nalu) {
+                videoExtraData_->Append(nalu->Data(), nalu->Size());
+            }
+        }
+    }
+
     if (sps) {
         sps_ = std::make_shared<Frame>();
         sps_->Assign(sps->Data(), sps->Size());
-        sps_->format = FRAME_FORMAT_H264;
+        sps_->format = videoFormat;
     }
 
     if (pps) {
         pps_ = std::make_shared<Frame>();
         pps_->Assign(pps->Data(), pps->Size());
-        pps_->format = FRAME_FORMAT_H264;
+        pps_->format = videoFormat;
     }
 
-    int pt, clockCycle;
-    std::string format;
-    if (videoTrack_->GetVideoConfig(pt, format, clockCycle)) {
-        if (format == "H264" || format == "h264") {
-            videoDepacketizer_ = RtpDepacketizer::Create(FRAME_FORMAT_H264);
-            if (!videoDepacketizer_) {
-                LOGE("Create RtpDepacketizer for aac failed");
-                return;
-            }
+    videoDepacketizer_ = RtpDepacketizer::Create(videoFormat);
+    if (!videoDepacketizer_) {
+        LOGE("Create RtpDepacketizer for %s failed", format.c_str());
+        return;
+    }
 
-            videoDepacketizer_->SetCallback([this](std::shared_ptr<Frame> frame) {
-                // if (frame->videoInfo.isKeyFrame && sps_ && pps_) {
-                //     sps_->timestamp = frame->timestamp;
-                //     DeliverFrame(sps_);
-                //     pps_->timestamp = frame->timestamp;
-                //     DeliverFrame(pps_);
-                // }
+    videoDepacketizer_->SetMetricsLabels(MetricLabels(GetMetricsLabels(), {{"media", "video"}}));
 
-                frame->videoInfo.width = videoWidth_;
-                frame->videoInfo.height = videoHeight_;
-                DeliverFrame(frame);
-            });
-        } else {
-            LOGE("Unsupported Video format %s", format.c_str());
-            return;
-        }
+    videoStats_.SetClockRate(clockCycle);
+    if (videoJitterMs_ > 0) {
+        videoDepacketizer_->SetJitterBuffer(videoJitterMs_, clockCycle);
+    }
+
+    if (nackEnabled_) {
+        videoDepacketizer_->SetLossCallback(
+            [this](uint32_t ssrc, const std::vector<uint16_t> &lost) { SendNack(VIDEO, ssrc, lost); });
+    }
+
+    if (videoFormat == FRAME_FORMAT_H264) {
+        H264PacketizationInfo info{};
+        videoTrack_->GetVideoPacketization(info.packetizationMode, info.interleavingDepth);
+        videoDepacketizer_->SetExtraData(&info);
+    } else {
+        H265PacketizationInfo info{videoTrack_->GetVideoMaxDonDiff()};
+        videoDepacketizer_->SetExtraData(&info);
     }
+
+    videoDepacketizer_->SetCallback([this](std::shared_ptr<Frame> frame) {
+        // if (frame->videoInfo.isKeyFrame && sps_ && pps_) {
+        //     sps_->timestamp = frame->timestamp;
+        //     DeliverFrame(sps_);
+        //     pps_->timestamp = frame->timestamp;
+        //     DeliverFrame(pps_);
+        // }
+
+        frame->videoInfo.width = videoWidth_;
+        frame->videoInfo.height = videoHeight_;
+        if (frame->videoInfo.isKeyFrame) {
+            RecordFirstKeyframe();
+        }
+        DeliverFrame(frame);
+    });
 }
 
 void RtspSource::InitAudioDepacketizer()
@@ -517,12 +1158,175 @@ void RtspSource::InitAudioDepacketizer()
                 return;
             }
 
+            audioDepacketizer_->SetMetricsLabels(MetricLabels(GetMetricsLabels(), {{"media", "audio"}}));
+
+            audioStats_.SetClockRate(audioSampleRate_);
+            if (audioJitterMs_ > 0) {
+                audioDepacketizer_->SetJitterBuffer(audioJitterMs_, audioSampleRate_);
+            }
+
+            if (nackEnabled_) {
+                audioDepacketizer_->SetLossCallback([this](uint32_t ssrc, const std::vector<uint16_t> &lost) {
+                    SendNack(AUDIO, ssrc, lost);
+                });
+            }
+
             AudioFrameInfo info{(uint8_t)audioChannels_, 1024, (uint32_t)audioSampleRate_};
             audioDepacketizer_->SetExtraData(&info);
-            audioDepacketizer_->SetCallback([this](std::shared_ptr<Frame> frame) { DeliverFrame(frame); });
+            // without video the first audio frame is what a player can start from
+            bool audioOnly = videoDepacketizer_ == nullptr;
+            audioDepacketizer_->SetCallback([this, audioOnly](std::shared_ptr<Frame> frame) {
+                if (audioOnly) {
+                    RecordFirstKeyframe();
+                }
+                DeliverFrame(frame);
+            });
         } else {
             LOGE("Unsupported Audio format %s", format.c_str());
             return;
         }
     }
-}
\ No newline at end of file
+}
+
+void RtspSource::SendNack(MediaType type, uint32_t mediaSsrc, const std::vector<uint16_t> &lost)
+{
+    RtcpRTPFB nack;
+    nack.padding = false;
+    nack.senderSsrc = rtcpSsrc_;
+    nack.mediaSsrc = mediaSsrc;
+    nack.SetLostSequences(lost);
+    auto data = nack.Generate();
+
+    // runs on the event loop of the RTP socket, the RTCP socket of the track belongs to the same loop
+    if (!SendRtcp(type, data->Data(), data->Size())) {
+        return;
+    }
+
+    nacksSent_.fetch_add(1, std::memory_order_relaxed);
+    packetsRequested_.fetch_add(lost.size(), std::memory_order_relaxed);
+    LOGD("%s NACK %zu packets from %d", type == VIDEO ? "Video" : "Audio", lost.size(), lost[0]);
+}
+
+void RtspSource::OnRtcp(MediaType type, const std::shared_ptr<DataBuffer> &buffer)
+{
+    int64_t arrivalUs = SteadyMicroseconds();
+    auto *stats = type == VIDEO ? &videoStats_ : &audioStats_;
+    ForEachRtcpPacket(buffer->Data(), buffer->Size(), [&](const RtcpHeader &header, const uint8_t *p, size_t size) {
+        if (header.pt == RTCP_SR) {
+            auto sr = RtcpSR::Parse(p, size);
+            if (sr) {
+                stats->OnSenderReport(*sr, arrivalUs);
+            }
+        } else if (header.pt == RTCP_BYE) {
+            LOGW("%s BYE from server", type == VIDEO ? "Video" : "Audio");
+        }
+    });
+}
+
+void RtspSource::StartReceiverReports()
+{
+    if (rtcpTimerFd_ >= 0) {
+        return;
+    }
+
+    // the statistics have a lock of their own; the transport, tracks, sockets and channels change under
+    // connectionMutex_ on the TCP thread, a report due while a response is being handled waits for the next interval
+    auto report = [this]() {
+        std::unique_lock<std::mutex> lock(connectionMutex_, std::try_to_lock);
+        if (lock.owns_lock()) {
+            SendReceiverReports();
+        }
+    };
+    rtcpTimerFd_ = UdpReactor::GetInstance()->AddTimer(reactorLoop_, RTCP_REPORT_INTERVAL_MS / 2,
+                                                       RTCP_REPORT_INTERVAL_MS, report);
+    if (rtcpTimerFd_ < 0) {
+        LOGE("start RTCP report timer failed");
+    }
+}
+
+void RtspSource::StartJitterPoll()
+{
+    if (jitterTimerFd_ >= 0 || (videoJitterMs_ == 0 && audioJitterMs_ == 0)) {
+        return;
+    }
+
+    // skips a gap once its hold time is over even if the stream pauses behind it, e.g. after the last packet of a
+    // keyframe went missing
+    auto poll = [this]() {
+        std::shared_ptr<RtpDepacketizer> depacketizers[2];
+        {
+            // a new description replaces the depacketizers under this lock, skip the tick while it is held
+            std::unique_lock<std::mutex> lock(connectionMutex_, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                return;
+            }
+            depacketizers[0] = videoDepacketizer_;
+            depacketizers[1] = audioDepacketizer_;
+        }
+
+        for (auto &depacketizer : depacketizers) {
+            if (depacketizer) {
+                depacketizer->Poll();
+            }
+        }
+    };
+    jitterTimerFd_ =
+        UdpReactor::GetInstance()->AddTimer(reactorLoop_, JITTER_POLL_INTERVAL_MS, JITTER_POLL_INTERVAL_MS, poll);
+    if (jitterTimerFd_ < 0) {
+        LOGE("start jitter buffer timer failed");
+    }
+}
+
+void RtspSource::SendReceiverReports()
+{
+    int64_t nowUs = SteadyMicroseconds();
+    for (MediaType type : {VIDEO, AUDIO}) {
+        bool active = interleaved_ ? (type == VIDEO ? videoTrack_ : audioTrack_) != nullptr
+                                   : (type == VIDEO ? videoRtcpFd_ : audioRtcpFd_) >= 0;
+        if (!active) {
+            continue;
+        }
+
+        // compound packet: RR, then SDES with our CNAME
+        RtcpRR rr;
+        rr.padding = false;
+        rr.ssrc = rtcpSsrc_;
+        ReportBlock block{};
+        if ((type == VIDEO ? videoStats_ : audioStats_).MakeReportBlock(block, nowUs)) {
+            rr.reportBlocks.push_back(block);
+        }
+
+        RtcpSDES sdes;
+        sdes.padding = false;
+        sdes.sdesChunks.push_back({rtcpSsrc_, {{RTCP_SDES_CNAME, cname_}}});
+
+        auto rrData = rr.Generate();
+        auto sdesData = sdes.Generate();
+        auto data = std::make_shared<DataBuffer>(rrData->Size() + sdesData->Size());
+        data->Append(rrData->Data(), rrData->Size());
+        data->Append(sdesData->Data(), sdesData->Size());
+        SendRtcp(type, data->Data(), data->Size());
+    }
+}
+
+bool RtspSource::SendRtcp(MediaType type, const uint8_t *data, size_t size)
+{
+    if (interleaved_) {
+        return SendInterleaved(type == VIDEO ? videoRtcpChannel_ : audioRtcpChannel_, data, size);
+    }
+
+    int fd = type == VIDEO ? videoRtcpFd_ : audioRtcpFd_;
+    uint16_t port = type == VIDEO ? remoteVideoRtcpPort_ : remoteAudioRtcpPort_;
+    if (fd < 0 || port == 0 || serverAddr_.sin_family != AF_INET) {
+        return false;
+    }
+
+    struct sockaddr_in addr = serverAddr_;
+    addr.sin_port = htons(port);
+    if (sendto(fd, data, size, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOGW("send rtcp failed: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
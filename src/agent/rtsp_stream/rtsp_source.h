@@ -5,22 +5,44 @@
 #ifndef HALFWAY_MEDIA_RTSP_SOURCE_H
 #define HALFWAY_MEDIA_RTSP_SOURCE_H
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <netinet/in.h>
 #include <string>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 #include "agent/base/media_source.h"
 #include "common/frame.h"
 #include "network/include/tcp_client.h"
-#include "network/include/udp_server.h"
+#include "protocol/rtcp/rtcp_stats.h"
 #include "protocol/rtp/rtp_packet.h"
+#include "protocol/rtp/rtp_packet_pool.h"
 #include "protocol/rtsp/rtsp_response.h"
 #include "protocol/rtsp/rtsp_sdp.h"
+#include "protocol/rtsp/rtsp_stream_parser.h"
 #include "protocol/rtsp/rtsp_url.h"
 
 #define RtspClient RtspSource
 
-class RtspSource : public MediaSource, public IClientListener, public IServerListener {
+enum class RtspTransport {
+    UDP,  // RTP/AVP, a port pair per track
+    TCP,  // RTP/AVP/TCP, interleaved on the RTSP connection, gets through NAT and firewalls
+    AUTO, // UDP, set up again over TCP when no packet arrives in time
+};
+
+enum class RtspState {
+    IDLE,
+    CONNECTING,   // handshake in progress
+    PLAYING,      // PLAY answered, media expected
+    RECONNECTING, // connection lost, waiting for the next attempt
+    STOPPED,
+};
+
+class RtspSource : public MediaSource, public IClientListener {
 public:
     ~RtspSource();
 
@@ -30,6 +52,74 @@ public:
         return std::shared_ptr<RtspSource>(new RtspSource(std::move(url)));
     }
 
+    // Jitter-buffer hold limit per track in milliseconds, 0 keeps the plain reorder cache. Call before Init().
+    void SetJitterBufferTime(uint32_t videoMs, uint32_t audioMs)
+    {
+        videoJitterMs_ = videoMs;
+        audioJitterMs_ = audioMs;
+    }
+
+    // Generic NACKs (RFC 4585) for the packets the sorter finds missing, on by default. Call before Init().
+    void SetNackEnabled(bool enable) { nackEnabled_ = enable; }
+
+    struct NackStats {
+        uint64_t nacksSent;        // RTCP NACK packets
+        uint64_t packetsRequested; // sequence numbers asked for
+    };
+    NackStats GetNackStats() const
+    {
+        return {nacksSent_.load(std::memory_order_relaxed), packetsRequested_.load(std::memory_order_relaxed)};
+    }
+
+    // Media transport, AUTO by default: the session falls back to TCP when no RTP packet arrived over UDP
+    // `udpTimeoutMs` after PLAY, reconnects of the source then go straight to TCP. Call before Start().
+    void SetTransport(RtspTransport transport, uint32_t udpTimeoutMs = 3000)
+    {
+        transport_ = transport;
+        udpTimeoutMs_ = udpTimeoutMs;
+        udpFailed_ = false;
+    }
+
+    // UdpReactor loop of the RTP/RTCP sockets, e.g. the one matching the worker a session is sharded to.
+    // Picked round-robin when not set. Call before Start().
+    void SetReactorLoop(size_t loop)
+    {
+        reactorLoop_ = loop;
+        fixedReactorLoop_ = true;
+    }
+
+    // Connects in fewer round trips, off by default: OPTIONS is skipped, the SDP of an earlier DESCRIBE of the same
+    // URL is reused, and the SETUP of the second track goes out together with PLAY. Call before Init().
+    void SetFastConnect(bool enable) { fastConnect_ = enable; }
+
+    // Reconnects after the connection closes, the media stalls for `stallTimeoutMs` or a handshake does not finish,
+    // on by default. Attempts back off exponentially with jitter up to `maxBackoffMs` and are rate-limited across
+    // the process by RtspReconnectScheduler. Without it a lost connection stops the source. Call before Start().
+    void SetReconnect(bool enable, uint32_t stallTimeoutMs = 10000, uint32_t maxBackoffMs = 30000)
+    {
+        reconnectEnabled_ = enable;
+        stallTimeoutMs_ = stallTimeoutMs;
+        maxBackoffMs_ = maxBackoffMs;
+    }
+
+    // The sinks stay attached across reconnects and keep writing to the same file. They are restarted, i.e. a
+    // MediaFileSink rolls to its next segment, when the stream parameters changed, or on every reconnect with
+    // `newSegment`.
+    void SetNewSegmentOnReconnect(bool newSegment) { newSegmentOnReconnect_ = newSegment; }
+
+    RtspState GetState() const { return state_.load(); }
+    uint64_t GetReconnects() const { return reconnects_.load(std::memory_order_relaxed); }
+
+    // microseconds from the start of the current connection to its first video keyframe, or to the first audio
+    // frame without video, -1 until then
+    int64_t GetTimeToFirstKeyframeUs() const { return firstKeyframeUs_.load(std::memory_order_relaxed); }
+
+    // reception statistics of a track, also sent to the server in receiver reports
+    RtcpReceiverStats::Stats GetReceiveStats(MediaType type)
+    {
+        return type == VIDEO ? videoStats_.GetStats() : audioStats_.GetStats();
+    }
+
     // impl MediaSource
     bool Init() override;
     bool Start() override;
@@ -41,12 +131,6 @@ public:
     void OnClose() override;
     void OnError(const std::string &errorInfo) override;
 
-    // impl IServerListener of UDP Servers
-    void OnError(std::shared_ptr<Session> clientSession, const std::string &errorInfo) override;
-    void OnClose(std::shared_ptr<Session> clientSession) override {}
-    void OnAccept(std::shared_ptr<Session> clientSession) override {}
-    void OnReceive(std::shared_ptr<Session> clientSession, std::shared_ptr<DataBuffer> buffer) override;
-
 private:
     RtspSource() = default;
     explicit RtspSource(std::string url) : url_(std::move(url)) {}
@@ -54,57 +138,174 @@ private:
     // impl MediaSource
     void ReceiveDataLoop() override;
 
+    class ConnectionListener;
+    // a connected client whose events are tagged with `generation`, nullptr on failure
+    std::unique_ptr<TcpClient> Connect(uint64_t generation, std::shared_ptr<IClientListener> &listener);
+    bool StartHandshake();
+    void ResetSession();
+
+    void Supervise();
+    bool SendKeepAlive();
+    void OnConnectionLost(const std::string &reason);
+    void ScheduleReconnect();
+    void Reconnect();
+
+    using ResponseHandler = std::function<void(RtspResponse &)>;
+    // sets CSeq and User-Agent, `onOk` gets the response if it is 200 OK, `onError` any other one.
+    // With `more` the request is held back and written together with the next one.
+    bool SendRequest(RtspRequest &request, ResponseHandler onOk, ResponseHandler onError = nullptr, bool more = false);
+    void OnMessage(const RtspStreamParser::Message &message);
+    void OnInterleaved(uint8_t channel, const uint8_t *data, size_t size);
+    void FlushInterleaved();
+    bool SendInterleaved(uint8_t channel, const uint8_t *data, size_t size);
+
     bool SendRequestOptions();
     void HandleResponseOptions(RtspResponse &response);
 
     bool SendRequestDescribe();
     void HandleResponseDescribe(RtspResponse &response);
 
-    bool SendRequestSetup(MediaType type);
-    void HandleResponseSetup(RtspResponse &response);
+    // parses the SDP and creates the tracks and their depacketizers, false without a usable track
+    bool ApplyDescription(const std::string &sdp, const std::string &baseUrl);
+    bool SetupFirstTrack();
+
+    bool SendRequestSetup(MediaType type, bool more = false);
+    void HandleResponseSetup(RtspResponse &response, MediaType type);
+    void HandleStaleDescription(RtspResponse &response);
 
     bool SendRequestPlay();
     void HandleResponsePlay(RtspResponse &response);
 
-    bool StartRtpServers();
+    bool SendRequestTeardown();
+    void HandleResponseTeardown(RtspResponse &response);
+
+    void RecordFirstKeyframe();
+
+    void StartUdpFallbackTimer();
+    void CheckUdpReception();
+
+    bool OpenRtpSockets(MediaType type, uint16_t &rtpPort);
+    void CloseRtpSockets();
     bool InitSinks();
+    bool RestartSinks();
 
     void InitVideoDepacketizer();
     void InitAudioDepacketizer();
 
+    void SendNack(MediaType type, uint32_t mediaSsrc, const std::vector<uint16_t> &lost);
+    void OnRtcp(MediaType type, const std::shared_ptr<DataBuffer> &buffer);
+    void StartReceiverReports();
+    void SendReceiverReports();
+    void StartJitterPoll();
+    bool SendRtcp(MediaType type, const uint8_t *data, size_t size);
+
 private:
     int cseq_ = 0;
-    int timeout_ = 0;
+    int timeout_ = 0; // seconds, from the Session header of SETUP
     std::string url_;
     RtspUrl rtspUrl_;
     std::string baseUrl_;
     RtspSdp sdp_;
     std::string session_;
-    MediaType setupType_;
+    bool audioSetupSent_ = false;
+    bool playSent_ = false;
+
+    bool fastConnect_ = false;
+    bool sdpFromCache_ = false;
+    int64_t startUs_ = 0;
+    int64_t handshakeUs_ = -1;
+    std::atomic<int64_t> firstKeyframeUs_{-1};
+    std::shared_ptr<MetricHistogram> handshakeMetric_;     // Start() to the PLAY response
+    std::shared_ptr<MetricHistogram> firstKeyframeMetric_; // Start() to the first keyframe
+
+    // connection supervision, handshake state is only touched with connectionMutex_ held
+    std::atomic<RtspState> state_{RtspState::IDLE};
+    std::mutex connectionMutex_;
+    std::atomic<uint64_t> generation_{0}; // of the connection whose events are handled, 0 for none
+    std::atomic<uint64_t> nextGeneration_{0};
+    bool reconnectEnabled_ = true;
+    bool newSegmentOnReconnect_ = false;
+    bool segmentPending_ = false;
+    uint32_t stallTimeoutMs_ = 10000;
+    uint32_t maxBackoffMs_ = 30000;
+    std::atomic<uint32_t> failedAttempts_{0}; // since media last flowed
+    std::atomic<uint64_t> reconnects_{0};
+    std::shared_ptr<MetricCounter> reconnectsMetric_;
+    int superviseTimerFd_ = -1; // owned by UdpReactor, runs on reactorLoop_
+    bool keepAliveOptions_ = false; // the server refuses GET_PARAMETER
+    int64_t lastKeepAliveUs_ = 0;
+    uint64_t lastReceived_ = 0;
+    int64_t lastReceiveUs_ = 0;
+    uint64_t udpReceivedBase_ = 0; // packets received before the PLAY the UDP fallback timer watches
 
     uint16_t remoteVideoRtpPort_ = 0;
     uint16_t remoteVideoRtcpPort_ = 0;
     uint16_t remoteAudioRtpPort_ = 0;
     uint16_t remoteAudioRtcpPort_ = 0;
 
-    std::shared_ptr<UdpServer> videoRtpServer_;
-    std::shared_ptr<UdpServer> videoRtcpServer_;
-    std::shared_ptr<UdpServer> audioRtpServer_;
-    std::shared_ptr<UdpServer> audioRtcpServer_;
+    RtspTransport transport_ = RtspTransport::AUTO;
+    uint32_t udpTimeoutMs_ = 3000;
+    std::atomic<bool> interleaved_{false}; // media currently comes over the RTSP connection
+    bool udpFailed_ = false;                // AUTO has fallen back to TCP, kept across reconnects
+    int fallbackTimerFd_ = -1; // owned by UdpReactor, runs on reactorLoop_
+    uint8_t videoRtpChannel_ = 0;
+    uint8_t videoRtcpChannel_ = 1;
+    uint8_t audioRtpChannel_ = 2;
+    uint8_t audioRtcpChannel_ = 3;
+    RtspStreamParser streamParser_; // responses and interleaved packets on the RTSP connection
+    RtpPacketPool interleavedPool_{1500}; // packets read from the connection, reused once depacketized
+    std::vector<std::shared_ptr<DataBuffer>> videoBatch_;
+    std::vector<std::shared_ptr<DataBuffer>> audioBatch_;
+    bool sinksReady_ = false;
+
+    // sockets are owned by the shared UdpReactor, all four run on the same event loop
+    size_t reactorLoop_ = 0;
+    bool fixedReactorLoop_ = false;
+    int videoRtpFd_ = -1;
+    int videoRtcpFd_ = -1;
+    int audioRtpFd_ = -1;
+    int audioRtcpFd_ = -1;
+
+    // RTCP goes to the RTSP server host, on the ports it answered in SETUP
+    struct sockaddr_in serverAddr_ {};
+    uint32_t rtcpSsrc_ = 0;
+    std::string cname_;
+    int rtcpTimerFd_ = -1; // owned by UdpReactor, runs on reactorLoop_
+    RtcpReceiverStats videoStats_;
+    RtcpReceiverStats audioStats_;
+    bool nackEnabled_ = true;
+    std::atomic<uint64_t> nacksSent_{0};
+    std::atomic<uint64_t> packetsRequested_{0};
 
+    uint32_t videoJitterMs_ = 0;
+    uint32_t audioJitterMs_ = 0;
+    int jitterTimerFd_ = -1; // owned by UdpReactor, runs on reactorLoop_
     std::shared_ptr<RtpDepacketizer> videoDepacketizer_;
     std::shared_ptr<RtpDepacketizer> audioDepacketizer_;
 
     std::unique_ptr<TcpClient> rtspConnectionClient_;
-    std::unordered_map<int, std::function<void(RtspResponse &)>> responseHandlers_;
+    std::shared_ptr<IClientListener> connectionListener_;
+    // cseq_, the handlers and writes to the connection, so that a request and an RTCP frame never mix
+    std::mutex requestMutex_;
+    struct PendingRequest {
+        ResponseHandler onOk;
+        ResponseHandler onError;
+    };
+    std::unordered_map<int, PendingRequest> responseHandlers_;
+    std::string outgoing_; // requests held back to be pipelined
 
     std::shared_ptr<MediaDescription> videoTrack_;
     std::shared_ptr<MediaDescription> audioTrack_;
 
     std::shared_ptr<Frame> sps_;
     std::shared_ptr<Frame> pps_;
+    FrameFormat videoFormat_ = FRAME_FORMAT_UNKNOWN;
+    std::shared_ptr<DataBuffer> videoExtraData_; // parameter sets of the SDP for the sinks, with start codes
     int videoWidth_ = 0, videoHeight_ = 0;
     int audioSampleRate_ = 0, audioChannels_ = 0;
+    // tracks, video codec and size, audio rate and channels the sinks were initialized with
+    using SinkParameters = std::tuple<bool, FrameFormat, int, int, bool, int, int>;
+    SinkParameters sinkParams_;
 };
 
 #endif // HALFWAY_MEDIA_RTSP_SOURCE_H
\ No newline at end of file
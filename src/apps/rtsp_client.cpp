@@ -1,3 +1,4 @@
+#include "../common/metrics.h"
 #include "../session/rtsp_client_session.h"
 #include <cstdio>
 #include <memory>
@@ -7,6 +8,9 @@ int main(int argc, char **argv)
 {
     printf("RTSP-Client, Built at %s on %s.\n", __TIME__, __DATE__);
 
+    // curl http://127.0.0.1:9464/metrics
+    MetricsRegistry::GetInstance()->StartHttpServer(9464);
+
     auto rtspRecoderSession = std::make_unique<RtspClientSession>();
 
     // rtspRecoderSession->SetSourceUrl("rtsp://192.168.1.83:8554/Luca-30s-720p.mkv");
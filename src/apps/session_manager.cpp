@@ -0,0 +1,82 @@
+#include "../common/metrics.h"
+#include "../session/session_manager.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t gRunning = 1;
+
+static void OnSignal(int)
+{
+    gRunning = 0;
+}
+
+static time_t ModifiedTime(const char *path)
+{
+    struct stat st {};
+    return stat(path, &st) == 0 ? st.st_mtime : 0;
+}
+
+int main(int argc, char **argv)
+{
+    printf("Session-Manager, Built at %s on %s.\n", __TIME__, __DATE__);
+
+    const char *config = nullptr;
+    const char *control = "/tmp/halfway_sessions.sock";
+    size_t workers = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:s:w:")) != -1) {
+        switch (opt) {
+            case 'c':
+                config = optarg;
+                break;
+            case 's':
+                control = optarg;
+                break;
+            case 'w':
+                workers = strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                printf("usage: %s [-c sessions.conf] [-s control.sock] [-w workers]\n", argv[0]);
+                printf("  sessions.conf: one `name rtsp://url file.mp4` per line, reloaded when it changes\n");
+                printf("  control: echo 'add|remove|list|reload ...' | nc -U control.sock\n");
+                return 1;
+        }
+    }
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+
+    // curl http://127.0.0.1:9464/metrics
+    MetricsRegistry::GetInstance()->StartHttpServer(9464);
+
+    auto manager = std::make_unique<SessionManager>(workers);
+    if (!manager->StartControlServer(control)) {
+        printf("control socket %s failed\n", control);
+        return 1;
+    }
+
+    time_t configTime = 0;
+    if (config) {
+        configTime = ModifiedTime(config);
+        if (!manager->LoadConfig(config)) {
+            printf("load %s failed\n", config);
+            return 1;
+        }
+    }
+
+    while (gRunning) {
+        sleep(1);
+        if (config && ModifiedTime(config) != configTime) {
+            configTime = ModifiedTime(config);
+            manager->Reload();
+        }
+    }
+
+    // finishes every recording before exit
+    manager->Stop();
+    return 0;
+}
@@ -0,0 +1,495 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "agent/base/event_definition.h"
+#include "agent/base/media_frame_pipeline.h"
+#include "agent/fake_data/fake_data_source.h"
+#include "agent/media_file/media_file_source.h"
+#include "common/utils.h"
+#include "protocol/rtp/rtp_packet.h"
+#include "protocol/rtp/rtp_packet_h264.h"
+#include "protocol/rtp/rtp_packet_h265.h"
+#include "protocol/rtp/rtp_packet_pool.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+// End-to-end benchmark of the RTP media path. Every frame of a source is packetized, sent through a loopback,
+// put back in order by the sorter, depacketized and read by a sink, inline on the thread of the source, which is not
+// paced. Reports frames/s and packets/s of the pipeline, heap allocations per frame and p50/p99 per stage.
+//
+// usage: pipeline_bench [--frames N] [--udp] [--reorder PERCENT] [file ...]
+//   --frames   frames of the synthetic H.264/AAC streams, 3000 by default
+//   --udp      loopback through a UDP socket pair on 127.0.0.1 instead of a copy in memory
+//   --reorder  swaps that many percent of adjacent packets before the sorter
+// Without files the synthetic streams and the media files of assets/ are run.
+
+#ifndef ASSETS_DIR
+#define ASSETS_DIR "../../assets"
+#endif
+
+constexpr int WARMUP_FRAMES = 100; // per track, pools and buffers grow during them
+constexpr size_t UDP_BATCH_MAX = 64;
+constexpr int UDP_RECV_TIMEOUT_MS = 200;
+constexpr int IOV_MAX_COUNT = 512;
+
+// heap allocations of the current thread
+static thread_local uint64_t tAllocations = 0;
+
+void *operator new(size_t size)
+{
+    tAllocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+struct BenchOptions {
+    uint64_t frames = 3000;
+    bool udp = false;
+    uint32_t reorderPercent = 0;
+};
+
+enum Stage {
+    STAGE_PACKETIZE,
+    STAGE_LOOPBACK,
+    STAGE_DEPACKETIZE,
+    STAGE_SINK,
+    STAGE_TOTAL,
+    STAGE_COUNT,
+};
+
+static const char *STAGE_NAMES[STAGE_COUNT] = {"packetize", "loopback", "depacketize", "sink", "total"};
+
+// Carries the packets of one track from the packetizer to the depacketizer, into buffers of its own as a socket
+// would, optionally through the kernel.
+class Loopback {
+public:
+    ~Loopback()
+    {
+        if (sendFd_ != -1) {
+            close(sendFd_);
+            close(recvFd_);
+        }
+    }
+
+    bool Open(bool udp)
+    {
+        if (!udp) {
+            return true;
+        }
+
+        recvFd_ = OpenSocket();
+        sendFd_ = OpenSocket();
+        if (recvFd_ == -1 || sendFd_ == -1) {
+            return false;
+        }
+
+        struct sockaddr_in addr {};
+        socklen_t length = sizeof(addr);
+        getsockname(recvFd_, (struct sockaddr *)&addr, &length);
+        if (connect(sendFd_, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            return false;
+        }
+
+        struct timeval timeout {
+            0, UDP_RECV_TIMEOUT_MS * 1000
+        };
+        setsockopt(recvFd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        return true;
+    }
+
+    // returns the number of packets lost on the way
+    size_t Transfer(const RtpPacketizer::PacketBatch &in, std::vector<std::shared_ptr<DataBuffer>> &out)
+    {
+        if (sendFd_ == -1) {
+            for (auto &packet : in) {
+                auto buffer = pool_.Alloc(packet->Size());
+                buffer->Assign(packet->Data(), packet->Size());
+                out.push_back(buffer);
+            }
+            return 0;
+        }
+
+        size_t lost = 0;
+        for (size_t i = 0; i < in.size(); i += UDP_BATCH_MAX) {
+            size_t count = std::min(UDP_BATCH_MAX, in.size() - i);
+            for (size_t j = 0; j < count; j++) {
+                iovs_[j].iov_base = in[i + j]->Data();
+                iovs_[j].iov_len = in[i + j]->Size();
+                msgs_[j] = {};
+                msgs_[j].msg_hdr.msg_iov = &iovs_[j];
+                msgs_[j].msg_hdr.msg_iovlen = 1;
+            }
+            int sent = sendmmsg(sendFd_, msgs_, count, 0);
+            lost += count - std::max(sent, 0);
+            lost += Receive(std::max(sent, 0), out);
+        }
+        return lost;
+    }
+
+private:
+    static int OpenSocket()
+    {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("open udp socket");
+            return -1;
+        }
+        return fd;
+    }
+
+    size_t Receive(size_t count, std::vector<std::shared_ptr<DataBuffer>> &out)
+    {
+        while (count > 0) {
+            for (size_t j = 0; j < count; j++) {
+                buffers_[j] = pool_.Alloc(MTU_DEFAULT);
+                iovs_[j].iov_base = buffers_[j]->Data();
+                iovs_[j].iov_len = MTU_DEFAULT;
+                msgs_[j] = {};
+                msgs_[j].msg_hdr.msg_iov = &iovs_[j];
+                msgs_[j].msg_hdr.msg_iovlen = 1;
+            }
+
+            int received = recvmmsg(recvFd_, msgs_, count, MSG_WAITFORONE, nullptr);
+            if (received <= 0) {
+                break;
+            }
+            for (int j = 0; j < received; j++) {
+                buffers_[j]->SetSize(msgs_[j].msg_len);
+                out.push_back(buffers_[j]);
+            }
+            count -= received;
+        }
+
+        for (auto &buffer : buffers_) {
+            buffer.reset();
+        }
+        return count;
+    }
+
+private:
+    int sendFd_ = -1;
+    int recvFd_ = -1;
+    RtpPacketPool pool_{MTU_DEFAULT};
+    struct mmsghdr msgs_[UDP_BATCH_MAX];
+    struct iovec iovs_[UDP_BATCH_MAX];
+    std::shared_ptr<DataBuffer> buffers_[UDP_BATCH_MAX];
+};
+
+struct Track {
+    const char *name = "";
+    bool ok = false;
+    std::shared_ptr<RtpPacketizer> packetizer;
+    std::shared_ptr<RtpDepacketizer> depacketizer;
+    Loopback loopback;
+
+    RtpPacketizer::PacketBatch sent;
+    std::vector<std::shared_ptr<DataBuffer>> received;
+    std::vector<std::shared_ptr<Frame>> output;
+
+    uint64_t frames = 0; // measured input frames, after the warmup
+    uint64_t seen = 0;
+    uint64_t packets = 0;
+    uint64_t lost = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t framesOut = 0;
+    uint64_t allocations = 0;
+    uint64_t checksum = 0; // keeps the reads of the sink from being optimized away
+    std::vector<int64_t> latency[STAGE_COUNT];
+};
+
+// Runs the stages for every frame it gets and signals the end of the stream.
+class PipelineSink : public FrameSink {
+public:
+    explicit PipelineSink(const BenchOptions &options) : options_(options) {}
+
+    void OnFrame(const std::shared_ptr<Frame> &frame) override
+    {
+        Track &track = FrameType(frame->format) == FRAME_FORMAT_VIDEO_BASE ? video_ : audio_;
+        if (track.seen == 0) {
+            InitTrack(track, frame);
+        }
+        track.seen++;
+        if (!track.ok) {
+            return;
+        }
+
+        uint64_t allocations = tAllocations;
+        int64_t t0 = SteadyNanoseconds();
+        track.packetizer->Packetize(frame);
+        int64_t t1 = SteadyNanoseconds();
+        size_t lost = track.loopback.Transfer(track.sent, track.received);
+        Reorder(track.received);
+        int64_t t2 = SteadyNanoseconds();
+        track.depacketizer->Depacketize(track.received);
+        int64_t t3 = SteadyNanoseconds();
+        uint64_t bytesOut = 0;
+        for (auto &out : track.output) {
+            bytesOut += Consume(track, out);
+        }
+        int64_t t4 = SteadyNanoseconds();
+        allocations = tAllocations - allocations;
+
+        size_t packets = track.sent.size();
+        size_t framesOut = track.output.size();
+        track.sent.clear();
+        track.received.clear();
+        track.output.clear();
+        if (track.seen <= WARMUP_FRAMES) {
+            return;
+        }
+
+        track.frames++;
+        track.packets += packets;
+        track.lost += lost;
+        track.bytesIn += frame->TotalSize();
+        track.bytesOut += bytesOut;
+        track.framesOut += framesOut;
+        track.allocations += allocations;
+        int64_t stages[STAGE_COUNT] = {t1 - t0, t2 - t1, t3 - t2, t4 - t3, t4 - t0};
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            track.latency[i].push_back(stages[i]);
+        }
+    }
+
+    bool OnNotify(void *userdata) override
+    {
+        AgentEvent *event = (AgentEvent *)userdata;
+        if (event->type == EVENT_SOURCE_EOS) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_ = true;
+            cond_.notify_all();
+        }
+        return true;
+    }
+
+    void WaitForEnd()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return finished_; });
+    }
+
+    void Report(const std::string &title, double wallSeconds);
+
+private:
+    void InitTrack(Track &track, const std::shared_ptr<Frame> &frame)
+    {
+        track.packetizer = RtpPacketizer::Create(frame->format);
+        track.depacketizer = RtpDepacketizer::Create(frame->format);
+        if (!track.packetizer || !track.depacketizer || !track.loopback.Open(options_.udp)) {
+            printf("  format %d is not supported, skipped\n", (int)frame->format);
+            return;
+        }
+
+        if (frame->format == FRAME_FORMAT_H264) {
+            track.name = "H.264";
+            H264PacketizationInfo info{1, 0};
+            track.depacketizer->SetExtraData(&info);
+        } else if (frame->format == FRAME_FORMAT_H265) {
+            track.name = "H.265";
+            H265PacketizationInfo info{0};
+            track.depacketizer->SetExtraData(&info);
+        } else if (frame->format == FRAME_FORMAT_AAC) {
+            track.name = "AAC";
+            AudioFrameInfo info{frame->audioInfo.channels, 1024, frame->audioInfo.sampleRate};
+            track.depacketizer->SetExtraData(&info);
+        }
+
+        track.packetizer->SetBatchCallback([&track](RtpPacketizer::PacketBatch &batch) {
+            track.sent.insert(track.sent.end(), batch.begin(), batch.end());
+        });
+        track.depacketizer->SetCallback([&track](std::shared_ptr<Frame> out) { track.output.push_back(out); });
+        track.ok = true;
+    }
+
+    void Reorder(std::vector<std::shared_ptr<DataBuffer>> &packets)
+    {
+        if (options_.reorderPercent == 0) {
+            return;
+        }
+
+        for (size_t i = 0; i + 1 < packets.size(); i++) {
+            random_ = random_ * 1103515245 + 12345;
+            if ((random_ >> 16) % 100 < options_.reorderPercent) {
+                std::swap(packets[i], packets[i + 1]);
+                i++;
+            }
+        }
+    }
+
+    // reads the payload in place, as a decoder or a file writer would
+    static uint64_t Consume(Track &track, const std::shared_ptr<Frame> &frame)
+    {
+        struct iovec iov[IOV_MAX_COUNT];
+        int count = frame->GetIoVec(iov, IOV_MAX_COUNT);
+        if (count < 0) {
+            frame->Flatten();
+            iov[0].iov_base = frame->Data();
+            iov[0].iov_len = frame->Size();
+            count = 1;
+        }
+
+        uint64_t size = 0;
+        uint64_t sum = 0;
+        for (int i = 0; i < count; i++) {
+            auto *data = (const uint8_t *)iov[i].iov_base;
+            for (size_t j = 0; j < iov[i].iov_len; j++) {
+                sum += data[j];
+            }
+            size += iov[i].iov_len;
+        }
+        track.checksum += sum;
+        return size;
+    }
+
+private:
+    BenchOptions options_;
+    Track video_;
+    Track audio_;
+    uint32_t random_ = 1;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool finished_ = false;
+};
+
+static double Percentile(std::vector<int64_t> &values, int percent)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, values.size() * percent / 100);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index] / 1000.0;
+}
+
+void PipelineSink::Report(const std::string &title, double wallSeconds)
+{
+    printf("%s, %s loopback, %u%% reordered: %.2f s\n", title.c_str(), options_.udp ? "udp" : "memory",
+           options_.reorderPercent, wallSeconds);
+
+    for (Track *track : {&video_, &audio_}) {
+        if (!track->ok || track->frames == 0) {
+            continue;
+        }
+
+        double seconds = 0;
+        for (auto ns : track->latency[STAGE_TOTAL]) {
+            seconds += ns / 1e9;
+        }
+        printf("  %-5s %lu frames, %lu packets, %lu lost, %.1f MB in, %lu frames %.1f MB out\n", track->name,
+               (unsigned long)track->frames, (unsigned long)track->packets, (unsigned long)track->lost,
+               track->bytesIn / 1e6, (unsigned long)track->framesOut, track->bytesOut / 1e6);
+        printf("        %.0f frames/s, %.0f packets/s, %.2f allocations/frame\n", track->frames / seconds,
+               track->packets / seconds, (double)track->allocations / track->frames);
+        printf("        p50/p99 us:");
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            printf(" %s %.1f/%.1f%s", STAGE_NAMES[i], Percentile(track->latency[i], 50),
+                   Percentile(track->latency[i], 99), i + 1 < STAGE_COUNT ? "," : "\n");
+        }
+    }
+}
+
+static void Run(const std::string &title, const std::shared_ptr<MediaSource> &source, const BenchOptions &options)
+{
+    auto sink = std::make_shared<PipelineSink>(options);
+    source->AddVideoSink(sink);
+    source->AddAudioSink(sink);
+
+    int64_t start = SteadyNanoseconds();
+    source->Start();
+    sink->WaitForEnd();
+    double wallSeconds = (SteadyNanoseconds() - start) / 1e9;
+
+    source->Stop();
+    sink->Report(title, wallSeconds);
+}
+
+static void RunSynthetic(const BenchOptions &options)
+{
+    auto source = FakeDataSource::Create(FakeDataType::H264_AAC);
+    source->SetRealtime(false);
+    source->SetFrameLimit(options.frames);
+    source->Init();
+    Run("synthetic H.264 4 Mbit/s + AAC 128 kbit/s", source, options);
+}
+
+static void RunFile(const std::string &path, const BenchOptions &options)
+{
+    if (access(path.c_str(), R_OK) != 0) {
+        printf("%s not found, skipped\n", path.c_str());
+        return;
+    }
+
+    auto source = MediaFileSource::Create(path);
+    source->SetRealtime(false);
+    if (!source->Init()) {
+        printf("%s cannot be opened, skipped\n", path.c_str());
+        return;
+    }
+    Run(path, source, options);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            options.frames = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--udp") {
+            options.udp = true;
+        } else if (arg == "--reorder" && i + 1 < argc) {
+            options.reorderPercent = std::min<uint32_t>(strtoul(argv[++i], nullptr, 10), 100);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            printf("usage: %s [--frames N] [--udp] [--reorder PERCENT] [file ...]\n", argv[0]);
+            return 1;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    if (files.empty()) {
+        RunSynthetic(options);
+        files = {ASSETS_DIR "/Hobbit.mkv", ASSETS_DIR "/echo.aac"};
+    }
+
+    for (auto &file : files) {
+        RunFile(file, options);
+    }
+    return 0;
+}
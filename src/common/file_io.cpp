@@ -3,9 +3,13 @@
 //
 
 #include "file_io.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 std::shared_ptr<FileReader> FileReader::Open(const std::string &filename)
@@ -49,6 +53,26 @@ FileReader::~FileReader()
     Close();
 }
 
+static bool WriteAll(int fd, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (written == 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
 std::shared_ptr<FileWriter> FileWriter::Open(const std::string &filename)
 {
     FILE *fd = fopen(filename.c_str(), "wb");
@@ -62,6 +86,7 @@ std::shared_ptr<FileWriter> FileWriter::Open(const std::string &filename)
 bool FileWriter::Write(const uint8_t *data, size_t size)
 {
     if (fd_) {
+        buffered_ = true;
         size_t ret = fwrite(data, 1, size, fd_);
         if (ret != size) {
             totalSize_ += ret;
@@ -85,12 +110,60 @@ bool FileWriter::Write(const std::string &str)
     return Write(str.c_str(), str.size());
 }
 
+bool FileWriter::Write(const struct iovec *iov, int count)
+{
+    if (!fd_) {
+        return false;
+    }
+
+    // bypass stdio buffering, flush what is pending first to keep the order
+    if (buffered_) {
+        Flush();
+    }
+
+    int fd = fileno(fd_);
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, std::min(count, IOV_MAX));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        size_t rest = written;
+        for (; count > 0 && rest >= iov->iov_len; iov++, count--) {
+            rest -= iov->iov_len;
+        }
+
+        if (count == 0) {
+            break;
+        }
+
+        if (written == 0) {
+            return false;
+        }
+
+        // the write stopped inside this one, finish it and go on with whole ones
+        if (rest > 0) {
+            if (!WriteAll(fd, (const uint8_t *)iov->iov_base + rest, iov->iov_len - rest)) {
+                return false;
+            }
+            iov++;
+            count--;
+        }
+    }
+
+    return true;
+}
+
 void FileWriter::Flush()
 {
     if (fd_) {
         fflush(fd_);
     }
     totalSize_ = 0;
+    buffered_ = false;
 }
 
 void FileWriter::Close()
@@ -10,6 +10,8 @@
 #include <memory>
 #include <string>
 
+struct iovec;
+
 class FileReader {
 public:
     static std::shared_ptr<FileReader> Open(const std::string &filename);
@@ -36,6 +38,7 @@ public:
     bool Write(const uint8_t *data, size_t size);
     bool Write(const char *data, size_t size);
     bool Write(const std::string &str);
+    bool Write(const struct iovec *iov, int count);
     void Flush();
     void Close();
 
@@ -47,6 +50,7 @@ private:
 private:
     FILE *fd_ = nullptr;
     size_t totalSize_ = 0;
+    bool buffered_ = false; // stdio holds data that writev() must not overtake
 };
 
 #endif // HALFWAY_MEDIA_FILE_IO_H
\ No newline at end of file
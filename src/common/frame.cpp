@@ -0,0 +1,139 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "frame.h"
+#include <cstring>
+#include <sys/uio.h>
+
+void Frame::SetPrefix(const void *data, size_t length)
+{
+    prefixSize_ = length < sizeof(prefix_) ? length : sizeof(prefix_);
+    memcpy(prefix_, data, prefixSize_);
+}
+
+void Frame::AppendSlice(const std::shared_ptr<DataBuffer> &buffer, size_t offset, size_t length)
+{
+    slices_.push_back({buffer, offset, length});
+    slicesSize_ += length;
+}
+
+void Frame::ClearSlices()
+{
+    std::lock_guard<std::mutex> lock(flattenMutex_);
+    slices_.clear();
+    prefixSize_ = 0;
+    slicesSize_ = 0;
+    flattened_ = false;
+}
+
+size_t Frame::TotalSize()
+{
+    if (slices_.empty()) {
+        return Size();
+    }
+
+    return prefixSize_ + slicesSize_;
+}
+
+uint8_t Frame::At(size_t offset)
+{
+    uint8_t value = 0;
+    Read(offset, &value, 1);
+    return value;
+}
+
+size_t Frame::Read(size_t offset, void *dst, size_t length)
+{
+    auto *out = static_cast<uint8_t *>(dst);
+    if (slices_.empty()) {
+        if (offset >= Size()) {
+            return 0;
+        }
+
+        length = length < Size() - offset ? length : Size() - offset;
+        memcpy(out, Data() + offset, length);
+        return length;
+    }
+
+    size_t copied = 0;
+    if (offset < prefixSize_) {
+        size_t n = length < prefixSize_ - offset ? length : prefixSize_ - offset;
+        memcpy(out, prefix_ + offset, n);
+        copied += n;
+        offset = 0;
+    } else {
+        offset -= prefixSize_;
+    }
+
+    for (auto &slice : slices_) {
+        if (copied == length) {
+            break;
+        }
+
+        if (offset >= slice.length) {
+            offset -= slice.length;
+            continue;
+        }
+
+        size_t n = length - copied < slice.length - offset ? length - copied : slice.length - offset;
+        memcpy(out + copied, slice.buffer->Data() + slice.offset + offset, n);
+        copied += n;
+        offset = 0;
+    }
+
+    return copied;
+}
+
+int Frame::GetIoVec(struct iovec *iov, int count)
+{
+    int n = 0;
+    if (slices_.empty()) {
+        if (Size() > 0) {
+            if (count == 0) {
+                return -1;
+            }
+            iov[n].iov_base = Data();
+            iov[n].iov_len = Size();
+            n++;
+        }
+        return n;
+    }
+
+    if (prefixSize_ > 0) {
+        if (count == 0) {
+            return -1;
+        }
+        iov[n].iov_base = prefix_;
+        iov[n].iov_len = prefixSize_;
+        n++;
+    }
+
+    for (auto &slice : slices_) {
+        if (n == count) {
+            return -1;
+        }
+        iov[n].iov_base = slice.buffer->Data() + slice.offset;
+        iov[n].iov_len = slice.length;
+        n++;
+    }
+
+    return n;
+}
+
+void Frame::Flatten()
+{
+    std::lock_guard<std::mutex> lock(flattenMutex_);
+    if (slices_.empty() || flattened_) {
+        return;
+    }
+
+    SetCapacity(prefixSize_ + slicesSize_);
+    Assign(prefix_, prefixSize_);
+    for (auto &slice : slices_) {
+        Append(slice.buffer->Data() + slice.offset, slice.length);
+    }
+
+    // slices are kept so that readers on other threads stay valid
+    flattened_ = true;
+}
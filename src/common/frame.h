@@ -6,7 +6,13 @@
 #define HALFWAY_MEDIA_FRAME_H
 
 #include "data_buffer.h"
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct iovec;
 
 enum FrameFormat {
     FRAME_FORMAT_UNKNOWN = 0,
@@ -42,6 +48,13 @@ struct AudioFrameInfo {
     uint32_t sampleRate;
 };
 
+// A range of bytes inside another buffer, e.g. the payload of a received RTP packet
+struct FrameSlice {
+    std::shared_ptr<DataBuffer> buffer;
+    size_t offset;
+    size_t length;
+};
+
 class Frame : public DataBuffer {
 public:
     template <typename... Args>
@@ -49,12 +62,37 @@ public:
     {
     }
 
+    // Scatter-gather view: a short prefix (start code, NAL header) followed by slices of other buffers.
+    // Data()/Size() of a scattered frame are only valid after Flatten(); use TotalSize()/Read()/GetIoVec() to
+    // access the payload without copying.
+    bool IsScattered() const { return !slices_.empty(); }
+    void SetPrefix(const void *data, size_t length);
+    void AppendSlice(const std::shared_ptr<DataBuffer> &buffer, size_t offset, size_t length);
+    void ClearSlices();
+
+    size_t TotalSize();
+    uint8_t At(size_t offset);
+    size_t Read(size_t offset, void *dst, size_t length);
+    // number of entries filled, -1 if `count` is too small
+    int GetIoVec(struct iovec *iov, int count);
+
+    // Gathers a scattered frame into its own buffer, no-op for contiguous frames
+    void Flatten();
+
     uint64_t timestamp;
     FrameFormat format;
     union {
         VideoFrameInfo videoInfo;
         AudioFrameInfo audioInfo;
     };
+
+private:
+    uint8_t prefix_[8];
+    size_t prefixSize_ = 0;
+    size_t slicesSize_ = 0;
+    bool flattened_ = false;
+    std::mutex flattenMutex_;
+    std::vector<FrameSlice> slices_;
 };
 
 #endif // HALFWAY_MEDIA_FRAME_H
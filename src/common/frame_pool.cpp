@@ -0,0 +1,397 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "frame_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+constexpr size_t FRAME_POOL_MIN_SHIFT = 8;     // smallest size class: 256 bytes
+constexpr size_t FRAME_POOL_CLASS_COUNT = 13;  // 256 bytes ... 1 MB
+constexpr size_t FRAME_POOL_LOCAL_MAX = 64;    // free objects kept per list per thread
+constexpr size_t FRAME_POOL_BATCH = 32;        // objects moved between a thread and the depot at once
+constexpr size_t FRAME_POOL_DEPOT_MAX = 1024;  // free objects kept per list in the shared depot
+
+constexpr size_t FRAME_POOL_CACHE_LINE = 64;
+
+enum CacheState : uint8_t {
+    CACHE_UNINITIALIZED,
+    CACHE_ALIVE,
+    CACHE_DESTROYED, // thread is exiting, released objects are freed directly
+};
+
+// Statistics of one thread, on a cache line of its own so that counting on the hot path never bounces a line between
+// cores. Only the owner thread adds, GetStats() sums all threads.
+struct alignas(FRAME_POOL_CACHE_LINE) PoolCounters {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> recycles{0};
+    std::atomic<uint64_t> discards{0};
+
+    static void Add(std::atomic<uint64_t> &counter)
+    {
+        // single writer: a plain load and store instead of a locked read-modify-write
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void AddTo(FramePool::Stats &stats) const
+    {
+        stats.hits += hits.load(std::memory_order_relaxed);
+        stats.misses += misses.load(std::memory_order_relaxed);
+        stats.recycles += recycles.load(std::memory_order_relaxed);
+        stats.discards += discards.load(std::memory_order_relaxed);
+    }
+};
+
+// counters of the live threads, plus the sum of the exited ones
+struct CounterRegistry {
+    std::mutex mutex;
+    std::vector<PoolCounters *> threads;
+    FramePool::Stats exited{};
+    FramePool::Stats baseline{}; // subtracted since ResetStats()
+};
+
+static CounterRegistry &Counters()
+{
+    static CounterRegistry *registry = new CounterRegistry(); // never destroyed, see FrameDepot()
+    return *registry;
+}
+
+static thread_local CacheState tCountersState = CACHE_UNINITIALIZED;
+
+struct ThreadCounters {
+    ThreadCounters()
+    {
+        std::lock_guard<std::mutex> lock(Counters().mutex);
+        Counters().threads.push_back(&counters);
+        tCountersState = CACHE_ALIVE;
+    }
+
+    ~ThreadCounters()
+    {
+        tCountersState = CACHE_DESTROYED;
+        auto &registry = Counters();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        counters.AddTo(registry.exited);
+        registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), &counters));
+    }
+
+    PoolCounters counters;
+};
+
+// counters of the calling thread, the shared fallback once its thread-local storage is gone
+static PoolCounters &LocalCounters()
+{
+    static PoolCounters *exiting = new PoolCounters(); // never destroyed, see FrameDepot()
+    if (tCountersState == CACHE_DESTROYED) {
+        return *exiting;
+    }
+
+    static thread_local ThreadCounters counters;
+    return counters.counters;
+}
+
+// Free objects shared by all threads. A thread spills into it when its local list is full and refills from it when
+// its local list is empty, so frames released on a consumer thread find their way back to the producer thread.
+struct FreeDepot {
+    explicit FreeDepot(void (*destroy)(void *)) : destroy(destroy) { items.reserve(FRAME_POOL_DEPOT_MAX); }
+
+    std::mutex mutex;
+    std::vector<void *> items;
+    void (*destroy)(void *);
+};
+
+struct FreeList {
+    void Init(FreeDepot *freeDepot)
+    {
+        depot = freeDepot;
+        items.reserve(FRAME_POOL_LOCAL_MAX);
+    }
+
+    void Destroy()
+    {
+        for (auto *item : items) {
+            depot->destroy(item);
+        }
+        items.clear();
+    }
+
+    // nullptr if neither the local list nor the depot has a free object
+    void *Pop()
+    {
+        if (items.empty()) {
+            std::lock_guard<std::mutex> lock(depot->mutex);
+            size_t count = std::min(FRAME_POOL_BATCH, depot->items.size());
+            items.insert(items.end(), depot->items.end() - count, depot->items.end());
+            depot->items.resize(depot->items.size() - count);
+        }
+
+        if (items.empty()) {
+            return nullptr;
+        }
+
+        void *item = items.back();
+        items.pop_back();
+        return item;
+    }
+
+    // false if the object was not kept and has to be freed by the caller
+    bool Push(void *item)
+    {
+        if (items.size() >= FRAME_POOL_LOCAL_MAX) {
+            std::lock_guard<std::mutex> lock(depot->mutex);
+            size_t count = std::min(FRAME_POOL_BATCH, FRAME_POOL_DEPOT_MAX - depot->items.size());
+            if (count == 0) {
+                return false;
+            }
+            depot->items.insert(depot->items.end(), items.end() - count, items.end());
+            items.resize(items.size() - count);
+        }
+
+        items.push_back(item);
+        return true;
+    }
+
+    FreeDepot *depot = nullptr;
+    std::vector<void *> items;
+};
+
+static inline size_t ClassSize(size_t index)
+{
+    return (size_t)1 << (index + FRAME_POOL_MIN_SHIFT);
+}
+
+// smallest class that can hold `capacity`, FRAME_POOL_CLASS_COUNT if it is too large to pool
+static size_t ClassForAlloc(size_t capacity)
+{
+    size_t index = 0;
+    while (index < FRAME_POOL_CLASS_COUNT && ClassSize(index) < capacity) {
+        ++index;
+    }
+    return index;
+}
+
+// largest class whose size fits in `capacity`, FRAME_POOL_CLASS_COUNT if it is too small or too large to pool
+static size_t ClassForRelease(size_t capacity)
+{
+    if (capacity < ClassSize(0) || capacity >= ClassSize(FRAME_POOL_CLASS_COUNT)) {
+        return FRAME_POOL_CLASS_COUNT;
+    }
+
+    size_t index = FRAME_POOL_CLASS_COUNT - 1;
+    while (ClassSize(index) > capacity) {
+        --index;
+    }
+    return index;
+}
+
+static void DestroyFrame(void *frame)
+{
+    delete static_cast<Frame *>(frame);
+}
+
+static FreeDepot &FrameDepot(size_t index)
+{
+    // never destroyed: other threads may still release frames during static destruction
+    static FreeDepot *depots[FRAME_POOL_CLASS_COUNT] = {};
+    static std::once_flag once;
+    std::call_once(once, [] {
+        for (auto &depot : depots) {
+            depot = new FreeDepot(DestroyFrame);
+        }
+    });
+    return *depots[index];
+}
+
+static thread_local CacheState tFrameCacheState = CACHE_UNINITIALIZED;
+
+struct FrameCache {
+    FrameCache()
+    {
+        for (size_t i = 0; i < FRAME_POOL_CLASS_COUNT; i++) {
+            lists[i].Init(&FrameDepot(i));
+        }
+        tFrameCacheState = CACHE_ALIVE;
+    }
+
+    ~FrameCache()
+    {
+        tFrameCacheState = CACHE_DESTROYED;
+        for (auto &list : lists) {
+            list.Destroy();
+        }
+    }
+
+    FreeList lists[FRAME_POOL_CLASS_COUNT];
+};
+
+static FrameCache *LocalFrameCache()
+{
+    if (tFrameCacheState == CACHE_DESTROYED) {
+        return nullptr;
+    }
+
+    static thread_local FrameCache cache;
+    return &cache;
+}
+
+// Recycles the shared_ptr control blocks as well, otherwise every Alloc() would still cost one malloc.
+template <typename T>
+class ControlBlockAllocator {
+public:
+    using value_type = T;
+
+    ControlBlockAllocator() = default;
+    template <typename U>
+    ControlBlockAllocator(const ControlBlockAllocator<U> &)
+    {
+    }
+
+    T *allocate(size_t n)
+    {
+        FreeList *list = n == 1 ? LocalList() : nullptr;
+        void *block = list ? list->Pop() : nullptr;
+        if (!block) {
+            block = ::operator new(n * sizeof(T));
+        }
+        return static_cast<T *>(block);
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        FreeList *list = n == 1 ? LocalList() : nullptr;
+        if (!list || !list->Push(p)) {
+            ::operator delete(p);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const ControlBlockAllocator<U> &) const
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const ControlBlockAllocator<U> &) const
+    {
+        return false;
+    }
+
+private:
+    static void DestroyBlock(void *block) { ::operator delete(block); }
+
+    struct BlockCache {
+        BlockCache()
+        {
+            static FreeDepot *depot = new FreeDepot(DestroyBlock); // never destroyed, see FrameDepot()
+            list.Init(depot);
+            state = CACHE_ALIVE;
+        }
+
+        ~BlockCache()
+        {
+            state = CACHE_DESTROYED;
+            list.Destroy();
+        }
+
+        FreeList list;
+    };
+
+    static FreeList *LocalList()
+    {
+        if (state == CACHE_DESTROYED) {
+            return nullptr;
+        }
+
+        static thread_local BlockCache cache;
+        return &cache.list;
+    }
+
+    static thread_local CacheState state;
+};
+
+template <typename T>
+thread_local CacheState ControlBlockAllocator<T>::state = CACHE_UNINITIALIZED;
+
+struct FrameRecycler {
+    void operator()(Frame *frame) const
+    {
+        // drop references to RTP packets before parking the frame
+        frame->ClearSlices();
+
+        size_t index = ClassForRelease(frame->Capacity());
+        FrameCache *cache = index < FRAME_POOL_CLASS_COUNT ? LocalFrameCache() : nullptr;
+        PoolCounters &counters = LocalCounters();
+        if (cache && cache->lists[index].Push(frame)) {
+            PoolCounters::Add(counters.recycles);
+            return;
+        }
+
+        PoolCounters::Add(counters.discards);
+        delete frame;
+    }
+};
+
+std::shared_ptr<Frame> FramePool::Alloc(size_t capacity)
+{
+    Frame *frame = nullptr;
+    size_t index = ClassForAlloc(capacity);
+    FrameCache *cache = index < FRAME_POOL_CLASS_COUNT ? LocalFrameCache() : nullptr;
+    if (cache) {
+        frame = static_cast<Frame *>(cache->lists[index].Pop());
+    }
+
+    PoolCounters &counters = LocalCounters();
+    if (frame) {
+        PoolCounters::Add(counters.hits);
+        frame->SetSize(0);
+    } else {
+        frame = new Frame(cache ? ClassSize(index) : capacity);
+        PoolCounters::Add(counters.misses);
+    }
+
+    frame->timestamp = 0;
+    frame->format = FRAME_FORMAT_UNKNOWN;
+    if (sizeof(frame->videoInfo) > sizeof(frame->audioInfo)) {
+        memset(&frame->videoInfo, 0, sizeof(frame->videoInfo));
+    } else {
+        memset(&frame->audioInfo, 0, sizeof(frame->audioInfo));
+    }
+
+    return std::shared_ptr<Frame>(frame, FrameRecycler(), ControlBlockAllocator<Frame>());
+}
+
+// sum of every thread, without the baseline
+static FramePool::Stats SumCounters(CounterRegistry &registry)
+{
+    FramePool::Stats stats = registry.exited;
+    for (auto *counters : registry.threads) {
+        counters->AddTo(stats);
+    }
+    return stats;
+}
+
+FramePool::Stats FramePool::GetStats()
+{
+    LocalCounters(); // registers the calling thread before the lock is taken
+    auto &registry = Counters();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    Stats stats = SumCounters(registry);
+    stats.hits -= registry.baseline.hits;
+    stats.misses -= registry.baseline.misses;
+    stats.recycles -= registry.baseline.recycles;
+    stats.discards -= registry.baseline.discards;
+    return stats;
+}
+
+void FramePool::ResetStats()
+{
+    LocalCounters(); // registers the calling thread before the lock is taken
+    auto &registry = Counters();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.baseline = SumCounters(registry);
+}
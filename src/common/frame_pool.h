@@ -0,0 +1,32 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_FRAME_POOL_H
+#define HALFWAY_MEDIA_FRAME_POOL_H
+
+#include "frame.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// Size-classed allocator for Frame objects on the depacketize/deliver hot path.
+/// A frame goes back to the free list of the releasing thread when its last shared_ptr is dropped,
+/// so a steady-state pipeline reuses the same buffers instead of calling malloc/free per frame.
+class FramePool {
+public:
+    struct Stats {
+        uint64_t hits;     // Alloc() served from a free list
+        uint64_t misses;   // Alloc() had to create a new frame
+        uint64_t recycles; // released frames put back into a free list
+        uint64_t discards; // released frames freed because the list was full or the size is not pooled
+    };
+
+    /// Returns a frame whose capacity is at least `capacity`, with size 0 and cleared media info.
+    static std::shared_ptr<Frame> Alloc(size_t capacity);
+
+    static Stats GetStats();
+    static void ResetStats();
+};
+
+#endif // HALFWAY_MEDIA_FRAME_POOL_H
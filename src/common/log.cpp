@@ -4,7 +4,461 @@
 
 #include "log.h"
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+constexpr size_t LOG_RING_SIZE = 64 * 1024; // per thread, a power of two
+constexpr size_t LOG_LINE_MAX = 4096;       // longer messages are truncated
+constexpr auto LOG_WRITE_INTERVAL = std::chrono::milliseconds(5);
+constexpr uint8_t LOG_RECORD_PADDING = 0xff;
+
+std::atomic<uint8_t> gLogLevels[LOG_MODULE_COUNT];
+
+static const char *LOG_MODULE_NAMES[LOG_MODULE_COUNT] = {"default", "common", "rtp",   "rtcp",
+                                                         "rtsp",    "codec",  "agent", "session"};
+static const char *LOG_LEVEL_NAMES[] = {"debug", "warn", "error", "off"};
+
+namespace {
+
+// Header of a message in a LogRing, followed by its text. Records are 8-byte aligned, so even the end of the
+// ring left unused by a wrapping record has room for the size and level fields of a padding record.
+struct LogRecord {
+    uint32_t size; // header and text, rounded up to 8
+    uint8_t level; // LOG_RECORD_PADDING for the unused end of the ring
+    uint8_t module;
+    uint16_t length; // of the text
+    int32_t line;
+    int64_t timeUs; // wall clock
+    const char *file;
+    const char *function;
+};
+
+// Single-producer single-consumer byte ring between one logging thread and the writer thread.
+class LogRing {
+public:
+    LogRing() : buffer_(new uint64_t[LOG_RING_SIZE / sizeof(uint64_t)]) {}
+
+    bool Push(const LogRecord &header, const char *text)
+    {
+        size_t need = (sizeof(LogRecord) + header.length + 7) & ~(size_t)7;
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        size_t offset = tail & (LOG_RING_SIZE - 1);
+        size_t contiguous = LOG_RING_SIZE - offset;
+        size_t total = need <= contiguous ? need : contiguous + need;
+        if (LOG_RING_SIZE - (tail - head) < total) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (need > contiguous) {
+            LogRecord padding{};
+            padding.size = (uint32_t)contiguous;
+            padding.level = LOG_RECORD_PADDING;
+            memcpy(Data() + offset, &padding, sizeof(uint64_t));
+            tail += contiguous;
+            offset = 0;
+        }
+
+        LogRecord record = header;
+        record.size = (uint32_t)need;
+        memcpy(Data() + offset, &record, sizeof(record));
+        memcpy(Data() + offset + sizeof(record), text, header.length);
+        tail_.store(tail + need, std::memory_order_release);
+        return true;
+    }
+
+    // records between head and tail stay valid until Release()
+    uint64_t Head() const { return head_.load(std::memory_order_relaxed); }
+    uint64_t Tail() const { return tail_.load(std::memory_order_acquire); }
+    const LogRecord *At(uint64_t position) const
+    {
+        return reinterpret_cast<const LogRecord *>(Data() + (position & (LOG_RING_SIZE - 1)));
+    }
+    void Release(uint64_t head) { head_.store(head, std::memory_order_release); }
+
+    uint64_t TakeDropped() { return dropped_.exchange(0, std::memory_order_relaxed); }
+
+    std::atomic<bool> retired{false}; // the thread has exited
+
+private:
+    char *Data() const { return reinterpret_cast<char *>(buffer_.get()); }
+
+    std::unique_ptr<uint64_t[]> buffer_;
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> dropped_{0};
+};
+
+class Logger {
+public:
+    // never destroyed, static destructors may still log
+    static Logger &Instance()
+    {
+        static Logger *logger = new Logger();
+        return *logger;
+    }
+
+    std::shared_ptr<LogRing> AddRing();
+    bool SetFile(const std::string &path);
+    void Flush();
+
+private:
+    Logger();
+
+    void Run();
+    bool WriteBatch();
+    void Format(const LogRecord &record);
+    void AppendTime(int64_t timeUs);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable wakeCond_;
+    std::condition_variable flushCond_;
+    std::vector<std::shared_ptr<LogRing>> rings_;
+    uint64_t flushRequested_ = 0;
+    uint64_t flushDone_ = 0;
+    int newFd_ = -1; // picked up by the writer thread
+
+    // writer thread only
+    int fd_ = STDOUT_FILENO;
+    bool color_ = false;
+    std::string out_;
+    std::vector<std::pair<int64_t, const LogRecord *>> batch_;
+    std::vector<std::pair<LogRing *, uint64_t>> consumed_;
+    time_t cachedSecond_ = -1;
+    char cachedTime_[32] = {0};
+    size_t cachedTimeLength_ = 0;
+
+    std::unique_ptr<std::thread> thread_;
+};
+
+struct ThreadRing {
+    ~ThreadRing()
+    {
+        if (ring) {
+            ring->retired = true;
+        }
+    }
+
+    std::shared_ptr<LogRing> ring;
+};
+
+thread_local ThreadRing tThreadRing;
+thread_local char tLineBuffer[LOG_LINE_MAX];
+
+} // namespace
+
+Logger::Logger()
+{
+    color_ = isatty(fd_);
+    thread_ = std::make_unique<std::thread>(&Logger::Run, this);
+    thread_->detach();
+    std::atexit(FlushLog);
+}
+
+std::shared_ptr<LogRing> Logger::AddRing()
+{
+    auto ring = std::make_shared<LogRing>();
+    std::lock_guard<std::mutex> lock(mutex_);
+    rings_.push_back(ring);
+    return ring;
+}
+
+bool Logger::SetFile(const std::string &path)
+{
+    int fd = STDOUT_FILENO;
+    if (!path.empty()) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+    }
+
+    // lines logged so far still go to the old sink
+    Flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (newFd_ >= 0 && newFd_ != STDOUT_FILENO) {
+            close(newFd_);
+        }
+        newFd_ = fd;
+    }
+    Flush();
+    return true;
+}
+
+void Logger::Flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t request = ++flushRequested_;
+    wakeCond_.notify_one();
+    flushCond_.wait(lock, [this, request] { return flushDone_ >= request; });
+}
+
+void Logger::Run()
+{
+    bool busy = false;
+    while (true) {
+        uint64_t flushRequest;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!busy && flushDone_ == flushRequested_) {
+                wakeCond_.wait_for(lock, LOG_WRITE_INTERVAL);
+            }
+            flushRequest = flushRequested_;
+        }
+
+        // one pass sees everything logged before the flush request
+        busy = WriteBatch();
+
+        if (flushRequest != flushDone_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            flushDone_ = flushRequest;
+            flushCond_.notify_all();
+        }
+    }
+}
+
+bool Logger::WriteBatch()
+{
+    std::vector<std::shared_ptr<LogRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // rings of exited threads go once they are drained
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+                                    [](const std::shared_ptr<LogRing> &ring) {
+                                        return ring->retired && ring->Head() == ring->Tail();
+                                    }),
+                     rings_.end());
+        rings = rings_;
+
+        if (newFd_ >= 0) {
+            if (fd_ != STDOUT_FILENO) {
+                close(fd_);
+            }
+            fd_ = newFd_;
+            color_ = isatty(fd_);
+            newFd_ = -1;
+        }
+    }
+
+    out_.clear();
+    batch_.clear();
+    consumed_.clear();
+    for (auto &ring : rings) {
+        uint64_t dropped = ring->TakeDropped();
+        if (dropped > 0) {
+            out_ += "log ring full, " + std::to_string(dropped) + " lines dropped\n";
+        }
+
+        uint64_t head = ring->Head();
+        uint64_t tail = ring->Tail();
+        while (head != tail) {
+            const LogRecord *record = ring->At(head);
+            if (record->level != LOG_RECORD_PADDING) {
+                batch_.emplace_back(record->timeUs, record);
+            }
+            head += record->size;
+        }
+        consumed_.emplace_back(ring.get(), head);
+    }
+
+    // merge the threads in time order
+    std::stable_sort(batch_.begin(), batch_.end(),
+                     [](const std::pair<int64_t, const LogRecord *> &a, const std::pair<int64_t, const LogRecord *> &b) {
+                         return a.first < b.first;
+                     });
+    for (auto &item : batch_) {
+        Format(*item.second);
+    }
+
+    for (auto &item : consumed_) {
+        item.first->Release(item.second);
+    }
+
+    size_t written = 0;
+    while (written < out_.size()) {
+        ssize_t n = write(fd_, out_.data() + written, out_.size() - written);
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+
+    return !batch_.empty();
+}
+
+void Logger::AppendTime(int64_t timeUs)
+{
+    // localtime_r() and strftime() once per second, only the milliseconds change in between
+    time_t second = timeUs / 1000000;
+    if (second != cachedSecond_) {
+        struct tm tm {};
+        localtime_r(&second, &tm);
+        cachedTimeLength_ = strftime(cachedTime_, sizeof(cachedTime_), "%Y-%m-%d %H:%M:%S.", &tm);
+        cachedSecond_ = second;
+    }
+
+    int ms = (int)(timeUs / 1000 % 1000);
+    out_.append(cachedTime_, cachedTimeLength_);
+    out_ += (char)('0' + ms / 100);
+    out_ += (char)('0' + ms / 10 % 10);
+    out_ += (char)('0' + ms % 10);
+}
+
+void Logger::Format(const LogRecord &record)
+{
+    if (color_ && record.level == LOG_LEVEL_WARN) {
+        out_ += "\033[0;33m";
+    } else if (color_ && record.level == LOG_LEVEL_ERROR) {
+        out_ += "\033[0;31m";
+    }
+
+    AppendTime(record.timeUs);
+    out_ += " - ";
+    out_ += record.file;
+    out_ += ':';
+    out_ += std::to_string(record.line);
+    out_ += " - ";
+    out_ += record.function;
+    out_ += ": ";
+    out_.append(reinterpret_cast<const char *>(&record + 1), record.length);
+
+    if (color_ && record.level != LOG_LEVEL_DEBUG) {
+        out_ += "\033[0m";
+    }
+    out_ += '\n';
+}
+
+void LogWrite(LogLevel level, LogModule module, const char *file, int line, const char *function, const char *fmt,
+              ...)
+{
+    auto &ring = tThreadRing.ring;
+    if (!ring) {
+        ring = Logger::Instance().AddRing();
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(tLineBuffer, sizeof(tLineBuffer), fmt, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    LogRecord record{};
+    record.level = level;
+    record.module = module;
+    record.length = (uint16_t)std::min((size_t)length, sizeof(tLineBuffer) - 1);
+    record.line = line;
+    record.timeUs = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    record.file = file;
+    record.function = function;
+    ring->Push(record, tLineBuffer);
+}
+
+void FlushLog()
+{
+    Logger::Instance().Flush();
+}
+
+bool SetLogFile(const std::string &path)
+{
+    return Logger::Instance().SetFile(path);
+}
+
+void SetLogLevel(LogLevel level)
+{
+    for (auto &moduleLevel : gLogLevels) {
+        moduleLevel.store(level, std::memory_order_relaxed);
+    }
+}
+
+void SetLogLevel(LogModule module, LogLevel level)
+{
+    if (module < LOG_MODULE_COUNT) {
+        gLogLevels[module].store(level, std::memory_order_relaxed);
+    }
+}
+
+static bool ParseLogLevel(const std::string &name, LogLevel &level)
+{
+    for (size_t i = 0; i <= LOG_LEVEL_OFF; i++) {
+        if (name == LOG_LEVEL_NAMES[i]) {
+            level = (LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SetLogLevels(const std::string &spec)
+{
+    bool ok = true;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+
+        std::string item = spec.substr(start, end - start);
+        start = end + 1;
+        if (item.empty()) {
+            continue;
+        }
+
+        LogLevel level;
+        size_t equal = item.find('=');
+        if (equal == std::string::npos) {
+            if (ParseLogLevel(item, level)) {
+                SetLogLevel(level);
+            } else {
+                ok = false;
+            }
+            continue;
+        }
+
+        std::string module = item.substr(0, equal);
+        auto name = std::find_if(std::begin(LOG_MODULE_NAMES), std::end(LOG_MODULE_NAMES),
+                                 [&module](const char *name) { return module == name; });
+        if (name == std::end(LOG_MODULE_NAMES) || !ParseLogLevel(item.substr(equal + 1), level)) {
+            ok = false;
+            continue;
+        }
+        SetLogLevel((LogModule)(name - std::begin(LOG_MODULE_NAMES)), level);
+    }
+
+    return ok;
+}
+
+static bool ApplyLogEnvironment()
+{
+    const char *spec = getenv("HALFWAY_LOG");
+    if (spec && !SetLogLevels(spec)) {
+        fprintf(stderr, "invalid HALFWAY_LOG=%s\n", spec);
+    }
+    return true;
+}
+
+static bool gLogEnvironmentApplied = ApplyLogEnvironment();
 
 std::string Time()
 {
@@ -12,9 +466,10 @@ std::string Time()
     auto tt = std::chrono::system_clock::to_time_t(now);
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
 
-    char date[24] = {0};
-    struct tm *ptm = localtime(&tt);
-    sprintf(date, "%04d-%02d-%02d %02d:%02d:%02d.%03d", ptm->tm_year + 1900, ptm->tm_mon + 1, ptm->tm_mday,
-            ptm->tm_hour, ptm->tm_min, ptm->tm_sec, (int)(ms % 1000));
+    char date[64] = {0};
+    struct tm tm {};
+    localtime_r(&tt, &tm);
+    snprintf(date, sizeof(date), "%04d-%02d-%02d %02d:%02d:%02d.%03d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(ms % 1000));
     return date;
-}
\ No newline at end of file
+}
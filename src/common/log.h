@@ -5,12 +5,107 @@
 #ifndef HALFWAY_MEDIA_LOG_H
 #define HALFWAY_MEDIA_LOG_H
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 
+// Asynchronous logging. A log call formats its message into a lock-free ring owned by the calling thread;
+// one background thread adds the timestamp and source location, merges the rings in time order and writes
+// the lines in batches. When a thread logs faster than the lines can be written, its newest lines are dropped
+// and the number of lost lines is reported instead of blocking the caller.
+//
+// Every module has its own runtime level, a disabled call costs one load and one branch.
+// Set the levels with SetLogLevels() or the HALFWAY_LOG environment variable, e.g. HALFWAY_LOG=warn,rtp=debug.
+// Under RELEASE LOGD and LOGW are compiled out altogether.
+
+enum LogLevel : uint8_t {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF,
+};
+
+enum LogModule : uint8_t {
+    LOG_MODULE_DEFAULT, // apps and anything outside the directories below
+    LOG_MODULE_COMMON,
+    LOG_MODULE_RTP,
+    LOG_MODULE_RTCP,
+    LOG_MODULE_RTSP,
+    LOG_MODULE_CODEC, // protocol/aac, protocol/annexb
+    LOG_MODULE_AGENT,
+    LOG_MODULE_SESSION,
+    LOG_MODULE_COUNT,
+};
+
 std::string Time();
 
+void SetLogLevel(LogLevel level);
+void SetLogLevel(LogModule module, LogLevel level);
+// a level for all modules and/or `module=level` pairs, comma separated, e.g. "error,rtsp=debug"
+bool SetLogLevels(const std::string &spec);
+
+// appends to `path`, an empty path goes back to stdout
+bool SetLogFile(const std::string &path);
+
+// returns once every line logged before the call has been written
+void FlushLog();
+
+void LogWrite(LogLevel level, LogModule module, const char *file, int line, const char *function, const char *fmt,
+              ...) __attribute__((format(printf, 6, 7)));
+
+extern std::atomic<uint8_t> gLogLevels[LOG_MODULE_COUNT];
+
+inline bool LogEnabled(LogModule module, LogLevel level)
+{
+    return level >= gLogLevels[module].load(std::memory_order_relaxed);
+}
+
+constexpr bool LogPathContains(const char *path, const char *dir)
+{
+    for (; *path; path++) {
+        const char *p = path;
+        const char *d = dir;
+        while (*d && *p == *d) {
+            p++;
+            d++;
+        }
+        if (!*d) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// resolved at compile time from the path of the source file
+constexpr LogModule LogModuleOf(const char *path)
+{
+    return LogPathContains(path, "protocol/rtp/")     ? LOG_MODULE_RTP
+           : LogPathContains(path, "protocol/rtcp/")  ? LOG_MODULE_RTCP
+           : LogPathContains(path, "protocol/rtsp/")  ? LOG_MODULE_RTSP
+           : LogPathContains(path, "rtsp_stream/")    ? LOG_MODULE_RTSP
+           : LogPathContains(path, "protocol/aac/")   ? LOG_MODULE_CODEC
+           : LogPathContains(path, "protocol/annexb") ? LOG_MODULE_CODEC
+           : LogPathContains(path, "agent/")          ? LOG_MODULE_AGENT
+           : LogPathContains(path, "session/")        ? LOG_MODULE_SESSION
+           : LogPathContains(path, "common/")         ? LOG_MODULE_COMMON
+                                                      : LOG_MODULE_DEFAULT;
+}
+
+// a source file may pick its module by defining LOG_MODULE before including this header
+#ifndef LOG_MODULE
+#define LOG_MODULE LogModuleOf(__FILE__)
+#endif
+
 #define FILENAME_ (__builtin_strrchr(__FILE__, '/') ? __builtin_strrchr(__FILE__, '/') + 1 : __FILE__)
 
+#define LOG_AT(level, fmt, ...)                                                                                        \
+    do {                                                                                                               \
+        constexpr LogModule logModule_ = LOG_MODULE;                                                                   \
+        if (__builtin_expect(LogEnabled(logModule_, level), 0)) {                                                      \
+            LogWrite(level, logModule_, FILENAME_, __LINE__, __PRETTY_FUNCTION__, fmt, ##__VA_ARGS__);                 \
+        }                                                                                                              \
+    } while (0)
+
 #ifdef RELEASE
 
 #define LOGD(fmt, ...)
@@ -18,23 +113,11 @@ std::string Time();
 
 #else
 
-#define LOGD(fmt, ...)                                                                                                 \
-    do {                                                                                                               \
-        printf("%s - %s:%d - %s: " fmt "\n", Time().c_str(), FILENAME_, __LINE__, __PRETTY_FUNCTION__, ##__VA_ARGS__); \
-    } while (0);
-
-#define LOGW(fmt, ...)                                                                                                 \
-    do {                                                                                                               \
-        printf("\033[0;33m%s - %s:%d - %s: " fmt "\033[0m\n", Time().c_str(), FILENAME_, __LINE__,                     \
-               __PRETTY_FUNCTION__, ##__VA_ARGS__);                                                                    \
-    } while (0);
+#define LOGD(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOGW(fmt, ...) LOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
 
 #endif // RELEASE
 
-#define LOGE(fmt, ...)                                                                                                 \
-    do {                                                                                                               \
-        printf("\033[0;31m%s - %s:%d - %s: " fmt "\033[0m\n", Time().c_str(), FILENAME_, __LINE__,                     \
-               __PRETTY_FUNCTION__, ##__VA_ARGS__);                                                                    \
-    } while (0);
+#define LOGE(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
 
-#endif // HALFWAY_MEDIA_LOG_H
\ No newline at end of file
+#endif // HALFWAY_MEDIA_LOG_H
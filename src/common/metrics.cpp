@@ -0,0 +1,334 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "metrics.h"
+#include "log.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+constexpr int HTTP_POLL_INTERVAL_MS = 200;    // how quickly StopHttpServer() is noticed
+constexpr int HTTP_CLIENT_TIMEOUT_MS = 1000;   // a scraper that does not send its request in time is dropped
+constexpr size_t HTTP_REQUEST_SIZE_MAX = 4096; // only the request line matters, the rest is read and ignored
+
+uint64_t MetricHistogram::Count() const
+{
+    uint64_t count = 0;
+    for (auto &bucket : buckets_) {
+        count += bucket.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+    StopHttpServer();
+}
+
+template <typename T>
+std::shared_ptr<T> MetricsRegistry::GetSeries(const std::string &name, const std::string &help,
+                                              const std::string &labels, MetricType type, double scale)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = families_.find(name);
+    if (it == families_.end()) {
+        it = families_.emplace(name, Family{type, help, scale, {}}).first;
+    } else if (it->second.type != type) {
+        // still hand out a working object, it is just not exported
+        LOGE("metric %s registered with another type", name.c_str());
+        return std::make_shared<T>();
+    }
+
+    auto &weak = it->second.series[labels];
+    auto series = std::static_pointer_cast<T>(weak.lock());
+    if (!series) {
+        series = std::make_shared<T>();
+        weak = series;
+    }
+    return series;
+}
+
+std::shared_ptr<MetricCounter> MetricsRegistry::Counter(const std::string &name, const std::string &help,
+                                                        const std::string &labels)
+{
+    return GetSeries<MetricCounter>(name, help, labels, MetricType::COUNTER, 1);
+}
+
+std::shared_ptr<MetricGauge> MetricsRegistry::Gauge(const std::string &name, const std::string &help,
+                                                    const std::string &labels)
+{
+    return GetSeries<MetricGauge>(name, help, labels, MetricType::GAUGE, 1);
+}
+
+std::shared_ptr<MetricHistogram> MetricsRegistry::Histogram(const std::string &name, const std::string &help,
+                                                            const std::string &labels, double scale)
+{
+    return GetSeries<MetricHistogram>(name, help, labels, MetricType::HISTOGRAM, scale);
+}
+
+static void AppendSample(std::string &out, const std::string &name, const std::string &labels, const char *extra,
+                         const char *value)
+{
+    out += name;
+    if (!labels.empty() || extra) {
+        out += '{';
+        out += labels;
+        if (extra) {
+            if (!labels.empty()) {
+                out += ',';
+            }
+            out += extra;
+        }
+        out += '}';
+    }
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+std::string MetricsRegistry::Export()
+{
+    std::string out;
+    char value[64];
+    char le[64];
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &item : families_) {
+        const std::string &name = item.first;
+        Family &family = item.second;
+
+        // drop the series of components that are gone
+        for (auto it = family.series.begin(); it != family.series.end();) {
+            it = it->second.expired() ? family.series.erase(it) : std::next(it);
+        }
+        if (family.series.empty()) {
+            continue;
+        }
+
+        const char *type = family.type == MetricType::COUNTER ? "counter"
+                           : family.type == MetricType::GAUGE ? "gauge"
+                                                              : "histogram";
+        out += "# HELP " + name + " " + family.help + "\n";
+        out += "# TYPE " + name + " " + type + "\n";
+
+        for (auto &series : family.series) {
+            auto object = series.second.lock();
+            if (!object) {
+                continue;
+            }
+
+            const std::string &labels = series.first;
+            if (family.type == MetricType::COUNTER) {
+                auto counter = static_cast<MetricCounter *>(object.get());
+                snprintf(value, sizeof(value), "%lu", (unsigned long)counter->Value());
+                AppendSample(out, name, labels, nullptr, value);
+            } else if (family.type == MetricType::GAUGE) {
+                auto gauge = static_cast<MetricGauge *>(object.get());
+                snprintf(value, sizeof(value), "%ld", (long)gauge->Value());
+                AppendSample(out, name, labels, nullptr, value);
+            } else {
+                auto histogram = static_cast<MetricHistogram *>(object.get());
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; i++) {
+                    cumulative += histogram->Bucket(i);
+                    if (i + 1 < METRIC_HISTOGRAM_BUCKETS) {
+                        snprintf(le, sizeof(le), "le=\"%.9g\"", (double)(1ull << i) * family.scale);
+                    } else {
+                        snprintf(le, sizeof(le), "le=\"+Inf\"");
+                    }
+                    snprintf(value, sizeof(value), "%lu", (unsigned long)cumulative);
+                    AppendSample(out, name + "_bucket", labels, le, value);
+                }
+
+                snprintf(value, sizeof(value), "%.9g", (double)histogram->Sum() * family.scale);
+                AppendSample(out, name + "_sum", labels, nullptr, value);
+                snprintf(value, sizeof(value), "%lu", (unsigned long)cumulative);
+                AppendSample(out, name + "_count", labels, nullptr, value);
+            }
+        }
+    }
+
+    return out;
+}
+
+bool MetricsRegistry::DumpToFile(const std::string &path)
+{
+    std::string text = Export();
+    std::string tmpPath = path + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    if (!file) {
+        LOGE("open %s failed: %s", tmpPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        LOGE("write %s failed: %s", path.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool MetricsRegistry::StartHttpServer(uint16_t port, const std::string &ip)
+{
+    std::lock_guard<std::mutex> lock(httpMutex_);
+    if (httpThread_) {
+        LOGW("metrics http server is already running");
+        return true;
+    }
+
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) {
+        LOGE("invalid ip %s", ip.c_str());
+        return false;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOGE("socket failed: %s", strerror(errno));
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        LOGE("listen on %s:%d failed: %s", ip.c_str(), port, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    listenFd_ = fd;
+    serving_ = true;
+    httpThread_ = std::make_unique<std::thread>(&MetricsRegistry::ServeHttp, this);
+    LOGD("metrics served on http://%s:%d/metrics", ip.c_str(), port);
+    return true;
+}
+
+void MetricsRegistry::StopHttpServer()
+{
+    std::lock_guard<std::mutex> lock(httpMutex_);
+    if (!httpThread_) {
+        return;
+    }
+
+    serving_ = false;
+    if (httpThread_->joinable()) {
+        httpThread_->join();
+    }
+    httpThread_.reset();
+    close(listenFd_);
+    listenFd_ = -1;
+}
+
+void MetricsRegistry::ServeHttp()
+{
+    while (serving_) {
+        struct pollfd pfd {
+            listenFd_, POLLIN, 0
+        };
+        if (poll(&pfd, 1, HTTP_POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+
+        int fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        HandleHttpClient(fd);
+        close(fd);
+    }
+}
+
+void MetricsRegistry::HandleHttpClient(int fd)
+{
+    struct timeval timeout {
+        0, HTTP_CLIENT_TIMEOUT_MS * 1000
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < HTTP_REQUEST_SIZE_MAX) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return;
+        }
+        request.append(buffer, n);
+    }
+
+    std::string status = "200 OK";
+    std::string body;
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+        body = Export();
+    } else if (request.compare(0, 4, "GET ") == 0) {
+        status = "404 Not Found";
+    } else {
+        status = "405 Method Not Allowed";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\n";
+    response += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+    response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            LOGW("send metrics failed: %s", strerror(errno));
+            return;
+        }
+        sent += n;
+    }
+}
+
+static void AppendLabels(std::string &out, std::initializer_list<std::pair<const char *, std::string>> labels)
+{
+    for (auto &label : labels) {
+        if (!out.empty()) {
+            out += ',';
+        }
+        out += label.first;
+        out += "=\"";
+        for (char c : label.second) {
+            if (c == '\\' || c == '"') {
+                out += '\\';
+                out += c;
+            } else if (c == '\n') {
+                out += "\\n";
+            } else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+}
+
+std::string MetricLabels(std::initializer_list<std::pair<const char *, std::string>> labels)
+{
+    std::string out;
+    AppendLabels(out, labels);
+    return out;
+}
+
+std::string MetricLabels(const std::string &base, std::initializer_list<std::pair<const char *, std::string>> labels)
+{
+    std::string out = base;
+    AppendLabels(out, labels);
+    return out;
+}
@@ -0,0 +1,136 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_METRICS_H
+#define HALFWAY_MEDIA_METRICS_H
+
+#include "singleton.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+constexpr size_t METRIC_CACHE_LINE = 64;
+constexpr size_t METRIC_HISTOGRAM_BUCKETS = 32; // values up to 2^30, then +Inf
+
+// Monotonic count, e.g. frames or bytes. Every metric sits on cache lines of its own, so metrics updated by
+// different threads never bounce a line between cores; an update is one relaxed atomic add.
+class alignas(METRIC_CACHE_LINE) MetricCounter {
+public:
+    void Add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+// Current level, e.g. a queue depth.
+class alignas(METRIC_CACHE_LINE) MetricGauge {
+public:
+    void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    void Add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+    int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+// Distribution of integer samples, e.g. latencies in nanoseconds. Bucket i counts the samples up to 2^i,
+// the last bucket everything above, so recording a sample is a bit scan and two relaxed adds.
+class alignas(METRIC_CACHE_LINE) MetricHistogram {
+public:
+    void Observe(uint64_t value)
+    {
+        size_t index = value <= 1 ? 0 : 64 - __builtin_clzll(value - 1);
+        if (index >= METRIC_HISTOGRAM_BUCKETS) {
+            index = METRIC_HISTOGRAM_BUCKETS - 1;
+        }
+        buckets_[index].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t Bucket(size_t index) const { return buckets_[index].load(std::memory_order_relaxed); }
+    uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t Count() const;
+
+private:
+    std::atomic<uint64_t> sum_{0};
+    std::array<std::atomic<uint64_t>, METRIC_HISTOGRAM_BUCKETS> buckets_{};
+};
+
+// Process-wide set of named metrics, rendered in the Prometheus text format.
+//
+// A series is identified by its name and labels. Asking twice for the same series returns the same object,
+// so components with identical labels add up. The registry only keeps weak references: a series disappears
+// from the export once the last component holding it is gone, which keeps per-session series from piling up.
+// Looking a series up takes a lock, components do it once at setup and update the returned object afterwards.
+class MetricsRegistry : public Singleton<MetricsRegistry> {
+    friend class Singleton<MetricsRegistry>;
+
+public:
+    ~MetricsRegistry() override;
+
+    std::shared_ptr<MetricCounter> Counter(const std::string &name, const std::string &help,
+                                           const std::string &labels = "");
+    std::shared_ptr<MetricGauge> Gauge(const std::string &name, const std::string &help,
+                                       const std::string &labels = "");
+    // samples are multiplied by `scale` on export, e.g. 1e-9 to record nanoseconds of a `_seconds` metric
+    std::shared_ptr<MetricHistogram> Histogram(const std::string &name, const std::string &help,
+                                               const std::string &labels = "", double scale = 1);
+
+    // text exposition format 0.0.4
+    std::string Export();
+
+    // writes to `path`.tmp first and renames it, so a reader never sees a partial file
+    bool DumpToFile(const std::string &path);
+
+    // serves Export() over HTTP on `ip`:`port`, e.g. for a Prometheus scraper
+    bool StartHttpServer(uint16_t port, const std::string &ip = "127.0.0.1");
+    void StopHttpServer();
+
+private:
+    MetricsRegistry() = default;
+
+    enum class MetricType {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM,
+    };
+
+    struct Family {
+        MetricType type;
+        std::string help;
+        double scale;
+        std::map<std::string, std::weak_ptr<void>> series; // by labels
+    };
+
+    template <typename T>
+    std::shared_ptr<T> GetSeries(const std::string &name, const std::string &help, const std::string &labels,
+                                 MetricType type, double scale);
+    void ServeHttp();
+    void HandleHttpClient(int fd);
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, Family> families_;
+
+    std::mutex httpMutex_;
+    int listenFd_ = -1;
+    std::atomic<bool> serving_{false};
+    std::unique_ptr<std::thread> httpThread_;
+};
+
+// `key="value"` pairs joined by commas, with the values escaped for the text format
+std::string MetricLabels(std::initializer_list<std::pair<const char *, std::string>> labels);
+// the pairs appended to `base`, which came from MetricLabels()
+std::string MetricLabels(const std::string &base, std::initializer_list<std::pair<const char *, std::string>> labels);
+
+#endif // HALFWAY_MEDIA_METRICS_H
@@ -0,0 +1,42 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "rate_limiter.h"
+#include <algorithm>
+#include <cmath>
+
+RateLimiter::RateLimiter(double rate, double burst) : rate_(rate), burst_(std::max(burst, 1.0)), tokens_(burst_) {}
+
+void RateLimiter::SetRate(double rate, double burst)
+{
+    rate_ = rate;
+    burst_ = std::max(burst, 1.0);
+    tokens_ = std::min(tokens_, burst_);
+}
+
+int64_t RateLimiter::Acquire(int64_t nowUs)
+{
+    Refill(nowUs);
+    if (tokens_ >= 1.0) {
+        tokens_ -= 1.0;
+        return 0;
+    }
+
+    if (rate_ <= 0) {
+        return INT64_MAX;
+    }
+
+    return std::max<int64_t>(1, (int64_t)std::ceil((1.0 - tokens_) * 1e6 / rate_));
+}
+
+void RateLimiter::Refill(int64_t nowUs)
+{
+    if (lastUs_ >= 0 && nowUs > lastUs_) {
+        tokens_ = std::min(burst_, tokens_ + (nowUs - lastUs_) * rate_ / 1e6);
+    }
+
+    if (nowUs > lastUs_) {
+        lastUs_ = nowUs;
+    }
+}
@@ -0,0 +1,33 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_RATE_LIMITER_H
+#define HALFWAY_MEDIA_RATE_LIMITER_H
+
+#include <cstdint>
+
+/// Token bucket: admits `rate` events per second on average and up to `burst` at once after a quiet period.
+/// The caller passes the current time, so one limiter can be shared under the caller's lock and tested without
+/// sleeping. Not thread-safe.
+class RateLimiter {
+public:
+    RateLimiter(double rate, double burst);
+
+    /// Changes the limits, the tokens collected so far are kept up to the new burst
+    void SetRate(double rate, double burst);
+
+    /// Takes a token and returns 0 if one is available at `nowUs`, otherwise microseconds until there is one
+    int64_t Acquire(int64_t nowUs);
+
+private:
+    void Refill(int64_t nowUs);
+
+private:
+    double rate_;
+    double burst_;
+    double tokens_;
+    int64_t lastUs_ = -1;
+};
+
+#endif // HALFWAY_MEDIA_RATE_LIMITER_H
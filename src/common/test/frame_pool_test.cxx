@@ -0,0 +1,139 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../frame_pool.h"
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Checks that a warmed-up pool serves a steady alloc/release load without creating frames, on a thread of its own and
+// with frames released on another thread than the one allocating them.
+
+constexpr int WARMUP_ROUNDS = 2000;
+constexpr int STEADY_ROUNDS = 200000;
+constexpr size_t IN_FLIGHT = 48; // frames between the producer and the consumer at most
+
+static void AllocLoop(int rounds)
+{
+    std::vector<std::shared_ptr<Frame>> frames;
+    for (int i = 0; i < rounds; i++) {
+        frames.push_back(FramePool::Alloc(1000 + (i % 3) * 20000));
+        if (frames.size() == 8) {
+            frames.clear();
+        }
+    }
+}
+
+// frames allocated on one thread and released on another, both threads live as long as the channel
+class HandOff {
+public:
+    HandOff() : consumer_(&HandOff::Consume, this) {}
+
+    ~HandOff()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cond_.notify_all();
+        consumer_.join();
+    }
+
+    void Produce(int rounds)
+    {
+        for (int i = 0; i < rounds; i++) {
+            auto frame = FramePool::Alloc(1400);
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return queue_.size() < IN_FLIGHT; });
+            queue_.push_back(std::move(frame));
+            cond_.notify_all();
+        }
+    }
+
+private:
+    void Consume()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!done_ || !queue_.empty()) {
+            if (queue_.empty()) {
+                cond_.wait(lock);
+                continue;
+            }
+            auto frame = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            frame.reset();
+            cond_.notify_all();
+            lock.lock();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::shared_ptr<Frame>> queue_;
+    bool done_ = false;
+    std::thread consumer_;
+};
+
+int main()
+{
+    FramePool::ResetStats();
+
+    // both threads warm up, wait for each other, then run the steady loop: the free lists are per thread, so the
+    // same threads have to carry on
+    std::atomic<int> warmed{0};
+    FramePool::Stats steady{};
+    auto barrier = [&warmed]() {
+        warmed++;
+        while (warmed < 2) {
+            std::this_thread::yield();
+        }
+    };
+    std::thread a([&]() {
+        AllocLoop(WARMUP_ROUNDS);
+        barrier();
+        AllocLoop(STEADY_ROUNDS);
+    });
+    std::thread b([&]() {
+        // the most frames the hand-off can hold: queued, parked in the consumer's list and in the producer's list
+        std::vector<std::shared_ptr<Frame>> reserve;
+        for (size_t i = 0; i < 4 * IN_FLIGHT + 128; i++) {
+            reserve.push_back(FramePool::Alloc(1400));
+        }
+        reserve.clear();
+
+        HandOff handOff;
+        handOff.Produce(WARMUP_ROUNDS);
+        barrier();
+        steady = FramePool::GetStats();
+        handOff.Produce(STEADY_ROUNDS);
+    });
+    a.join();
+    b.join();
+
+    FramePool::Stats after = FramePool::GetStats();
+    printf("misses %llu -> %llu, hits %llu, recycles %llu, discards %llu\n", (unsigned long long)steady.misses,
+           (unsigned long long)after.misses, (unsigned long long)after.hits, (unsigned long long)after.recycles,
+           (unsigned long long)after.discards);
+    assert(steady.misses > 0);
+    assert(after.misses == steady.misses);
+    assert(after.hits >= steady.hits + 2 * STEADY_ROUNDS);
+
+    // the counters of exited threads are kept
+    assert(after.hits + after.misses == after.recycles + after.discards);
+
+    FramePool::ResetStats();
+    FramePool::Stats reset = FramePool::GetStats();
+    assert(reset.hits == 0 && reset.misses == 0 && reset.recycles == 0 && reset.discards == 0);
+
+    printf("frame pool test passed\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+// LOGD and LOGW are compiled out under RELEASE
+#undef RELEASE
+#define LOG_MODULE LOG_MODULE_RTP
+#include "../log.h"
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Checks that lines from several threads all arrive, in order, that levels filter per module,
+// and measures the cost of a log call.
+
+static_assert(LogModuleOf("/home/src/protocol/rtp/rtp_sorter.cpp") == LOG_MODULE_RTP, "");
+static_assert(LogModuleOf("/home/src/protocol/rtcp/rtcp.cpp") == LOG_MODULE_RTCP, "");
+static_assert(LogModuleOf("/home/src/agent/rtsp_stream/rtsp_source.cpp") == LOG_MODULE_RTSP, "");
+static_assert(LogModuleOf("/home/common/src/agent/base/media_source.cpp") == LOG_MODULE_AGENT, "");
+static_assert(LogModuleOf("/home/src/common/udp_reactor.cpp") == LOG_MODULE_COMMON, "");
+static_assert(LogModuleOf("/home/src/apps/rtsp_client.cpp") == LOG_MODULE_DEFAULT, "");
+
+const char *LOG_FILE = "/tmp/halfway_log_test.log";
+
+static std::vector<std::string> ReadLines()
+{
+    std::vector<std::string> lines;
+    std::ifstream file(LOG_FILE);
+    std::string line;
+    while (std::getline(file, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+static void TestThreads()
+{
+    const int kThreads = 4;
+    const int kLines = 500;
+
+    unlink(LOG_FILE);
+    assert(SetLogFile(LOG_FILE));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([t]() {
+            for (int i = 0; i < kLines; i++) {
+                LOGD("thread %d line %d", t, i);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    FlushLog();
+
+    auto lines = ReadLines();
+    assert(lines.size() == kThreads * kLines);
+
+    std::vector<int> next(kThreads, 0);
+    for (auto &line : lines) {
+        int t, i;
+        auto pos = line.find("thread ");
+        assert(pos != std::string::npos);
+        assert(sscanf(line.c_str() + pos, "thread %d line %d", &t, &i) == 2);
+        assert(i == next[t]);
+        next[t]++;
+    }
+}
+
+static void TestLevels()
+{
+    unlink(LOG_FILE);
+    assert(SetLogFile(LOG_FILE));
+
+    assert(SetLogLevels("debug,rtp=error"));
+    LOGD("hidden debug");
+    LOGW("hidden warning");
+    LOGE("shown error %d", 42);
+
+    SetLogLevel(LOG_MODULE_RTP, LOG_LEVEL_WARN);
+    LOGW("shown warning");
+
+    assert(!SetLogLevels("rtp=loud"));
+    assert(!SetLogLevels("nomodule=debug"));
+    FlushLog();
+
+    auto lines = ReadLines();
+    assert(lines.size() == 2);
+    assert(lines[0].find("log_test.cxx:") != std::string::npos);
+    assert(lines[0].find("TestLevels") != std::string::npos);
+    assert(lines[0].find(": shown error 42") != std::string::npos);
+    assert(lines[1].find(": shown warning") != std::string::npos);
+
+    SetLogLevel(LOG_LEVEL_DEBUG);
+}
+
+static void BenchCalls()
+{
+    const int kCalls = 1000 * 1000;
+
+    SetLogLevel(LOG_MODULE_RTP, LOG_LEVEL_ERROR);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kCalls; i++) {
+        LOGD("disabled %d", i);
+    }
+    auto disabledNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // stays below the ring size, so nothing is dropped
+    const int kEnabled = 1000;
+    SetLogLevel(LOG_MODULE_RTP, LOG_LEVEL_DEBUG);
+    FlushLog();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kEnabled; i++) {
+        LOGD("seq: %d, size %zu", i, (size_t)i * 3);
+    }
+    auto enabledNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    FlushLog();
+
+    printf("disabled LOGD: %.2f ns per call, enabled LOGD: %.1f ns per call\n", disabledNs / kCalls,
+           enabledNs / kEnabled);
+}
+
+int main()
+{
+    TestThreads();
+    TestLevels();
+    BenchCalls();
+    SetLogFile("");
+
+    printf("log test passed\n");
+    return 0;
+}
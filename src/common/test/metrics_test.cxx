@@ -0,0 +1,106 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../metrics.h"
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Checks the text export of the metrics registry and measures the cost of an update.
+
+static bool Contains(const std::string &text, const std::string &line)
+{
+    return text.find(line) != std::string::npos;
+}
+
+static void TestExport()
+{
+    auto registry = MetricsRegistry::GetInstance();
+    auto labels = MetricLabels({{"session", "rtsp://host/a\"b"}, {"media", "video"}});
+    assert(labels == "session=\"rtsp://host/a\\\"b\",media=\"video\"");
+
+    auto frames = registry->Counter("test_frames_total", "Frames.", labels);
+    auto same = registry->Counter("test_frames_total", "Frames.", labels);
+    assert(frames == same);
+    frames->Add();
+    same->Add(2);
+
+    auto depth = registry->Gauge("test_depth", "Depth.");
+    depth->Set(-3);
+
+    auto latency = registry->Histogram("test_latency_seconds", "Latency.", "", 1e-9);
+    latency->Observe(1);    // le 1ns
+    latency->Observe(3);    // le 4ns
+    latency->Observe(4);    // le 4ns
+    latency->Observe(1000); // le 1024ns
+    latency->Observe(UINT64_C(1) << 40);
+
+    auto text = registry->Export();
+    assert(Contains(text, "# TYPE test_frames_total counter\n"));
+    assert(Contains(text, "test_frames_total{" + labels + "} 3\n"));
+    assert(Contains(text, "test_depth -3\n"));
+    assert(Contains(text, "# TYPE test_latency_seconds histogram\n"));
+    assert(Contains(text, "test_latency_seconds_bucket{le=\"1e-09\"} 1\n"));
+    assert(Contains(text, "test_latency_seconds_bucket{le=\"2e-09\"} 1\n"));
+    assert(Contains(text, "test_latency_seconds_bucket{le=\"4e-09\"} 3\n"));
+    assert(Contains(text, "test_latency_seconds_bucket{le=\"1.024e-06\"} 4\n"));
+    assert(Contains(text, "test_latency_seconds_bucket{le=\"+Inf\"} 5\n"));
+    assert(Contains(text, "test_latency_seconds_count 5\n"));
+
+    // the series of a component that is gone are no longer exported
+    frames.reset();
+    same.reset();
+    text = registry->Export();
+    assert(!Contains(text, "test_frames_total"));
+
+    assert(registry->DumpToFile("/tmp/halfway_metrics_test.prom"));
+    std::ifstream file("/tmp/halfway_metrics_test.prom");
+    std::stringstream content;
+    content << file.rdbuf();
+    assert(content.str() == registry->Export());
+}
+
+static void BenchUpdate()
+{
+    const int kThreads = 4;
+    const uint64_t kUpdates = 10 * 1000 * 1000;
+
+    auto registry = MetricsRegistry::GetInstance();
+    std::vector<std::thread> threads;
+    std::clock_t start = std::clock();
+    for (int i = 0; i < kThreads; i++) {
+        threads.emplace_back([&registry, i]() {
+            auto labels = MetricLabels({{"thread", std::to_string(i)}});
+            auto counter = registry->Counter("bench_updates_total", "Updates.", labels);
+            auto histogram = registry->Histogram("bench_values", "Values.", labels);
+            for (uint64_t n = 0; n < kUpdates; n++) {
+                counter->Add();
+                histogram->Observe(n & 0xfff);
+            }
+            assert(counter->Value() == kUpdates);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // CPU time, so the figure does not depend on how many cores the threads got
+    double ns = (double)(std::clock() - start) * 1e9 / CLOCKS_PER_SEC / (kUpdates * kThreads);
+    printf("counter add + histogram observe: %.1f ns of CPU time, %d threads\n", ns, kThreads);
+}
+
+int main()
+{
+    TestExport();
+    BenchUpdate();
+
+    printf("metrics test passed\n");
+    return 0;
+}
@@ -0,0 +1,74 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../rate_limiter.h"
+#include <cassert>
+#include <cstdio>
+
+// Checks the burst, the refill rate and the waiting time the limiter hands back, on a simulated clock.
+
+static void TestBurstAndRate()
+{
+    RateLimiter limiter(10, 5); // 10/s, 5 at once
+    int64_t nowUs = 1000000;
+    for (int i = 0; i < 5; i++) {
+        assert(limiter.Acquire(nowUs) == 0);
+    }
+
+    // the bucket is empty, the next token comes in 100 ms
+    int64_t waitUs = limiter.Acquire(nowUs);
+    assert(waitUs == 100000);
+    assert(limiter.Acquire(nowUs + 50000) == 50000);
+    assert(limiter.Acquire(nowUs + 100000) == 0);
+
+    // over 10 s exactly 100 are admitted when asking all the time
+    int admitted = 0;
+    for (int64_t t = nowUs + 100000; t < nowUs + 100000 + 10000000; t += 1000) {
+        if (limiter.Acquire(t) == 0) {
+            admitted++;
+        }
+    }
+    assert(admitted >= 99 && admitted <= 101);
+}
+
+static void TestQuietPeriod()
+{
+    RateLimiter limiter(1, 3);
+    for (int i = 0; i < 3; i++) {
+        assert(limiter.Acquire(0) == 0);
+    }
+    assert(limiter.Acquire(0) > 0);
+
+    // a long pause refills up to the burst only
+    int64_t nowUs = 3600LL * 1000000;
+    for (int i = 0; i < 3; i++) {
+        assert(limiter.Acquire(nowUs) == 0);
+    }
+    assert(limiter.Acquire(nowUs) == 1000000);
+
+    // a clock going backwards neither adds nor takes tokens
+    assert(limiter.Acquire(nowUs - 500000) == 1000000);
+}
+
+static void TestSetRate()
+{
+    RateLimiter limiter(100, 100);
+    limiter.SetRate(1, 2);
+    assert(limiter.Acquire(0) == 0);
+    assert(limiter.Acquire(0) == 0);
+    assert(limiter.Acquire(0) == 1000000);
+
+    limiter.SetRate(0, 1);
+    assert(limiter.Acquire(5000000) == INT64_MAX);
+}
+
+int main()
+{
+    TestBurstAndRate();
+    TestQuietPeriod();
+    TestSetRate();
+
+    printf("rate limiter test passed\n");
+    return 0;
+}
@@ -0,0 +1,130 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../udp_reactor.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Loopback RTP ingest benchmark: senders blast 1200-byte datagrams at one reactor loop,
+// the loop's thread CPU time gives packets/s per core for each receive batch size.
+// Like the sorter and the zero-copy frames of the depacketizer, the handler holds on to the latest packets, and the
+// receive allocations after the warm-up show whether released buffers are reused.
+
+constexpr size_t PACKET_SIZE = 1200;
+constexpr int SENDER_COUNT = 2;
+constexpr int SEND_BATCH = 64;
+constexpr auto RUN_TIME = std::chrono::seconds(2);
+constexpr auto WARMUP_TIME = std::chrono::milliseconds(500);
+constexpr size_t RETAINED_PACKETS = 512; // reorder window plus the packets of the frames in flight
+
+static double ThreadCpuSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Sender(uint16_t port, std::atomic<bool> &running)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in to {};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    to.sin_port = htons(port);
+    connect(fd, (struct sockaddr *)&to, sizeof(to));
+
+    std::vector<uint8_t> payload(PACKET_SIZE, 0x80);
+    struct iovec iov {payload.data(), payload.size()};
+    std::vector<struct mmsghdr> msgs(SEND_BATCH);
+    for (auto &msg : msgs) {
+        msg.msg_hdr.msg_iov = &iov;
+        msg.msg_hdr.msg_iovlen = 1;
+    }
+
+    while (running) {
+        sendmmsg(fd, msgs.data(), msgs.size(), 0);
+    }
+    close(fd);
+}
+
+static void Run(size_t batchSize)
+{
+    auto reactor = UdpReactor::GetInstance();
+    reactor->SetLoopCount(1);
+    reactor->SetRecvBatchSize(batchSize);
+
+    int rtpFd = -1;
+    int rtcpFd = -1;
+    uint16_t port = UdpReactor::OpenPortPair(rtpFd, rtcpFd);
+    assert(port != 0);
+    close(rtcpFd);
+
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> calls{0};
+    double cpuStart = -1;
+    std::atomic<double> cpuEnd{0};
+    std::deque<std::shared_ptr<DataBuffer>> retained;
+    bool ok = reactor->AddBatchSocket(rtpFd, reactor->PickLoop(),
+                                      [&](const std::vector<std::shared_ptr<DataBuffer>> &batch) {
+                                          if (cpuStart < 0) {
+                                              cpuStart = ThreadCpuSeconds();
+                                          }
+                                          for (auto &packet : batch) {
+                                              retained.push_back(packet);
+                                              if (retained.size() > RETAINED_PACKETS) {
+                                                  retained.pop_front();
+                                              }
+                                          }
+                                          packets.fetch_add(batch.size(), std::memory_order_relaxed);
+                                          calls.fetch_add(1, std::memory_order_relaxed);
+                                          cpuEnd.store(ThreadCpuSeconds(), std::memory_order_relaxed);
+                                      });
+    assert(ok);
+
+    std::atomic<bool> running{true};
+    std::vector<std::thread> senders;
+    for (int i = 0; i < SENDER_COUNT; i++) {
+        senders.emplace_back(Sender, port, std::ref(running));
+    }
+
+    std::this_thread::sleep_for(WARMUP_TIME);
+    uint64_t warmAllocations = reactor->GetRecvAllocations();
+    std::this_thread::sleep_for(RUN_TIME - WARMUP_TIME);
+    running = false;
+    for (auto &t : senders) {
+        t.join();
+    }
+
+    reactor->RemoveSocket(rtpFd);
+    uint64_t allocations = reactor->GetRecvAllocations();
+    retained.clear();
+    UdpReactor::DestroyInstance();
+
+    double seconds = std::chrono::duration<double>(RUN_TIME).count();
+    double cpu = cpuEnd.load() - cpuStart;
+    uint64_t total = packets.load();
+    printf("batch %3zu: %10.0f pkt/s, %10.0f pkt/s per core, %5.1f pkt/call, %llu allocations, %llu after warm-up\n",
+           batchSize, total / seconds, cpu > 0 ? total / cpu : 0.0, calls ? (double)total / calls.load() : 0.0,
+           (unsigned long long)allocations, (unsigned long long)(allocations - warmAllocations));
+}
+
+int main(int argc, char **argv)
+{
+    size_t batchSize = argc > 1 ? atoi(argv[1]) : 32;
+    Run(1);
+    Run(batchSize);
+    return 0;
+}
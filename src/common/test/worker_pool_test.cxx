@@ -0,0 +1,80 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../worker_pool.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+// Checks that tasks of one shard run in order on one worker and that Stop() runs what was posted before it.
+
+static void TestSharding()
+{
+    constexpr size_t WORKERS = 4;
+    constexpr size_t SHARDS = 64;
+    constexpr int TASKS = 1000;
+
+    WorkerPool pool(WORKERS);
+    assert(pool.Size() == WORKERS);
+    assert(pool.CurrentWorker() == -1);
+
+    std::mutex mutex;
+    std::vector<std::vector<int>> order(SHARDS);
+    std::vector<int> workers(SHARDS, -1);
+    bool sameWorker = true;
+    for (int i = 0; i < TASKS; i++) {
+        for (size_t shard = 0; shard < SHARDS; shard++) {
+            pool.Post(shard, [&, shard, i]() {
+                std::lock_guard<std::mutex> lock(mutex);
+                int worker = pool.CurrentWorker();
+                if (workers[shard] == -1) {
+                    workers[shard] = worker;
+                }
+                sameWorker = sameWorker && worker == workers[shard] && worker == (int)(shard % WORKERS);
+                order[shard].push_back(i);
+            });
+        }
+    }
+    pool.Stop();
+
+    assert(sameWorker);
+    for (auto &tasks : order) {
+        assert(tasks.size() == TASKS);
+        for (int i = 0; i < TASKS; i++) {
+            assert(tasks[i] == i);
+        }
+    }
+}
+
+static void TestStop()
+{
+    WorkerPool pool(2);
+    std::atomic<int> done{0};
+    for (int i = 0; i < 100; i++) {
+        pool.Post(i, [&done]() {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            done++;
+        });
+    }
+
+    pool.Stop();
+    assert(done == 100);
+
+    // dropped once stopped
+    pool.Post(0, [&done]() { done++; });
+    pool.Stop();
+    assert(done == 100);
+}
+
+int main()
+{
+    TestSharding();
+    TestStop();
+
+    printf("worker pool test passed\n");
+    return 0;
+}
@@ -0,0 +1,656 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "udp_reactor.h"
+#include "log.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <future>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+
+constexpr int UDP_REACTOR_MAX_EVENTS = 64;
+constexpr size_t UDP_RECV_BUFFER_SIZE = 2048; // RTP over UDP is kept below the MTU
+constexpr size_t UDP_RECV_BATCH_DEFAULT = 32;
+constexpr int UDP_SOCKET_RCVBUF = 2 * 1024 * 1024;
+constexpr int PORT_PAIR_RETRY_MAX = 64;
+constexpr size_t UDP_RECV_BLOCK_SIZE = 64; // shared_ptr control block of a pooled buffer
+
+struct UdpReactor::Channel {
+    Handler handler;
+    BatchHandler batchHandler;
+    SourceHandler sourceHandler;
+    TimerHandler timerHandler;
+
+    explicit operator bool() const { return handler || batchHandler || sourceHandler || timerHandler; }
+};
+
+// Receive buffers of one loop, and the shared_ptr control blocks that hand them out. Alloc() runs on the loop thread,
+// the last reference to a buffer returns it from any thread. Freed with the last buffer once the loop is gone.
+class UdpReactor::RecvPool {
+public:
+    std::shared_ptr<DataBuffer> Alloc()
+    {
+        DataBuffer *buffer = nullptr;
+        if (localBuffers_.empty()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            localBuffers_.swap(freeBuffers_);
+        }
+
+        if (!localBuffers_.empty()) {
+            buffer = localBuffers_.back();
+            localBuffers_.pop_back();
+            buffer->SetSize(0);
+        } else {
+            buffer = new DataBuffer(UDP_RECV_BUFFER_SIZE);
+            allocations_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        return std::shared_ptr<DataBuffer>(buffer, Recycler{this}, BlockAllocator<DataBuffer>(this));
+    }
+
+    uint64_t GetAllocations() const { return allocations_.load(std::memory_order_relaxed); }
+
+    // the loop has stopped, buffers still referenced are freed when released
+    void Close()
+    {
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            FreeAll();
+            last = outstanding_.load(std::memory_order_relaxed) == 0;
+        }
+
+        if (last) {
+            delete this;
+        }
+    }
+
+private:
+    struct Recycler {
+        RecvPool *pool;
+        void operator()(DataBuffer *buffer) const { pool->ReleaseBuffer(buffer); }
+    };
+
+    template <typename T>
+    struct BlockAllocator {
+        using value_type = T;
+
+        explicit BlockAllocator(RecvPool *pool) : pool(pool) {}
+        template <typename U>
+        BlockAllocator(const BlockAllocator<U> &other) : pool(other.pool)
+        {
+        }
+
+        T *allocate(size_t n) { return static_cast<T *>(pool->AllocBlock(n * sizeof(T))); }
+        void deallocate(T *p, size_t n) { pool->ReleaseBlock(p, n * sizeof(T)); }
+
+        template <typename U>
+        bool operator==(const BlockAllocator<U> &other) const
+        {
+            return pool == other.pool;
+        }
+
+        template <typename U>
+        bool operator!=(const BlockAllocator<U> &other) const
+        {
+            return pool != other.pool;
+        }
+
+        RecvPool *pool;
+    };
+
+    void *AllocBlock(size_t size)
+    {
+        if (size > UDP_RECV_BLOCK_SIZE) {
+            allocations_.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+
+        if (localBlocks_.empty()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            localBlocks_.swap(freeBlocks_);
+        }
+
+        if (localBlocks_.empty()) {
+            allocations_.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(UDP_RECV_BLOCK_SIZE);
+        }
+
+        void *block = localBlocks_.back();
+        localBlocks_.pop_back();
+        return block;
+    }
+
+    void ReleaseBuffer(DataBuffer *buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_) {
+            delete buffer;
+        } else {
+            freeBuffers_.push_back(buffer);
+        }
+    }
+
+    // the last step of releasing a buffer, after its deleter
+    void ReleaseBlock(void *block, size_t size)
+    {
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closed_ || size > UDP_RECV_BLOCK_SIZE) {
+                ::operator delete(block);
+            } else {
+                freeBlocks_.push_back(block);
+            }
+            last = outstanding_.fetch_sub(1, std::memory_order_relaxed) == 1 && closed_;
+        }
+
+        if (last) {
+            delete this;
+        }
+    }
+
+    void FreeAll()
+    {
+        for (auto *buffers : {&localBuffers_, &freeBuffers_}) {
+            for (auto *buffer : *buffers) {
+                delete buffer;
+            }
+            buffers->clear();
+        }
+
+        for (auto *blocks : {&localBlocks_, &freeBlocks_}) {
+            for (auto *block : *blocks) {
+                ::operator delete(block);
+            }
+            blocks->clear();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    bool closed_ = false;
+    std::vector<DataBuffer *> freeBuffers_; // released, guarded by mutex_
+    std::vector<void *> freeBlocks_;
+    std::vector<DataBuffer *> localBuffers_; // loop thread only, refilled from the free lists in one swap
+    std::vector<void *> localBlocks_;
+    std::atomic<uint64_t> outstanding_{0};
+    std::atomic<uint64_t> allocations_{0};
+};
+
+struct UdpReactor::EventLoop {
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::atomic<bool> running{true};
+    std::thread::id threadId;
+    std::unique_ptr<std::thread> thread;
+
+    std::mutex taskMutex;
+    std::vector<std::function<void()>> tasks;
+
+    // indexed by fd, only touched on the loop thread
+    std::vector<Channel> channels;
+
+    // receive ring, a slot takes another buffer of the pool while the consumer still holds the previous one
+    RecvPool *pool = nullptr;
+    std::vector<std::shared_ptr<DataBuffer>> ring;
+    std::vector<struct iovec> iovs;
+    std::vector<struct mmsghdr> msgs;
+    std::vector<struct sockaddr_in> names;
+    std::vector<std::shared_ptr<DataBuffer>> batch;
+};
+
+UdpReactor::UdpReactor() : batchSize_(UDP_RECV_BATCH_DEFAULT) {}
+
+UdpReactor::~UdpReactor()
+{
+    for (auto &loop : loops_) {
+        loop->running = false;
+        uint64_t one = 1;
+        write(loop->wakeFd, &one, sizeof(one));
+    }
+
+    for (auto &loop : loops_) {
+        if (loop->thread && loop->thread->joinable()) {
+            loop->thread->join();
+        }
+
+        for (size_t fd = 0; fd < loop->channels.size(); fd++) {
+            if (loop->channels[fd]) {
+                close((int)fd);
+            }
+        }
+
+        close(loop->wakeFd);
+        close(loop->epollFd);
+        loop->ring.clear();
+        loop->batch.clear();
+        loop->pool->Close();
+    }
+}
+
+void UdpReactor::SetLoopCount(size_t count)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!loops_.empty()) {
+        LOGW("reactor already running with %zu loops", loops_.size());
+        return;
+    }
+
+    loopCount_ = count;
+}
+
+void UdpReactor::SetRecvBatchSize(size_t count)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!loops_.empty()) {
+        LOGW("reactor already running with batch size %zu", batchSize_);
+        return;
+    }
+
+    batchSize_ = count ? count : 1;
+}
+
+size_t UdpReactor::PickLoop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (loops_.empty() && !StartLoops()) {
+            return 0;
+        }
+    }
+
+    return nextLoop_.fetch_add(1, std::memory_order_relaxed) % loops_.size();
+}
+
+bool UdpReactor::AddSocket(int fd, size_t loop, Handler handler)
+{
+    Channel channel;
+    channel.handler = std::move(handler);
+    return AddChannel(fd, loop, std::move(channel));
+}
+
+bool UdpReactor::AddBatchSocket(int fd, size_t loop, BatchHandler handler)
+{
+    Channel channel;
+    channel.batchHandler = std::move(handler);
+    return AddChannel(fd, loop, std::move(channel));
+}
+
+bool UdpReactor::AddSourceSocket(int fd, size_t loop, SourceHandler handler)
+{
+    Channel channel;
+    channel.sourceHandler = std::move(handler);
+    return AddChannel(fd, loop, std::move(channel));
+}
+
+int UdpReactor::AddTimer(size_t loop, uint32_t delayMs, uint32_t intervalMs, TimerHandler handler)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        LOGE("timerfd_create failed: %s", strerror(errno));
+        return -1;
+    }
+
+    // a zero it_value would disarm the timer
+    delayMs = delayMs ? delayMs : 1;
+    struct itimerspec spec {};
+    spec.it_value.tv_sec = delayMs / 1000;
+    spec.it_value.tv_nsec = (long)(delayMs % 1000) * 1000000;
+    spec.it_interval.tv_sec = intervalMs / 1000;
+    spec.it_interval.tv_nsec = (long)(intervalMs % 1000) * 1000000;
+    if (timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+        LOGE("timerfd_settime failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    Channel channel;
+    channel.timerHandler = std::move(handler);
+    if (!AddChannel(fd, loop, std::move(channel))) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool UdpReactor::AddChannel(int fd, size_t loopIndex, Channel channel)
+{
+    if (fd < 0 || !channel) {
+        LOGE("invalid socket %d", fd);
+        return false;
+    }
+
+    EventLoop *loop = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (loops_.empty() && !StartLoops()) {
+            return false;
+        }
+
+        if (fdLoops_.count(fd)) {
+            LOGE("socket %d already added", fd);
+            return false;
+        }
+
+        loopIndex %= loops_.size();
+        loop = loops_[loopIndex].get();
+        fdLoops_.emplace(fd, loopIndex);
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    PostTask(loop, [loop, fd, channel = std::move(channel)]() mutable {
+        if (loop->channels.size() <= (size_t)fd) {
+            loop->channels.resize(fd + 1);
+        }
+        loop->channels[fd] = std::move(channel);
+
+        struct epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("epoll_ctl add %d failed: %s", fd, strerror(errno));
+        }
+    });
+
+    return true;
+}
+
+void UdpReactor::RemoveSocket(int fd)
+{
+    EventLoop *loop = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = fdLoops_.find(fd);
+        if (it == fdLoops_.end()) {
+            return;
+        }
+
+        loop = loops_[it->second].get();
+        fdLoops_.erase(it);
+    }
+
+    auto done = std::make_shared<std::promise<void>>();
+    auto future = done->get_future();
+    PostTask(loop, [loop, fd, done]() {
+        epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        if ((size_t)fd < loop->channels.size()) {
+            loop->channels[fd] = Channel();
+        }
+        close(fd);
+        done->set_value();
+    });
+
+    if (std::this_thread::get_id() != loop->threadId) {
+        future.wait();
+    }
+}
+
+int UdpReactor::OpenSocket(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOGE("socket failed: %s", strerror(errno));
+        return -1;
+    }
+
+    int rcvbuf = UDP_SOCKET_RCVBUF;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+uint16_t UdpReactor::OpenPortPair(int &rtpFd, int &rtcpFd)
+{
+    for (int i = 0; i < PORT_PAIR_RETRY_MAX; i++) {
+        int fd = OpenSocket(0);
+        if (fd < 0) {
+            return 0;
+        }
+
+        struct sockaddr_in addr {};
+        socklen_t len = sizeof(addr);
+        getsockname(fd, (struct sockaddr *)&addr, &len);
+        uint16_t port = ntohs(addr.sin_port);
+
+        // the kernel picked an odd port, retry for an even one
+        if (port % 2 != 0 || port == 65534) {
+            close(fd);
+            continue;
+        }
+
+        int rtcp = OpenSocket(port + 1);
+        if (rtcp < 0) {
+            close(fd);
+            continue;
+        }
+
+        rtpFd = fd;
+        rtcpFd = rtcp;
+        return port;
+    }
+
+    LOGE("no idle port pair");
+    return 0;
+}
+
+uint64_t UdpReactor::GetRecvAllocations()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t allocations = 0;
+    for (auto &loop : loops_) {
+        allocations += loop->pool->GetAllocations();
+    }
+    return allocations;
+}
+
+bool UdpReactor::StartLoops()
+{
+    // the CPUs this process may run on, e.g. a cpuset of a container, not all CPUs of the host
+    std::vector<size_t> cores;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cores.push_back(cpu);
+            }
+        }
+    } else {
+        LOGW("get cpu affinity failed: %s", strerror(errno));
+    }
+
+    if (cores.empty()) {
+        size_t online = std::max(std::thread::hardware_concurrency(), 1u);
+        for (size_t cpu = 0; cpu < online; cpu++) {
+            cores.push_back(cpu);
+        }
+    }
+
+    size_t count = loopCount_ ? loopCount_ : cores.size();
+    for (size_t i = 0; i < count; i++) {
+        auto loop = std::make_unique<EventLoop>();
+        loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epollFd < 0 || loop->wakeFd < 0) {
+            LOGE("create event loop failed: %s", strerror(errno));
+            close(loop->epollFd);
+            close(loop->wakeFd);
+            break;
+        }
+
+        struct epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.fd = loop->wakeFd;
+        epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &ev);
+        loop->pool = new RecvPool();
+        loop->ring.resize(batchSize_);
+        loop->iovs.resize(batchSize_);
+        loop->msgs.resize(batchSize_);
+        loop->names.resize(batchSize_);
+        loop->batch.reserve(batchSize_);
+
+        auto *raw = loop.get();
+        loop->thread = std::make_unique<std::thread>(&UdpReactor::RunLoop, this, raw, cores[i % cores.size()]);
+        loop->threadId = loop->thread->get_id();
+        loops_.emplace_back(std::move(loop));
+    }
+
+    LOGD("started %zu udp event loops", loops_.size());
+    return !loops_.empty();
+}
+
+void UdpReactor::RunLoop(EventLoop *loop, size_t core)
+{
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+        LOGW("pin event loop to core %zu failed", core);
+    }
+
+    struct epoll_event events[UDP_REACTOR_MAX_EVENTS];
+    while (loop->running) {
+        int n = epoll_wait(loop->epollFd, events, UDP_REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == loop->wakeFd) {
+                uint64_t count;
+                read(loop->wakeFd, &count, sizeof(count));
+                RunTasks(loop);
+            } else {
+                HandleReadable(loop, fd);
+            }
+        }
+    }
+}
+
+void UdpReactor::HandleReadable(EventLoop *loop, int fd)
+{
+    if ((size_t)fd < loop->channels.size() && loop->channels[fd].timerHandler) {
+        uint64_t expirations = 0;
+        if (read(fd, &expirations, sizeof(expirations)) > 0) {
+            // a copy, the handler may remove its own timer
+            auto handler = loop->channels[fd].timerHandler;
+            handler();
+        }
+        return;
+    }
+
+    size_t count = loop->ring.size();
+
+    // drain the socket, the handler may remove it in between
+    while ((size_t)fd < loop->channels.size() && loop->channels[fd]) {
+        for (size_t i = 0; i < count; i++) {
+            auto &buffer = loop->ring[i];
+            if (!buffer || buffer.use_count() > 1) {
+                buffer = loop->pool->Alloc();
+            }
+
+            loop->iovs[i].iov_base = buffer->Data();
+            loop->iovs[i].iov_len = UDP_RECV_BUFFER_SIZE;
+            memset(&loop->msgs[i], 0, sizeof(struct mmsghdr));
+            loop->msgs[i].msg_hdr.msg_iov = &loop->iovs[i];
+            loop->msgs[i].msg_hdr.msg_iovlen = 1;
+            loop->msgs[i].msg_hdr.msg_name = &loop->names[i];
+            loop->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        int n = recvmmsg(fd, loop->msgs.data(), count, MSG_DONTWAIT, nullptr);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOGE("recvmmsg on %d failed: %s", fd, strerror(errno));
+            }
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (loop->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                LOGW("drop truncated datagram on %d", fd);
+                continue;
+            }
+
+            loop->ring[i]->SetSize(loop->msgs[i].msg_len);
+            loop->batch.emplace_back(loop->ring[i]);
+        }
+
+        Channel &channel = loop->channels[fd];
+        if (channel.batchHandler) {
+            channel.batchHandler(loop->batch);
+        } else if (channel.sourceHandler) {
+            for (int i = 0, j = 0; i < n; i++) {
+                if (!(loop->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                    channel.sourceHandler(loop->batch[j++], loop->names[i]);
+                }
+            }
+        } else {
+            for (auto &buffer : loop->batch) {
+                channel.handler(buffer);
+            }
+        }
+        loop->batch.clear();
+
+        // a short read means the socket is empty, skip the EAGAIN round trip
+        if ((size_t)n < count) {
+            return;
+        }
+    }
+}
+
+void UdpReactor::PostTask(EventLoop *loop, std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(loop->taskMutex);
+        loop->tasks.emplace_back(std::move(task));
+    }
+
+    uint64_t one = 1;
+    write(loop->wakeFd, &one, sizeof(one));
+}
+
+void UdpReactor::RunTasks(EventLoop *loop)
+{
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(loop->taskMutex);
+        tasks.swap(loop->tasks);
+    }
+
+    for (auto &task : tasks) {
+        task();
+    }
+}
@@ -0,0 +1,95 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_UDP_REACTOR_H
+#define HALFWAY_MEDIA_UDP_REACTOR_H
+
+#include "data_buffer.h"
+#include "singleton.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <unordered_map>
+#include <vector>
+
+/// Process-wide set of epoll loops multiplexing the RTP/RTCP sockets of every session.
+/// Each loop runs on its own thread pinned to a core and dispatches a datagram straight to the handler registered
+/// for its socket through a per-fd table, so ingest scales with the number of loops instead of one thread per port.
+/// Datagrams are read with recvmmsg() into buffers of a per-loop pool, up to the batch size per call. A buffer goes
+/// back to the pool of its loop when the last reference is dropped, on whatever thread, so a steady stream of
+/// datagrams allocates nothing even when the depacketizer or zero-copy frames hold on to them.
+class UdpReactor : public Singleton<UdpReactor> {
+    friend class Singleton<UdpReactor>;
+
+public:
+    using Handler = std::function<void(std::shared_ptr<DataBuffer> buffer)>;
+    using BatchHandler = std::function<void(const std::vector<std::shared_ptr<DataBuffer>> &batch)>;
+    using SourceHandler = std::function<void(std::shared_ptr<DataBuffer> buffer, const struct sockaddr_in &from)>;
+    using TimerHandler = std::function<void()>;
+
+    ~UdpReactor() override;
+
+    /// Number of event loops, 0 means one per CPU in the affinity mask of the process. Only effective before the first
+    /// socket is added.
+    void SetLoopCount(size_t count);
+
+    /// Datagrams read per recvmmsg() call, 1 reads them one by one. Only effective before the first socket is added.
+    void SetRecvBatchSize(size_t count);
+
+    /// Loops are handed out round-robin. Registering all sockets of a session on the same loop keeps its packets
+    /// on one thread.
+    size_t PickLoop();
+
+    /// Takes ownership of `fd`, which is made non-blocking and closed by RemoveSocket().
+    bool AddSocket(int fd, size_t loop, Handler handler);
+
+    /// Same as AddSocket(), but the handler gets every datagram of one recvmmsg() call at once.
+    bool AddBatchSocket(int fd, size_t loop, BatchHandler handler);
+
+    /// Same as AddSocket(), but the handler also gets the sender address, e.g. to answer RTCP feedback.
+    bool AddSourceSocket(int fd, size_t loop, SourceHandler handler);
+
+    /// Runs `handler` on the loop thread every `intervalMs`, the first time after `delayMs`.
+    /// Returns a timer fd to pass to RemoveSocket(), -1 on failure.
+    int AddTimer(size_t loop, uint32_t delayMs, uint32_t intervalMs, TimerHandler handler);
+
+    /// Returns once the handler of `fd` can no longer be running, unless called from the loop thread itself.
+    void RemoveSocket(int fd);
+
+    /// Non-blocking UDP socket bound to `port` on all interfaces, -1 on failure.
+    static int OpenSocket(uint16_t port);
+
+    /// Binds an even RTP port and the following RTCP port, returns the RTP port or 0 on failure.
+    static uint16_t OpenPortPair(int &rtpFd, int &rtcpFd);
+
+    /// Heap allocations of the receive pools so far, stops growing once the pools cover the datagrams in flight.
+    uint64_t GetRecvAllocations();
+
+private:
+    UdpReactor();
+
+    struct Channel;
+    struct EventLoop;
+    class RecvPool;
+    bool AddChannel(int fd, size_t loop, Channel channel);
+    bool StartLoops();
+    void RunLoop(EventLoop *loop, size_t index);
+    void HandleReadable(EventLoop *loop, int fd);
+    void PostTask(EventLoop *loop, std::function<void()> task);
+    void RunTasks(EventLoop *loop);
+
+private:
+    std::mutex mutex_;
+    size_t loopCount_ = 0;
+    size_t batchSize_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::unordered_map<int, size_t> fdLoops_;
+    std::atomic<size_t> nextLoop_{0};
+};
+
+#endif // HALFWAY_MEDIA_UDP_REACTOR_H
@@ -0,0 +1,305 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "udp_sender.h"
+#include "log.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+constexpr size_t UDP_GSO_SEGMENTS_MAX = 64; // UDP_MAX_SEGMENTS in the kernel
+constexpr size_t UDP_GSO_BYTES_MAX = 65507; // one UDP datagram before segmentation
+constexpr size_t UDP_SENDMMSG_MAX = 1024;   // UIO_MAXIOV
+constexpr int UDP_SOCKET_SNDBUF = 2 * 1024 * 1024;
+
+static bool Resolve(const std::string &ip, uint16_t port, struct sockaddr_in &addr)
+{
+    struct addrinfo hints {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *result = nullptr;
+    if (getaddrinfo(ip.c_str(), nullptr, &hints, &result) != 0 || !result) {
+        LOGE("resolve %s failed", ip.c_str());
+        return false;
+    }
+
+    addr = *(struct sockaddr_in *)result->ai_addr;
+    addr.sin_port = htons(port);
+    freeaddrinfo(result);
+    return true;
+}
+
+UdpSender::UdpSender(int fd) : fd_(fd)
+{
+    int segment = 0;
+    socklen_t len = sizeof(segment);
+    gsoSupported_ = getsockopt(fd_, SOL_UDP, UDP_SEGMENT, &segment, &len) == 0;
+    gsoEnabled_ = gsoSupported_;
+    LOGD("udp gso %s", gsoSupported_ ? "supported" : "not supported");
+}
+
+UdpSender::~UdpSender()
+{
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+std::shared_ptr<UdpSender> UdpSender::Create(uint16_t localPort)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOGE("socket failed: %s", strerror(errno));
+        return nullptr;
+    }
+
+    int sndbuf = UDP_SOCKET_SNDBUF;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    if (localPort != 0) {
+        struct sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(localPort);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            LOGE("bind port %d failed: %s", localPort, strerror(errno));
+            close(fd);
+            return nullptr;
+        }
+    }
+
+    return std::shared_ptr<UdpSender>(new UdpSender(fd));
+}
+
+std::shared_ptr<UdpSender> UdpSender::Create(int fd)
+{
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if (fd < 0 || getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 || type != SOCK_DGRAM) {
+        LOGE("fd %d is not a UDP socket", fd);
+        return nullptr;
+    }
+
+    // sockets of UdpReactor are non-blocking, sendmmsg() here waits for room in the send buffer like Create(port)
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0 && (flags & O_NONBLOCK)) {
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+
+    int sndbuf = UDP_SOCKET_SNDBUF;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    return std::shared_ptr<UdpSender>(new UdpSender(fd));
+}
+
+bool UdpSender::AddDestination(const std::string &ip, uint16_t port)
+{
+    struct sockaddr_in addr {};
+    if (!Resolve(ip, port, addr)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &dest : destinations_) {
+        if (dest.sin_addr.s_addr == addr.sin_addr.s_addr && dest.sin_port == addr.sin_port) {
+            return true;
+        }
+    }
+
+    destinations_.emplace_back(addr);
+    return true;
+}
+
+void UdpSender::RemoveDestination(const std::string &ip, uint16_t port)
+{
+    struct sockaddr_in addr {};
+    if (!Resolve(ip, port, addr)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = destinations_.begin(); it != destinations_.end(); ++it) {
+        if (it->sin_addr.s_addr == addr.sin_addr.s_addr && it->sin_port == addr.sin_port) {
+            destinations_.erase(it);
+            return;
+        }
+    }
+}
+
+size_t UdpSender::DestinationCount()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return destinations_.size();
+}
+
+std::vector<struct sockaddr_in> UdpSender::GetDestinations()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return destinations_;
+}
+
+void UdpSender::BuildRuns(const std::vector<std::shared_ptr<DataBuffer>> &packets, Batch &batch)
+{
+    batch.runs.clear();
+    size_t i = 0;
+    while (i < packets.size()) {
+        Run run{i, 1, 0};
+        size_t segmentSize = packets[i]->Size();
+        size_t bytes = segmentSize;
+
+        // GSO cuts the payload into segmentSize pieces, only the last one may be shorter
+        if (gsoEnabled_) {
+            while (i + run.count < packets.size() && run.count < UDP_GSO_SEGMENTS_MAX) {
+                size_t size = packets[i + run.count]->Size();
+                if (size > segmentSize || bytes + size > UDP_GSO_BYTES_MAX) {
+                    break;
+                }
+
+                bytes += size;
+                run.count++;
+                if (size < segmentSize) {
+                    break;
+                }
+            }
+
+            if (run.count > 1) {
+                run.segmentSize = segmentSize;
+            }
+        }
+
+        batch.runs.emplace_back(run);
+        i += run.count;
+    }
+}
+
+bool UdpSender::Send(const std::vector<std::shared_ptr<DataBuffer>> &packets)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return SendLocked(packets, destinations_, batch_, 0);
+}
+
+bool UdpSender::SendToHost(const std::vector<std::shared_ptr<DataBuffer>> &packets, const struct in_addr &host)
+{
+    std::lock_guard<std::mutex> hostLock(hostMutex_);
+    hostBatch_.destinations.clear();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &dest : destinations_) {
+            if (dest.sin_addr.s_addr == host.s_addr) {
+                hostBatch_.destinations.emplace_back(dest);
+            }
+        }
+    }
+
+    // the socket is blocking for Send(), a full send buffer must not stall the caller
+    return SendLocked(packets, hostBatch_.destinations, hostBatch_, MSG_DONTWAIT);
+}
+
+uint16_t UdpSender::GetLocalPort() const
+{
+    struct sockaddr_in addr {};
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd_, (struct sockaddr *)&addr, &len) < 0) {
+        LOGE("getsockname failed: %s", strerror(errno));
+        return 0;
+    }
+
+    return ntohs(addr.sin_port);
+}
+
+bool UdpSender::SendLocked(const std::vector<std::shared_ptr<DataBuffer>> &packets,
+                           const std::vector<struct sockaddr_in> &destinations, Batch &batch, int flags)
+{
+    if (packets.empty() || destinations.empty()) {
+        return true;
+    }
+
+    BuildRuns(packets, batch);
+
+    size_t messageCount = batch.runs.size() * destinations.size();
+    batch.iovs.resize(packets.size());
+    batch.msgs.resize(messageCount);
+    batch.controls.assign(messageCount * CMSG_SPACE(sizeof(uint16_t)), 0);
+
+    for (size_t i = 0; i < packets.size(); i++) {
+        batch.iovs[i].iov_base = packets[i]->Data();
+        batch.iovs[i].iov_len = packets[i]->Size();
+    }
+
+    size_t index = 0;
+    for (auto &dest : destinations) {
+        for (auto &run : batch.runs) {
+            struct mmsghdr &msg = batch.msgs[index];
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_hdr.msg_name = (void *)&dest;
+            msg.msg_hdr.msg_namelen = sizeof(dest);
+            msg.msg_hdr.msg_iov = &batch.iovs[run.first];
+            msg.msg_hdr.msg_iovlen = run.count;
+
+            if (run.segmentSize > 0) {
+                uint8_t *control = batch.controls.data() + index * CMSG_SPACE(sizeof(uint16_t));
+                msg.msg_hdr.msg_control = control;
+                msg.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg.msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segmentSize = run.segmentSize;
+                memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+            }
+            index++;
+        }
+    }
+
+    size_t sent = 0;
+    if (Submit(batch, messageCount, sent, flags)) {
+        return true;
+    }
+
+    if ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        LOGD("send buffer full, drop %zu of %zu messages", messageCount - sent, messageCount);
+        return false;
+    }
+
+    if (gsoEnabled_ && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+        // e.g. the egress device cannot segment, fall back to one datagram per packet for good
+        LOGW("udp gso send failed (%s), disable it", strerror(errno));
+        gsoEnabled_ = false;
+        if (sent == 0) {
+            return SendLocked(packets, destinations, batch, flags);
+        }
+    }
+
+    LOGE("sendmmsg failed: %s", strerror(errno));
+    return false;
+}
+
+bool UdpSender::Submit(Batch &batch, size_t count, size_t &sent, int flags)
+{
+    while (sent < count) {
+        size_t chunk = std::min(count - sent, UDP_SENDMMSG_MAX);
+        int n = sendmmsg(fd_, batch.msgs.data() + sent, chunk, flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += n;
+    }
+
+    return true;
+}
@@ -0,0 +1,85 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_UDP_SENDER_H
+#define HALFWAY_MEDIA_UDP_SENDER_H
+
+#include "data_buffer.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+/// Sends batches of datagrams to one or more receivers with a few syscalls per batch.
+/// Runs of equally sized packets (FU-A fragments of a frame) go out as one UDP GSO (UDP_SEGMENT) message per
+/// receiver when the kernel supports it, and all messages of a batch are submitted with sendmmsg().
+class UdpSender {
+public:
+    ~UdpSender();
+
+    /// Binds to `localPort` when it is not 0.
+    static std::shared_ptr<UdpSender> Create(uint16_t localPort = 0);
+    /// Takes over a UDP socket that is already bound, e.g. the RTP socket of UdpReactor::OpenPortPair(), so that the
+    /// port is never released in between. The sender closes the socket.
+    static std::shared_ptr<UdpSender> Create(int fd);
+
+    bool AddDestination(const std::string &ip, uint16_t port);
+    void RemoveDestination(const std::string &ip, uint16_t port);
+    size_t DestinationCount();
+    std::vector<struct sockaddr_in> GetDestinations();
+
+    bool Send(const std::vector<std::shared_ptr<DataBuffer>> &packets);
+    /// Sends only to the destinations on `host`, e.g. retransmissions for the receiver that asked for them.
+    /// Waits neither for a Send() in progress nor for room in the send buffer, what does not fit is dropped.
+    bool SendToHost(const std::vector<std::shared_ptr<DataBuffer>> &packets, const struct in_addr &host);
+
+    bool GsoEnabled() const { return gsoEnabled_; }
+    void SetGsoEnabled(bool enable) { gsoEnabled_ = enable && gsoSupported_; }
+
+    int GetSocketFd() const { return fd_; }
+    /// The bound port, also when the kernel picked it.
+    uint16_t GetLocalPort() const;
+
+private:
+    explicit UdpSender(int fd);
+
+    struct Run {
+        size_t first;
+        size_t count;
+        size_t segmentSize; // 0 when the run is sent without GSO
+    };
+
+    // scratch reused across calls
+    struct Batch {
+        std::vector<Run> runs;
+        std::vector<struct iovec> iovs;
+        std::vector<struct mmsghdr> msgs;
+        std::vector<struct sockaddr_in> destinations;
+        std::vector<uint8_t> controls;
+    };
+
+    void BuildRuns(const std::vector<std::shared_ptr<DataBuffer>> &packets, Batch &batch);
+    bool SendLocked(const std::vector<std::shared_ptr<DataBuffer>> &packets,
+                    const std::vector<struct sockaddr_in> &destinations, Batch &batch, int flags);
+    bool Submit(Batch &batch, size_t count, size_t &sent, int flags);
+
+private:
+    int fd_ = -1;
+    bool gsoSupported_ = false;
+    std::atomic<bool> gsoEnabled_{false};
+    std::mutex mutex_;
+    std::vector<struct sockaddr_in> destinations_;
+    Batch batch_;
+
+    // SendToHost() runs on an event loop, it only holds mutex_ to copy the destinations
+    std::mutex hostMutex_;
+    Batch hostBatch_;
+};
+
+#endif // HALFWAY_MEDIA_UDP_SENDER_H
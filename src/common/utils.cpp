@@ -4,6 +4,7 @@
 
 #include "utils.h"
 #include <chrono>
+#include <unistd.h>
 
 extern "C" {
 #include <libavutil/error.h>
@@ -15,12 +16,40 @@ int64_t Milliseconds()
     return std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
 }
 
+int64_t Microseconds()
+{
+    auto now = std::chrono::system_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+}
+
+int64_t SteadyMicroseconds()
+{
+    auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+}
+
+int64_t SteadyNanoseconds()
+{
+    auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+}
+
 char *ff_strerror(int errRet)
 {
     static char errBuff[64];
     return av_make_error_string(errBuff, 64, errRet);
 }
 
+std::string HostName()
+{
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0) {
+        return "localhost";
+    }
+
+    return name;
+}
+
 UrlType DetectUrlType(const std::string &url)
 {
     if (url.empty()) {
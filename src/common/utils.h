@@ -9,9 +9,16 @@
 #include <string>
 
 int64_t Milliseconds();
+int64_t Microseconds();
+
+// steady clock, for intervals and arrival times
+int64_t SteadyMicroseconds();
+int64_t SteadyNanoseconds();
 
 char *ff_strerror(int errRet);
 
+std::string HostName();
+
 enum UrlType {
     TYPE_UNKNOWN,
     TYPE_FILE,
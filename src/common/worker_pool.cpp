@@ -0,0 +1,103 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "worker_pool.h"
+#include "log.h"
+#include <algorithm>
+#include <pthread.h>
+#include <string>
+
+// owner and index of the worker running on this thread
+static thread_local const WorkerPool *tPool = nullptr;
+static thread_local int tWorkerIndex = -1;
+
+WorkerPool::WorkerPool(size_t count)
+{
+    if (count == 0) {
+        count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        workers_.emplace_back(std::make_unique<Worker>());
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        Worker *worker = workers_[i].get();
+        worker->thread = std::thread(&WorkerPool::Run, this, worker, i);
+    }
+    LOGD("started %zu workers", count);
+}
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+}
+
+void WorkerPool::Post(size_t index, std::function<void()> task)
+{
+    Worker *worker = workers_[index % workers_.size()].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->running) {
+        return;
+    }
+
+    worker->tasks.emplace_back(std::move(task));
+    if (worker->tasks.size() == 1) {
+        worker->cond.notify_one();
+    }
+}
+
+int WorkerPool::CurrentWorker() const
+{
+    return tPool == this ? tWorkerIndex : -1;
+}
+
+size_t WorkerPool::Pending(size_t index)
+{
+    Worker *worker = workers_[index % workers_.size()].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    return worker->tasks.size();
+}
+
+void WorkerPool::Stop()
+{
+    for (auto &worker : workers_) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->running = false;
+        worker->cond.notify_one();
+    }
+
+    for (size_t i = 0; i < workers_.size(); i++) {
+        auto &thread = workers_[i]->thread;
+        if (CurrentWorker() == (int)i) {
+            // stopped from one of its own tasks
+            thread.detach();
+        } else if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+void WorkerPool::Run(Worker *worker, size_t index)
+{
+    tPool = this;
+    tWorkerIndex = (int)index;
+    std::string name = "worker-" + std::to_string(index);
+    pthread_setname_np(pthread_self(), name.c_str());
+
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    for (;;) {
+        worker->cond.wait(lock, [worker] { return !worker->running || !worker->tasks.empty(); });
+        if (worker->tasks.empty()) {
+            break;
+        }
+
+        auto task = std::move(worker->tasks.front());
+        worker->tasks.pop_front();
+        lock.unlock();
+        task();
+        task = nullptr;
+        lock.lock();
+    }
+}
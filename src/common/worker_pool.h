@@ -0,0 +1,58 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_WORKER_POOL_H
+#define HALFWAY_MEDIA_WORKER_POOL_H
+
+#include "noncopyable.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed set of worker threads, each running the tasks posted to it in order.
+/// Work is sharded by posting everything that belongs together (e.g. one session) to the same worker, which then
+/// needs no locking among those tasks, while the number of threads stays at the core count however many sessions
+/// there are.
+class WorkerPool : public NonCopyable {
+public:
+    /// 0 starts one worker per core
+    explicit WorkerPool(size_t count = 0);
+    ~WorkerPool();
+
+    size_t Size() const { return workers_.size(); }
+
+    /// Runs `task` on worker `index % Size()`. Tasks posted after Stop() are dropped.
+    void Post(size_t index, std::function<void()> task);
+
+    /// Index of the worker the calling thread is, -1 on any other thread
+    int CurrentWorker() const;
+
+    /// Tasks waiting in the queue of a worker
+    size_t Pending(size_t index);
+
+    /// Runs the queued tasks, then joins the workers
+    void Stop();
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<std::function<void()>> tasks;
+        bool running = true;
+        std::thread thread;
+    };
+
+    void Run(Worker *worker, size_t index);
+
+private:
+    std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+#endif // HALFWAY_MEDIA_WORKER_POOL_H
@@ -0,0 +1,148 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "annexb_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ANNEXB_X86 1
+#include <immintrin.h>
+#endif
+
+static const uint8_t *FindStartCodeScalar(const uint8_t *p, const uint8_t *end)
+{
+    // p[2] decides how far to skip: a start code ends with 01 behind two zeros
+    while (p + 3 <= end) {
+        if (p[2] > 1) {
+            p += 3;
+        } else if (p[2] == 0) {
+            p++;
+        } else if (p[0] == 0 && p[1] == 0) {
+            return p;
+        } else {
+            p += 3;
+        }
+    }
+
+    return end;
+}
+
+#ifdef ANNEXB_X86
+__attribute__((target("sse2"))) static const uint8_t *FindStartCodeSse2(const uint8_t *p, const uint8_t *end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    // candidate i is p[i] == 0, p[i + 1] == 0 and p[i + 2] == 1, the three loads overlap
+    while (p + 18 <= end) {
+        __m128i b0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+        __m128i match = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+                                      _mm_cmpeq_epi8(b2, one));
+        int mask = _mm_movemask_epi8(match);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+
+    return FindStartCodeScalar(p, end);
+}
+
+__attribute__((target("avx2"))) static const uint8_t *FindStartCodeAvx2(const uint8_t *p, const uint8_t *end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+
+    while (p + 34 <= end) {
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        __m256i b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+        __m256i match = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+                                         _mm256_cmpeq_epi8(b2, one));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(match);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+
+    return FindStartCodeSse2(p, end);
+}
+#endif
+
+AnnexbScanner::AnnexbScanner(Isa isa) : isa_(Supported(isa) ? isa : SCALAR), find_(FindStartCodeScalar)
+{
+#ifdef ANNEXB_X86
+    if (isa_ == AVX2) {
+        find_ = FindStartCodeAvx2;
+    } else if (isa_ == SSE2) {
+        find_ = FindStartCodeSse2;
+    }
+#endif
+}
+
+AnnexbScanner::Isa AnnexbScanner::Best()
+{
+    static Isa best = Supported(AVX2) ? AVX2 : (Supported(SSE2) ? SSE2 : SCALAR);
+    return best;
+}
+
+bool AnnexbScanner::Supported(Isa isa)
+{
+    switch (isa) {
+        case SCALAR:
+            return true;
+#ifdef ANNEXB_X86
+        case SSE2:
+            return __builtin_cpu_supports("sse2");
+        case AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *AnnexbScanner::Name(Isa isa)
+{
+    switch (isa) {
+        case SSE2:
+            return "sse2";
+        case AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+bool AnnexbScanner::Next(const uint8_t *data, size_t length, size_t &cursor, NaluSpan &nalu) const
+{
+    const uint8_t *end = data + length;
+    const uint8_t *code = find_(data + cursor, end);
+    if (end - code <= 3) {
+        cursor = length;
+        return false; // no start code left, or one in the last bytes without a NAL unit behind it
+    }
+
+    // a zero in front makes it the 4-byte form, further zeros are trailing_zero_8bits of the previous unit
+    nalu.prefixLength = (code > data && code[-1] == 0) ? 4 : 3;
+    nalu.offset = code + 3 - data;
+
+    const uint8_t *next = find_(code + 3, end);
+    const uint8_t *nalEnd = (next < end && next[-1] == 0) ? next - 1 : next;
+    nalu.size = nalEnd - (code + 3);
+    cursor = next - data;
+    return true;
+}
+
+void AnnexbScanner::Split(const uint8_t *data, size_t length, std::vector<NaluSpan> &nalus) const
+{
+    nalus.clear();
+    size_t cursor = 0;
+    NaluSpan nalu{};
+    while (Next(data, length, cursor, nalu)) {
+        nalus.push_back(nalu);
+    }
+}
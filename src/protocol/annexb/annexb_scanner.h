@@ -0,0 +1,51 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_PROTOCOL_ANNEXB_SCANNER_H
+#define HALFWAY_MEDIA_PROTOCOL_ANNEXB_SCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One NAL unit of an Annex-B byte stream (H.264 / H.265), `offset` points behind its start code
+struct NaluSpan {
+    size_t offset;
+    size_t size;
+    uint8_t prefixLength; // 3 for 00 00 01, 4 for 00 00 00 01
+};
+
+// Finds start codes 16 (SSE2) or 32 (AVX2) bytes at a time. The widest instruction set the CPU supports is picked
+// at runtime, other CPUs use the byte loop.
+class AnnexbScanner {
+public:
+    enum Isa {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    explicit AnnexbScanner(Isa isa = Best());
+
+    static Isa Best();
+    static bool Supported(Isa isa);
+    static const char *Name(Isa isa);
+
+    Isa GetIsa() const { return isa_; }
+
+    // the next 00 00 01 at or after `p`, `end` if there is none
+    const uint8_t *FindStartCode(const uint8_t *p, const uint8_t *end) const { return find_(p, end); }
+
+    // the NAL unit following `cursor`, which starts at 0 and is advanced past it, false at the end of the data
+    bool Next(const uint8_t *data, size_t length, size_t &cursor, NaluSpan &nalu) const;
+
+    // all NAL units in one pass, `nalus` is cleared first and keeps its capacity
+    void Split(const uint8_t *data, size_t length, std::vector<NaluSpan> &nalus) const;
+
+private:
+    Isa isa_;
+    const uint8_t *(*find_)(const uint8_t *p, const uint8_t *end);
+};
+
+#endif // HALFWAY_MEDIA_PROTOCOL_ANNEXB_SCANNER_H
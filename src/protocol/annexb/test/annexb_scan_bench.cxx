@@ -0,0 +1,222 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../annexb_scanner.h"
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <tuple>
+#include <vector>
+
+// Compares the SIMD start-code scanner with the former byte loop of RtpPacketizerH264.
+// Usage: annexb_scan_bench [stream.h264|stream.h265 ...]
+// Without arguments synthetic 1080p and 4K streams are used: random slice payloads with emulation prevention, so
+// start codes only appear at NAL boundaries as in a real encoder output.
+
+constexpr int ROUNDS = 5;
+
+// the previous implementation, kept as the baseline
+static const uint8_t *FindNextNal(const uint8_t *start, const uint8_t *end, int &nalSize)
+{
+    while (start <= end - 3) {
+        if (start[0] == 0x00 && start[1] == 0x00) {
+            if (start[2] == 0x01) {
+                nalSize = 3;
+                return start;
+            } else if (start[2] == 0x00 && start[3] == 0x01) {
+                nalSize = 4;
+                return start;
+            }
+        }
+        ++start;
+    }
+    return end;
+}
+
+static void SplitLegacy(const uint8_t *data, size_t length, std::vector<NaluSpan> &nalus)
+{
+    nalus.clear();
+    const uint8_t *last = nullptr;
+    const uint8_t *current = data;
+    const uint8_t *end = data + length;
+    int prefixLength = 0, lastPrefixLength = 0;
+
+    while (current < end) {
+        current = FindNextNal(current, end, prefixLength);
+        if (last) {
+            size_t offset = last - data + lastPrefixLength;
+            nalus.push_back({offset, (size_t)(current - last) - lastPrefixLength, (uint8_t)lastPrefixLength});
+        }
+        last = current;
+        current += prefixLength;
+        lastPrefixLength = prefixLength;
+    }
+}
+
+static void AppendNalu(std::vector<uint8_t> &stream, std::mt19937 &rng, uint8_t header, size_t size, bool longPrefix)
+{
+    if (longPrefix) {
+        stream.push_back(0);
+    }
+    stream.insert(stream.end(), {0, 0, 1, header});
+
+    std::uniform_int_distribution<int> byte(0, 255);
+    int zeros = 0;
+    for (size_t i = 0; i < size; i++) {
+        uint8_t b = byte(rng);
+        if (zeros >= 2 && b <= 3) {
+            stream.push_back(3); // emulation_prevention_three_byte
+            zeros = 0;
+        }
+        stream.push_back(b);
+        zeros = b == 0 ? zeros + 1 : 0;
+    }
+    if (stream.back() == 0) {
+        stream.back() = 0x80; // rbsp_stop_one_bit
+    }
+}
+
+// 60 frames per second with a keyframe every 2 seconds, 4 slices per frame
+static std::vector<uint8_t> MakeStream(size_t bitrate, size_t bytes)
+{
+    std::vector<uint8_t> stream;
+    stream.reserve(bytes + bytes / 8);
+    std::mt19937 rng(1);
+    size_t frameSize = bitrate / 8 / 60;
+    for (size_t frame = 0; stream.size() < bytes; frame++) {
+        bool key = frame % 120 == 0;
+        if (key) {
+            AppendNalu(stream, rng, 0x67, 20, true);
+            AppendNalu(stream, rng, 0x68, 4, true);
+        }
+        size_t slice = (key ? frameSize * 8 : frameSize) / 4;
+        for (int i = 0; i < 4; i++) {
+            AppendNalu(stream, rng, key ? 0x65 : 0x41, slice, i == 0);
+        }
+    }
+    return stream;
+}
+
+static std::vector<uint8_t> ReadStream(const char *path)
+{
+    std::vector<uint8_t> stream;
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("open %s failed\n", path);
+        return stream;
+    }
+
+    uint8_t chunk[64 * 1024];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        stream.insert(stream.end(), chunk, chunk + n);
+    }
+    fclose(file);
+    return stream;
+}
+
+template <typename Split>
+static double Measure(const std::vector<uint8_t> &stream, std::vector<NaluSpan> &nalus, Split split)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        auto start = std::chrono::steady_clock::now();
+        split(stream.data(), stream.size(), nalus);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        double gbps = stream.size() / ns;
+        if (gbps > best) {
+            best = gbps;
+        }
+    }
+    return best;
+}
+
+static bool SameSpans(const std::vector<NaluSpan> &a, const std::vector<NaluSpan> &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].offset != b[i].offset || a[i].size != b[i].size || a[i].prefixLength != b[i].prefixLength) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void Run(const char *label, const std::vector<uint8_t> &stream)
+{
+    std::vector<NaluSpan> expected;
+    double legacy = Measure(stream, expected, SplitLegacy);
+    printf("%-16s %8.1f MB %8zu NALs  legacy %6.2f GB/s", label, stream.size() / 1e6, expected.size(), legacy);
+
+    for (auto isa : {AnnexbScanner::SCALAR, AnnexbScanner::SSE2, AnnexbScanner::AVX2}) {
+        if (!AnnexbScanner::Supported(isa)) {
+            continue;
+        }
+        AnnexbScanner scanner(isa);
+        std::vector<NaluSpan> nalus;
+        double gbps = Measure(stream, nalus, [&](const uint8_t *data, size_t length, std::vector<NaluSpan> &out) {
+            scanner.Split(data, length, out);
+        });
+        assert(SameSpans(nalus, expected));
+        printf("  %s %6.2f GB/s (%.1fx)", AnnexbScanner::Name(isa), gbps, gbps / legacy);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    printf("best scanner: %s\n", AnnexbScanner::Name(AnnexbScanner::Best()));
+
+    // edge cases: stream boundaries, 3- and 4-byte prefixes, trailing zeros and a start code in the last bytes.
+    // Truncations are only compared between the scanners, the byte loop reads one byte past the end.
+    const uint8_t edge[] = {0, 0, 0, 1, 0x67, 0, 0, 1, 0x68, 0xaa, 0, 0, 0, 0, 1, 0x65, 0, 0, 1};
+    std::vector<NaluSpan> expected = {{4, 1, 4}, {8, 3, 3}, {15, 1, 4}};
+    for (size_t length = 0; length <= sizeof(edge); length++) {
+        std::vector<NaluSpan> scalar;
+        AnnexbScanner(AnnexbScanner::SCALAR).Split(edge, length, scalar);
+        if (length == sizeof(edge)) {
+            assert(SameSpans(scalar, expected));
+        }
+        for (auto isa : {AnnexbScanner::SSE2, AnnexbScanner::AVX2}) {
+            std::vector<NaluSpan> nalus;
+            AnnexbScanner(isa).Split(edge, length, nalus);
+            assert(SameSpans(nalus, scalar));
+        }
+    }
+
+    // dense zeros and ones put start codes at every position relative to the 16 and 32 byte blocks
+    std::mt19937 rng(2);
+    std::uniform_int_distribution<int> byte(0, 3);
+    for (int i = 0; i < 10000; i++) {
+        std::vector<uint8_t> data(rng() % 200);
+        for (auto &b : data) {
+            b = byte(rng) == 3 ? 0x55 : byte(rng) % 2;
+        }
+        std::vector<NaluSpan> scalar;
+        AnnexbScanner(AnnexbScanner::SCALAR).Split(data.data(), data.size(), scalar);
+        for (auto isa : {AnnexbScanner::SSE2, AnnexbScanner::AVX2}) {
+            std::vector<NaluSpan> nalus;
+            AnnexbScanner(isa).Split(data.data(), data.size(), nalus);
+            assert(SameSpans(nalus, scalar));
+        }
+    }
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            auto stream = ReadStream(argv[i]);
+            if (!stream.empty()) {
+                Run(argv[i], stream);
+            }
+        }
+        return 0;
+    }
+
+    Run("1080p 8 Mbps", MakeStream(8000000, 64 * 1024 * 1024));
+    Run("4K 40 Mbps", MakeStream(40000000, 256 * 1024 * 1024));
+    return 0;
+}
@@ -29,6 +29,23 @@ constexpr const uint64_t NPT_OFFSET_70_YEARS = 2208988800ULL;
         }                                                                                                              \
     } while (0);
 
+void ForEachRtcpPacket(const uint8_t *p, size_t length,
+                       const std::function<void(const RtcpHeader &header, const uint8_t *packet, size_t size)> &callback)
+{
+    while (p != nullptr && length >= sizeof(RtcpHeader)) {
+        auto *header = (const RtcpHeader *)p;
+        size_t size = header->GetLength();
+        if (header->version != VERSON || size > length) {
+            LOGD("malformed rtcp packet, %zu bytes left", length);
+            return;
+        }
+
+        callback(*header, p, size);
+        p += size;
+        length -= size;
+    }
+}
+
 std::shared_ptr<RtcpSR> RtcpSR::Parse(const uint8_t *p, size_t length)
 {
     ASSERT_RETRUN_NULL((p != nullptr && length >= (sizeof(RtcpHeader) + SSRC_SIZE + sizeof(SenderInfo))),
@@ -232,9 +249,8 @@ std::shared_ptr<RtcpSDES> RtcpSDES::Parse(const uint8_t *p, size_t length)
             p += length;
         }
         sdes->sdesChunks.push_back(chunk);
-        if ((p - chunkStart) % 4 != 0) {
-            p = chunkStart + ALIGN32(p - chunkStart);
-        }
+        // skip the null octet ending the item list and the padding after it
+        p = chunkStart + ALIGN32(p - chunkStart + 1);
     }
 
     assert(sdes->sourceCount == sdes->sdesChunks.size());
@@ -254,7 +270,7 @@ std::shared_ptr<DataBuffer> RtcpSDES::Generate()
             chunkSize += 2;
             chunkSize += item.second.size();
         }
-        estimatedSize += ALIGN32(chunkSize);
+        estimatedSize += ALIGN32(chunkSize + 1);
     }
 
     auto data = std::make_shared<DataBuffer>(estimatedSize);
@@ -281,12 +297,11 @@ std::shared_ptr<DataBuffer> RtcpSDES::Generate()
             data->Append(item.second);
         }
 
+        // the item list ends with at least one null octet, then pads to a 32-bit boundary
         size_t chunkLength = data->Size() - chunkPoint;
-        if ((chunkLength) % 4 != 0) {
-            size_t count = ALIGN32(chunkLength) - chunkLength;
-            for (size_t i = 0; i < count; i++) {
-                data->Append((uint8_t)0);
-            }
+        size_t count = ALIGN32(chunkLength + 1) - chunkLength;
+        for (size_t i = 0; i < count; i++) {
+            data->Append((uint8_t)0);
         }
     }
 
@@ -385,12 +400,96 @@ std::shared_ptr<DataBuffer> RtcpAPP::Generate()
 
 std::shared_ptr<RtcpRTPFB> RtcpRTPFB::Parse(const uint8_t *p, size_t length)
 {
-    LOGE("unimplemented");
-    return nullptr;
+    ASSERT_RETRUN_NULL((p != nullptr && length >= (sizeof(RtcpHeader) + SSRC_SIZE * 2)), LOGE("invalid input param"));
+
+    auto *header = (RtcpHeader *)p;
+    ASSERT_RETRUN_NULL(header->version == VERSON, LOGE("version(%d) is invalid", header->version));
+    ASSERT_RETRUN_NULL(header->pt == RTCP_RTPFB, LOGE("pt(%u) != RTCP_RTPFB(%d)", header->pt, RTCP_RTPFB));
+    ASSERT_RETRUN_NULL(length >= header->GetLength(),
+                       LOGE("actual length(%zu) < rtcp field length(%d)", length, header->GetLength()));
+
+    auto fb = std::make_shared<RtcpRTPFB>();
+    fb->padding = header->padding;
+    fb->fmt = header->subtype;
+    fb->length = header->GetLength();
+    fb->senderSsrc = header->GetSSRC();
+
+    auto end = p + fb->length;
+    p += sizeof(RtcpHeader) + SSRC_SIZE;
+    fb->mediaSsrc = BS32(*(uint32_t *)p);
+    p += SSRC_SIZE;
+
+    if (fb->fmt != RTCP_RTPFB_NACK) {
+        // other transport layer feedback is kept as header only
+        return fb;
+    }
+
+    while (p + sizeof(NackItem) <= end) {
+        NackItem item;
+        item.pid = BS16(((NackItem *)p)->pid);
+        item.blp = BS16(((NackItem *)p)->blp);
+        fb->nackItems.push_back(item);
+        p += sizeof(NackItem);
+    }
+
+    return fb;
 }
 
 std::shared_ptr<DataBuffer> RtcpRTPFB::Generate()
 {
-    LOGE("unimplemented");
-    return nullptr;
-}
\ No newline at end of file
+    size_t size = sizeof(RtcpHeader) + SSRC_SIZE * 2 + sizeof(NackItem) * nackItems.size();
+    auto data = std::make_shared<DataBuffer>(size);
+    data->SetSize(size);
+
+    RtcpHeader *header = (RtcpHeader *)data->Data();
+    header->version = VERSON;
+    header->pt = RTCP_RTPFB;
+    header->padding = padding;
+    header->subtype = fmt;
+    header->SetLength(size);
+    header->SetSSRC(senderSsrc);
+
+    uint8_t *p = data->Data() + sizeof(RtcpHeader) + SSRC_SIZE;
+    *(uint32_t *)p = BS32(mediaSsrc);
+    p += SSRC_SIZE;
+
+    for (auto &item : nackItems) {
+        ((NackItem *)p)->pid = BS16(item.pid);
+        ((NackItem *)p)->blp = BS16(item.blp);
+        p += sizeof(NackItem);
+    }
+
+    return data;
+}
+
+void RtcpRTPFB::SetLostSequences(const std::vector<uint16_t> &sequences)
+{
+    fmt = RTCP_RTPFB_NACK;
+    nackItems.clear();
+    for (auto seq : sequences) {
+        if (!nackItems.empty()) {
+            auto &last = nackItems.back();
+            uint16_t offset = seq - last.pid;
+            if (offset >= 1 && offset <= 16) {
+                last.blp |= 1 << (offset - 1);
+                continue;
+            }
+        }
+        nackItems.push_back({seq, 0});
+    }
+}
+
+std::vector<uint16_t> RtcpRTPFB::GetLostSequences() const
+{
+    std::vector<uint16_t> sequences;
+    for (auto &item : nackItems) {
+        sequences.push_back(item.pid);
+        for (uint16_t i = 0; i < 16; i++) {
+            if (item.blp & (1 << i)) {
+                sequences.push_back(item.pid + i + 1);
+            }
+        }
+    }
+
+    return sequences;
+}
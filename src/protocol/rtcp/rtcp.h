@@ -8,6 +8,7 @@
 #include "common/data_buffer.h"
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <utility>
@@ -47,6 +48,10 @@ private:
     uint32_t ssrc_[0]; // 0 bit
 };
 
+// Calls `callback` for each packet of a compound RTCP packet, stops at the first one that does not fit
+void ForEachRtcpPacket(const uint8_t *p, size_t length,
+                       const std::function<void(const RtcpHeader &header, const uint8_t *packet, size_t size)> &callback);
+
 // SR: Sender Report RTCP Packet
 // @see https://www.rfc-editor.org/rfc/rfc3550#section-6.4.1
 //
@@ -298,17 +303,36 @@ public:
 //    |            PID                |             BLP               |
 //    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 
+// clang-format off
+enum RtpfbFmt : uint8_t {
+    RTCP_RTPFB_NACK = 1, // Generic NACK, @see https://www.rfc-editor.org/rfc/rfc4585#section-6.2.1
+};
+// clang-format on
+
+// Generic NACK: PID is the first lost packet, bit i of BLP marks PID + i + 1 as lost too
+struct NackItem {
+    uint16_t pid;
+    uint16_t blp;
+};
+
 class RtcpRTPFB {
 public:
     static std::shared_ptr<RtcpRTPFB> Parse(const uint8_t *p, size_t length);
 
     std::shared_ptr<DataBuffer> Generate();
 
+    /// Packs the lost sequence numbers (in sending order) into as few NACK items as possible.
+    void SetLostSequences(const std::vector<uint16_t> &sequences);
+    std::vector<uint16_t> GetLostSequences() const;
+
 public:
     bool padding;
-    uint8_t fmt;
+    uint8_t fmt = RTCP_RTPFB_NACK;
     RtcpType pt = RTCP_RTPFB;
     uint16_t length;
+    uint32_t senderSsrc;
+    uint32_t mediaSsrc;
+    std::vector<NackItem> nackItems;
 };
 
 #endif // HALFWAY_MEDIA_PROTOCOL_RTCP_PACKET_H
\ No newline at end of file
@@ -0,0 +1,303 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "rtcp_stats.h"
+#include "common/log.h"
+#include "protocol/rtp/rtp_packet.h"
+#include <algorithm>
+#include <cmath>
+
+constexpr uint32_t RTP_SEQ_MOD = 1 << 16;
+constexpr uint16_t MAX_DROPOUT = 3000;
+constexpr uint16_t MAX_MISORDER = 100;
+constexpr int64_t LOST_MAX = 0x7fffff; // cumulative loss is a signed 24-bit field
+constexpr int64_t LOST_MIN = -0x800000;
+constexpr size_t RECEIVERS_MAX = 1024; // reporters tracked per stream
+
+// middle 32 bits of the 64-bit NTP timestamp, the unit of LSR and DLSR is 1/65536 seconds
+static uint32_t NtpMiddle32(uint64_t utcUs)
+{
+    RtcpSR::SenderInfo info;
+    info.SetNPTTime(utcUs);
+    return (info.nptTsMSW << 16) | (info.nptTsLSW >> 16);
+}
+
+static size_t RtpPayloadSize(const uint8_t *data, size_t size)
+{
+    auto *rtp = (const RtpHeader *)data;
+    size_t header = RtpHeader::ParseHeaderLength(data, size);
+    if (header == 0) {
+        return 0;
+    }
+
+    size_t padding = rtp->GetPadding() ? data[size - 1] : 0;
+    return size > header + padding ? size - header - padding : 0;
+}
+
+void RtcpReceiverStats::SetClockRate(uint32_t clockRate)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    clockRate_ = clockRate;
+    jitter_ = 0;
+    hasTransit_ = false;
+}
+
+void RtcpReceiverStats::OnRtpPacket(const uint8_t *data, size_t size, int64_t arrivalUs)
+{
+    if (data == nullptr || size < 12) { // RTP fixed header size
+        return;
+    }
+
+    auto *rtp = (const RtpHeader *)data;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!init_ || rtp->GetSSRC() != ssrc_) {
+        if (init_) {
+            LOGW("ssrc changed from %08x to %08x, reset statistics", ssrc_, rtp->GetSSRC());
+        }
+        init_ = true;
+        ssrc_ = rtp->GetSSRC();
+        InitSeq(rtp->GetSeqNumber());
+        expectedPrior_ = 0;
+        receivedPrior_ = 0;
+        jitter_ = 0;
+        hasTransit_ = false;
+    } else if (!UpdateSeq(rtp->GetSeqNumber())) {
+        return;
+    }
+
+    received_++;
+    UpdateJitter(rtp->GetTimestamp(), arrivalUs);
+}
+
+void RtcpReceiverStats::OnRtpPackets(const std::vector<std::shared_ptr<DataBuffer>> &packets, int64_t arrivalUs)
+{
+    for (auto &packet : packets) {
+        OnRtpPacket(packet->Data(), packet->Size(), arrivalUs);
+    }
+}
+
+void RtcpReceiverStats::OnSenderReport(const RtcpSR &sr, int64_t arrivalUs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastSr_ = (sr.senderInfo.nptTsMSW << 16) | (sr.senderInfo.nptTsLSW >> 16);
+    lastSrArrivalUs_ = arrivalUs;
+}
+
+bool RtcpReceiverStats::MakeReportBlock(ReportBlock &block, int64_t nowUs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!init_) {
+        return false;
+    }
+
+    uint64_t extendedMax = cycles_ + maxSeq_;
+    uint64_t expected = extendedMax - baseSeq_ + 1;
+    int64_t lost = std::min(std::max((int64_t)expected - (int64_t)received_, LOST_MIN), LOST_MAX);
+
+    int64_t expectedInterval = expected - expectedPrior_;
+    int64_t lostInterval = expectedInterval - (int64_t)(received_ - receivedPrior_);
+    expectedPrior_ = expected;
+    receivedPrior_ = received_;
+    fractionLost_ = (expectedInterval == 0 || lostInterval <= 0) ? 0 : (lostInterval << 8) / expectedInterval;
+
+    block.ssrc = ssrc_;
+    block.fractionLost = fractionLost_;
+    block.lostPacketCount = (uint32_t)lost & 0xffffff;
+    block.highestSequence = (uint32_t)extendedMax;
+    block.jitter = (uint32_t)jitter_;
+    block.lastSR = lastSr_;
+    // in units of 1/65536 seconds, 0 until an SR was received
+    block.delaySinceLastSR = lastSr_ ? (uint32_t)((nowUs - lastSrArrivalUs_) * 65536 / 1000000) : 0;
+    return true;
+}
+
+RtcpReceiverStats::Stats RtcpReceiverStats::GetStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats{};
+    if (!init_) {
+        return stats;
+    }
+
+    stats.ssrc = ssrc_;
+    stats.extendedHighestSeq = cycles_ + maxSeq_;
+    stats.received = received_;
+    stats.expected = (uint64_t)stats.extendedHighestSeq - baseSeq_ + 1;
+    stats.cumulativeLost = (int64_t)stats.expected - (int64_t)received_;
+    stats.fractionLost = fractionLost_;
+    stats.jitterMs = clockRate_ ? jitter_ * 1000 / clockRate_ : 0;
+    return stats;
+}
+
+void RtcpReceiverStats::InitSeq(uint16_t seq)
+{
+    baseSeq_ = seq;
+    maxSeq_ = seq;
+    badSeq_ = RTP_SEQ_MOD + 1; // so seq == badSeq_ is false
+    cycles_ = 0;
+    received_ = 0;
+}
+
+bool RtcpReceiverStats::UpdateSeq(uint16_t seq)
+{
+    uint16_t udelta = seq - maxSeq_;
+    if (udelta < MAX_DROPOUT) {
+        // in order, with permissible gap
+        if (seq < maxSeq_) {
+            cycles_ += RTP_SEQ_MOD;
+        }
+        maxSeq_ = seq;
+    } else if (udelta <= RTP_SEQ_MOD - MAX_MISORDER) {
+        // the sequence number made a very large jump
+        if (seq == badSeq_) {
+            // two sequential packets, assume the other side restarted without telling us
+            LOGW("sequence restarted at %d", seq);
+            InitSeq(seq);
+        } else {
+            badSeq_ = (seq + 1) & (RTP_SEQ_MOD - 1);
+            return false;
+        }
+    }
+    // else duplicate or reordered packet
+
+    return true;
+}
+
+void RtcpReceiverStats::UpdateJitter(uint32_t rtpTimestamp, int64_t arrivalUs)
+{
+    if (clockRate_ == 0) {
+        return;
+    }
+
+    uint32_t arrival = (uint32_t)(arrivalUs * clockRate_ / 1000000);
+    uint32_t transit = arrival - rtpTimestamp;
+    if (hasTransit_) {
+        int32_t d = (int32_t)(transit - lastTransit_);
+        jitter_ += (std::abs((double)d) - jitter_) / 16;
+    }
+    lastTransit_ = transit;
+    hasTransit_ = true;
+}
+
+void RtcpSenderStats::SetClockRate(uint32_t clockRate)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    clockRate_ = clockRate;
+}
+
+void RtcpSenderStats::OnRtpPackets(const std::vector<std::shared_ptr<DataBuffer>> &packets, int64_t sendUs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &packet : packets) {
+        if (packet == nullptr || packet->Size() < 12) { // RTP fixed header size
+            continue;
+        }
+
+        auto *rtp = (const RtpHeader *)packet->Data();
+        if (init_ && rtp->GetSSRC() != ssrc_) {
+            LOGW("ssrc changed from %08x to %08x, reset counters", ssrc_, rtp->GetSSRC());
+            packetCount_ = 0;
+            octetCount_ = 0;
+            receivers_.clear();
+        }
+
+        init_ = true;
+        ssrc_ = rtp->GetSSRC();
+        packetCount_++;
+        octetCount_ += RtpPayloadSize(packet->Data(), packet->Size());
+        lastRtpTs_ = rtp->GetTimestamp();
+        lastSendUs_ = sendUs;
+    }
+}
+
+bool RtcpSenderStats::MakeSenderReport(RtcpSR &sr, int64_t nowUs, uint64_t utcUs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!init_) {
+        return false;
+    }
+
+    // extrapolate the media clock from the last sent packet to the wallclock time of the report
+    uint32_t elapsed = clockRate_ ? (uint32_t)((nowUs - lastSendUs_) * clockRate_ / 1000000) : 0;
+
+    sr.ssrc = ssrc_;
+    sr.senderInfo.SetNPTTime(utcUs);
+    sr.senderInfo.rtpTs = lastRtpTs_ + elapsed;
+    sr.senderInfo.packetCount = (uint32_t)packetCount_; // the fields wrap around
+    sr.senderInfo.octetCount = (uint32_t)octetCount_;
+    return true;
+}
+
+void RtcpSenderStats::OnReceiverReport(uint32_t reporter, const std::vector<ReportBlock> &blocks,
+                                       const struct in_addr &from, int64_t nowUs, uint64_t utcUs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &block : blocks) {
+        if (!init_ || block.ssrc != ssrc_) {
+            continue;
+        }
+
+        auto it = receivers_.find(reporter);
+        if (it == receivers_.end()) {
+            if (receivers_.size() >= RECEIVERS_MAX) {
+                LOGW("too many receivers, ignore report of %08x", reporter);
+                continue;
+            }
+            it = receivers_.emplace(reporter, ReceiverInfo{reporter, from, 0, 0, 0, 0, -1, 0}).first;
+        }
+
+        auto &info = it->second;
+        info.address = from;
+        info.fractionLost = block.fractionLost;
+        // sign-extend the 24-bit field
+        info.cumulativeLost = (int32_t)(block.lostPacketCount << 8) >> 8;
+        info.extendedHighestSeq = block.highestSequence;
+        info.jitterMs = clockRate_ ? (double)block.jitter * 1000 / clockRate_ : 0;
+        info.lastReportUs = nowUs;
+
+        if (block.lastSR != 0) {
+            // RTT = A - LSR - DLSR, all in 1/65536 seconds
+            uint32_t rtt = NtpMiddle32(utcUs) - block.lastSR - block.delaySinceLastSR;
+            if (rtt < 0x80000000) { // a clock step can make it negative
+                info.rttMs = (double)rtt * 1000 / 65536;
+            }
+        }
+    }
+}
+
+void RtcpSenderStats::OnBye(uint32_t reporter)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    receivers_.erase(reporter);
+}
+
+uint32_t RtcpSenderStats::GetSSRC()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ssrc_;
+}
+
+uint64_t RtcpSenderStats::GetPacketCount()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return packetCount_;
+}
+
+uint64_t RtcpSenderStats::GetOctetCount()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return octetCount_;
+}
+
+std::vector<RtcpSenderStats::ReceiverInfo> RtcpSenderStats::GetReceivers()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<ReceiverInfo> receivers;
+    receivers.reserve(receivers_.size());
+    for (auto &item : receivers_) {
+        receivers.emplace_back(item.second);
+    }
+
+    return receivers;
+}
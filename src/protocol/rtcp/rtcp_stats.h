@@ -0,0 +1,120 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_PROTOCOL_RTCP_STATS_H
+#define HALFWAY_MEDIA_PROTOCOL_RTCP_STATS_H
+
+#include "common/data_buffer.h"
+#include "rtcp.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <unordered_map>
+#include <vector>
+
+// Reception statistics of one RTP stream as a receiver reports them
+// @see https://www.rfc-editor.org/rfc/rfc3550#appendix-A.1 (sequence number validation)
+// @see https://www.rfc-editor.org/rfc/rfc3550#appendix-A.3 (loss)
+// @see https://www.rfc-editor.org/rfc/rfc3550#appendix-A.8 (interarrival jitter)
+class RtcpReceiverStats {
+public:
+    struct Stats {
+        uint32_t ssrc;
+        uint32_t extendedHighestSeq;
+        uint64_t received;
+        uint64_t expected;
+        int64_t cumulativeLost;
+        uint8_t fractionLost; // of the last report interval, in 1/256
+        double jitterMs;
+    };
+
+    // RTP timestamp rate of the stream, needed for the jitter
+    void SetClockRate(uint32_t clockRate);
+
+    // arrival times are on the steady clock, in microseconds
+    void OnRtpPacket(const uint8_t *data, size_t size, int64_t arrivalUs);
+    void OnRtpPackets(const std::vector<std::shared_ptr<DataBuffer>> &packets, int64_t arrivalUs);
+    void OnSenderReport(const RtcpSR &sr, int64_t arrivalUs);
+
+    // report block for the interval since the previous call, false until a packet was received
+    bool MakeReportBlock(ReportBlock &block, int64_t nowUs);
+
+    Stats GetStats();
+
+private:
+    void InitSeq(uint16_t seq);
+    bool UpdateSeq(uint16_t seq);
+    void UpdateJitter(uint32_t rtpTimestamp, int64_t arrivalUs);
+
+private:
+    std::mutex mutex_;
+    bool init_ = false;
+    uint32_t ssrc_ = 0;
+    uint32_t clockRate_ = 0;
+
+    uint16_t maxSeq_ = 0;
+    uint32_t cycles_ = 0;  // shifted count of sequence number cycles
+    uint32_t baseSeq_ = 0;
+    uint32_t badSeq_ = 0;
+    uint64_t received_ = 0;
+    uint64_t expectedPrior_ = 0;
+    uint64_t receivedPrior_ = 0;
+    uint8_t fractionLost_ = 0;
+
+    double jitter_ = 0; // in RTP timestamp units
+    uint32_t lastTransit_ = 0;
+    bool hasTransit_ = false;
+
+    uint32_t lastSr_ = 0; // middle 32 bits of the NTP timestamp of the last SR
+    int64_t lastSrArrivalUs_ = 0;
+};
+
+// Sender side of one RTP stream: the counters of its sender reports and what the receivers report back
+// @see https://www.rfc-editor.org/rfc/rfc3550#section-6.4.1 (round-trip time from LSR and DLSR)
+class RtcpSenderStats {
+public:
+    struct ReceiverInfo {
+        uint32_t ssrc; // of the reporting receiver
+        struct in_addr address;
+        uint8_t fractionLost; // in 1/256
+        int32_t cumulativeLost;
+        uint32_t extendedHighestSeq;
+        double jitterMs;
+        double rttMs;         // -1 until a report refers to one of our SRs
+        int64_t lastReportUs; // steady clock
+    };
+
+    void SetClockRate(uint32_t clockRate);
+
+    // `sendUs` on the steady clock
+    void OnRtpPackets(const std::vector<std::shared_ptr<DataBuffer>> &packets, int64_t sendUs);
+
+    // fills SSRC, sender info and the RTP timestamp matching `utcUs`, false until a packet was sent
+    bool MakeSenderReport(RtcpSR &sr, int64_t nowUs, uint64_t utcUs);
+
+    // report blocks about other streams are ignored
+    void OnReceiverReport(uint32_t reporter, const std::vector<ReportBlock> &blocks, const struct in_addr &from,
+                          int64_t nowUs, uint64_t utcUs);
+    void OnBye(uint32_t reporter);
+
+    uint32_t GetSSRC();
+    uint64_t GetPacketCount();
+    uint64_t GetOctetCount();
+    std::vector<ReceiverInfo> GetReceivers();
+
+private:
+    std::mutex mutex_;
+    bool init_ = false;
+    uint32_t ssrc_ = 0;
+    uint32_t clockRate_ = 0;
+    uint64_t packetCount_ = 0;
+    uint64_t octetCount_ = 0; // payload only
+    uint32_t lastRtpTs_ = 0;
+    int64_t lastSendUs_ = 0;
+    std::unordered_map<uint32_t, ReceiverInfo> receivers_;
+};
+
+#endif // HALFWAY_MEDIA_PROTOCOL_RTCP_STATS_H
@@ -3,11 +3,14 @@
 //
 
 #include "../rtcp.h"
+#include "../rtcp_stats.h"
+#include "../../rtp/rtp_packet.h"
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <string>
+#include <vector>
 
 // Real-time Transport Control Protocol (Sender Report)
 //     [Stream setup by RTSP (frame 26372)]
@@ -79,6 +82,23 @@ uint8_t rr[32] = {0x81, 0xc9, 0x00, 0x07, 0x42, 0x29, 0x84, 0x73, 0x60, 0xef, 0x
 
 uint8_t bye[8] = {0x81, 0xcb, 0x00, 0x01, 0x42, 0x29, 0x84, 0x73};
 
+// Real-time Transport Control Protocol (Generic NACK)
+//     [Stream setup by RTSP (frame 12)]
+//     10.. .... = Version: RFC 1889 Version (2)
+//     ..0. .... = Padding: False
+//     ...0 0001 = RTCP Feedback message type (FMT): Generic negative acknowledgement (NACK) (1)
+//     Packet type: Generic RTP Feedback (205)
+//     Length: 4 (20 bytes)
+//     Sender SSRC: 0x42298473 (1110017139)
+//     Media source SSRC: 0x60ef152b (1626281259)
+//     RTCP Transport Feedback NACK PID: 65534
+//     RTCP Transport Feedback NACK BLP: 0x0005 (Frames 65535 1 lost)
+//     RTCP Transport Feedback NACK PID: 30
+//     RTCP Transport Feedback NACK BLP: 0x0000
+
+uint8_t nack[20] = {0x81, 0xcd, 0x00, 0x04, 0x42, 0x29, 0x84, 0x73, 0x60, 0xef,
+                    0x15, 0x2b, 0xff, 0xfe, 0x00, 0x05, 0x00, 0x1e, 0x00, 0x00};
+
 int main(int argc, char **argv)
 {
     printf("RTCP test\n");
@@ -131,4 +151,92 @@ int main(int argc, char **argv)
     assert(genBYE != nullptr);
     assert(std::string((char *)&bye[0], sizeof(bye)) == std::string((char *)genBYE->Data(), genBYE->Size()));
     printf("RTCP RtcpBYE test pass\n");
+
+    auto rtcpNACK = RtcpRTPFB::Parse(nack, sizeof(nack));
+    assert(rtcpNACK != nullptr);
+    assert(rtcpNACK->fmt == RTCP_RTPFB_NACK);
+    assert(rtcpNACK->senderSsrc == 0x42298473);
+    assert(rtcpNACK->mediaSsrc == 0x60ef152b);
+    assert(rtcpNACK->nackItems.size() == 2);
+    assert((rtcpNACK->GetLostSequences() == std::vector<uint16_t>{65534, 65535, 1, 30}));
+
+    auto genNACK = rtcpNACK->Generate();
+    assert(genNACK != nullptr);
+    assert(std::string((char *)&nack[0], sizeof(nack)) == std::string((char *)genNACK->Data(), genNACK->Size()));
+
+    RtcpRTPFB packedNACK;
+    packedNACK.padding = false;
+    packedNACK.senderSsrc = 0x42298473;
+    packedNACK.mediaSsrc = 0x60ef152b;
+    packedNACK.SetLostSequences({65534, 65535, 1, 30});
+    genNACK = packedNACK.Generate();
+    assert(std::string((char *)&nack[0], sizeof(nack)) == std::string((char *)genNACK->Data(), genNACK->Size()));
+    printf("RTCP RtcpRTPFB test pass\n");
+
+    // 65530 .. 9 across the wrap, 65533 and 2 lost, 7 arrives late
+    RtcpReceiverStats stats;
+    stats.SetClockRate(90000);
+    std::vector<uint16_t> sequences = {65530, 65531, 65532, 65534, 65535, 0, 1, 3, 4, 5, 6, 8, 7, 9};
+    for (size_t i = 0; i < sequences.size(); i++) {
+        RtpHeader rtp;
+        rtp.SetSeqNumber(sequences[i]);
+        rtp.SetSSRC(0x60ef152b);
+        rtp.SetTimestamp(3000 * i);
+        stats.OnRtpPacket((uint8_t *)&rtp, 12, 33333 * i);
+    }
+
+    ReportBlock block{};
+    assert(stats.MakeReportBlock(block, 0));
+    assert(block.ssrc == 0x60ef152b);
+    assert(block.highestSequence == 65536 + 9);
+    assert(block.lostPacketCount == 2);
+    assert(block.fractionLost == 2 * 256 / 16);
+    assert(stats.GetStats().received == 14 && stats.GetStats().expected == 16);
+
+    RtcpRR statsRR;
+    statsRR.padding = false;
+    statsRR.ssrc = 0x42298473;
+    statsRR.reportBlocks.push_back(block);
+    auto genStatsRR = statsRR.Generate();
+    auto parsedRR = RtcpRR::Parse(genStatsRR->Data(), genStatsRR->Size());
+    assert(parsedRR != nullptr && parsedRR->reportBlocks[0].lostPacketCount == 2);
+    assert(parsedRR->reportBlocks[0].highestSequence == 65536 + 9);
+
+    // a fresh interval without loss
+    assert(stats.MakeReportBlock(block, 0) && block.fractionLost == 0 && block.lostPacketCount == 2);
+    printf("RTCP RtcpReceiverStats test pass\n");
+
+    RtcpSenderStats senderStats;
+    senderStats.SetClockRate(90000);
+    std::vector<std::shared_ptr<DataBuffer>> sent;
+    for (uint16_t seq = 100; seq < 110; seq++) {
+        RtpHeader rtp;
+        rtp.SetSeqNumber(seq);
+        rtp.SetSSRC(0x60ef152b);
+        rtp.SetTimestamp(90000);
+        auto packet = std::make_shared<DataBuffer>(112);
+        packet->Assign((uint8_t *)&rtp, 12);
+        packet->SetSize(112);
+        sent.push_back(packet);
+    }
+    senderStats.OnRtpPackets(sent, 0);
+
+    RtcpSR statsSR;
+    uint64_t utcUs = 1700000000ULL * 1000000;
+    assert(senderStats.MakeSenderReport(statsSR, 500000, utcUs));
+    assert(statsSR.ssrc == 0x60ef152b && statsSR.senderInfo.rtpTs == 90000 + 45000);
+    assert(statsSR.senderInfo.packetCount == 10 && statsSR.senderInfo.octetCount == 1000);
+
+    // the receiver held the SR for 100 ms and its report arrives 300 ms after the SR was sent
+    ReportBlock echo{};
+    echo.ssrc = 0x60ef152b;
+    echo.lostPacketCount = 0xfffffe; // -2, duplicates
+    echo.lastSR = (statsSR.senderInfo.nptTsMSW << 16) | (statsSR.senderInfo.nptTsLSW >> 16);
+    echo.delaySinceLastSR = 65536 / 10;
+    in_addr receiver{};
+    senderStats.OnReceiverReport(0x42298473, {echo}, receiver, 800000, utcUs + 300000);
+    auto receivers = senderStats.GetReceivers();
+    assert(receivers.size() == 1 && receivers[0].ssrc == 0x42298473 && receivers[0].cumulativeLost == -2);
+    assert(receivers[0].rttMs > 199 && receivers[0].rttMs < 201);
+    printf("RTCP RtcpSenderStats test pass\n");
 }
\ No newline at end of file
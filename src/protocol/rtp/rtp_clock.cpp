@@ -0,0 +1,43 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "rtp_clock.h"
+#include "../../common/log.h"
+#include <numeric>
+#include <random>
+
+RtpClock::RtpClock(uint32_t clockRate) : clockRate_(clockRate)
+{
+    std::random_device rd;
+    offset_ = rd();
+    Update();
+}
+
+void RtpClock::SetClockRate(uint32_t clockRate)
+{
+    if (clockRate != clockRate_) {
+        clockRate_ = clockRate;
+        Update();
+    }
+}
+
+void RtpClock::SetTimeBase(uint32_t num, uint32_t den)
+{
+    if (num == 0 || den == 0) {
+        LOGE("invalid time base %u/%u", num, den);
+        return;
+    }
+
+    num_ = num;
+    den_ = den;
+    Update();
+}
+
+void RtpClock::Update()
+{
+    uint64_t mul = (uint64_t)clockRate_ * num_;
+    uint64_t gcd = std::gcd(mul, (uint64_t)den_);
+    mul_ = gcd ? mul / gcd : 0;
+    div_ = gcd ? den_ / gcd : 1;
+}
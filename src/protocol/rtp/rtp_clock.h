@@ -0,0 +1,45 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_PROTOCOL_RTP_CLOCK_H
+#define HALFWAY_MEDIA_PROTOCOL_RTP_CLOCK_H
+
+#include <cstdint>
+
+// Maps Frame::timestamp to the RTP timestamp of one stream (RFC 3550 5.1).
+// Frame timestamps count `num / den` seconds, by default milliseconds as the sources deliver them. The mapping is
+// kept as a reduced fraction, so it costs a multiplication per frame (and a division only for time bases that do
+// not divide the clock rate), and starts at a random offset.
+class RtpClock {
+public:
+    explicit RtpClock(uint32_t clockRate);
+
+    void SetClockRate(uint32_t clockRate);
+    uint32_t GetClockRate() const { return clockRate_; }
+
+    // e.g. (1, 1000) for milliseconds, (1, 90000) for frames that already carry 90 kHz RTP timestamps
+    void SetTimeBase(uint32_t num, uint32_t den);
+
+    uint32_t ToRtp(uint64_t timestamp) const
+    {
+        unsigned __int128 ticks = (unsigned __int128)timestamp * mul_;
+        if (div_ != 1) {
+            ticks /= div_;
+        }
+        return offset_ + (uint32_t)ticks;
+    }
+
+private:
+    void Update();
+
+private:
+    uint32_t clockRate_;
+    uint32_t num_ = 1;
+    uint32_t den_ = 1000;
+    uint64_t mul_ = 0;
+    uint64_t div_ = 1;
+    uint32_t offset_;
+};
+
+#endif // HALFWAY_MEDIA_PROTOCOL_RTP_CLOCK_H
@@ -0,0 +1,41 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "rtp_history.h"
+#include "rtp_packet.h"
+
+static_assert((RTP_HISTORY_SIZE & (RTP_HISTORY_SIZE - 1)) == 0, "history size must be a power of two");
+
+static inline size_t HistoryIndex(uint16_t seq)
+{
+    return seq & (RTP_HISTORY_SIZE - 1);
+}
+
+void RtpHistory::Put(const std::vector<std::shared_ptr<DataBuffer>> &packets)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &packet : packets) {
+        if (packet == nullptr || packet->Size() < 12) { // RTP fixed header size
+            continue;
+        }
+
+        ring_[HistoryIndex(((RtpHeader *)packet->Data())->GetSeqNumber())] = packet;
+    }
+}
+
+size_t RtpHistory::Get(const std::vector<uint16_t> &sequences, std::vector<std::shared_ptr<DataBuffer>> &packets)
+{
+    size_t found = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto seq : sequences) {
+        auto &packet = ring_[HistoryIndex(seq)];
+        // the slot may already hold a newer packet
+        if (packet && ((RtpHeader *)packet->Data())->GetSeqNumber() == seq) {
+            packets.emplace_back(packet);
+            found++;
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,34 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_PROTOCOL_RTP_HISTORY_H
+#define HALFWAY_MEDIA_PROTOCOL_RTP_HISTORY_H
+
+#include "../../common/data_buffer.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// packets kept for retransmission per stream, a power of two so that the slot of a sequence number is
+// seq & (RTP_HISTORY_SIZE - 1)
+constexpr size_t RTP_HISTORY_SIZE = 512;
+
+// Bounded history of the last sent RTP packets of one stream, looked up by sequence number to answer NACKs.
+// A packet is overwritten by the one RTP_HISTORY_SIZE sequence numbers later.
+class RtpHistory {
+public:
+    void Put(const std::vector<std::shared_ptr<DataBuffer>> &packets);
+
+    // appends the packets still held for `sequences` to `packets`, returns how many were found
+    size_t Get(const std::vector<uint16_t> &sequences, std::vector<std::shared_ptr<DataBuffer>> &packets);
+
+private:
+    std::mutex mutex_;
+    std::array<std::shared_ptr<DataBuffer>, RTP_HISTORY_SIZE> ring_;
+};
+
+#endif // HALFWAY_MEDIA_PROTOCOL_RTP_HISTORY_H
@@ -6,6 +6,7 @@
 #include "../../common/log.h"
 #include "rtp_packet_aac.h"
 #include "rtp_packet_h264.h"
+#include "rtp_packet_h265.h"
 #include <cstdint>
 
 std::shared_ptr<RtpPacketizer> RtpPacketizer::Create(FrameFormat format)
@@ -15,6 +16,9 @@ std::shared_ptr<RtpPacketizer> RtpPacketizer::Create(FrameFormat format)
         case FRAME_FORMAT_H264:
             packetizer = std::make_shared<RtpPacketizerH264>();
             break;
+        case FRAME_FORMAT_H265:
+            packetizer = std::make_shared<RtpPacketizerH265>();
+            break;
         case FRAME_FORMAT_AAC:
             packetizer = std::make_shared<RtpPacketizerAAC>();
             break;
@@ -35,6 +39,27 @@ void RtpPacketizer::FillRtpHeader(RtpHeader &header, uint8_t pt, uint32_t ts, bo
     header.SetMarker(mark);
 }
 
+void RtpPacketizer::EmitPacket(std::shared_ptr<DataBuffer> packet)
+{
+    if (batchCallback_) {
+        batch_.emplace_back(std::move(packet));
+    } else if (packetizeCallback_) {
+        packetizeCallback_(packet);
+    }
+}
+
+void RtpPacketizer::FlushBatch()
+{
+    if (batch_.empty()) {
+        return;
+    }
+
+    if (batchCallback_) {
+        batchCallback_(batch_);
+    }
+    batch_.clear();
+}
+
 std::shared_ptr<RtpDepacketizer> RtpDepacketizer::Create(FrameFormat format)
 {
     std::shared_ptr<RtpDepacketizer> depacketizer;
@@ -42,6 +67,9 @@ std::shared_ptr<RtpDepacketizer> RtpDepacketizer::Create(FrameFormat format)
         case FRAME_FORMAT_H264:
             depacketizer = std::make_shared<RtpDepacketizerH264>();
             break;
+        case FRAME_FORMAT_H265:
+            depacketizer = std::make_shared<RtpDepacketizerH265>();
+            break;
         case FRAME_FORMAT_AAC:
             depacketizer = std::make_shared<RtpDepacketizerAAC>();
             break;
@@ -56,4 +84,27 @@ std::shared_ptr<RtpDepacketizer> RtpDepacketizer::Create(FrameFormat format)
 RtpDepacketizer::RtpDepacketizer()
 {
     sorter_.SetCallback([this](std::shared_ptr<DataBuffer> packet) { DepacketizeInner(packet); });
+    SetMetricsLabels("");
+}
+
+void RtpDepacketizer::SetCallback(const std::function<void(std::shared_ptr<Frame>)> callback)
+{
+    depacketizeCallback_ = [this, callback](std::shared_ptr<Frame> frame) {
+        framesMetric_->Add();
+        bytesMetric_->Add(frame->TotalSize());
+        if (callback) {
+            callback(frame);
+        }
+    };
+}
+
+void RtpDepacketizer::SetMetricsLabels(const std::string &labels)
+{
+    sorter_.SetMetricsLabels(labels);
+
+    auto registry = MetricsRegistry::GetInstance();
+    framesMetric_ = registry->Counter("halfway_depacketized_frames_total", "Frames rebuilt from RTP packets.", labels);
+    bytesMetric_ = registry->Counter("halfway_depacketized_bytes_total", "Bytes of the frames rebuilt.", labels);
+    droppedMetric_ = registry->Counter("halfway_depacketizer_dropped_packets_total",
+                                       "RTP packets the depacketizer could not use.", labels);
 }
\ No newline at end of file
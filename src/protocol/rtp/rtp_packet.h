@@ -7,12 +7,17 @@
 
 #include "../../common/data_buffer.h"
 #include "../../common/frame.h"
+#include "../../common/metrics.h"
+#include "rtp_clock.h"
+#include "rtp_packet_pool.h"
 #include "rtp_sorter.h"
 #include <cstdint>
 #include <functional>
 #include <memory>
 #include <netinet/in.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #define MTU_DEFAULT 1500
 #define IP_PACKET_HEADER_SIZE 20
@@ -89,7 +94,33 @@ public:
     void SetExtLength(uint16_t extensionLength) { extLength_ = htons(extensionLength); }
     uint16_t GetExtLength() const { return ntohs(extLength_); }
 
-    int GetHeaderLength() const { return 12 + cc_ * 4 + extension_ * (4 + ntohs(extLength_) * 4); }
+    // on a received packet the header must be followed by its CSRCs and extension, see ParseHeaderLength()
+    int GetHeaderLength() const
+    {
+        auto *data = reinterpret_cast<const uint8_t *>(this);
+        int length = RTP_PACKET_HEADER_DEFAULT_SIZE + cc_ * 4;
+        return extension_ ? length + 4 + ((data[length + 2] << 8) | data[length + 3]) * 4 : length;
+    }
+
+    // header length of a received packet including CSRCs and extension, 0 when the packet is shorter than that
+    static size_t ParseHeaderLength(const uint8_t *data, size_t size)
+    {
+        if (data == nullptr || size < RTP_PACKET_HEADER_DEFAULT_SIZE) {
+            return 0;
+        }
+
+        auto *rtp = reinterpret_cast<const RtpHeader *>(data);
+        size_t length = RTP_PACKET_HEADER_DEFAULT_SIZE + rtp->GetCC() * 4;
+        if (rtp->GetExtension()) {
+            // the extension length follows the CSRCs, not the fixed header
+            if (size < length + 4) {
+                return 0;
+            }
+            length += 4 + ((data[length + 2] << 8) | data[length + 3]) * 4;
+        }
+
+        return length <= size ? length : 0;
+    }
 
 private:
     uint8_t cc_ : 4;
@@ -115,8 +146,12 @@ public:
 
     static std::shared_ptr<RtpPacketizer> Create(FrameFormat format);
 
+    using PacketBatch = std::vector<std::shared_ptr<DataBuffer>>;
+
     virtual void Packetize(const std::shared_ptr<Frame> &frame) = 0;
     void SetCallback(const std::function<void(std::shared_ptr<DataBuffer>)> callback) { packetizeCallback_ = callback; }
+    // all packets of one frame at once, takes precedence over SetCallback()
+    void SetBatchCallback(const std::function<void(PacketBatch &)> callback) { batchCallback_ = callback; }
 
     uint32_t GetSSRC()
     {
@@ -130,13 +165,32 @@ public:
 
     void FillRtpHeader(RtpHeader &header, uint8_t pt, uint32_t ts, bool mark);
 
+    RtpPacketPool::Stats GetPacketPoolStats() const { return packetPool_.GetStats(); }
+
+    // unit of Frame::timestamp, milliseconds by default, see RtpClock::SetTimeBase()
+    void SetTimeBase(uint32_t num, uint32_t den) { clock_.SetTimeBase(num, den); }
+
 protected:
-    RtpPacketizer() = default;
+    explicit RtpPacketizer(uint32_t clockRate) : clock_(clockRate) {}
+
+    // an empty packet buffer from the pool, for `payloadSize` bytes behind the default RTP header
+    std::shared_ptr<DataBuffer> AllocPacket(size_t payloadSize)
+    {
+        return packetPool_.Alloc(RTP_PACKET_HEADER_DEFAULT_SIZE + payloadSize);
+    }
+
+    void EmitPacket(std::shared_ptr<DataBuffer> packet);
+    // called at the end of Packetize()
+    void FlushBatch();
 
 protected:
     uint32_t ssrc_ = 0;
     uint16_t seqNumber_ = 0;
     std::function<void(std::shared_ptr<DataBuffer>)> packetizeCallback_;
+    std::function<void(PacketBatch &)> batchCallback_;
+    PacketBatch batch_;
+    RtpClock clock_;
+    RtpPacketPool packetPool_{RTP_PACKET_HEADER_DEFAULT_SIZE + RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE};
 };
 
 //----------------------------------------------------------------
@@ -148,21 +202,43 @@ public:
     static std::shared_ptr<RtpDepacketizer> Create(FrameFormat format);
 
     void Depacketize(std::shared_ptr<DataBuffer> dataBuffer) { sorter_.Input(dataBuffer); }
+    void Depacketize(const std::vector<std::shared_ptr<DataBuffer>> &batch) { sorter_.Input(batch); }
 
     virtual void SetExtraData(void *extra) {}
 
-    void SetCallback(const std::function<void(std::shared_ptr<Frame>)> callback) { depacketizeCallback_ = callback; }
+    // see RtpSorter::SetJitterBuffer()
+    void SetJitterBuffer(uint32_t maxHoldMs, uint32_t clockRate) { sorter_.SetJitterBuffer(maxHoldMs, clockRate); }
+    // see RtpSorter::Poll(), call periodically in jitter-buffer mode so that a gap also expires when no packet follows
+    void Poll() { sorter_.Poll(); }
+
+    // see RtpSorter::SetLossCallback()
+    void SetLossCallback(const std::function<void(uint32_t ssrc, const std::vector<uint16_t> &lost)> callback)
+    {
+        sorter_.SetLossCallback(callback);
+    }
+
+    // frames are counted before they reach `callback`
+    void SetCallback(const std::function<void(std::shared_ptr<Frame>)> callback);
+
+    // labels of the metrics of this stream, including those of its RtpSorter; call before the first packet
+    void SetMetricsLabels(const std::string &labels);
 
 protected:
     RtpDepacketizer();
 
     virtual void DepacketizeInner(std::shared_ptr<DataBuffer> dataBuffer) = 0;
 
+    // malformed packets, or packets of a NAL unit that cannot be completed
+    void CountDropped(uint64_t count = 1) { droppedMetric_->Add(count); }
+
 protected:
     std::function<void(std::shared_ptr<Frame>)> depacketizeCallback_;
 
 private:
     RtpSorter sorter_;
+    std::shared_ptr<MetricCounter> framesMetric_;
+    std::shared_ptr<MetricCounter> bytesMetric_;
+    std::shared_ptr<MetricCounter> droppedMetric_;
 };
 
 #endif // HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_H
\ No newline at end of file
@@ -3,8 +3,10 @@
 //
 
 #include "rtp_packet_aac.h"
+#include "common/frame_pool.h"
 #include "common/log.h"
 #include "protocol/aac/adts_header.h"
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -17,36 +19,94 @@ void RtpPacketizerAAC::Packetize(const std::shared_ptr<Frame> &frame)
     LOGD("samplerate: %d, channels: %d,nbSample: %d, ts: %lu ", frame->audioInfo.sampleRate, frame->audioInfo.channels,
          frame->audioInfo.nbSamples, frame->timestamp);
 
-    const uint8_t *p = frame->Data();
-    size_t size = frame->Size();
-
-    if (0xFF == p[0] && 0xF0 == (p[1] & 0xF0) && size > 7) {
+    // a depacketized frame is an ADTS header prefix and a slice of an RTP packet, read in place
+    size_t offset = 0;
+    size_t size = frame->TotalSize();
+    uint8_t p[7];
+    if (size > 7 && frame->Read(0, p, sizeof(p)) == sizeof(p) && 0xFF == p[0] && 0xF0 == (p[1] & 0xF0)) {
         LOGD("skip ADTS header");
-        if (size != (((p[3] & 0x03) << 11) | (p[4] << 3) | ((p[5] >> 5) & 0x07))) {
+        if (size != (size_t)(((p[3] & 0x03) << 11) | (p[4] << 3) | ((p[5] >> 5) & 0x07))) {
             LOGE("invalid aac data");
             return;
         }
-        p += 7;
+        offset = 7;
         size -= 7;
     }
 
-    uint16_t auHeaderLength = htons(16);      // 16-bits AU headers-length
-    uint16_t auHeader = (size << 3) & 0xfff8; // 13bit AU-size/3bit AU-Index/AU-Index-delta
+    if (frame->audioInfo.sampleRate > 0) {
+        clock_.SetClockRate(frame->audioInfo.sampleRate);
+    }
+    uint32_t ts = clock_.ToRtp(frame->timestamp);
+    uint32_t samples = frame->audioInfo.nbSamples > 0 ? frame->audioInfo.nbSamples : 1024;
 
-    std::shared_ptr<DataBuffer> rtpPacket = std::make_shared<DataBuffer>(RTP_PACKET_HEADER_DEFAULT_SIZE + 4 + size);
+    if (!pending_.empty()) {
+        // millisecond frame timestamps are off by a few samples, anything closer than half an AU follows on
+        int32_t gap = (int32_t)(ts - (pendingTs_ + pendingSamples_));
+        size_t payloadSize = 2 + 2 * (pending_.size() + 1) + pendingSize_ + size;
+        if (gap > (int32_t)samples / 2 || gap < -(int32_t)samples / 2 ||
+            payloadSize > RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE || pending_.size() == AAC_MAX_AUS_PER_PACKET) {
+            FlushPending();
+        }
+    }
 
-    RtpHeader header;
-    uint32_t ts = (uint32_t)(frame->timestamp * (frame->audioInfo.sampleRate / 1000));
-    FillRtpHeader(header, 97, ts, true); // fill header
+    if (pending_.empty()) {
+        pendingTs_ = ts;
+    }
+    pending_.push_back({frame, offset, size});
+    pendingSize_ += size;
+    pendingSamples_ += samples;
+
+    if ((uint64_t)pendingSamples_ * 1000 >= (uint64_t)packetDurationMs_ * clock_.GetClockRate()) {
+        FlushPending();
+    }
+    FlushBatch();
+}
+
+//  RTP payload for AAC-hbr (RFC 3640 3.2.1)
+//
+//  +---------+-----------+-----------+---------------+
+//  | RTP     | AU Header | Auxiliary | Access Unit   |
+//  | Header  | Section   | Section   | Data Section  |
+//  +---------+-----------+-----------+---------------+
+//
+//  +---------------+-------------+-------------+--+-------------+
+//  | AU-headers-   | AU-header   | AU-header   |  | AU-header   |
+//  | length        | (1)         | (2)         |..| (n)         |
+//  +---------------+-------------+-------------+--+-------------+
+//
+//  AU-headers-length counts bits, each AU-header is a 13-bit AU-size and a 3-bit AU-Index(-delta) of 0.
+//  The auxiliary section is empty.
+
+void RtpPacketizerAAC::FlushPending()
+{
+    if (pending_.empty()) {
+        return;
+    }
+
+    size_t headersSize = 2 * pending_.size();
+    std::shared_ptr<DataBuffer> rtpPacket = AllocPacket(2 + headersSize + pendingSize_);
 
+    RtpHeader header;
+    FillRtpHeader(header, 97, pendingTs_, true); // fill header
     rtpPacket->Assign(&header, header.GetHeaderLength());
-    rtpPacket->Append(&auHeaderLength, sizeof(auHeaderLength));
-    rtpPacket->Append(&auHeader, sizeof(auHeader));
-    rtpPacket->Append(p, size);
 
-    if (packetizeCallback_) {
-        packetizeCallback_(rtpPacket);
+    uint16_t auHeadersLength = htons(AAC_HBR_AU_HEADER_BITS * pending_.size());
+    rtpPacket->Append(&auHeadersLength, sizeof(auHeadersLength));
+    for (auto &au : pending_) {
+        uint16_t auHeader = htons((au.size << 3) & 0xfff8);
+        rtpPacket->Append(&auHeader, sizeof(auHeader));
+    }
+
+    for (auto &au : pending_) {
+        size_t dataOffset = rtpPacket->Size();
+        rtpPacket->SetSize(dataOffset + au.size);
+        au.frame->Read(au.offset, rtpPacket->Data() + dataOffset, au.size);
     }
+
+    EmitPacket(rtpPacket);
+    pending_.clear();
+    pendingSize_ = 0;
+    pendingSamples_ = 0;
 }
 
 void RtpDepacketizerAAC::DepacketizeInner(std::shared_ptr<DataBuffer> dataBuffer)
@@ -54,20 +114,62 @@ void RtpDepacketizerAAC::DepacketizeInner(std::shared_ptr<DataBuffer> dataBuffer
     RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
     // LOGW("seq: %d, header length: %d, size: %zu", rtp->GetSeqNumber(), rtp->GetHeaderLength(), dataBuffer->Size());
 
-    auto frame = std::make_shared<Frame>();
-    frame->format = FRAME_FORMAT_AAC;
-    frame->audioInfo.channels = channels_;
-    frame->audioInfo.nbSamples = nbSamples_;
-    frame->audioInfo.sampleRate = sampleRate_;
-    frame->timestamp = rtp->GetTimestamp();
-
-    int adtsLength = dataBuffer->Size() - 12 - 4;
-    ADTSHeader header;
-    header.SetChannel(channels_).SetSamplingFrequency(sampleRate_).SetLength(adtsLength + 7);
-    frame->Assign(&header, sizeof(header));
-    frame->Append(dataBuffer->Data() + 12 + 4, adtsLength);
-    if (depacketizeCallback_) {
-        depacketizeCallback_(frame);
+    const uint8_t *data = dataBuffer->Data();
+    size_t end = dataBuffer->Size();
+    size_t offset = RtpHeader::ParseHeaderLength(data, end);
+    if (offset == 0) {
+        LOGE("RTP header exceeds the packet");
+        CountDropped();
+        return;
+    }
+
+    if (rtp->GetPadding() && end > offset) {
+        end -= std::min<size_t>(data[end - 1], end - offset);
+    }
+    if (offset + 2 > end) {
+        LOGE("AAC packet too short");
+        CountDropped();
+        return;
+    }
+
+    size_t headersBits = (data[offset] << 8) | data[offset + 1];
+    offset += 2;
+    const uint8_t *auHeaders = data + offset;
+    size_t headersSize = (headersBits + 7) / 8;
+    if (headersBits == 0 || offset + headersSize > end) {
+        LOGE("invalid AU-headers-length %zu", headersBits);
+        CountDropped();
+        return;
+    }
+
+    size_t count = headersBits / AAC_HBR_AU_HEADER_BITS;
+    offset += headersSize;
+    for (size_t i = 0; i < count; i++) {
+        size_t auSize = ((auHeaders[2 * i] << 8) | auHeaders[2 * i + 1]) >> (16 - AAC_HBR_SIZE_LENGTH);
+        if (offset + auSize > end) {
+            // the first part of a fragmented AU, or a broken packet
+            LOGW("AU of %zu bytes exceeds the packet", auSize);
+            CountDropped();
+            return;
+        }
+
+        // zero-copy: the frame refers to the AU inside the RTP packet
+        auto frame = FramePool::Alloc(0);
+        frame->format = FRAME_FORMAT_AAC;
+        frame->audioInfo.channels = channels_;
+        frame->audioInfo.nbSamples = nbSamples_;
+        frame->audioInfo.sampleRate = sampleRate_;
+        frame->timestamp = rtp->GetTimestamp() + i * nbSamples_;
+
+        ADTSHeader header;
+        header.SetChannel(channels_).SetSamplingFrequency(sampleRate_).SetLength(auSize + 7);
+        frame->SetPrefix(&header, sizeof(header));
+        frame->AppendSlice(dataBuffer, offset, auSize);
+        offset += auSize;
+
+        if (depacketizeCallback_) {
+            depacketizeCallback_(frame);
+        }
     }
 }
 
@@ -6,12 +6,48 @@
 #define HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_AAC_H
 
 #include "rtp_packet.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
+// until the first frame tells the sample rate
+constexpr uint32_t AAC_CLOCK_RATE_DEFAULT = 48000;
+
+// RFC 3640 AAC-hbr: 16-bit AU headers of a 13-bit AU-size and a 3-bit AU-Index(-delta)
+constexpr size_t AAC_HBR_AU_HEADER_BITS = 16;
+constexpr size_t AAC_HBR_SIZE_LENGTH = 13;
+constexpr size_t AAC_MAX_AUS_PER_PACKET = 16;
+
+// Several consecutive AUs share one packet when a packet duration is set (RFC 3640 3.2.3.1). The RTP timestamp is
+// that of the first AU, the others follow it without gaps.
 class RtpPacketizerAAC : public RtpPacketizer {
 public:
+    RtpPacketizerAAC() : RtpPacketizer(AAC_CLOCK_RATE_DEFAULT) { pending_.reserve(AAC_MAX_AUS_PER_PACKET); }
+
     void Packetize(const std::shared_ptr<Frame> &frame) override;
+
+    // AUs are held until they cover `ms` of audio or fill a packet, 0 sends each AU on its own
+    void SetPacketDuration(uint32_t ms) { packetDurationMs_ = ms; }
+
+private:
+    void FlushPending();
+
+private:
+    struct PendingAu {
+        std::shared_ptr<Frame> frame;
+        size_t offset; // behind the ADTS header
+        size_t size;
+    };
+
+    uint32_t packetDurationMs_ = 0;
+    std::vector<PendingAu> pending_;
+    size_t pendingSize_ = 0; // AU data of pending_
+    uint32_t pendingTs_ = 0; // RTP timestamp of the first pending AU
+    uint32_t pendingSamples_ = 0;
 };
 
+// Every AU of a packet becomes one frame: an ADTS header prefix and a slice of the RTP packet.
 class RtpDepacketizerAAC : public RtpDepacketizer {
 public:
     void DepacketizeInner(std::shared_ptr<DataBuffer> dataBuffer) override;
@@ -3,11 +3,13 @@
 //
 
 #include "rtp_packet_h264.h"
+#include "common/frame_pool.h"
 #include "common/log.h"
-#include "common/utils.h"
 #include "rtp_packet.h"
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <mutex>
 #include <netinet/in.h>
@@ -27,95 +29,90 @@ static int PrefixSize(const uint8_t *p)
     return 0;
 }
 
-static const uint8_t *FindNextNal(const uint8_t *start, const uint8_t *end, int &nalSize)
+void RtpPacketizerH264::Packetize(const std::shared_ptr<Frame> &frame)
 {
-    while (start <= end - 3) {
-        if (start[0] == 0x00 && start[1] == 0x00) {
-            if (start[2] == 0x01) {
-                nalSize = 3;
-                return start;
-            } else if (start[2] == 0x00 && start[3] == 0x01) {
-                nalSize = 4;
-                return start;
-            }
+    LOGD("enter size: %zu", frame->TotalSize());
+
+    if (frame->IsScattered()) {
+        // a depacketized frame carries exactly one NAL unit behind its start code
+        uint8_t prefix[4] = {0};
+        frame->Read(0, prefix, sizeof(prefix));
+        size_t prefixLength = PrefixSize(prefix);
+        if (prefixLength > 0 && frame->TotalSize() > prefixLength) {
+            PacketizeNalu(*frame, prefixLength, frame->TotalSize() - prefixLength, clock_.ToRtp(frame->timestamp));
         }
-        ++start;
+        FlushBatch();
+        LOGD("leave");
+        return;
     }
-    return end;
-}
 
-static std::vector<std::tuple<const uint8_t *, size_t, int>> SplitH264Frame(const uint8_t *data, size_t length)
-{
-    std::vector<std::tuple<const uint8_t *, size_t, int>> frames;
-    const uint8_t *last = nullptr;
-    const uint8_t *current = data;
-    const uint8_t *end = data + length;
-    int prefixLength = 0, lastPrefixLength = 0;
-
-    while (current < end) {
-        current = FindNextNal(current, end, prefixLength);
-        if (last) {
-            frames.emplace_back(last, current - last, lastPrefixLength);
+    // all NAL units of the frame share its timestamp
+    uint32_t rtpTs = clock_.ToRtp(frame->timestamp);
+
+    // NAL units are visited in place, one start code search ahead
+    size_t cursor = 0;
+    NaluSpan nalu{};
+    while (scanner_.Next(frame->Data(), frame->Size(), cursor, nalu)) {
+        if (nalu.size > 0) {
+            PacketizeNalu(*frame, nalu.offset, nalu.size, rtpTs);
         }
-        last = current;
-        current += prefixLength;
-        lastPrefixLength = prefixLength;
     }
-
-    return frames;
+    FlushBatch();
+    LOGD("leave");
 }
 
-void RtpPacketizerH264::Packetize(const std::shared_ptr<Frame> &frame)
+void RtpPacketizerH264::PacketizeNalu(Frame &frame, size_t offset, size_t length, uint32_t rtpTs)
 {
-    LOGD("enter size: %zu", frame->Size());
-
-    auto frames = SplitH264Frame(frame->Data(), frame->Size());
-
-    for (auto &f : frames) {
-        const uint8_t *nalu = std::get<0>(f);
-        size_t size = std::get<1>(f);
-        int prefixLength = std::get<2>(f);
-
-        switch (NALU_TYPE(nalu[prefixLength])) {
-            case NALU_SPS:
-                if (sps_ == nullptr) {
-                    sps_ = std::make_unique<DataBuffer>();
-                    sps_->Assign(nalu + prefixLength, size - prefixLength);
-                }
-                break;
-            case NALU_PPS:
-                if (pps_ == nullptr) {
-                    pps_ = std::make_unique<DataBuffer>();
-                    pps_->Assign(nalu + prefixLength, size - prefixLength);
-                }
-                break;
-            case NALU_IDR:
-                MakeIDRPacket(nalu + prefixLength, size - prefixLength, frame->timestamp);
-                break;
-            default:
-                MakeFuAPacket(nalu + prefixLength, size - prefixLength, frame->timestamp);
-                break;
-        }
+    switch (NALU_TYPE(frame.At(offset))) {
+        case NALU_SPS:
+            if (sps_ == nullptr) {
+                sps_ = std::make_unique<DataBuffer>(length);
+                sps_->SetSize(length);
+                frame.Read(offset, sps_->Data(), length);
+            }
+            break;
+        case NALU_PPS:
+            if (pps_ == nullptr) {
+                pps_ = std::make_unique<DataBuffer>(length);
+                pps_->SetSize(length);
+                frame.Read(offset, pps_->Data(), length);
+            }
+            break;
+        case NALU_IDR:
+            MakeIDRPacket(frame, offset, length, rtpTs);
+            break;
+        default:
+            MakeFuAPacket(frame, offset, length, rtpTs);
+            break;
     }
-    LOGD("leave");
 }
 
-void RtpPacketizerH264::MakeIDRPacket(const uint8_t *data, size_t length, int64_t ts)
+void RtpPacketizerH264::MakeIDRPacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs)
 {
-    if (!sps_->Empty() && !pps_->Empty()) {
-        std::vector<std::pair<const uint8_t *, size_t>> nalus;
+    if (sps_ && pps_ && !sps_->Empty() && !pps_->Empty()) {
+        auto &nalus = stapNalus_;
+        nalus.clear();
         nalus.emplace_back(sps_->Data(), sps_->Size());
         nalus.emplace_back(pps_->Data(), pps_->Size());
 
         if (1 + 2 + sps_->Size() + 2 + pps_->Size() + 2 + length <= RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE) {
-            nalus.emplace_back(data, length);
-            MakeStapAPacket(nalus, ts);
+            if (frame.IsScattered()) {
+                if (!stapScratch_) {
+                    stapScratch_ = std::make_unique<DataBuffer>(RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE);
+                }
+                stapScratch_->SetSize(length);
+                frame.Read(offset, stapScratch_->Data(), length);
+                nalus.emplace_back(stapScratch_->Data(), length);
+            } else {
+                nalus.emplace_back(frame.Data() + offset, length);
+            }
+            MakeStapAPacket(nalus, rtpTs);
         } else {
-            MakeStapAPacket(nalus, ts);
-            MakeFuAPacket(data, length, ts);
+            MakeStapAPacket(nalus, rtpTs);
+            MakeFuAPacket(frame, offset, length, rtpTs);
         }
     } else {
-        MakeFuAPacket(data, length, ts);
+        MakeFuAPacket(frame, offset, length, rtpTs);
     }
 }
 
@@ -134,24 +131,21 @@ void RtpPacketizerH264::MakeIDRPacket(const uint8_t *data, size_t length, int64_
 //  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 //
 
-void RtpPacketizerH264::MakeSinglePacket(const uint8_t *data, size_t length, int64_t ts)
+void RtpPacketizerH264::MakeSinglePacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs)
 {
     if (length > RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE) {
         LOGE("data size [%zu] exceeded max packet payload size", length);
         return;
     }
 
-    std::shared_ptr<DataBuffer> rtpPacket = std::make_shared<DataBuffer>(length + RTP_PACKET_HEADER_DEFAULT_SIZE);
+    std::shared_ptr<DataBuffer> rtpPacket = AllocPacket(length);
     RtpHeader header;
-    int64_t now = Milliseconds();
-    uint32_t myts = (uint32_t)(now * (90000 / 1000));
-    FillRtpHeader(header, 96, myts, true); // fill header
+    FillRtpHeader(header, 96, rtpTs, true); // fill header
     rtpPacket->Assign(&header, header.GetHeaderLength());
-    rtpPacket->Append(data, length);
+    rtpPacket->SetSize(header.GetHeaderLength() + length);
+    frame.Read(offset, rtpPacket->Data() + header.GetHeaderLength(), length);
 
-    if (packetizeCallback_) {
-        packetizeCallback_(rtpPacket);
-    }
+    EmitPacket(rtpPacket);
 }
 
 //  STAP-A packet containing two single-time aggregation units
@@ -175,7 +169,7 @@ void RtpPacketizerH264::MakeSinglePacket(const uint8_t *data, size_t length, int
 //  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 //
 
-void RtpPacketizerH264::MakeStapAPacket(std::vector<std::pair<const uint8_t *, size_t>> nalus, int64_t ts)
+void RtpPacketizerH264::MakeStapAPacket(const std::vector<std::pair<const uint8_t *, size_t>> &nalus, uint32_t rtpTs)
 {
     size_t packetSize = 1;
     for (auto &nal : nalus) {
@@ -187,11 +181,9 @@ void RtpPacketizerH264::MakeStapAPacket(std::vector<std::pair<const uint8_t *, s
         return;
     }
 
-    std::shared_ptr<DataBuffer> rtpPacket = std::make_shared<DataBuffer>(packetSize + RTP_PACKET_HEADER_DEFAULT_SIZE);
+    std::shared_ptr<DataBuffer> rtpPacket = AllocPacket(packetSize);
     RtpHeader header;
-    int64_t now = Milliseconds();
-    uint32_t myts = (uint32_t)(now * (90000 / 1000));
-    FillRtpHeader(header, 96, myts, true); // fill header
+    FillRtpHeader(header, 96, rtpTs, true); // fill header
     rtpPacket->Assign(&header, header.GetHeaderLength());
 
     uint8_t stapAHeader = ((NALU_STAP_A & 0x1f) | (nalus[0].first[0] & 0x60)); // TYPE & NRI
@@ -204,9 +196,7 @@ void RtpPacketizerH264::MakeStapAPacket(std::vector<std::pair<const uint8_t *, s
         LOGD("append packet, size: %lu", nal.second);
     }
 
-    if (packetizeCallback_) {
-        packetizeCallback_(rtpPacket);
-    }
+    EmitPacket(rtpPacket);
 }
 
 //  RTP payload format for FU-A
@@ -240,57 +230,43 @@ void RtpPacketizerH264::MakeStapAPacket(std::vector<std::pair<const uint8_t *, s
 //   +---------------+
 //
 
-void RtpPacketizerH264::MakeFuAPacket(const uint8_t *data, size_t length, int64_t ts)
+void RtpPacketizerH264::MakeFuAPacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs)
 {
-    LOGD("nalu %02x-%02x-%02x-%02x, length: %zu", data[0], data[1], data[2], data[3], length);
+    LOGD("nalu type %d, length: %zu", NALU_TYPE(frame.At(offset)), length);
     if (length <= RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE) {
-        MakeSinglePacket(data, length, ts);
+        MakeSinglePacket(frame, offset, length, rtpTs);
         return;
     }
 
     RtpHeader header;
-    int64_t now = Milliseconds();
-    uint32_t myts = (uint32_t)(now * (90000 / 1000));
 
-    const uint8_t *p = data + 1;
-    uint8_t fuIndicator = (data[0] & 0x60) | (NALU_FU_A & 0x1f); // NRI & TYPE
-    int segmentLength = RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE - 2;
-    int segmentCount = (length - 1 + segmentLength - 1) / segmentLength;
+    uint8_t naluHeader = frame.At(offset);
+    size_t payloadOffset = offset + 1;
+    uint8_t fuIndicator = (naluHeader & 0x60) | (NALU_FU_A & 0x1f); // NRI & TYPE
+    size_t segmentLength = RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE - 2;
+    size_t segmentCount = (length - 1 + segmentLength - 1) / segmentLength;
 
     for (size_t i = 0; i < segmentCount; i++) {
-        std::shared_ptr<DataBuffer> rtpPacket = std::make_shared<DataBuffer>();
-        rtpPacket->SetCapacity(RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE + RTP_PACKET_HEADER_DEFAULT_SIZE);
+        bool last = (i == segmentCount - 1);
+        size_t payloadLength = last ? (length - 1 - segmentLength * i) : segmentLength;
 
-        if (i == segmentCount - 1) {
-            FillRtpHeader(header, 96, myts, true); // fill header
-        } else {
-            FillRtpHeader(header, 96, myts, false); // fill header
-        }
+        std::shared_ptr<DataBuffer> rtpPacket = AllocPacket(2 + payloadLength);
+
+        FillRtpHeader(header, 96, rtpTs, last); // fill header
         rtpPacket->Assign(&header, header.GetHeaderLength());
         rtpPacket->Append(fuIndicator);
 
         FUHeader fuHeader{};
-        fuHeader.type = data[0] & 0x1f;
-
-        if (i == segmentCount - 1) {
-            fuHeader.end = 1;
-            rtpPacket->Append(&fuHeader, 1);
-            rtpPacket->Append(p + segmentLength * i, (length - 1) % segmentLength);
-            if (packetizeCallback_) {
-                packetizeCallback_(rtpPacket);
-            }
-            break;
-        }
+        fuHeader.type = naluHeader & 0x1f;
+        fuHeader.start = (i == 0) ? 1 : 0;
+        fuHeader.end = last ? 1 : 0;
+        rtpPacket->Append(&fuHeader, 1);
 
-        if (i == 0) {
-            fuHeader.start = 1;
-        }
+        size_t headerSize = rtpPacket->Size();
+        rtpPacket->SetSize(headerSize + payloadLength);
+        frame.Read(payloadOffset + segmentLength * i, rtpPacket->Data() + headerSize, payloadLength);
 
-        rtpPacket->Append(&fuHeader, 1);
-        rtpPacket->Append(p + segmentLength * i, segmentLength);
-        if (packetizeCallback_) {
-            packetizeCallback_(rtpPacket);
-        }
+        EmitPacket(rtpPacket);
     }
 }
 
@@ -299,32 +275,46 @@ void RtpPacketizerH264::MakeFuAPacket(const uint8_t *data, size_t length, int64_
 //  |F|NRI|  Type   |
 //  +-+-+-+-+-+-+-+-+
 
+static inline uint16_t ReadU16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t ReadU24(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
 void RtpDepacketizerH264::DepacketizeInner(std::shared_ptr<DataBuffer> dataBuffer)
 {
     // LOGD("size: %zu", dataBuffer->Size());
-    auto p = dataBuffer->Data() + 12; // skip RTP Header
+    RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
+    if (dataBuffer->Size() <= (size_t)rtp->GetHeaderLength()) {
+        LOGE("empty RTP payload");
+        CountDropped();
+        return;
+    }
+    auto p = dataBuffer->Data() + rtp->GetHeaderLength(); // skip RTP Header
 
     uint8_t type = p[0] & 0x1f;
 
     switch (type) {
         case NALU_STAP_A:
-            LOGW("unsupported type STAP_A nal");
+            HandleStapPacket(dataBuffer, false);
             break;
         case NALU_STAP_B:
-            LOGE("unsupported type STAP-B nal");
+            HandleStapPacket(dataBuffer, true);
             break;
         case NALU_MTAP16:
-            LOGE("unsupported type MTAP16 nal");
+            HandleMtapPacket(dataBuffer, 2);
             break;
         case NALU_MTAP24:
-            LOGE("unsupported type MTAP24 nal");
+            HandleMtapPacket(dataBuffer, 3);
             break;
         case NALU_FU_A:
-            // LOGD("FU-A nal");
-            HandleFuAPacket(dataBuffer);
-            break;
         case NALU_FU_B:
-            LOGE("unsupported type FU-B nal");
+            // LOGD("FU nal");
+            HandleFuPacket(dataBuffer);
             break;
         default:
             if (type < 24) {
@@ -332,11 +322,20 @@ void RtpDepacketizerH264::DepacketizeInner(std::shared_ptr<DataBuffer> dataBuffe
                 HandleSinglePacket(dataBuffer);
             } else {
                 LOGE("Undefined type %d", type);
+                CountDropped();
             }
             break;
     }
 }
 
+void RtpDepacketizerH264::SetExtraData(void *extra)
+{
+    H264PacketizationInfo *info = (H264PacketizationInfo *)extra;
+    interleaved_ = (info->packetizationMode == 2);
+    interleavingDepth_ = std::min<uint32_t>(info->interleavingDepth, H264_DEINTERLEAVE_MAX_NALUS - 1);
+    deinterleave_.reserve(H264_DEINTERLEAVE_MAX_NALUS + 1);
+}
+
 void RtpDepacketizerH264::HandleSinglePacket(std::shared_ptr<DataBuffer> dataBuffer)
 {
     RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
@@ -347,11 +346,10 @@ void RtpDepacketizerH264::HandleSinglePacket(std::shared_ptr<DataBuffer> dataBuf
     auto *data = dataBuffer->Data() + rtp->GetHeaderLength();
     size_t length = dataBuffer->Size() - rtp->GetHeaderLength();
 
-    auto frame = std::make_shared<Frame>();
-    frame->SetCapacity(4 + length);
-
-    frame->Assign(gStartCode, sizeof(gStartCode));
-    frame->Append(data, length);
+    // zero-copy: the frame refers to the payload of the RTP packet
+    auto frame = FramePool::Alloc(0);
+    frame->SetPrefix(gStartCode, sizeof(gStartCode));
+    frame->AppendSlice(dataBuffer, rtp->GetHeaderLength(), length);
 
     frame->videoInfo.isKeyFrame = (NALU_TYPE(data[0]) == NALU_IDR);
     frame->format = FRAME_FORMAT_H264;
@@ -362,7 +360,142 @@ void RtpDepacketizerH264::HandleSinglePacket(std::shared_ptr<DataBuffer> dataBuf
     }
 }
 
-void RtpDepacketizerH264::HandleFuAPacket(std::shared_ptr<DataBuffer> dataBuffer)
+//  STAP-B packet, STAP-A has no DON field
+//
+//   0                   1                   2                   3
+//   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                          RTP Header                           |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |STAP-B NAL HDR | DON                           | NALU 1 Size   |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  | NALU 1 Size   | NALU 1 HDR    | NALU 1 Data                   |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+                               +
+//  :                                                               :
+//  +               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |               | NALU 2 Size                   | NALU 2 HDR    |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                       NALU 2 Data                             |
+//  :                                                               :
+//  |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                               :...OPTIONAL RTP padding        |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+//  The DON of each following NAL unit is one more than that of the previous one.
+
+void RtpDepacketizerH264::HandleStapPacket(std::shared_ptr<DataBuffer> dataBuffer, bool withDon)
+{
+    RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
+    LOGD("seq: %d, header length: %d", rtp->GetSeqNumber(), rtp->GetHeaderLength());
+
+    lastSeq_ = rtp->GetSeqNumber();
+    lastTs_ = rtp->GetTimestamp();
+    const uint8_t *data = dataBuffer->Data();
+    size_t end = dataBuffer->Size();
+    size_t offset = rtp->GetHeaderLength() + 1; // STAP NAL header
+
+    uint16_t don = don_ + 1;
+    if (withDon) {
+        if (offset + 2 > end) {
+            LOGE("STAP-B packet too short");
+            CountDropped();
+            return;
+        }
+        don = ReadU16(data + offset);
+        offset += 2;
+    }
+
+    while (offset + 2 <= end) {
+        size_t naluSize = ReadU16(data + offset);
+        offset += 2;
+        if (naluSize == 0 || offset + naluSize > end) {
+            LOGE("invalid aggregation unit size %zu", naluSize);
+            CountDropped();
+            return;
+        }
+
+        EmitNalu(dataBuffer, offset, naluSize, rtp->GetTimestamp(), don++);
+        offset += naluSize;
+    }
+}
+
+//  MTAP16 packet, the timestamp offset of MTAP24 is 24 bits
+//
+//   0                   1                   2                   3
+//   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                          RTP Header                           |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |MTAP16 NAL HDR |  decoding order number base   | NALU 1 Size   |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |  NALU 1 Size  |  NALU 1 DOND  |       NALU 1 TS offset        |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |  NALU 1 HDR   |  NALU 1 DATA                                  |
+//  +-+-+-+-+-+-+-+-+                                               +
+//  :                                                               :
+//  +               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |               | NALU 2 SIZE                   |  NALU 2 DOND  |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |       NALU 2 TS offset        |  NALU 2 HDR   |  NALU 2 DATA  |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  :                                                               :
+//  |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                               :...OPTIONAL RTP padding        |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+//  NALU size counts DOND and TS offset too. DON = DONB + DOND, timestamp = RTP timestamp + TS offset.
+
+void RtpDepacketizerH264::HandleMtapPacket(std::shared_ptr<DataBuffer> dataBuffer, size_t tsOffsetSize)
+{
+    RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
+    LOGD("seq: %d, header length: %d", rtp->GetSeqNumber(), rtp->GetHeaderLength());
+
+    lastSeq_ = rtp->GetSeqNumber();
+    lastTs_ = rtp->GetTimestamp();
+    const uint8_t *data = dataBuffer->Data();
+    size_t end = dataBuffer->Size();
+    size_t offset = rtp->GetHeaderLength() + 1; // MTAP NAL header
+    if (offset + 2 > end) {
+        LOGE("MTAP packet too short");
+        CountDropped();
+        return;
+    }
+
+    uint16_t donb = ReadU16(data + offset);
+    offset += 2;
+
+    size_t unitHeaderSize = 1 + tsOffsetSize; // DOND, TS offset
+    while (offset + 2 <= end) {
+        size_t unitSize = ReadU16(data + offset);
+        offset += 2;
+        if (unitSize <= unitHeaderSize || offset + unitSize > end) {
+            LOGE("invalid aggregation unit size %zu", unitSize);
+            CountDropped();
+            return;
+        }
+
+        uint16_t don = donb + data[offset];
+        uint32_t tsOffset = (tsOffsetSize == 2) ? ReadU16(data + offset + 1) : ReadU24(data + offset + 1);
+        EmitNalu(dataBuffer, offset + unitHeaderSize, unitSize - unitHeaderSize, rtp->GetTimestamp() + tsOffset, don);
+        offset += unitSize;
+    }
+}
+
+//  RTP payload format for FU-B, the DON field is only present in the first fragment
+//
+//   0                   1                   2                   3
+//   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  | FU indicator  |   FU header   |               DON             |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-|
+//  |                                                               |
+//  |                         FU payload                            |
+//  |                                                               |
+//  |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                               :...OPTIONAL RTP padding        |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+void RtpDepacketizerH264::HandleFuPacket(std::shared_ptr<DataBuffer> dataBuffer)
 {
     RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
     LOGD("seq: %d, header length: %d", rtp->GetSeqNumber(), rtp->GetHeaderLength());
@@ -373,6 +506,12 @@ void RtpDepacketizerH264::HandleFuAPacket(std::shared_ptr<DataBuffer> dataBuffer
     size_t length = dataBuffer->Size() - rtp->GetHeaderLength();
 
     uint8_t *fuIndicator = data;
+    size_t fuHeaderSize = (NALU_TYPE(*fuIndicator) == NALU_FU_B) ? 4 : 2;
+    if (length <= fuHeaderSize) {
+        LOGE("FU packet too short");
+        CountDropped();
+        return;
+    }
     FUHeader *fuHeader = (FUHeader *)(data + 1);
 
     if (seq != lastSeq_ + 1) {
@@ -384,8 +523,9 @@ void RtpDepacketizerH264::HandleFuAPacket(std::shared_ptr<DataBuffer> dataBuffer
         // not a nalu
         LOGW("lastTs != ts, this is new packet");
         PopCache();
+        fuDon_ = (fuHeaderSize == 4) ? ReadU16(data + 2) : (uint16_t)(don_ + 1);
         cache_.emplace(dataBuffer);
-        cacheDataLength_ = 1 + length - 2; // - sizeof(fuIndicator) - sizeof(fuHeader) + nalu type field size
+        cacheDataLength_ = 1 + length - fuHeaderSize; // - sizeof(fuIndicator) - sizeof(fuHeader) + nalu type field size
     } else {
         if (fuHeader->end == 1) {
             // last packet
@@ -394,10 +534,11 @@ void RtpDepacketizerH264::HandleFuAPacket(std::shared_ptr<DataBuffer> dataBuffer
             LOGW("last packet");
             PopCache();
         } else if (fuHeader->start == 1) {
-            LOGW("start fu-a");
+            LOGW("start fu");
             PopCache();
+            fuDon_ = (fuHeaderSize == 4) ? ReadU16(data + 2) : (uint16_t)(don_ + 1);
             cache_.emplace(dataBuffer);
-            cacheDataLength_ = 1 + length - 2; // - sizeof(fuIndicator) - sizeof(fuHeader) + nalu type field size
+            cacheDataLength_ = 1 + length - fuHeaderSize; // - sizeof(fuIndicator) - sizeof(fuHeader) + nalu type field size
         } else {
             cache_.emplace(dataBuffer);
             cacheDataLength_ += (length - 2); // - sizeof(fuIndicator) - sizeof(fuHeader) + nalu type field size
@@ -423,30 +564,92 @@ void RtpDepacketizerH264::PopCache()
     FUHeader *fuHeader = (FUHeader *)(data + 1);
     if (fuHeader->start != 1) {
         LOGE("Can't find FU-A fisrt packet");
+        CountDropped(cache_.size() + 1);
         std::queue<std::shared_ptr<DataBuffer>> empty;
         cache_.swap(empty);
         return;
     }
 
-    auto frame = std::make_shared<Frame>();
-    frame->SetCapacity(cacheDataLength_ + sizeof(gStartCode));
+    // zero-copy: the frame refers to the fragments of the cached RTP packets
+    auto frame = FramePool::Alloc(0);
     frame->format = FRAME_FORMAT_H264;
     frame->videoInfo.isKeyFrame = (fuHeader->type == NALU_IDR);
     frame->timestamp = rtp->GetTimestamp();
 
-    uint8_t naluHeader = ((data[0] & 0xe0) | (data[1] & 0x1f));
-    frame->Assign(gStartCode, sizeof(gStartCode));
-    frame->Append(naluHeader);
-    frame->Append(data + 2, startRtpPacket->Size() - rtp->GetHeaderLength() - 2);
+    uint8_t prefix[sizeof(gStartCode) + 1];
+    memcpy(prefix, gStartCode, sizeof(gStartCode));
+    prefix[sizeof(gStartCode)] = ((data[0] & 0xe0) | (data[1] & 0x1f)); // NAL header
+    frame->SetPrefix(prefix, sizeof(prefix));
+    size_t fuHeaderSize = (NALU_TYPE(data[0]) == NALU_FU_B) ? 4 : 2; // FU-B carries the DON
+    frame->AppendSlice(startRtpPacket, rtp->GetHeaderLength() + fuHeaderSize,
+                       startRtpPacket->Size() - rtp->GetHeaderLength() - fuHeaderSize);
 
     while (!cache_.empty()) {
         auto packet = cache_.front();
         RtpHeader *rtp = (RtpHeader *)packet->Data();
-        frame->Append(packet->Data() + rtp->GetHeaderLength() + 2, packet->Size() - rtp->GetHeaderLength() - 2);
+        frame->AppendSlice(packet, rtp->GetHeaderLength() + 2, packet->Size() - rtp->GetHeaderLength() - 2);
         cache_.pop();
     }
 
-    if (depacketizeCallback_) {
+    OutputFrame(frame, fuDon_);
+}
+
+void RtpDepacketizerH264::EmitNalu(const std::shared_ptr<DataBuffer> &packet, size_t offset, size_t length,
+                                   uint32_t ts, uint16_t don)
+{
+    // zero-copy: the frame refers to the aggregation unit inside the RTP packet
+    auto frame = FramePool::Alloc(0);
+    frame->SetPrefix(gStartCode, sizeof(gStartCode));
+    frame->AppendSlice(packet, offset, length);
+
+    frame->videoInfo.isKeyFrame = (NALU_TYPE(packet->Data()[offset]) == NALU_IDR);
+    frame->format = FRAME_FORMAT_H264;
+    frame->timestamp = ts;
+
+    OutputFrame(frame, don);
+}
+
+void RtpDepacketizerH264::OutputFrame(std::shared_ptr<Frame> frame, uint16_t don)
+{
+    don_ = don;
+    if (interleaved_) {
+        Deinterleave(frame, don);
+    } else if (depacketizeCallback_) {
         depacketizeCallback_(frame);
     }
-}
\ No newline at end of file
+}
+
+// RFC 6184 13.3: a NAL unit is output once more than sprop-interleaving-depth VCL NAL units wait behind it, always
+// the one with the lowest DON. DONs are compared modulo 2^16.
+void RtpDepacketizerH264::Deinterleave(std::shared_ptr<Frame> frame, uint16_t don)
+{
+    if (donOutput_ && (int16_t)(don - lastOutputDon_) <= 0) {
+        LOGW("NAL unit DON %d arrived after DON %d was output, dropped", don, lastOutputDon_);
+        CountDropped();
+        return;
+    }
+
+    uint8_t type = NALU_TYPE(frame->At(sizeof(gStartCode)));
+    bool vcl = (type >= NALU_SLICE_NON_IDR && type <= NALU_IDR);
+    deinterleave_.push_back({don, vcl, std::move(frame)});
+    pendingVcl_ += vcl ? 1 : 0;
+
+    while (pendingVcl_ > interleavingDepth_ || deinterleave_.size() > H264_DEINTERLEAVE_MAX_NALUS) {
+        auto lowest = deinterleave_.begin();
+        for (auto it = deinterleave_.begin() + 1; it != deinterleave_.end(); ++it) {
+            if ((int16_t)(it->don - lowest->don) < 0) {
+                lowest = it;
+            }
+        }
+
+        auto output = std::move(lowest->frame);
+        lastOutputDon_ = lowest->don;
+        donOutput_ = true;
+        pendingVcl_ -= lowest->vcl ? 1 : 0;
+        deinterleave_.erase(lowest);
+
+        if (depacketizeCallback_) {
+            depacketizeCallback_(output);
+        }
+    }
+}
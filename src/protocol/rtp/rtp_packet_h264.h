@@ -6,6 +6,7 @@
 #define HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_H264_H
 
 #include "../../common/data_buffer.h"
+#include "../annexb/annexb_scanner.h"
 #include "rtp_packet.h"
 #include <cstdint>
 #include <memory>
@@ -62,37 +63,81 @@ struct FUHeader {
     uint8_t start : 1;
 };
 
+constexpr uint32_t H264_CLOCK_RATE = 90000;
+
+// upper bound of NAL units held for DON ordering, whatever sprop-interleaving-depth says
+constexpr size_t H264_DEINTERLEAVE_MAX_NALUS = 128;
+
+// From the fmtp line of the SDP, passed to RtpDepacketizerH264::SetExtraData()
+struct H264PacketizationInfo {
+    int packetizationMode;      // 0 single NAL unit, 1 non-interleaved, 2 interleaved
+    uint32_t interleavingDepth; // sprop-interleaving-depth, VCL NAL units that may precede another in DON order
+};
+
 class RtpPacketizerH264 : public RtpPacketizer {
 public:
+    RtpPacketizerH264() : RtpPacketizer(H264_CLOCK_RATE) {}
+
     void Packetize(const std::shared_ptr<Frame> &frame) override;
 
 private:
-    void MakeIDRPacket(const uint8_t *data, size_t length, int64_t ts);
-    void MakeSinglePacket(const uint8_t *data, size_t length, int64_t ts);
-    void MakeStapAPacket(std::vector<std::pair<const uint8_t *, size_t>>, int64_t ts);
-    void MakeFuAPacket(const uint8_t *data, size_t length, int64_t ts);
+    // NAL units are addressed by offset into the frame so that scattered frames are read without flattening
+    void PacketizeNalu(Frame &frame, size_t offset, size_t length, uint32_t rtpTs);
+    void MakeIDRPacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs);
+    void MakeSinglePacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs);
+    void MakeStapAPacket(const std::vector<std::pair<const uint8_t *, size_t>> &nalus, uint32_t rtpTs);
+    void MakeFuAPacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs);
 
 private:
     std::unique_ptr<DataBuffer> sps_;
     std::unique_ptr<DataBuffer> pps_;
+    std::unique_ptr<DataBuffer> stapScratch_; // small IDR of a scattered frame, gathered for STAP-A
+    AnnexbScanner scanner_;
+    std::vector<std::pair<const uint8_t *, size_t>> stapNalus_; // reused by MakeIDRPacket()
 };
 
+// Aggregation packets (STAP-A/B, MTAP16/24) are split into one frame per NAL unit that refers to the RTP packet,
+// nothing is copied. In interleaved mode NAL units are delivered in decoding order number (DON) order.
 class RtpDepacketizerH264 : public RtpDepacketizer {
 public:
     void DepacketizeInner(std::shared_ptr<DataBuffer> dataBuffer) override;
+    // H264PacketizationInfo
+    void SetExtraData(void *extra) override;
 
 private:
     void HandleSinglePacket(std::shared_ptr<DataBuffer> dataBuffer);
-    void HandleFuAPacket(std::shared_ptr<DataBuffer> dataBuffer);
+    void HandleStapPacket(std::shared_ptr<DataBuffer> dataBuffer, bool withDon);
+    void HandleMtapPacket(std::shared_ptr<DataBuffer> dataBuffer, size_t tsOffsetSize);
+    // FU-A, and FU-B which only starts a fragmented NAL unit in interleaved mode
+    void HandleFuPacket(std::shared_ptr<DataBuffer> dataBuffer);
 
     void PopCache();
 
+    void EmitNalu(const std::shared_ptr<DataBuffer> &packet, size_t offset, size_t length, uint32_t ts, uint16_t don);
+    void OutputFrame(std::shared_ptr<Frame> frame, uint16_t don);
+    void Deinterleave(std::shared_ptr<Frame> frame, uint16_t don);
+
 private:
     uint16_t lastSeq_;
     uint32_t lastTs_;
     int cacheDataLength_;
     std::mutex mutex_;
     std::queue<std::shared_ptr<DataBuffer>> cache_;
+
+    struct PendingNalu {
+        uint16_t don;
+        bool vcl;
+        std::shared_ptr<Frame> frame;
+    };
+
+    bool interleaved_ = false;
+    uint32_t interleavingDepth_ = 0;
+    uint16_t don_ = 0;   // DON of the last NAL unit received
+    uint16_t fuDon_ = 0; // DON of the NAL unit being reassembled
+    bool donOutput_ = false;
+    uint16_t lastOutputDon_ = 0;
+    size_t pendingVcl_ = 0;
+    std::vector<PendingNalu> deinterleave_;
 };
 
 #endif // HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_H264_H
\ No newline at end of file
@@ -0,0 +1,473 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "rtp_packet_h265.h"
+#include "common/frame_pool.h"
+#include "common/log.h"
+#include "rtp_packet.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <vector>
+
+const char gStartCode[4] = {0x00, 0x00, 0x00, 0x01};
+
+static int PrefixSize(const uint8_t *p)
+{
+    if (p[0] == 0x00 && p[1] == 0x00) {
+        if (p[2] == 0x01) {
+            return 3;
+        } else if (p[2] == 0x00 && p[3] == 0x01) {
+            return 4;
+        }
+    }
+    return 0;
+}
+
+void RtpPacketizerH265::Packetize(const std::shared_ptr<Frame> &frame)
+{
+    LOGD("enter size: %zu", frame->TotalSize());
+
+    if (frame->IsScattered()) {
+        // a depacketized frame carries exactly one NAL unit behind its start code
+        uint8_t prefix[4] = {0};
+        frame->Read(0, prefix, sizeof(prefix));
+        size_t prefixLength = PrefixSize(prefix);
+        if (prefixLength > 0 && frame->TotalSize() > prefixLength + 2) {
+            PacketizeNalu(*frame, prefixLength, frame->TotalSize() - prefixLength, clock_.ToRtp(frame->timestamp));
+        }
+        FlushBatch();
+        LOGD("leave");
+        return;
+    }
+
+    // all NAL units of the frame share its timestamp
+    uint32_t rtpTs = clock_.ToRtp(frame->timestamp);
+
+    size_t cursor = 0;
+    NaluSpan nalu{};
+    while (scanner_.Next(frame->Data(), frame->Size(), cursor, nalu)) {
+        if (nalu.size > 2) {
+            PacketizeNalu(*frame, nalu.offset, nalu.size, rtpTs);
+        }
+    }
+    FlushBatch();
+    LOGD("leave");
+}
+
+void RtpPacketizerH265::PacketizeNalu(Frame &frame, size_t offset, size_t length, uint32_t rtpTs)
+{
+    uint8_t type = HEVC_NALU_TYPE(frame.At(offset));
+    switch (type) {
+        case HEVC_NALU_VPS:
+            SaveParameterSet(vps_, frame, offset, length);
+            break;
+        case HEVC_NALU_SPS:
+            SaveParameterSet(sps_, frame, offset, length);
+            break;
+        case HEVC_NALU_PPS:
+            SaveParameterSet(pps_, frame, offset, length);
+            break;
+        default:
+            if (HEVC_IS_IRAP(type)) {
+                MakeIrapPacket(frame, offset, length, rtpTs);
+            } else {
+                MakeFuPacket(frame, offset, length, rtpTs);
+            }
+            break;
+    }
+}
+
+void RtpPacketizerH265::SaveParameterSet(std::unique_ptr<DataBuffer> &parameterSet, Frame &frame, size_t offset,
+                                         size_t length)
+{
+    // parameter sets may change between sequences, the buffer is only replaced when it is too small
+    if (parameterSet == nullptr || parameterSet->Capacity() < length) {
+        parameterSet = std::make_unique<DataBuffer>(length);
+    }
+    parameterSet->SetSize(length);
+    frame.Read(offset, parameterSet->Data(), length);
+}
+
+void RtpPacketizerH265::MakeIrapPacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs)
+{
+    if (!vps_ || !sps_ || !pps_ || vps_->Empty() || sps_->Empty() || pps_->Empty()) {
+        MakeFuPacket(frame, offset, length, rtpTs);
+        return;
+    }
+
+    auto &nalus = apNalus_;
+    nalus.clear();
+    nalus.emplace_back(vps_->Data(), vps_->Size());
+    nalus.emplace_back(sps_->Data(), sps_->Size());
+    nalus.emplace_back(pps_->Data(), pps_->Size());
+
+    if (2 + 2 + vps_->Size() + 2 + sps_->Size() + 2 + pps_->Size() + 2 + length <=
+        RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE) {
+        if (frame.IsScattered()) {
+            if (!apScratch_) {
+                apScratch_ = std::make_unique<DataBuffer>(RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE);
+            }
+            apScratch_->SetSize(length);
+            frame.Read(offset, apScratch_->Data(), length);
+            nalus.emplace_back(apScratch_->Data(), length);
+        } else {
+            nalus.emplace_back(frame.Data() + offset, length);
+        }
+        MakeApPacket(nalus, rtpTs);
+    } else {
+        MakeApPacket(nalus, rtpTs);
+        MakeFuPacket(frame, offset, length, rtpTs);
+    }
+}
+
+//  RTP payload format for single NAL unit packet
+//
+//   0                   1                   2                   3
+//   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |           PayloadHdr          |      DONL (conditional)       |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                                                               |
+//  |                  NAL unit payload data                        |
+//  |                                                               |
+//  |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                               :...OPTIONAL RTP padding        |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+
+void RtpPacketizerH265::MakeSinglePacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs)
+{
+    if (length > RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE) {
+        LOGE("data size [%zu] exceeded max packet payload size", length);
+        return;
+    }
+
+    std::shared_ptr<DataBuffer> rtpPacket = AllocPacket(length);
+    RtpHeader header;
+    FillRtpHeader(header, 96, rtpTs, true); // fill header
+    rtpPacket->Assign(&header, header.GetHeaderLength());
+    rtpPacket->SetSize(header.GetHeaderLength() + length);
+    frame.Read(offset, rtpPacket->Data() + header.GetHeaderLength(), length);
+
+    EmitPacket(rtpPacket);
+}
+
+//  AP containing two aggregation units, without DONL and DOND fields
+//
+//   0                   1                   2                   3
+//   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                          RTP Header                           |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |   PayloadHdr (Type=48)        |         NALU 1 Size           |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |          NALU 1 HDR           |                               |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+         NALU 1 Data           |
+//  |                   . . .                                       |
+//  |                                                               |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |  . . .                        | NALU 2 Size                   |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |          NALU 2 HDR           |                               |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+          NALU 2 Data          |
+//  |                   . . .                                       |
+//  |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                               :...OPTIONAL RTP padding        |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+
+void RtpPacketizerH265::MakeApPacket(const std::vector<std::pair<const uint8_t *, size_t>> &nalus, uint32_t rtpTs)
+{
+    size_t packetSize = 2;
+    for (auto &nal : nalus) {
+        packetSize += (2 + nal.second);
+    }
+
+    if (packetSize > RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE) {
+        LOGE("data size [%zu] exceeded max packet payload size", packetSize);
+        return;
+    }
+
+    std::shared_ptr<DataBuffer> rtpPacket = AllocPacket(packetSize);
+    RtpHeader header;
+    FillRtpHeader(header, 96, rtpTs, true); // fill header
+    rtpPacket->Assign(&header, header.GetHeaderLength());
+
+    // F, LayerId and TID of the first NAL unit
+    uint8_t payloadHeader[2] = {(uint8_t)((nalus[0].first[0] & 0x81) | (HEVC_NALU_AP << 1)), nalus[0].first[1]};
+    rtpPacket->Append(payloadHeader, sizeof(payloadHeader));
+
+    for (auto &nal : nalus) {
+        uint16_t nalSize = htons(nal.second);
+        rtpPacket->Append(&nalSize, sizeof(nalSize));
+        rtpPacket->Append(nal.first, nal.second);
+        LOGD("append packet, size: %lu", nal.second);
+    }
+
+    EmitPacket(rtpPacket);
+}
+
+//  RTP payload format for FU
+//
+//   0                   1                   2                   3
+//   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |    PayloadHdr (Type=49)       |   FU header   | DONL (cond)   |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-|
+//  | DONL (cond)   |                                               |
+//  |-+-+-+-+-+-+-+-+                                               |
+//  |                         FU payload                            |
+//  |                                                               |
+//  |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//  |                               :...OPTIONAL RTP padding        |
+//  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+
+void RtpPacketizerH265::MakeFuPacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs)
+{
+    LOGD("nalu type %d, length: %zu", HEVC_NALU_TYPE(frame.At(offset)), length);
+    if (length <= RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE) {
+        MakeSinglePacket(frame, offset, length, rtpTs);
+        return;
+    }
+
+    RtpHeader header;
+
+    uint8_t naluHeader[2] = {frame.At(offset), frame.At(offset + 1)};
+    size_t payloadOffset = offset + 2;
+    uint8_t payloadHeader[2] = {(uint8_t)((naluHeader[0] & 0x81) | (HEVC_NALU_FU << 1)), naluHeader[1]};
+    size_t segmentLength = RTP_OVER_UDP_PACKET_PAYLOAD_MAX_SIZE - 3;
+    size_t segmentCount = (length - 2 + segmentLength - 1) / segmentLength;
+
+    for (size_t i = 0; i < segmentCount; i++) {
+        bool last = (i == segmentCount - 1);
+        size_t payloadLength = last ? (length - 2 - segmentLength * i) : segmentLength;
+
+        std::shared_ptr<DataBuffer> rtpPacket = AllocPacket(3 + payloadLength);
+
+        FillRtpHeader(header, 96, rtpTs, last); // fill header
+        rtpPacket->Assign(&header, header.GetHeaderLength());
+        rtpPacket->Append(payloadHeader, sizeof(payloadHeader));
+
+        HevcFUHeader fuHeader{};
+        fuHeader.type = HEVC_NALU_TYPE(naluHeader[0]);
+        fuHeader.start = (i == 0) ? 1 : 0;
+        fuHeader.end = last ? 1 : 0;
+        rtpPacket->Append(&fuHeader, 1);
+
+        size_t headerSize = rtpPacket->Size();
+        rtpPacket->SetSize(headerSize + payloadLength);
+        frame.Read(payloadOffset + segmentLength * i, rtpPacket->Data() + headerSize, payloadLength);
+
+        EmitPacket(rtpPacket);
+    }
+}
+
+void RtpDepacketizerH265::DepacketizeInner(std::shared_ptr<DataBuffer> dataBuffer)
+{
+    RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
+    if (dataBuffer->Size() <= (size_t)rtp->GetHeaderLength() + 2) {
+        LOGE("RTP payload too short");
+        CountDropped();
+        return;
+    }
+    auto p = dataBuffer->Data() + rtp->GetHeaderLength(); // skip RTP Header
+
+    uint8_t type = HEVC_NALU_TYPE(p[0]);
+
+    switch (type) {
+        case HEVC_NALU_AP:
+            HandleApPacket(dataBuffer);
+            break;
+        case HEVC_NALU_FU:
+            HandleFuPacket(dataBuffer);
+            break;
+        case HEVC_NALU_PACI:
+            LOGE("unsupported type PACI nal");
+            CountDropped();
+            break;
+        default:
+            if (type < HEVC_NALU_AP) {
+                HandleSinglePacket(dataBuffer);
+            } else {
+                LOGE("Undefined type %d", type);
+                CountDropped();
+            }
+            break;
+    }
+}
+
+void RtpDepacketizerH265::SetExtraData(void *extra)
+{
+    H265PacketizationInfo *info = (H265PacketizationInfo *)extra;
+    donlPresent_ = (info->maxDonDiff > 0);
+}
+
+void RtpDepacketizerH265::HandleSinglePacket(std::shared_ptr<DataBuffer> dataBuffer)
+{
+    RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
+    LOGD("seq: %d, header length: %d", rtp->GetSeqNumber(), rtp->GetHeaderLength());
+
+    lastSeq_ = rtp->GetSeqNumber();
+    size_t offset = rtp->GetHeaderLength();
+    size_t length = dataBuffer->Size() - offset;
+    if (!donlPresent_) {
+        EmitNalu(dataBuffer, nullptr, offset, length, rtp->GetTimestamp());
+        return;
+    }
+
+    if (length <= 4) {
+        LOGE("single NAL unit packet too short");
+        CountDropped();
+        return;
+    }
+    // the DONL field sits between the NAL unit header and its payload
+    EmitNalu(dataBuffer, dataBuffer->Data() + offset, offset + 4, length - 4, rtp->GetTimestamp());
+}
+
+void RtpDepacketizerH265::HandleApPacket(std::shared_ptr<DataBuffer> dataBuffer)
+{
+    RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
+    LOGD("seq: %d, header length: %d", rtp->GetSeqNumber(), rtp->GetHeaderLength());
+
+    lastSeq_ = rtp->GetSeqNumber();
+    const uint8_t *data = dataBuffer->Data();
+    size_t end = dataBuffer->Size();
+    size_t offset = rtp->GetHeaderLength() + 2; // PayloadHdr
+
+    bool first = true;
+    while (offset < end) {
+        if (donlPresent_) {
+            offset += first ? 2 : 1; // DONL, DOND
+        }
+        first = false;
+        if (offset + 2 > end) {
+            LOGE("invalid aggregation unit");
+            CountDropped();
+            return;
+        }
+
+        size_t naluSize = (data[offset] << 8) | data[offset + 1];
+        offset += 2;
+        if (naluSize <= 2 || offset + naluSize > end) {
+            LOGE("invalid aggregation unit size %zu", naluSize);
+            CountDropped();
+            return;
+        }
+
+        EmitNalu(dataBuffer, nullptr, offset, naluSize, rtp->GetTimestamp());
+        offset += naluSize;
+    }
+}
+
+void RtpDepacketizerH265::HandleFuPacket(std::shared_ptr<DataBuffer> dataBuffer)
+{
+    RtpHeader *rtp = (RtpHeader *)dataBuffer->Data();
+    LOGD("seq: %d, header length: %d", rtp->GetSeqNumber(), rtp->GetHeaderLength());
+
+    uint16_t seq = rtp->GetSeqNumber();
+    auto *data = dataBuffer->Data() + rtp->GetHeaderLength();
+    size_t length = dataBuffer->Size() - rtp->GetHeaderLength();
+    HevcFUHeader *fuHeader = (HevcFUHeader *)(data + 2);
+
+    size_t fuHeaderSize = (fuHeader->start == 1 && donlPresent_) ? 5 : 3;
+    if (length <= fuHeaderSize) {
+        LOGE("FU packet too short");
+        CountDropped();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fuHeader->start == 1) {
+        if (!cache_.empty()) {
+            LOGW("FU without end fragment dropped");
+            CountDropped(cache_.size());
+            std::queue<std::shared_ptr<DataBuffer>> empty;
+            cache_.swap(empty);
+        }
+        cache_.emplace(dataBuffer);
+    } else if (cache_.empty()) {
+        LOGW("Can't find FU first packet, seq: %d", seq);
+        CountDropped();
+    } else if (seq != (uint16_t)(lastSeq_ + 1)) {
+        LOGW("Packet loss occurred, last: %d, now: %d", lastSeq_, seq);
+        CountDropped(cache_.size() + 1);
+        std::queue<std::shared_ptr<DataBuffer>> empty;
+        cache_.swap(empty);
+    } else {
+        cache_.emplace(dataBuffer);
+        if (fuHeader->end == 1) {
+            PopCache();
+        }
+    }
+
+    lastSeq_ = seq;
+}
+
+void RtpDepacketizerH265::PopCache()
+{
+    auto startRtpPacket = cache_.front();
+    cache_.pop();
+
+    RtpHeader *rtp = (RtpHeader *)startRtpPacket->Data();
+    auto data = startRtpPacket->Data() + rtp->GetHeaderLength();
+    HevcFUHeader *fuHeader = (HevcFUHeader *)(data + 2);
+
+    // zero-copy: the frame refers to the fragments of the cached RTP packets
+    auto frame = FramePool::Alloc(0);
+    frame->format = FRAME_FORMAT_H265;
+    frame->videoInfo.isKeyFrame = HEVC_IS_IRAP(fuHeader->type);
+    frame->timestamp = rtp->GetTimestamp();
+
+    uint8_t prefix[sizeof(gStartCode) + 2];
+    memcpy(prefix, gStartCode, sizeof(gStartCode));
+    prefix[sizeof(gStartCode)] = (data[0] & 0x81) | (fuHeader->type << 1); // NAL unit header
+    prefix[sizeof(gStartCode) + 1] = data[1];
+    frame->SetPrefix(prefix, sizeof(prefix));
+    size_t fuHeaderSize = donlPresent_ ? 5 : 3;
+    frame->AppendSlice(startRtpPacket, rtp->GetHeaderLength() + fuHeaderSize,
+                       startRtpPacket->Size() - rtp->GetHeaderLength() - fuHeaderSize);
+
+    while (!cache_.empty()) {
+        auto packet = cache_.front();
+        RtpHeader *rtp = (RtpHeader *)packet->Data();
+        frame->AppendSlice(packet, rtp->GetHeaderLength() + 3, packet->Size() - rtp->GetHeaderLength() - 3);
+        cache_.pop();
+    }
+
+    if (depacketizeCallback_) {
+        depacketizeCallback_(frame);
+    }
+}
+
+void RtpDepacketizerH265::EmitNalu(const std::shared_ptr<DataBuffer> &packet, const uint8_t *header, size_t offset,
+                                   size_t length, uint32_t ts)
+{
+    // zero-copy: the frame refers to the NAL unit inside the RTP packet
+    auto frame = FramePool::Alloc(0);
+    uint8_t type;
+    if (header) {
+        uint8_t prefix[sizeof(gStartCode) + 2];
+        memcpy(prefix, gStartCode, sizeof(gStartCode));
+        memcpy(prefix + sizeof(gStartCode), header, 2);
+        frame->SetPrefix(prefix, sizeof(prefix));
+        type = HEVC_NALU_TYPE(header[0]);
+    } else {
+        frame->SetPrefix(gStartCode, sizeof(gStartCode));
+        type = HEVC_NALU_TYPE(packet->Data()[offset]);
+    }
+    frame->AppendSlice(packet, offset, length);
+
+    frame->videoInfo.isKeyFrame = HEVC_IS_IRAP(type);
+    frame->format = FRAME_FORMAT_H265;
+    frame->timestamp = ts;
+
+    if (depacketizeCallback_) {
+        depacketizeCallback_(frame);
+    }
+}
@@ -0,0 +1,124 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_H265_H
+#define HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_H265_H
+
+#include "../../common/data_buffer.h"
+#include "../annexb/annexb_scanner.h"
+#include "rtp_packet.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <utility>
+#include <vector>
+
+//
+//  HEVC NAL Unit Header
+//
+//    +---------------+---------------+
+//    |0|1|2|3|4|5|6|7|0|1|2|3|4|5|6|7|
+//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//    |F|   Type    |  LayerId  | TID |
+//    +-------------+-----------------+
+
+#define HEVC_NALU_TYPE(octet) ((((octet) >> 1) & 0x3f))
+
+enum HevcNaluType {
+    HEVC_NALU_TRAIL_N = 0,
+    HEVC_NALU_TRAIL_R = 1,
+    HEVC_NALU_BLA_W_LP = 16, // first IRAP type
+    HEVC_NALU_BLA_W_RADL = 17,
+    HEVC_NALU_BLA_N_LP = 18,
+    HEVC_NALU_IDR_W_RADL = 19,
+    HEVC_NALU_IDR_N_LP = 20,
+    HEVC_NALU_CRA = 21,
+    HEVC_NALU_RSV_IRAP_23 = 23, // last IRAP type
+    HEVC_NALU_VPS = 32,         // Video parameter set
+    HEVC_NALU_SPS = 33,         // Sequence parameter set
+    HEVC_NALU_PPS = 34,         // Picture parameter set
+    HEVC_NALU_AUD = 35,         // Access unit delimiter
+    HEVC_NALU_SEI_PREFIX = 39,
+    HEVC_NALU_SEI_SUFFIX = 40,
+    HEVC_NALU_AP = 48,   // Aggregation packet
+    HEVC_NALU_FU = 49,   // Fragmentation unit
+    HEVC_NALU_PACI = 50, // PACI packet
+};
+
+#define HEVC_IS_IRAP(type) ((type) >= HEVC_NALU_BLA_W_LP && (type) <= HEVC_NALU_RSV_IRAP_23)
+
+//  FU header
+//
+//   +---------------+
+//   |0|1|2|3|4|5|6|7|
+//   +-+-+-+-+-+-+-+-+
+//   |S|E|  FuType   |
+//   +---------------+
+//
+
+struct HevcFUHeader {
+    uint8_t type : 6;
+    uint8_t end : 1;
+    uint8_t start : 1;
+};
+
+constexpr uint32_t H265_CLOCK_RATE = 90000;
+
+// From the fmtp line of the SDP, passed to RtpDepacketizerH265::SetExtraData()
+struct H265PacketizationInfo {
+    uint32_t maxDonDiff; // sprop-max-don-diff, packets carry DONL/DOND fields when it is not 0
+};
+
+// RFC 7798. VPS, SPS and PPS are held back and sent in an aggregation packet in front of each IRAP picture.
+class RtpPacketizerH265 : public RtpPacketizer {
+public:
+    RtpPacketizerH265() : RtpPacketizer(H265_CLOCK_RATE) {}
+
+    void Packetize(const std::shared_ptr<Frame> &frame) override;
+
+private:
+    void PacketizeNalu(Frame &frame, size_t offset, size_t length, uint32_t rtpTs);
+    void SaveParameterSet(std::unique_ptr<DataBuffer> &parameterSet, Frame &frame, size_t offset, size_t length);
+    void MakeIrapPacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs);
+    void MakeSinglePacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs);
+    void MakeApPacket(const std::vector<std::pair<const uint8_t *, size_t>> &nalus, uint32_t rtpTs);
+    void MakeFuPacket(Frame &frame, size_t offset, size_t length, uint32_t rtpTs);
+
+private:
+    std::unique_ptr<DataBuffer> vps_;
+    std::unique_ptr<DataBuffer> sps_;
+    std::unique_ptr<DataBuffer> pps_;
+    std::unique_ptr<DataBuffer> apScratch_; // small IRAP of a scattered frame, gathered for the AP
+    AnnexbScanner scanner_;
+    std::vector<std::pair<const uint8_t *, size_t>> apNalus_; // reused by MakeIrapPacket()
+};
+
+// Single NAL unit packets, APs and FUs, each NAL unit becomes one frame referring to the RTP packets.
+// DONL/DOND fields are skipped, NAL units are delivered in transmission order.
+class RtpDepacketizerH265 : public RtpDepacketizer {
+public:
+    void DepacketizeInner(std::shared_ptr<DataBuffer> dataBuffer) override;
+    // H265PacketizationInfo
+    void SetExtraData(void *extra) override;
+
+private:
+    void HandleSinglePacket(std::shared_ptr<DataBuffer> dataBuffer);
+    void HandleApPacket(std::shared_ptr<DataBuffer> dataBuffer);
+    void HandleFuPacket(std::shared_ptr<DataBuffer> dataBuffer);
+
+    void PopCache();
+
+    // `header` is the 2-byte NAL unit header when it is not right in front of `offset`
+    void EmitNalu(const std::shared_ptr<DataBuffer> &packet, const uint8_t *header, size_t offset, size_t length,
+                  uint32_t ts);
+
+private:
+    bool donlPresent_ = false;
+    uint16_t lastSeq_ = 0;
+    std::mutex mutex_;
+    std::queue<std::shared_ptr<DataBuffer>> cache_;
+};
+
+#endif // HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_H265_H
@@ -0,0 +1,49 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "rtp_packet_pool.h"
+#include "../../common/log.h"
+#include <atomic>
+
+std::shared_ptr<DataBuffer> RtpPacketPool::Alloc(size_t capacity)
+{
+    if (capacity > packetCapacity_) {
+        stats_.misses++;
+        return std::make_shared<DataBuffer>(capacity);
+    }
+
+    // buffers are released roughly in the order they were handed out, so only the oldest one needs checking
+    if (!packets_.empty()) {
+        auto &packet = packets_[next_];
+        if (packet.use_count() == 1) {
+            // pairs with the release of the last other reference
+            std::atomic_thread_fence(std::memory_order_acquire);
+            next_ = (next_ + 1) % packets_.size();
+            packet->SetSize(0);
+            stats_.hits++;
+            if (exhausted_) {
+                exhausted_ = false;
+                LOGW("rtp packet pool recovered, %llu packets were not pooled",
+                     (unsigned long long)stats_.unpooled);
+            }
+            return packet;
+        }
+    }
+
+    stats_.misses++;
+    auto packet = std::make_shared<DataBuffer>(packetCapacity_);
+    if (packets_.size() >= RTP_PACKET_POOL_MAX) {
+        stats_.unpooled++;
+        if (!exhausted_) {
+            exhausted_ = true;
+            LOGW("rtp packet pool exhausted, %zu packets still referenced", packets_.size());
+        }
+        return packet;
+    }
+
+    // becomes the newest buffer, just in front of the oldest one
+    packets_.insert(packets_.begin() + next_, packet);
+    next_ = (next_ + 1) % packets_.size();
+    return packet;
+}
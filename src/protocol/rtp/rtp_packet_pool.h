@@ -0,0 +1,45 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_POOL_H
+#define HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_POOL_H
+
+#include "../../common/data_buffer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// upper bound of pooled packets per packetizer, enough for the NACK history plus the frames in flight
+constexpr size_t RTP_PACKET_POOL_MAX = 2048;
+
+// Reusable RTP packet buffers of one packetizer, handed out in allocation order.
+// A buffer is reused once nobody else holds it any more (sent, and dropped from the retransmission history), so a
+// steady-state stream cycles through the same buffers without touching the heap. The pool grows while all buffers
+// are still referenced and is used from the packetizing thread only.
+class RtpPacketPool {
+public:
+    struct Stats {
+        uint64_t hits;     // Alloc() reused a buffer
+        uint64_t misses;   // Alloc() created a buffer
+        uint64_t unpooled; // of the misses, buffers not kept because the pool was full
+    };
+
+    explicit RtpPacketPool(size_t packetCapacity) : packetCapacity_(packetCapacity) {}
+
+    // an empty buffer with at least `capacity` bytes, larger than the pooled size ones are not pooled
+    std::shared_ptr<DataBuffer> Alloc(size_t capacity);
+
+    size_t Size() const { return packets_.size(); }
+    Stats GetStats() const { return stats_; }
+
+private:
+    size_t packetCapacity_;
+    size_t next_ = 0; // oldest buffer handed out
+    std::vector<std::shared_ptr<DataBuffer>> packets_;
+    Stats stats_{};
+    bool exhausted_ = false; // logged once until a buffer is reused again
+};
+
+#endif // HALFWAY_MEDIA_PROTOCOL_RTP_PACKET_POOL_H
@@ -5,14 +5,107 @@
 #include "rtp_sorter.h"
 #include "../../common/log.h"
 #include "rtp_packet.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
 #include <mutex>
 
 const size_t SORTER_CACHE_SIZE_MAX = 100;
+const int64_t JITTER_HOLD_MIN_US = 10 * 1000; // never wait less than this for a missing packet
+const double JITTER_HOLD_FACTOR = 4.0;         // hold time in multiples of the measured jitter
+static_assert(SORTER_CACHE_SIZE_MAX < SORTER_RING_SIZE, "reorder cache must fit into the ring");
+static_assert((SORTER_RING_SIZE & (SORTER_RING_SIZE - 1)) == 0, "ring size must be a power of two");
+
+static inline size_t RingIndex(uint16_t seq)
+{
+    return seq & (SORTER_RING_SIZE - 1);
+}
+
+static int64_t NowUs()
+{
+    auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+}
+
+RtpSorter::RtpSorter()
+{
+    SetMetricsLabels("");
+}
 
 void RtpSorter::Input(std::shared_ptr<DataBuffer> packet)
 {
     std::lock_guard<std::mutex> lock(mutex_);
+    // arrival times only matter in jitter-buffer mode, skip the clock read otherwise
+    InputLocked(packet, maxHoldUs_ > 0 ? NowUs() : 0);
+}
+
+void RtpSorter::Input(std::shared_ptr<DataBuffer> packet, int64_t arrivalUs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    InputLocked(packet, arrivalUs);
+}
+
+void RtpSorter::Input(const std::vector<std::shared_ptr<DataBuffer>> &packets)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t arrivalUs = maxHoldUs_ > 0 ? NowUs() : 0;
+    for (auto &packet : packets) {
+        InputLocked(packet, arrivalUs);
+    }
+}
+
+void RtpSorter::SetJitterBuffer(uint32_t maxHoldMs, uint32_t clockRate)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    maxHoldUs_ = (int64_t)maxHoldMs * 1000;
+    clockRate_ = clockRate;
+    jitter_ = 0;
+    hasTransit_ = false;
+    if (cached_ > 0) {
+        UpdateGapSince();
+    }
+}
+
+void RtpSorter::Poll()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    SkipExpiredGaps(NowUs());
+}
+
+double RtpSorter::GetJitterMs()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return clockRate_ ? jitter_ * 1000 / clockRate_ : 0;
+}
+
+uint32_t RtpSorter::GetHoldTimeMs()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (uint32_t)(HoldTimeUs() / 1000);
+}
+
+uint64_t RtpSorter::GetSkippedCount()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return skipped_;
+}
+
+void RtpSorter::SetMetricsLabels(const std::string &labels)
+{
+    auto registry = MetricsRegistry::GetInstance();
+    std::lock_guard<std::mutex> lock(mutex_);
+    packetsMetric_ = registry->Counter("halfway_rtp_received_packets_total", "RTP packets received.", labels);
+    reorderedMetric_ =
+        registry->Counter("halfway_rtp_reordered_packets_total", "RTP packets that arrived ahead of a gap.", labels);
+    discardedMetric_ =
+        registry->Counter("halfway_rtp_discarded_packets_total", "Late or duplicate RTP packets.", labels);
+    lostMetric_ = registry->Counter("halfway_rtp_lost_packets_total", "RTP packets given up on.", labels);
+}
+
+void RtpSorter::InputLocked(const std::shared_ptr<DataBuffer> &packet, int64_t arrivalUs)
+{
     if (packet == nullptr || packet->Size() <= 12) { // RTP fixed header size
         return;
     }
@@ -20,64 +113,188 @@ void RtpSorter::Input(std::shared_ptr<DataBuffer> packet)
     RtpHeader *rtp = (RtpHeader *)packet->Data();
     uint16_t seq = rtp->GetSeqNumber();
     static CompareRtpSequenceNumber comparator;
+    packetsMetric_->Add();
+
+    if (maxHoldUs_ > 0) {
+        UpdateJitter(rtp->GetTimestamp(), arrivalUs);
+    }
 
     if (!init_) {
         init_ = true;
-        lastSeq_ = seq;
-        if (callback_) {
-            callback_(packet);
-        }
+        Deliver(seq, packet);
         return;
     }
 
+    uint16_t distance = seq - lastSeq_;
+
     // ordered rtp packet
-    if (lastSeq_ + 1 == seq || (lastSeq_ == UINT16_MAX && seq == 0)) {
-        lastSeq_ = seq;
-        if (callback_) {
-            callback_(packet);
+    if (distance == 1) {
+        Deliver(seq, packet);
+        if (cached_ > 0) {
+            TryPopCache();
+            UpdateGapSince();
         }
-
-        TryPopCache();
-    } else if (comparator(seq, lastSeq_)) {
+    } else if (distance == 0 || comparator(seq, lastSeq_)) {
         LOGW("discard the late packet %d before last %d", seq, lastSeq_);
+        discardedMetric_->Add();
+    } else if (distance >= SORTER_RING_SIZE) {
+        // too far ahead to wait for the gap, give up on it and restart from this packet
+        LOGW("jump from %d to %d, flush %zu cached packets", lastSeq_, seq, cached_);
+        Flush();
+        Skip(seq - lastSeq_ - 1);
+        Deliver(seq, packet);
     } else {
-        cache_.emplace(seq, packet);
+        auto &slot = ring_[RingIndex(seq)];
+        if (slot) {
+            discardedMetric_->Add();
+            return; // duplicate
+        }
 
-        if (cache_.size() > SORTER_CACHE_SIZE_MAX) {
-            lastSeq_ = cache_.begin()->first;
-            if (callback_) {
-                callback_(cache_.begin()->second);
+        if (comparator(highestSeq_, seq)) {
+            if (lossCallback_) {
+                ReportLoss(rtp->GetSSRC(), seq);
             }
+            highestSeq_ = seq;
+        }
 
-            cache_.erase(cache_.begin());
+        slot = packet;
+        reorderedMetric_->Add();
+        arrivalUs_[RingIndex(seq)] = arrivalUs;
+        if (cached_++ == 0) {
+            gapSinceUs_ = arrivalUs;
         }
 
-        TryPopCache();
+        if (cached_ > SORTER_CACHE_SIZE_MAX) {
+            PopOldest();
+            TryPopCache();
+            UpdateGapSince();
+        }
+    }
+
+    if (maxHoldUs_ > 0) {
+        SkipExpiredGaps(arrivalUs);
     }
 }
 
-void RtpSorter::TryPopCache()
+void RtpSorter::Deliver(uint16_t seq, const std::shared_ptr<DataBuffer> &packet)
 {
-    if (cache_.empty()) {
-        return;
+    lastSeq_ = seq;
+    if (cached_ == 0) {
+        highestSeq_ = seq;
     }
+    if (callback_) {
+        callback_(packet);
+    }
+}
 
-    std::vector<uint16_t> keysToDelete;
-    for (auto &it : cache_) {
-        if (lastSeq_ + 1 == it.first) {
-            lastSeq_ = it.first;
+void RtpSorter::ReportLoss(uint32_t ssrc, uint16_t seq)
+{
+    // everything between the newest packet so far and this one has not arrived yet
+    lost_.clear();
+    for (uint16_t missing = highestSeq_ + 1; missing != seq; missing++) {
+        lost_.push_back(missing);
+    }
 
-            if (callback_) {
-                callback_(it.second);
-            }
+    if (!lost_.empty()) {
+        lossCallback_(ssrc, lost_);
+    }
+}
+
+void RtpSorter::Skip(uint16_t count)
+{
+    skipped_ += count;
+    lostMetric_->Add(count);
+}
 
-            keysToDelete.push_back(it.first);
-        } else {
+void RtpSorter::TryPopCache()
+{
+    while (cached_ > 0) {
+        auto &slot = ring_[RingIndex(lastSeq_ + 1)];
+        if (!slot) {
             break;
         }
+
+        std::shared_ptr<DataBuffer> packet = std::move(slot);
+        slot.reset();
+        cached_--;
+        Deliver(lastSeq_ + 1, packet);
+    }
+}
+
+void RtpSorter::PopOldest()
+{
+    for (uint16_t seq = lastSeq_ + 1; cached_ > 0; seq++) {
+        auto &slot = ring_[RingIndex(seq)];
+        if (slot) {
+            std::shared_ptr<DataBuffer> packet = std::move(slot);
+            slot.reset();
+            cached_--;
+            Skip(seq - lastSeq_ - 1);
+            Deliver(seq, packet);
+            return;
+        }
+    }
+}
+
+void RtpSorter::Flush()
+{
+    while (cached_ > 0) {
+        PopOldest();
+    }
+}
+
+void RtpSorter::UpdateJitter(uint32_t rtpTimestamp, int64_t arrivalUs)
+{
+    if (clockRate_ == 0) {
+        return;
+    }
+
+    // RFC 3550 A.8, arrival time converted to RTP timestamp units
+    uint32_t arrival = (uint32_t)(arrivalUs * clockRate_ / 1000000);
+    uint32_t transit = arrival - rtpTimestamp;
+    if (hasTransit_) {
+        int32_t d = (int32_t)(transit - lastTransit_);
+        jitter_ += (std::abs((double)d) - jitter_) / 16;
+    }
+    lastTransit_ = transit;
+    hasTransit_ = true;
+}
+
+int64_t RtpSorter::HoldTimeUs() const
+{
+    if (maxHoldUs_ <= 0 || clockRate_ == 0) {
+        return maxHoldUs_;
+    }
+
+    int64_t jitterUs = (int64_t)(jitter_ * 1000000 / clockRate_);
+    int64_t hold = std::max(JITTER_HOLD_MIN_US, (int64_t)(JITTER_HOLD_FACTOR * jitterUs));
+    return std::min(hold, maxHoldUs_);
+}
+
+void RtpSorter::SkipExpiredGaps(int64_t nowUs)
+{
+    if (maxHoldUs_ <= 0) {
+        return;
     }
 
-    for (uint16_t key : keysToDelete) {
-        cache_.erase(key);
+    int64_t holdUs = HoldTimeUs();
+    while (cached_ > 0 && nowUs - gapSinceUs_ >= holdUs) {
+        uint16_t from = lastSeq_;
+        PopOldest();
+        LOGW("skip gap %d..%d after %ld ms", (uint16_t)(from + 1), (uint16_t)(lastSeq_ - 1),
+             (long)((nowUs - gapSinceUs_) / 1000));
+        TryPopCache();
+        UpdateGapSince();
+    }
+}
+
+void RtpSorter::UpdateGapSince()
+{
+    // the next gap is waited for since its oldest packet arrived
+    for (uint16_t seq = lastSeq_ + 1; cached_ > 0; seq++) {
+        if (ring_[RingIndex(seq)]) {
+            gapSinceUs_ = arrivalUs_[RingIndex(seq)];
+            return;
+        }
     }
 }
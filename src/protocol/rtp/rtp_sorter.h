@@ -6,10 +6,15 @@
 #define HALFWAY_MEDIA_PROTOCOL_RTP_SORTER_H
 
 #include "../../common/data_buffer.h"
+#include "../../common/metrics.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
-#include <map>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 
 struct CompareRtpSequenceNumber {
     bool operator()(const uint16_t &x, const uint16_t &y) const
@@ -19,20 +24,83 @@ struct CompareRtpSequenceNumber {
     }
 };
 
+// reorder window, a power of two so that the slot of a sequence number is seq & (SORTER_RING_SIZE - 1)
+constexpr size_t SORTER_RING_SIZE = 128;
+
+// Restores RTP sequence order. Out-of-order packets wait in a fixed ring indexed by sequence number,
+// so insert and drain are O(1) and nothing is allocated per packet.
+//
+// By default a gap is only given up when the ring holds too many packets. In jitter-buffer mode a gap is also
+// skipped once it has been waited for longer than the hold time, which follows the measured interarrival jitter
+// (RFC 3550 A.8) and never exceeds the configured maximum.
+//
+// The loss callback reports sequence numbers once, when a packet arrives ahead of them, e.g. to send a NACK.
 class RtpSorter {
 public:
+    RtpSorter();
+
     void Input(std::shared_ptr<DataBuffer> packet);
+    // a whole receive batch under one lock
+    void Input(const std::vector<std::shared_ptr<DataBuffer>> &packets);
+    // with an explicit arrival time on the steady clock, in microseconds
+    void Input(std::shared_ptr<DataBuffer> packet, int64_t arrivalUs);
     void SetCallback(std::function<void(std::shared_ptr<DataBuffer>)> cb) { callback_ = cb; }
+    // called under the sorter lock with the SSRC of the stream and the newly missing sequence numbers
+    void SetLossCallback(std::function<void(uint32_t ssrc, const std::vector<uint16_t> &lost)> cb)
+    {
+        lossCallback_ = cb;
+    }
+
+    // maxHoldMs 0 turns jitter-buffer mode off, clockRate is the RTP timestamp rate of the track
+    void SetJitterBuffer(uint32_t maxHoldMs, uint32_t clockRate);
+    // skips expired gaps without a new packet, for callers that drive the sorter from a timer
+    void Poll();
+
+    double GetJitterMs();
+    uint32_t GetHoldTimeMs();
+    uint64_t GetSkippedCount();
+
+    // packets, reorders, discarded and lost packets are counted under these labels
+    void SetMetricsLabels(const std::string &labels);
 
 private:
+    void InputLocked(const std::shared_ptr<DataBuffer> &packet, int64_t arrivalUs);
+    void Deliver(uint16_t seq, const std::shared_ptr<DataBuffer> &packet);
+    void ReportLoss(uint32_t ssrc, uint16_t seq);
+    void Skip(uint16_t count);
     void TryPopCache();
+    void PopOldest();
+    void Flush();
+    void UpdateJitter(uint32_t rtpTimestamp, int64_t arrivalUs);
+    int64_t HoldTimeUs() const;
+    void SkipExpiredGaps(int64_t nowUs);
+    void UpdateGapSince();
 
 private:
-    uint16_t lastSeq_;
+    uint16_t lastSeq_ = 0;
+    uint16_t highestSeq_ = 0; // newest sequence number seen, ahead of lastSeq_ while packets wait in the ring
     bool init_ = false;
     std::mutex mutex_;
     std::function<void(std::shared_ptr<DataBuffer>)> callback_;
-    std::map<uint16_t, std::shared_ptr<DataBuffer>, CompareRtpSequenceNumber> cache_;
+    std::function<void(uint32_t, const std::vector<uint16_t> &)> lossCallback_;
+    std::vector<uint16_t> lost_;
+    size_t cached_ = 0;
+    std::array<std::shared_ptr<DataBuffer>, SORTER_RING_SIZE> ring_;
+    std::array<int64_t, SORTER_RING_SIZE> arrivalUs_{};
+
+    // jitter-buffer mode
+    int64_t maxHoldUs_ = 0;
+    uint32_t clockRate_ = 0;
+    double jitter_ = 0; // in RTP timestamp units
+    uint32_t lastTransit_ = 0;
+    bool hasTransit_ = false;
+    int64_t gapSinceUs_ = 0; // arrival of the oldest packet waiting behind the current gap
+    uint64_t skipped_ = 0;
+
+    std::shared_ptr<MetricCounter> packetsMetric_;
+    std::shared_ptr<MetricCounter> reorderedMetric_;
+    std::shared_ptr<MetricCounter> discardedMetric_;
+    std::shared_ptr<MetricCounter> lostMetric_;
 };
 
 #endif // HALFWAY_MEDIA_PROTOCOL_RTP_SORTER_H
\ No newline at end of file
@@ -0,0 +1,352 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../rtp_packet.h"
+#include "../rtp_packet_aac.h"
+#include "../rtp_packet_h264.h"
+#include "../rtp_packet_h265.h"
+#include "../../aac/adts_header.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Feeds hand-built RTP packets to the depacketizers and checks the frames that come out.
+
+static uint16_t gSeq = 1000;
+
+static std::shared_ptr<DataBuffer> MakePacket(uint32_t ts, const std::vector<uint8_t> &payload, bool mark = true)
+{
+    RtpHeader header;
+    header.SetSeqNumber(gSeq++);
+    header.SetTimestamp(ts);
+    header.SetSSRC(0x12345678);
+    header.SetPayloadType(96);
+    header.SetMarker(mark);
+
+    auto packet = std::make_shared<DataBuffer>(RTP_PACKET_HEADER_DEFAULT_SIZE + payload.size());
+    packet->Assign(&header, header.GetHeaderLength());
+    packet->Append(payload.data(), payload.size());
+    return packet;
+}
+
+static void AppendU16(std::vector<uint8_t> &v, uint16_t value)
+{
+    v.push_back(value >> 8);
+    v.push_back(value & 0xff);
+}
+
+static std::vector<uint8_t> Nalu(uint8_t header, size_t size)
+{
+    std::vector<uint8_t> nalu(size, header);
+    nalu[0] = header;
+    return nalu;
+}
+
+static std::vector<uint8_t> FrameBytes(const std::shared_ptr<Frame> &frame)
+{
+    std::vector<uint8_t> bytes(frame->TotalSize());
+    frame->Read(0, bytes.data(), bytes.size());
+    return bytes;
+}
+
+static bool IsNalu(const std::shared_ptr<Frame> &frame, const std::vector<uint8_t> &nalu)
+{
+    std::vector<uint8_t> expected = {0x00, 0x00, 0x00, 0x01};
+    expected.insert(expected.end(), nalu.begin(), nalu.end());
+    return FrameBytes(frame) == expected;
+}
+
+static void TestStapA()
+{
+    auto depacketizer = RtpDepacketizer::Create(FRAME_FORMAT_H264);
+    std::vector<std::shared_ptr<Frame>> frames;
+    depacketizer->SetCallback([&](std::shared_ptr<Frame> frame) { frames.emplace_back(frame); });
+
+    auto sps = Nalu(0x67, 20);
+    auto pps = Nalu(0x68, 4);
+    auto idr = Nalu(0x65, 300);
+    std::vector<uint8_t> payload = {0x78}; // STAP-A, NRI 3
+    for (auto *nalu : {&sps, &pps, &idr}) {
+        AppendU16(payload, nalu->size());
+        payload.insert(payload.end(), nalu->begin(), nalu->end());
+    }
+    depacketizer->Depacketize(MakePacket(3000, payload));
+
+    assert(frames.size() == 3);
+    assert(IsNalu(frames[0], sps) && IsNalu(frames[1], pps) && IsNalu(frames[2], idr));
+    assert(!frames[0]->videoInfo.isKeyFrame && frames[2]->videoInfo.isKeyFrame);
+    for (auto &frame : frames) {
+        assert(frame->IsScattered()); // refers to the RTP packet
+        assert(frame->timestamp == 3000);
+    }
+
+    // a truncated aggregation unit is dropped, the units before it are kept
+    frames.clear();
+    payload = {0x78};
+    AppendU16(payload, sps.size());
+    payload.insert(payload.end(), sps.begin(), sps.end());
+    AppendU16(payload, 100);
+    payload.insert(payload.end(), 10, 0x41);
+    depacketizer->Depacketize(MakePacket(6000, payload));
+    assert(frames.size() == 1 && IsNalu(frames[0], sps));
+    printf("STAP-A ok\n");
+}
+
+static void TestInterleaved()
+{
+    auto depacketizer = RtpDepacketizer::Create(FRAME_FORMAT_H264);
+    H264PacketizationInfo info{2, 2};
+    depacketizer->SetExtraData(&info);
+    std::vector<std::shared_ptr<Frame>> frames;
+    depacketizer->SetCallback([&](std::shared_ptr<Frame> frame) { frames.emplace_back(frame); });
+
+    // DON order: sps(10) pps(11) idr(12) p(13) p(14) p(15), sent as STAP-B, MTAP16, FU-B + FU-A, STAP-B
+    auto sps = Nalu(0x67, 20);
+    auto pps = Nalu(0x68, 4);
+    auto idr = Nalu(0x65, 2000);
+    auto p1 = Nalu(0x41, 30);
+    auto p2 = Nalu(0x41, 40);
+    auto p3 = Nalu(0x41, 50);
+
+    std::vector<uint8_t> stapB = {0x79}; // STAP-B
+    AppendU16(stapB, 10);
+    for (auto *nalu : {&sps, &pps}) {
+        AppendU16(stapB, nalu->size());
+        stapB.insert(stapB.end(), nalu->begin(), nalu->end());
+    }
+    depacketizer->Depacketize(MakePacket(9000, stapB));
+
+    // p2 and p1 out of order, p1 presented 1 ms later
+    std::vector<uint8_t> mtap = {0x7a}; // MTAP16
+    AppendU16(mtap, 13);
+    AppendU16(mtap, 3 + p2.size());
+    mtap.push_back(1);
+    AppendU16(mtap, 0);
+    mtap.insert(mtap.end(), p2.begin(), p2.end());
+    AppendU16(mtap, 3 + p1.size());
+    mtap.push_back(0);
+    AppendU16(mtap, 90);
+    mtap.insert(mtap.end(), p1.begin(), p1.end());
+    depacketizer->Depacketize(MakePacket(9000, mtap));
+
+    std::vector<uint8_t> fuB = {0x7d, 0x85}; // FU-B, start, IDR
+    AppendU16(fuB, 12);
+    fuB.insert(fuB.end(), idr.begin() + 1, idr.begin() + 1000);
+    depacketizer->Depacketize(MakePacket(9000, fuB, false));
+    std::vector<uint8_t> fuA = {0x7c, 0x45}; // FU-A, end, IDR
+    fuA.insert(fuA.end(), idr.begin() + 1000, idr.end());
+    depacketizer->Depacketize(MakePacket(9000, fuA));
+
+    stapB = {0x79};
+    AppendU16(stapB, 15);
+    AppendU16(stapB, p3.size());
+    stapB.insert(stapB.end(), p3.begin(), p3.end());
+    depacketizer->Depacketize(MakePacket(12000, stapB));
+
+    // depth 2: the last two VCL NAL units stay behind
+    assert(frames.size() == 4);
+    assert(IsNalu(frames[0], sps) && IsNalu(frames[1], pps) && IsNalu(frames[2], idr) && IsNalu(frames[3], p1));
+    assert(frames[2]->videoInfo.isKeyFrame);
+    assert(frames[3]->timestamp == 9090);
+
+    // already behind the output
+    std::vector<uint8_t> late = {0x79};
+    AppendU16(late, 13);
+    AppendU16(late, p1.size());
+    late.insert(late.end(), p1.begin(), p1.end());
+    depacketizer->Depacketize(MakePacket(12000, late));
+    assert(frames.size() == 4);
+    printf("interleaved ok\n");
+}
+
+static void TestH265()
+{
+    auto packetizer = RtpPacketizer::Create(FRAME_FORMAT_H265);
+    auto depacketizer = RtpDepacketizer::Create(FRAME_FORMAT_H265);
+    std::vector<std::shared_ptr<Frame>> frames;
+    depacketizer->SetCallback([&](std::shared_ptr<Frame> frame) { frames.emplace_back(frame); });
+    size_t packets = 0;
+    packetizer->SetCallback([&](std::shared_ptr<DataBuffer> packet) {
+        packets++;
+        depacketizer->Depacketize(packet);
+    });
+
+    auto vps = Nalu(0x40, 24);
+    auto sps = Nalu(0x42, 40);
+    auto pps = Nalu(0x44, 8);
+    auto idr = Nalu(0x26, 5000); // IDR_W_RADL
+    auto trail = Nalu(0x02, 300); // TRAIL_R
+    auto frame = std::make_shared<Frame>(8192);
+    frame->format = FRAME_FORMAT_H265;
+    frame->timestamp = 40;
+    for (auto *nalu : {&vps, &sps, &pps, &idr, &trail}) {
+        const uint8_t startCode[4] = {0x00, 0x00, 0x00, 0x01};
+        frame->Append(startCode, sizeof(startCode));
+        frame->Append(nalu->data(), nalu->size());
+    }
+    packetizer->Packetize(frame);
+
+    // AP with the parameter sets, 4 FUs, single NAL unit packet
+    assert(packets == 6);
+    assert(frames.size() == 5);
+    assert(IsNalu(frames[0], vps) && IsNalu(frames[1], sps) && IsNalu(frames[2], pps));
+    assert(IsNalu(frames[3], idr) && IsNalu(frames[4], trail));
+    assert(frames[3]->videoInfo.isKeyFrame && !frames[4]->videoInfo.isKeyFrame);
+    assert(frames[3]->timestamp == frames[4]->timestamp);
+
+    // DONL and DOND fields when sprop-max-don-diff is set
+    frames.clear();
+    auto donDepacketizer = RtpDepacketizer::Create(FRAME_FORMAT_H265);
+    H265PacketizationInfo info{2};
+    donDepacketizer->SetExtraData(&info);
+    donDepacketizer->SetCallback([&](std::shared_ptr<Frame> frame) { frames.emplace_back(frame); });
+    std::vector<uint8_t> ap = {0x60, 0x01}; // AP
+    AppendU16(ap, 7);                       // DONL
+    AppendU16(ap, vps.size());
+    ap.insert(ap.end(), vps.begin(), vps.end());
+    ap.push_back(0); // DOND
+    AppendU16(ap, trail.size());
+    ap.insert(ap.end(), trail.begin(), trail.end());
+    donDepacketizer->Depacketize(MakePacket(3000, ap));
+    std::vector<uint8_t> single = {trail[0], trail[1]};
+    AppendU16(single, 9); // DONL
+    single.insert(single.end(), trail.begin() + 2, trail.end());
+    donDepacketizer->Depacketize(MakePacket(6000, single));
+    assert(frames.size() == 3);
+    assert(IsNalu(frames[0], vps) && IsNalu(frames[1], trail) && IsNalu(frames[2], trail));
+    printf("H.265 ok\n");
+}
+
+static void TestAacAggregation()
+{
+    auto packetizer = std::make_shared<RtpPacketizerAAC>();
+    packetizer->SetPacketDuration(100);
+    auto depacketizer = RtpDepacketizer::Create(FRAME_FORMAT_AAC);
+    AudioFrameInfo info{2, 1024, 48000};
+    depacketizer->SetExtraData(&info);
+    std::vector<std::shared_ptr<Frame>> frames;
+    depacketizer->SetCallback([&](std::shared_ptr<Frame> frame) { frames.emplace_back(frame); });
+    std::vector<size_t> auCounts;
+    packetizer->SetCallback([&](std::shared_ptr<DataBuffer> packet) {
+        auCounts.push_back(((packet->Data()[12] << 8) | packet->Data()[13]) / 16);
+        depacketizer->Depacketize(packet);
+    });
+
+    // 1024 samples at 48 kHz is 21.3 ms, 5 AUs reach 100 ms
+    std::vector<std::vector<uint8_t>> aus;
+    for (int i = 0; i < 12; i++) {
+        aus.emplace_back(Nalu((uint8_t)i, 100 + i * 10));
+        auto frame = std::make_shared<Frame>(256);
+        frame->format = FRAME_FORMAT_AAC;
+        frame->audioInfo = info;
+        frame->timestamp = (i * 1024 * 1000 + 24000) / 48000; // milliseconds, rounded
+        ADTSHeader adts(48000, 2, aus.back().size() + 7);
+        frame->Assign(&adts, sizeof(adts));
+        frame->Append(aus.back().data(), aus.back().size());
+        packetizer->Packetize(frame);
+    }
+
+    assert((auCounts == std::vector<size_t>{5, 5}));
+    assert(frames.size() == 10);
+    for (size_t i = 0; i < frames.size(); i++) {
+        auto bytes = FrameBytes(frames[i]);
+        assert(bytes.size() == 7 + aus[i].size());
+        assert(std::equal(aus[i].begin(), aus[i].end(), bytes.begin() + 7));
+        int64_t drift = (int64_t)(frames[i]->timestamp - frames[0]->timestamp) - (int64_t)i * 1024;
+        assert(drift > -48 && drift < 48); // within the 1 ms resolution of the frame timestamps
+        (void)drift;
+    }
+
+    // a gap in the timestamps ends the packet early
+    auto frame = std::make_shared<Frame>(256);
+    frame->format = FRAME_FORMAT_AAC;
+    frame->audioInfo = info;
+    frame->timestamp = 1000;
+    frame->Assign(aus[0].data(), aus[0].size());
+    packetizer->Packetize(frame);
+    assert(auCounts.size() == 3 && auCounts[2] == 2);
+    printf("AAC ok\n");
+}
+
+static void TestAacCsrcExtension()
+{
+    auto depacketizer = RtpDepacketizer::Create(FRAME_FORMAT_AAC);
+    AudioFrameInfo info{2, 1024, 48000};
+    depacketizer->SetExtraData(&info);
+    std::vector<std::shared_ptr<Frame>> frames;
+    depacketizer->SetCallback([&](std::shared_ptr<Frame> frame) { frames.emplace_back(frame); });
+
+    // V=2 X=1 CC=2, the extension length follows the two CSRCs
+    uint16_t seq = gSeq++;
+    std::vector<uint8_t> bytes = {0x92, 0xe1, (uint8_t)(seq >> 8), (uint8_t)seq, 0, 0, 0x04, 0, 0x12, 0x34, 0x56, 0x78};
+    for (uint8_t b : {0xaa, 0xaa, 0x00, 0x03, 0xbb, 0xbb, 0x00, 0x02}) { // CSRCs
+        bytes.push_back(b);
+    }
+    for (uint8_t b : {0xbe, 0xde, 0x00, 0x01, 0x10, 0x20, 0x30, 0x40}) { // one-byte header extension of one word
+        bytes.push_back(b);
+    }
+    auto au = Nalu(0x21, 50);
+    AppendU16(bytes, 16);             // AU-headers-length in bits
+    AppendU16(bytes, au.size() << 3); // AU-size, AU-index 0
+    bytes.insert(bytes.end(), au.begin(), au.end());
+
+    auto packet = std::make_shared<DataBuffer>(bytes.size());
+    packet->Assign(bytes.data(), bytes.size());
+    depacketizer->Depacketize(packet);
+    assert(frames.size() == 1);
+    auto frameBytes = FrameBytes(frames[0]);
+    assert(frameBytes.size() == 7 + au.size());
+    assert(std::equal(au.begin(), au.end(), frameBytes.begin() + 7));
+
+    // cut inside the extension: dropped instead of read past the end
+    auto truncated = std::make_shared<DataBuffer>(26);
+    bytes[3]++; // next sequence number
+    truncated->Assign(bytes.data(), 26);
+    depacketizer->Depacketize(truncated);
+    assert(frames.size() == 1);
+    printf("AAC CSRC and extension ok\n");
+}
+
+static void TestJitterGapExpiry()
+{
+    auto depacketizer = RtpDepacketizer::Create(FRAME_FORMAT_H264);
+    std::vector<std::shared_ptr<Frame>> frames;
+    depacketizer->SetCallback([&](std::shared_ptr<Frame> frame) { frames.emplace_back(frame); });
+    depacketizer->SetJitterBuffer(50, 90000);
+
+    auto first = Nalu(0x65, 100);
+    auto third = Nalu(0x41, 100);
+    depacketizer->Depacketize(MakePacket(0, first));
+    gSeq++; // lost
+    depacketizer->Depacketize(MakePacket(6000, third));
+    assert(frames.size() == 1);
+
+    // the packet behind the gap waits for the hold time, then Poll() gives up on the gap without further input
+    depacketizer->Poll();
+    assert(frames.size() == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    depacketizer->Poll();
+    assert(frames.size() == 2);
+    assert(IsNalu(frames[1], third));
+    printf("jitter gap expiry ok\n");
+}
+
+int main()
+{
+    TestStapA();
+    TestInterleaved();
+    TestH265();
+    TestAacAggregation();
+    TestAacCsrcExtension();
+    TestJitterGapExpiry();
+
+    printf("rtp depacketizer test passed\n");
+    return 0;
+}
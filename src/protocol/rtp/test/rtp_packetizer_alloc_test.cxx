@@ -0,0 +1,152 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../rtp_history.h"
+#include "../rtp_packet.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+// Packetizes steady H.264 and H.265 streams and checks that, once the packet pool is warm, the packetizers perform no
+// heap allocation. Packets are kept in an RtpHistory as RtpSink does, so buffers are only reused after leaving it.
+// Also checks that RTP timestamps follow the frame timestamps on the 90 kHz clock.
+
+constexpr int WARMUP_FRAMES = 300;
+constexpr int MEASURED_FRAMES = 3000;
+constexpr int GOP = 60;
+constexpr uint64_t FRAME_INTERVAL_MS = 40;
+
+static std::atomic<size_t> gAllocations{0};
+
+void *operator new(size_t size)
+{
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+static void AppendNalu(std::shared_ptr<Frame> &frame, uint8_t header, size_t size)
+{
+    const uint8_t startCode[4] = {0, 0, 0, 1};
+    std::vector<uint8_t> nalu(size, 0x5a);
+    nalu[0] = header;
+    frame->Append(startCode, sizeof(startCode));
+    frame->Append(nalu.data(), nalu.size());
+}
+
+static std::shared_ptr<Frame> MakeFrame(FrameFormat format, bool key, size_t sliceSize)
+{
+    auto frame = std::make_shared<Frame>(sliceSize * 2 + 64);
+    frame->format = format;
+    if (format == FRAME_FORMAT_H265) {
+        if (key) {
+            AppendNalu(frame, 0x40, 24); // VPS
+            AppendNalu(frame, 0x42, 40); // SPS
+            AppendNalu(frame, 0x44, 8);  // PPS
+            AppendNalu(frame, 0x26, sliceSize);
+        } else {
+            AppendNalu(frame, 0x02, sliceSize);
+            AppendNalu(frame, 0x02, 200);
+        }
+    } else if (key) {
+        AppendNalu(frame, 0x67, 20);
+        AppendNalu(frame, 0x68, 4);
+        AppendNalu(frame, 0x65, sliceSize);
+    } else {
+        AppendNalu(frame, 0x41, sliceSize);
+        AppendNalu(frame, 0x41, 200); // small slice, single NAL unit packet
+    }
+    return frame;
+}
+
+static void Run(FrameFormat format)
+{
+    // keyframes take the STAP-A/AP + FU-A/FU path, a small one only STAP-A/AP
+    std::vector<std::shared_ptr<Frame>> frames;
+    for (int i = 0; i < GOP; i++) {
+        frames.emplace_back(MakeFrame(format, i == 0, i == 0 ? 60000 : 8000 + i * 100));
+    }
+    frames.emplace_back(MakeFrame(format, true, 500));
+
+    auto packetizer = RtpPacketizer::Create(format);
+    RtpHistory history;
+    size_t packets = 0;
+    size_t bytes = 0;
+    bool first = true;
+    uint32_t rtpBase = 0;
+    uint32_t expectedTs = 0;
+    bool timestampsOk = true;
+    packetizer->SetBatchCallback([&](RtpPacketizer::PacketBatch &batch) {
+        history.Put(batch);
+        packets += batch.size();
+        for (auto &packet : batch) {
+            bytes += packet->Size();
+            uint32_t ts = ((RtpHeader *)packet->Data())->GetTimestamp();
+            if (first) {
+                first = false;
+                rtpBase = ts;
+            }
+            timestampsOk = timestampsOk && ts - rtpBase == expectedTs;
+        }
+    });
+
+    uint64_t timestamp = 0;
+    auto packetize = [&](const std::shared_ptr<Frame> &frame) {
+        frame->timestamp = timestamp;
+        expectedTs = (uint32_t)(timestamp * 90);
+        packetizer->Packetize(frame);
+        timestamp += FRAME_INTERVAL_MS;
+    };
+
+    for (int i = 0; i < WARMUP_FRAMES; i++) {
+        packetize(frames[i % frames.size()]);
+    }
+
+    auto warm = packetizer->GetPacketPoolStats();
+    size_t before = gAllocations.load();
+    packets = 0;
+    for (int i = 0; i < MEASURED_FRAMES; i++) {
+        packetize(frames[i % frames.size()]);
+    }
+    size_t allocations = gAllocations.load() - before;
+    auto stats = packetizer->GetPacketPoolStats();
+
+    printf("%s: %d frames, %zu packets, %zu bytes, pool hits %llu misses %llu, heap allocations %zu\n",
+           format == FRAME_FORMAT_H265 ? "H.265" : "H.264", MEASURED_FRAMES,
+           packets, bytes, (unsigned long long)(stats.hits - warm.hits),
+           (unsigned long long)(stats.misses - warm.misses), allocations);
+    assert(packets > 0);
+    assert(timestampsOk);
+    (void)timestampsOk;
+    assert(stats.misses == warm.misses);
+    assert(allocations == 0);
+    (void)allocations;
+}
+
+int main()
+{
+    Run(FRAME_FORMAT_H264);
+    Run(FRAME_FORMAT_H265);
+
+    printf("rtp packetizer alloc test passed\n");
+    return 0;
+}
@@ -0,0 +1,164 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../rtp_sorter.h"
+#include "../rtp_packet.h"
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+// Compares the ring RtpSorter with the former std::map based reorder cache under 0%, 1% and 5% reordering.
+
+constexpr size_t PACKET_COUNT = 1000000;
+constexpr int ROUNDS = 5;
+
+// the previous implementation, kept as the baseline
+class MapRtpSorter {
+public:
+    void Input(std::shared_ptr<DataBuffer> packet)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (packet == nullptr || packet->Size() <= 12) {
+            return;
+        }
+
+        RtpHeader *rtp = (RtpHeader *)packet->Data();
+        uint16_t seq = rtp->GetSeqNumber();
+        static CompareRtpSequenceNumber comparator;
+
+        if (!init_) {
+            init_ = true;
+            lastSeq_ = seq;
+            callback_(packet);
+            return;
+        }
+
+        if (lastSeq_ + 1 == seq || (lastSeq_ == UINT16_MAX && seq == 0)) {
+            lastSeq_ = seq;
+            callback_(packet);
+            TryPopCache();
+        } else if (comparator(seq, lastSeq_)) {
+        } else {
+            cache_.emplace(seq, packet);
+            if (cache_.size() > 100) {
+                lastSeq_ = cache_.begin()->first;
+                callback_(cache_.begin()->second);
+                cache_.erase(cache_.begin());
+            }
+            TryPopCache();
+        }
+    }
+
+    void SetCallback(std::function<void(std::shared_ptr<DataBuffer>)> cb) { callback_ = cb; }
+
+private:
+    void TryPopCache()
+    {
+        if (cache_.empty()) {
+            return;
+        }
+
+        std::vector<uint16_t> keysToDelete;
+        for (auto &it : cache_) {
+            if (lastSeq_ + 1 == it.first) {
+                lastSeq_ = it.first;
+                callback_(it.second);
+                keysToDelete.push_back(it.first);
+            } else {
+                break;
+            }
+        }
+
+        for (uint16_t key : keysToDelete) {
+            cache_.erase(key);
+        }
+    }
+
+    uint16_t lastSeq_;
+    bool init_ = false;
+    std::mutex mutex_;
+    std::function<void(std::shared_ptr<DataBuffer>)> callback_;
+    std::map<uint16_t, std::shared_ptr<DataBuffer>, CompareRtpSequenceNumber> cache_;
+};
+
+static std::vector<std::shared_ptr<DataBuffer>> MakePackets(double reorderRatio)
+{
+    std::vector<std::shared_ptr<DataBuffer>> packets;
+    packets.reserve(PACKET_COUNT);
+    uint16_t seq = 60000; // crosses the 16-bit wraparound many times
+    for (size_t i = 0; i < PACKET_COUNT; i++) {
+        RtpHeader header;
+        header.SetSeqNumber(seq++);
+        auto packet = std::make_shared<DataBuffer>(64);
+        packet->Assign(&header, RTP_PACKET_HEADER_DEFAULT_SIZE);
+        packet->Append(std::string(20, 'x'));
+        packets.emplace_back(packet);
+    }
+
+    // move a packet a few places later, as a network path change would
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::uniform_int_distribution<size_t> distance(1, 8);
+    for (size_t i = 1; i + 8 < packets.size(); i++) {
+        if (chance(rng) < reorderRatio) {
+            std::swap(packets[i], packets[i + distance(rng)]);
+        }
+    }
+    return packets;
+}
+
+template <typename Sorter>
+static double Measure(const std::vector<std::shared_ptr<DataBuffer>> &packets, size_t &delivered)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        Sorter sorter;
+        size_t count = 0;
+        uint16_t expected = 60000;
+        bool ordered = true;
+        sorter.SetCallback([&](std::shared_ptr<DataBuffer> packet) {
+            uint16_t seq = ((RtpHeader *)packet->Data())->GetSeqNumber();
+            ordered = ordered && seq == expected;
+            expected = seq + 1;
+            count++;
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto &packet : packets) {
+            sorter.Input(packet);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        assert(ordered);
+        (void)ordered;
+
+        delivered = count;
+        double perPacket = ns / packets.size();
+        if (round == 0 || perPacket < best) {
+            best = perPacket;
+        }
+    }
+    return best;
+}
+
+int main()
+{
+    printf("%-10s %14s %14s %10s\n", "reorder", "map ns/pkt", "ring ns/pkt", "speedup");
+    for (double ratio : {0.0, 0.01, 0.05}) {
+        auto packets = MakePackets(ratio);
+        size_t mapDelivered = 0;
+        size_t ringDelivered = 0;
+        double mapNs = Measure<MapRtpSorter>(packets, mapDelivered);
+        double ringNs = Measure<RtpSorter>(packets, ringDelivered);
+        assert(mapDelivered == PACKET_COUNT && ringDelivered == PACKET_COUNT);
+        char label[16];
+        snprintf(label, sizeof(label), "%.0f%%", ratio * 100);
+        printf("%-10s %14.1f %14.1f %9.2fx\n", label, mapNs, ringNs, mapNs / ringNs);
+    }
+    return 0;
+}
@@ -128,6 +128,15 @@ public:
         SetHeaders(RequestHeader::TRANSPORT, ss.str());
         return *this;
     }
+
+    // RTP and RTCP framed on the RTSP connection (RFC 2326 10.12), on channels `rtpChannel` and `rtpChannel + 1`
+    RtspRequest &SetInterleavedTransport(uint8_t rtpChannel)
+    {
+        std::stringstream ss;
+        ss << "RTP/AVP/TCP;unicast;interleaved=" << (int)rtpChannel << "-" << rtpChannel + 1;
+        SetHeaders(RequestHeader::TRANSPORT, ss.str());
+        return *this;
+    }
 };
 
 class RtspRequestPlay : public RtspRequest {
@@ -145,4 +154,10 @@ public:
     explicit RtspRequestTeardown(std::string url = "*") : RtspRequest(TEARDOWN, url) {}
 };
 
+// without a body it only keeps the session alive (RFC 2326 10.8)
+class RtspRequestGetParameter : public RtspRequest {
+public:
+    explicit RtspRequestGetParameter(std::string url = "*") : RtspRequest(GET_PARAMETER, url) {}
+};
+
 #endif // HALFWAY_MEDIA_PROTOCOL_RTSP_REQUEST_H
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include "rtsp_response.h"
 #include "../../common/log.h"
 #include "rtsp_common.h"
+#include <algorithm>
+#include <charconv>
 #include <regex>
 #include <sstream>
 #include <string>
@@ -119,6 +121,54 @@ bool RtspResponse::Parse(const std::string &response)
     return true;
 }
 
+bool RtspResponse::Parse(std::string_view statusLine, std::string_view headers, std::string_view body)
+{
+    // RTSP/1.0 SP Status-Code SP Reason-Phrase
+    size_t versionEnd = statusLine.find(' ');
+    if (versionEnd == std::string_view::npos || statusLine.substr(0, versionEnd) != RTSP_VERSION) {
+        LOGE("Failed to parse RTSP response status line");
+        return false;
+    }
+
+    std::string_view rest = statusLine.substr(versionEnd + 1);
+    std::string_view code = rest.substr(0, rest.find(' '));
+    const char *codeEnd = code.data() + code.size();
+    int value = 0;
+    if (code.empty() || std::from_chars(code.data(), codeEnd, value).ptr != codeEnd) {
+        LOGE("Failed to parse RTSP response status code");
+        return false;
+    }
+    statusCode_ = (StatusCode)value;
+    statusMessage_ = code.size() < rest.size() ? std::string(rest.substr(code.size() + 1)) : std::string();
+
+    while (!headers.empty()) {
+        size_t end = headers.find("\r\n");
+        std::string_view line = headers.substr(0, end);
+        headers = end == std::string_view::npos ? std::string_view() : headers.substr(end + 2);
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            continue;
+        }
+
+        std::string name(line.substr(0, colon));
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+            value.remove_prefix(1);
+        }
+
+        auto x = FindKeyByValue(name);
+        if (x != ResponseHeader::INVALID_VALUE) {
+            headers_.emplace(x, std::string(value));
+        } else {
+            LOGE("Unrecognizable header field: %s", name.c_str());
+        }
+    }
+
+    messageBody_ = std::string(body);
+    return true;
+}
+
 std::vector<std::string> RtspResponseOptions::GetPublic()
 {
     std::regex regex("\\s*,\\s*");
@@ -180,6 +230,26 @@ std::pair<uint16_t, uint16_t> RtspResponseSetup::GetServerPort()
     return {0, 0};
 }
 
+bool RtspResponseSetup::GetInterleaved(uint8_t &rtpChannel, uint8_t &rtcpChannel)
+{
+    std::string transport = GetHeader(ResponseHeader::TRANSPORT);
+    std::regex pattern("interleaved=([0-9]+)(-([0-9]+))?");
+    std::smatch matches;
+    if (!std::regex_search(transport, matches, pattern)) {
+        return false;
+    }
+
+    int rtp = std::stoi(matches[1]);
+    int rtcp = matches[3].matched ? std::stoi(matches[3]) : rtp + 1;
+    if (rtp > 255 || rtcp > 255) {
+        return false;
+    }
+
+    rtpChannel = rtp;
+    rtcpChannel = rtcp;
+    return true;
+}
+
 std::string RtspResponseSetup::GetSession()
 {
     auto session = GetHeader(ResponseHeader::SESSION);
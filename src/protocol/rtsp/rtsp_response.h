@@ -12,6 +12,7 @@
 #include <map>
 #include <regex>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -103,6 +104,8 @@ public:
 
     virtual std::string Stringify();
     bool Parse(const std::string &response);
+    // from a message already split by RtspStreamParser, without regular expressions
+    bool Parse(std::string_view statusLine, std::string_view headers, std::string_view body);
 
 private:
     int cseq_ = -1;
@@ -138,6 +141,8 @@ public:
     RtspResponse &SetTransport(std::string transport);
     std::string GetTransport();
     std::pair<uint16_t, uint16_t> GetServerPort();
+    // RTP and RTCP channels of an interleaved transport, false if the server did not choose one
+    bool GetInterleaved(uint8_t &rtpChannel, uint8_t &rtcpChannel);
     std::string GetSession();
     int GetTimeout();
 };
@@ -201,6 +201,57 @@ bool MediaDescription::GetVideoConfig(int &pt, std::string &format, int &clockCy
     return true;
 }
 
+void MediaDescription::GetVideoPacketization(int &packetizationMode, uint32_t &interleavingDepth)
+{
+    packetizationMode = 0;
+    interleavingDepth = 0;
+    if (type != VIDEO) {
+        return;
+    }
+
+    std::string mark("fmtp:");
+    for (auto &a : attributes) {
+        if (a.find(mark) != std::string::npos) {
+            std::smatch sm;
+            if (std::regex_search(a, sm, std::regex("packetization-mode=([0-9]+)"))) {
+                packetizationMode = std::stoi(sm[1]);
+            }
+            if (std::regex_search(a, sm, std::regex("sprop-interleaving-depth=([0-9]+)"))) {
+                interleavingDepth = std::stoul(sm[1]);
+            }
+            return;
+        }
+    }
+}
+
+uint32_t MediaDescription::GetVideoMaxDonDiff()
+{
+    if (type != VIDEO) {
+        return 0;
+    }
+
+    std::string mark("fmtp:");
+    for (auto &a : attributes) {
+        if (a.find(mark) != std::string::npos) {
+            std::smatch sm;
+            if (std::regex_search(a, sm, std::regex("sprop-max-don-diff=([0-9]+)"))) {
+                return std::stoul(sm[1]);
+            }
+            return 0;
+        }
+    }
+    return 0;
+}
+
+std::shared_ptr<DataBuffer> MediaDescription::GetVideoVps()
+{
+    if (sps_ == nullptr) {
+        ParseVideoSpsPps();
+    }
+
+    return vps_;
+}
+
 std::shared_ptr<DataBuffer> MediaDescription::GetVideoSps()
 {
     if (sps_ != nullptr) {
@@ -226,6 +277,10 @@ std::pair<int, int> MediaDescription::GetVideoSize()
         ParseVideoSpsPps();
     }
 
+    if (vps_ != nullptr) {
+        return GetHevcVideoSize();
+    }
+
     if (sps_ == nullptr || sps_->Size() <= 14) {
         LOGE("sps is invalid");
         return {0, 0};
@@ -372,39 +427,129 @@ std::pair<int, int> MediaDescription::GetVideoSize()
     return {width, height};
 }
 
+std::pair<int, int> MediaDescription::GetHevcVideoSize()
+{
+    if (sps_ == nullptr || sps_->Size() <= 4 + 2 + 13) {
+        LOGE("sps is invalid");
+        return {0, 0};
+    }
+
+    // parsed from a copy, emulation prevention bytes are removed in place
+    std::vector<uint8_t> rbsp(sps_->Data() + 4, sps_->Data() + sps_->Size());
+    uint8_t *buf = rbsp.data();
+    uint32_t len = rbsp.size();
+    uint32_t cursor = 0;
+    ExtractNaluRbsp(buf, &len);
+
+    /// Rec. ITU-T H.265 (08/2021)
+    /// 7.3.2.2.1 General sequence parameter set RBSP syntax
+
+    // forbidden_zero_bit
+    GetU(1, buf, cursor);
+    int32_t nalUnitType = GetU(6, buf, cursor);
+    if (nalUnitType != 33) {
+        return {0, 0};
+    }
+    // nuh_layer_id, nuh_temporal_id_plus1
+    GetU(9, buf, cursor);
+
+    // sps_video_parameter_set_id
+    GetU(4, buf, cursor);
+    int32_t sps_max_sub_layers_minus1 = GetU(3, buf, cursor);
+    // sps_temporal_id_nesting_flag
+    GetU(1, buf, cursor);
+
+    // profile_tier_level(1, sps_max_sub_layers_minus1): general profile 88 bits, general_level_idc
+    cursor += 88 + 8;
+    int32_t sub_layer_profile_present_flag[8];
+    int32_t sub_layer_level_present_flag[8];
+    for (int32_t i = 0; i < sps_max_sub_layers_minus1; i++) {
+        sub_layer_profile_present_flag[i] = GetU(1, buf, cursor);
+        sub_layer_level_present_flag[i] = GetU(1, buf, cursor);
+    }
+    if (sps_max_sub_layers_minus1 > 0) {
+        // reserved_zero_2bits
+        cursor += 2 * (8 - sps_max_sub_layers_minus1);
+    }
+    for (int32_t i = 0; i < sps_max_sub_layers_minus1; i++) {
+        cursor += sub_layer_profile_present_flag[i] ? 88 : 0;
+        cursor += sub_layer_level_present_flag[i] ? 8 : 0;
+    }
+    if (cursor >= len * 8) {
+        return {0, 0};
+    }
+
+    // sps_seq_parameter_set_id
+    GetUe(buf, len, cursor);
+    int32_t chroma_format_idc = GetUe(buf, len, cursor);
+    int32_t separate_colour_plane_flag = 0;
+    if (chroma_format_idc == 3) {
+        separate_colour_plane_flag = GetU(1, buf, cursor);
+    }
+    int32_t width = GetUe(buf, len, cursor);  // pic_width_in_luma_samples
+    int32_t height = GetUe(buf, len, cursor); // pic_height_in_luma_samples
+
+    int32_t conformance_window_flag = GetU(1, buf, cursor);
+    if (conformance_window_flag) {
+        int32_t conf_win_left_offset = GetUe(buf, len, cursor);
+        int32_t conf_win_right_offset = GetUe(buf, len, cursor);
+        int32_t conf_win_top_offset = GetUe(buf, len, cursor);
+        int32_t conf_win_bottom_offset = GetUe(buf, len, cursor);
+
+        bool subsampled = !separate_colour_plane_flag && (chroma_format_idc == 1 || chroma_format_idc == 2);
+        int32_t subWidthC = subsampled ? 2 : 1;
+        int32_t subHeightC = (subsampled && chroma_format_idc == 1) ? 2 : 1;
+        width -= subWidthC * (conf_win_left_offset + conf_win_right_offset);
+        height -= subHeightC * (conf_win_top_offset + conf_win_bottom_offset);
+    }
+
+    return {width, height};
+}
+
 bool MediaDescription::ParseVideoSpsPps()
 {
     if (type != VIDEO) {
         return false;
     }
 
+    char startCode[4] = {0x00, 0x00, 0x00, 0x01};
+    auto decode = [&startCode](const std::string &base64, std::shared_ptr<DataBuffer> &nalu) {
+        std::vector<uint8_t> naluVec;
+        if (!Base64::Decode(base64, naluVec)) {
+            return false;
+        }
+        nalu = DataBuffer::Create(4 + naluVec.size());
+        nalu->Assign(startCode, 4);
+        nalu->Append(naluVec.data(), naluVec.size());
+        return true;
+    };
+
     std::string mark("fmtp:");
     for (auto &a : attributes) {
         if (a.find(mark) != std::string::npos) {
-            std::regex pattern("sprop-parameter-sets=([a-zA-Z0-9+=]+),([a-zA-Z0-9+=]+)");
             std::smatch sm;
+            // H.265, RFC 7798
+            std::smatch vps, sps, pps;
+            if (std::regex_search(a, vps, std::regex("sprop-vps=([a-zA-Z0-9+/=]+)")) &&
+                std::regex_search(a, sps, std::regex("sprop-sps=([a-zA-Z0-9+/=]+)")) &&
+                std::regex_search(a, pps, std::regex("sprop-pps=([a-zA-Z0-9+/=]+)"))) {
+                if (!decode(vps[1], vps_) || !decode(sps[1], sps_) || !decode(pps[1], pps_)) {
+                    vps_ = sps_ = pps_ = nullptr;
+                    return false;
+                }
+                return true;
+            }
+
+            std::regex pattern("sprop-parameter-sets=([a-zA-Z0-9+=]+),([a-zA-Z0-9+=]+)");
             if (!std::regex_search(a, sm, pattern)) {
                 LOGE("error");
                 return false;
             }
 
-            std::string spsBase64 = sm[1];
-            std::string ppsBase64 = sm[2];
-
-            std::vector<uint8_t> spsVec, ppsVec;
-            if (!Base64::Decode(spsBase64, spsVec) || !Base64::Decode(ppsBase64, ppsVec)) {
+            if (!decode(sm[1], sps_) || !decode(sm[2], pps_)) {
+                sps_ = pps_ = nullptr;
                 return false;
             }
-
-            char startCode[4] = {0x00, 0x00, 0x00, 0x01};
-
-            sps_ = DataBuffer::Create(4 + spsVec.size());
-            sps_->Assign(startCode, 4);
-            sps_->Append(spsVec.data(), spsVec.size());
-
-            pps_ = DataBuffer::Create(4 + ppsVec.size());
-            pps_->Assign(startCode, 4);
-            pps_->Append(ppsVec.data(), ppsVec.size());
             return true;
         }
     }
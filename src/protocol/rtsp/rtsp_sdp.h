@@ -45,12 +45,19 @@ public:
     bool GetAudioConfig(int &pt, std::string &format, int &samplingRate, int &channels);
 
     bool GetVideoConfig(int &pt, std::string &format, int &clockCycle);
+    // packetization-mode and sprop-interleaving-depth of the fmtp line, 0 when absent
+    void GetVideoPacketization(int &packetizationMode, uint32_t &interleavingDepth);
+    // sprop-max-don-diff of H.265, 0 when absent
+    uint32_t GetVideoMaxDonDiff();
+    // H.265 only
+    std::shared_ptr<DataBuffer> GetVideoVps();
     std::shared_ptr<DataBuffer> GetVideoSps();
     std::shared_ptr<DataBuffer> GetVideoPps();
     std::pair<int, int> GetVideoSize();
 
 private:
     bool ParseVideoSpsPps();
+    std::pair<int, int> GetHevcVideoSize();
     int32_t GetSe(uint8_t *buf, uint32_t nLen, uint32_t &pos);
     int32_t GetUe(const uint8_t *buf, uint32_t nLen, uint32_t &pos);
     int32_t GetU(uint8_t bitCount, const uint8_t *buf, uint32_t &pos);
@@ -68,6 +75,7 @@ public:
     std::string bandwidth;               // b=
     std::vector<std::string> attributes; // a=
 
+    std::shared_ptr<DataBuffer> vps_;
     std::shared_ptr<DataBuffer> sps_;
     std::shared_ptr<DataBuffer> pps_;
 };
@@ -0,0 +1,209 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "rtsp_stream_parser.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+
+constexpr size_t INTERLEAVED_HEADER_SIZE = 4; // '$', channel, 16-bit length
+constexpr size_t METHOD_SIZE_MAX = 32;        // longest request method name we wait for
+
+static bool IsUpper(uint8_t c)
+{
+    return c >= 'A' && c <= 'Z';
+}
+
+static bool EqualsIgnoreCase(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::string_view Trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// 1 if `data` starts like "RTSP/" or a request line, 0 if it still may, -1 if it cannot
+static int MatchStartLine(const char *data, size_t size)
+{
+    static const char VERSION[] = "RTSP/";
+    size_t n = std::min(size, sizeof(VERSION) - 1);
+    if (std::equal(data, data + n, VERSION)) {
+        return n == sizeof(VERSION) - 1 ? 1 : 0;
+    }
+
+    // METHOD SP
+    for (size_t i = 0; i < size && i <= METHOD_SIZE_MAX; i++) {
+        if (data[i] == ' ') {
+            return i > 0 ? 1 : -1;
+        }
+        if (!IsUpper(data[i]) && data[i] != '_') {
+            return -1;
+        }
+    }
+    return size <= METHOD_SIZE_MAX ? 0 : -1;
+}
+
+std::string_view RtspStreamParser::Message::Header(std::string_view name) const
+{
+    std::string_view rest = headers;
+    while (!rest.empty()) {
+        size_t end = rest.find('\n');
+        std::string_view line = rest.substr(0, end);
+        rest = end == std::string_view::npos ? std::string_view() : rest.substr(end + 1);
+
+        size_t colon = line.find(':');
+        if (colon != std::string_view::npos && EqualsIgnoreCase(Trim(line.substr(0, colon)), name)) {
+            return Trim(line.substr(colon + 1));
+        }
+    }
+    return {};
+}
+
+int RtspStreamParser::Message::CSeq() const
+{
+    std::string_view value = Header("CSeq");
+    int cseq = -1;
+    if (std::from_chars(value.data(), value.data() + value.size(), cseq).ec != std::errc()) {
+        return -1;
+    }
+    return cseq;
+}
+
+void RtspStreamParser::Input(const uint8_t *data, size_t size)
+{
+    // finish the buffered tail first, copying no more of this read than it needs when it is a packet
+    while (!tail_.empty() && size > 0) {
+        size_t take = size;
+        if (tail_[0] == '$') {
+            size_t need = INTERLEAVED_HEADER_SIZE;
+            if (tail_.size() >= INTERLEAVED_HEADER_SIZE) {
+                need += ((uint8_t)tail_[2] << 8) | (uint8_t)tail_[3];
+            }
+            take = std::min(size, need - tail_.size());
+        }
+
+        tail_.append((const char *)data, take);
+        data += take;
+        size -= take;
+        tail_.erase(0, Parse((const uint8_t *)tail_.data(), tail_.size()));
+    }
+
+    if (size == 0) {
+        return;
+    }
+
+    size_t used = Parse(data, size);
+    tail_.assign((const char *)data + used, size - used);
+}
+
+void RtspStreamParser::Reset()
+{
+    tail_.clear();
+}
+
+size_t RtspStreamParser::Parse(const uint8_t *data, size_t size)
+{
+    size_t offset = 0;
+    while (offset < size) {
+        const uint8_t *p = data + offset;
+        size_t left = size - offset;
+        if (p[0] == '$') {
+            if (left < INTERLEAVED_HEADER_SIZE) {
+                break;
+            }
+
+            size_t length = (p[2] << 8) | p[3];
+            if (left < INTERLEAVED_HEADER_SIZE + length) {
+                break;
+            }
+
+            if (interleavedHandler_) {
+                interleavedHandler_(p[1], p + INTERLEAVED_HEADER_SIZE, length);
+            }
+            offset += INTERLEAVED_HEADER_SIZE + length;
+            continue;
+        }
+
+        size_t messageSize = IsUpper(p[0]) ? ParseMessage((const char *)p, left) : SIZE_MAX;
+        if (messageSize == 0) {
+            break;
+        }
+
+        if (messageSize == SIZE_MAX) {
+            // resynchronize on the next byte that may start a packet or a message
+            size_t skip = 1;
+            while (skip < left && p[skip] != '$' && !IsUpper(p[skip])) {
+                skip++;
+            }
+            skipped_ += skip;
+            offset += skip;
+            continue;
+        }
+
+        offset += messageSize;
+    }
+
+    return offset;
+}
+
+size_t RtspStreamParser::ParseMessage(const char *data, size_t size)
+{
+    int match = MatchStartLine(data, size);
+    if (match <= 0) {
+        return match == 0 ? 0 : SIZE_MAX;
+    }
+
+    static const char BLANK_LINE[] = "\r\n\r\n";
+    const char *end = data + std::min(size, RTSP_HEADER_SIZE_MAX);
+    const char *blank = std::search(data, end, BLANK_LINE, BLANK_LINE + 4);
+    if (blank == end) {
+        return size < RTSP_HEADER_SIZE_MAX ? 0 : SIZE_MAX;
+    }
+
+    Message message;
+    const char *lineEnd = std::search(data, blank + 2, BLANK_LINE, BLANK_LINE + 2);
+    message.startLine = std::string_view(data, lineEnd - data);
+    if (lineEnd != blank) {
+        message.headers = std::string_view(lineEnd + 2, blank - lineEnd);
+    }
+
+    size_t headerSize = blank + 4 - data;
+    size_t contentLength = 0;
+    std::string_view value = message.Header("Content-Length");
+    if (!value.empty() && std::from_chars(value.data(), value.data() + value.size(), contentLength).ec != std::errc()) {
+        return SIZE_MAX;
+    }
+
+    if (contentLength > RTSP_BODY_SIZE_MAX) {
+        return SIZE_MAX;
+    }
+
+    if (size < headerSize + contentLength) {
+        return 0;
+    }
+
+    message.body = std::string_view(data + headerSize, contentLength);
+    if (messageHandler_) {
+        messageHandler_(message);
+    }
+    return headerSize + contentLength;
+}
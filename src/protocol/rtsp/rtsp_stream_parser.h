@@ -0,0 +1,68 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_PROTOCOL_RTSP_STREAM_PARSER_H
+#define HALFWAY_MEDIA_PROTOCOL_RTSP_STREAM_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// upper bound of the start line plus headers, a longer header means the stream is out of sync
+constexpr size_t RTSP_HEADER_SIZE_MAX = 16384;
+// upper bound of a message body, e.g. a large SDP
+constexpr size_t RTSP_BODY_SIZE_MAX = 1048576;
+
+// Incremental parser of the byte stream of an RTSP connection (RFC 2326 10.12).
+// Splits it into messages, framed by their blank line and Content-Length, and $-framed interleaved packets, whatever
+// the read boundaries are: a read may end inside a header, a body or a packet, or hold several of them.
+//
+// Messages and packets are handed out as views into the data passed to Input() when they are complete there, only an
+// incomplete tail is copied and kept for the next call. A view is valid during the handler only.
+// Bytes that cannot start a message or a packet are skipped until one can, so a corrupt stream resynchronizes.
+class RtspStreamParser {
+public:
+    struct Message {
+        std::string_view startLine; // "RTSP/1.0 200 OK", or a request line of the server
+        std::string_view headers;   // header lines after the start line, each ended by CRLF
+        std::string_view body;
+
+        bool IsResponse() const { return startLine.compare(0, 5, "RTSP/") == 0; }
+        // value of the first header named `name`, case-insensitive, without surrounding whitespace
+        std::string_view Header(std::string_view name) const;
+        // CSeq header, -1 if missing
+        int CSeq() const;
+    };
+
+    using MessageHandler = std::function<void(const Message &message)>;
+    using InterleavedHandler = std::function<void(uint8_t channel, const uint8_t *data, size_t size)>;
+
+    void SetMessageHandler(MessageHandler handler) { messageHandler_ = std::move(handler); }
+    void SetInterleavedHandler(InterleavedHandler handler) { interleavedHandler_ = std::move(handler); }
+
+    void Input(const uint8_t *data, size_t size);
+
+    // drops a buffered tail, e.g. after reconnecting, not from inside a handler
+    void Reset();
+
+    size_t Buffered() const { return tail_.size(); }
+    uint64_t SkippedBytes() const { return skipped_; }
+
+private:
+    // returns the bytes used by complete messages and packets
+    size_t Parse(const uint8_t *data, size_t size);
+    // hands out the message starting at `data` and returns its length, 0 while incomplete, SIZE_MAX if no message
+    // can start there
+    size_t ParseMessage(const char *data, size_t size);
+
+private:
+    std::string tail_;
+    uint64_t skipped_ = 0;
+    MessageHandler messageHandler_;
+    InterleavedHandler interleavedHandler_;
+};
+
+#endif // HALFWAY_MEDIA_PROTOCOL_RTSP_STREAM_PARSER_H
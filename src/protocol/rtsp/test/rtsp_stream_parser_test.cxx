@@ -0,0 +1,215 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "../rtsp_response.h"
+#include "../rtsp_stream_parser.h"
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// Feeds an RTSP connection stream to the parser in reads of every size and checks what comes out.
+
+struct Item {
+    bool packet;
+    int channel;
+    std::string data; // whole message, or packet payload
+};
+
+struct Collector {
+    std::vector<Item> items;
+    RtspStreamParser parser;
+
+    Collector()
+    {
+        parser.SetMessageHandler([this](const RtspStreamParser::Message &message) {
+            std::string whole(message.startLine.data(), message.body.data() + message.body.size());
+            items.push_back({false, -1, whole});
+        });
+        parser.SetInterleavedHandler([this](uint8_t channel, const uint8_t *data, size_t size) {
+            items.push_back({true, channel, std::string((const char *)data, size)});
+        });
+    }
+
+    void Input(const std::string &data) { parser.Input((const uint8_t *)data.data(), data.size()); }
+};
+
+static std::string Packet(uint8_t channel, const std::string &payload)
+{
+    std::string frame = "$";
+    frame += (char)channel;
+    frame += (char)(payload.size() >> 8);
+    frame += (char)(payload.size() & 0xff);
+    return frame + payload;
+}
+
+static const std::string SETUP_RESPONSE = "RTSP/1.0 200 OK\r\n"
+                                          "CSeq: 3\r\n"
+                                          "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n"
+                                          "Session: 12345678;timeout=60\r\n"
+                                          "\r\n";
+
+static const std::string DESCRIBE_RESPONSE = "RTSP/1.0 200 OK\r\n"
+                                             "CSeq: 2\r\n"
+                                             "Content-Type: application/sdp\r\n"
+                                             "content-length:   27\r\n"
+                                             "\r\n"
+                                             "v=0\r\n"
+                                             "m=video 0 RTP/AVP 96\r\n";
+
+static const std::string SERVER_REQUEST = "GET_PARAMETER rtsp://host/a RTSP/1.0\r\nCSeq: 1\r\n\r\n";
+
+static std::string Stream(std::vector<Item> &expected)
+{
+    std::string rtp(1400, '\x80');
+    for (size_t i = 0; i < rtp.size(); i++) {
+        rtp[i] = (char)(i * 7); // contains '$', 'R' and CRLF
+    }
+
+    expected = {{false, -1, DESCRIBE_RESPONSE},  {false, -1, SETUP_RESPONSE}, {true, 0, rtp},
+                {true, 1, std::string(28, 'R')}, {false, -1, SERVER_REQUEST}, {true, 2, ""},
+                {true, 0, rtp.substr(0, 12)},    {false, -1, SETUP_RESPONSE}};
+
+    std::string stream;
+    for (auto &item : expected) {
+        stream += item.packet ? Packet(item.channel, item.data) : item.data;
+    }
+    return stream;
+}
+
+static void Check(const std::vector<Item> &items, const std::vector<Item> &expected)
+{
+    assert(items.size() == expected.size());
+    for (size_t i = 0; i < items.size(); i++) {
+        assert(items[i].packet == expected[i].packet);
+        assert(items[i].channel == expected[i].channel);
+        assert(items[i].data == expected[i].data);
+    }
+}
+
+static void TestWholeAndSplit()
+{
+    std::vector<Item> expected;
+    std::string stream = Stream(expected);
+
+    Collector whole;
+    whole.Input(stream);
+    Check(whole.items, expected);
+    assert(whole.parser.Buffered() == 0);
+
+    // every split point, and byte by byte
+    for (size_t split = 1; split < stream.size(); split++) {
+        Collector collector;
+        collector.Input(stream.substr(0, split));
+        collector.Input(stream.substr(split));
+        Check(collector.items, expected);
+        assert(collector.parser.Buffered() == 0);
+    }
+
+    Collector bytes;
+    for (char c : stream) {
+        bytes.Input(std::string(1, c));
+    }
+    Check(bytes.items, expected);
+
+    // random reads
+    std::mt19937 random(7);
+    for (int round = 0; round < 200; round++) {
+        Collector collector;
+        size_t offset = 0;
+        while (offset < stream.size()) {
+            size_t size = random() % 1500 + 1;
+            collector.Input(stream.substr(offset, size));
+            offset += size;
+        }
+        Check(collector.items, expected);
+    }
+}
+
+static void TestPartialPacketCopy()
+{
+    // a packet cut by the read is completed from the next read without copying the packets behind it
+    std::string payload(1000, 'x');
+    std::string stream = Packet(0, payload) + Packet(0, payload) + Packet(0, payload);
+    Collector collector;
+    collector.Input(stream.substr(0, 500));
+    assert(collector.items.empty());
+    assert(collector.parser.Buffered() == 500);
+    collector.Input(stream.substr(500, 2000));
+    assert(collector.items.size() == 2);
+    assert(collector.parser.Buffered() == 2500 - 2 * 1004);
+    collector.Input(stream.substr(2500));
+    assert(collector.items.size() == 3);
+    assert(collector.parser.Buffered() == 0);
+}
+
+static void TestResync()
+{
+    std::vector<Item> expected;
+    std::string stream = Stream(expected);
+
+    Collector collector;
+    collector.Input(std::string("\x01\x02garbage\r\n", 11));
+    collector.Input(stream);
+    Check(collector.items, expected);
+    assert(collector.parser.SkippedBytes() > 0);
+
+    // a header that never ends is given up
+    Collector endless;
+    endless.Input("RTSP/1.0 200 OK\r\n" + std::string(RTSP_HEADER_SIZE_MAX, 'a'));
+    endless.Input(SETUP_RESPONSE);
+    assert(endless.items.size() == 1);
+    assert(endless.items[0].data == SETUP_RESPONSE);
+}
+
+static void TestMessage()
+{
+    RtspStreamParser parser;
+    int count = 0;
+    parser.SetMessageHandler([&count](const RtspStreamParser::Message &message) {
+        assert(message.IsResponse());
+        assert(message.CSeq() == 2);
+        assert(message.Header("CONTENT-TYPE") == "application/sdp");
+        assert(message.Header("Content-Length") == "27");
+        assert(message.Header("Session").empty());
+        assert(message.body == "v=0\r\nm=video 0 RTP/AVP 96\r\n");
+
+        RtspResponse response;
+        assert(response.Parse(message.startLine, message.headers, message.body));
+        assert(response.GetStatusCode() == StatusCode::OK);
+        assert(response.GetStatusMessage() == "OK");
+        assert(response.GetCSeq() == 2);
+        assert(response.GetHeader(ResponseHeader::CONTENT_TYPE) == "application/sdp");
+        assert(response.GetMessageBody() == message.body);
+        count++;
+    });
+    parser.Input((const uint8_t *)DESCRIBE_RESPONSE.data(), DESCRIBE_RESPONSE.size());
+    assert(count == 1);
+
+    RtspResponse setup;
+    assert(setup.Parse("RTSP/1.0 200 OK", "CSeq: 3\r\nTransport: RTP/AVP/TCP;unicast;interleaved=4-5\r\n", ""));
+    RtspResponseSetup transport(setup);
+    uint8_t rtp = 0, rtcp = 0;
+    assert(transport.GetInterleaved(rtp, rtcp) && rtp == 4 && rtcp == 5);
+
+    RtspResponse error;
+    assert(error.Parse("RTSP/1.0 461 Unsupported Transport", "CSeq: 4\r\n", ""));
+    assert(error.GetStatusCode() == StatusCode::UnsupportedTransport);
+    assert(error.GetStatusMessage() == "Unsupported Transport");
+    assert(!error.Parse("HTTP/1.1 200 OK", "", ""));
+    assert(!error.Parse("RTSP/1.0 2x0 OK", "", ""));
+}
+
+int main()
+{
+    TestWholeAndSplit();
+    TestPartialPacketCopy();
+    TestResync();
+    TestMessage();
+
+    printf("rtsp stream parser test passed\n");
+    return 0;
+}
@@ -23,7 +23,13 @@ bool RtspClientSession::Init()
         return false;
     }
 
-    source_ = RtspSource::Create(url_);
+    auto source = RtspSource::Create(url_);
+    if (reactorLoop_ >= 0) {
+        source->SetReactorLoop(reactorLoop_);
+    }
+    source->SetFastConnect(fastConnect_);
+    source->SetDeliveryOptions(deliveryOptions_);
+    source_ = source;
 
     if (!source_->Init()) {
         LOGE("source init failed");
@@ -46,4 +52,26 @@ bool RtspClientSession::Start()
 
     LOGD("source started");
     return true;
-}
\ No newline at end of file
+}
+
+void RtspClientSession::Stop()
+{
+    if (!source_) {
+        return;
+    }
+
+    source_->Stop();
+    if (sink_) {
+        source_->RemoveVideoSink(sink_);
+        source_->RemoveAudioSink(sink_);
+
+        AgentEvent event{EVENT_SINK_STOP, nullptr};
+        std::static_pointer_cast<FrameSink>(sink_)->OnNotify(&event);
+    }
+    LOGD("session %s stopped", url_.c_str());
+}
+
+bool RtspClientSession::GetSinkDeliveryStats(SinkDeliveryStats &stats)
+{
+    return source_ && sink_ && source_->GetSinkDeliveryStats(sink_->Id(), stats);
+}
@@ -7,6 +7,7 @@
 
 #include "../agent/base/media_sink.h"
 #include "../agent/base/media_source.h"
+#include <cstdint>
 #include <string>
 
 class RtspClientSession {
@@ -15,16 +16,33 @@ public:
     void SetSourceUrl(std::string url) { url_ = url; }
     void SetRecorderFileName(std::string filename) { filename_ = filename; }
 
+    // how frames reach the file sink and which UdpReactor loop receives the RTP packets, call before Init()
+    void SetDeliveryOptions(const DeliveryOptions &options) { deliveryOptions_ = options; }
+    void SetReactorLoop(size_t loop) { reactorLoop_ = loop; }
+    // skip OPTIONS, reuse the SDP of an earlier connection and pipeline SETUP/PLAY, see RtspSource::SetFastConnect()
+    void SetFastConnect(bool enable) { fastConnect_ = enable; }
+
     bool Init();
 
     bool Start();
 
+    // stops receiving, waits for the sink to take its last frame, then finishes the file
+    void Stop();
+
+    // frames received but not yet written to the file
+    bool GetSinkDeliveryStats(SinkDeliveryStats &stats);
+
 public:
     std::string url_;
     std::string filename_;
 
     std::shared_ptr<MediaSource> source_;
     std::shared_ptr<MediaSink> sink_;
+
+private:
+    DeliveryOptions deliveryOptions_;
+    int64_t reactorLoop_ = -1;
+    bool fastConnect_ = false;
 };
 
 #endif // HALFWAY_MEDIA_SESSION_RTSP_RECORDER_SESSION_H
\ No newline at end of file
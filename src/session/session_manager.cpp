@@ -0,0 +1,411 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#include "session_manager.h"
+#include "../common/log.h"
+#include "../common/udp_reactor.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+constexpr int CONTROL_POLL_INTERVAL_MS = 200;     // how quickly StopControlServer() is noticed
+constexpr int CONTROL_CLIENT_TIMEOUT_MS = 1000;   // a client that does not send its command in time is dropped
+constexpr size_t CONTROL_COMMAND_SIZE_MAX = 4096; // one line
+constexpr size_t SESSION_QUEUE_SIZE = 256;        // frames, about 5 s of 25 fps video with its audio
+
+static const char *StateName(SessionManager::State state)
+{
+    switch (state) {
+        case SessionManager::State::STARTING:
+            return "starting";
+        case SessionManager::State::RUNNING:
+            return "running";
+        default:
+            return "failed";
+    }
+}
+
+SessionManager::SessionManager(size_t workers)
+{
+    if (workers == 0) {
+        workers = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    // one reactor loop per worker, a session uses the loop with the index of its worker
+    UdpReactor::GetInstance()->SetLoopCount(workers);
+    deliveryPool_ = std::make_shared<WorkerPool>(workers);
+    controlPool_ = std::make_unique<WorkerPool>(workers);
+}
+
+SessionManager::~SessionManager()
+{
+    Stop();
+}
+
+bool SessionManager::Add(const std::string &name, const std::string &url, const std::string &file)
+{
+    return AddSession(name, url, file, false);
+}
+
+bool SessionManager::AddSession(const std::string &name, const std::string &url, const std::string &file,
+                                bool fromConfig)
+{
+    if (name.empty() || url.empty() || file.empty()) {
+        LOGE("session needs a name, url and file");
+        return false;
+    }
+
+    auto entry = std::make_shared<Session>();
+    entry->url = url;
+    entry->file = file;
+    entry->worker = std::hash<std::string>{}(name) % deliveryPool_->Size();
+    entry->fromConfig = fromConfig;
+    entry->session = std::make_shared<RtspClientSession>();
+    entry->session->SetSourceUrl(url);
+    entry->session->SetRecorderFileName(file);
+    entry->session->SetReactorLoop(entry->worker);
+    entry->session->SetFastConnect(true);
+
+    DeliveryOptions options;
+    options.mode = DeliveryMode::POOLED;
+    options.queueSize = SESSION_QUEUE_SIZE;
+    options.policy = OverflowPolicy::DROP_UNTIL_KEYFRAME;
+    options.pool = deliveryPool_;
+    options.worker = entry->worker;
+    entry->session->SetDeliveryOptions(options);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!sessions_.emplace(name, entry).second) {
+            LOGW("session %s already exists", name.c_str());
+            return false;
+        }
+    }
+
+    LOGD("add session %s on worker %zu: %s -> %s", name.c_str(), entry->worker, url.c_str(), file.c_str());
+    controlPool_->Post(entry->worker, [entry, name]() {
+        if (!entry->session->Init() || !entry->session->Start()) {
+            LOGE("session %s failed to start", name.c_str());
+            entry->state = State::FAILED;
+            return;
+        }
+        entry->state = State::RUNNING;
+    });
+    return true;
+}
+
+bool SessionManager::Remove(const std::string &name)
+{
+    std::shared_ptr<Session> entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = sessions_.find(name);
+        if (it == sessions_.end()) {
+            LOGW("no session %s", name.c_str());
+            return false;
+        }
+        entry = std::move(it->second);
+        sessions_.erase(it);
+    }
+
+    LOGD("remove session %s", name.c_str());
+    // runs after a pending Init()/Start() of the session, which was posted to the same worker
+    controlPool_->Post(entry->worker, [entry]() { entry->session->Stop(); });
+    return true;
+}
+
+bool SessionManager::LoadConfig(const std::string &path)
+{
+    std::ifstream config(path);
+    if (!config) {
+        LOGE("open %s failed: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct Item {
+        std::string url;
+        std::string file;
+    };
+    std::map<std::string, Item> items;
+    std::string line;
+    for (int number = 1; std::getline(config, line); number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string name;
+        Item item;
+        if (!(fields >> name)) {
+            continue;
+        }
+        if (!(fields >> item.url >> item.file)) {
+            LOGW("%s:%d: expected `name url file`", path.c_str(), number);
+            continue;
+        }
+        items[name] = item;
+    }
+
+    std::vector<std::string> removals;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        configPath_ = path;
+        for (auto &session : sessions_) {
+            auto it = items.find(session.first);
+            if (!session.second->fromConfig) {
+                if (it != items.end()) {
+                    LOGW("session %s was not added by the config, left alone", session.first.c_str());
+                    items.erase(it);
+                }
+                continue;
+            }
+
+            if (it == items.end() || it->second.url != session.second->url || it->second.file != session.second->file) {
+                removals.push_back(session.first);
+            } else {
+                items.erase(it);
+            }
+        }
+    }
+
+    for (auto &name : removals) {
+        Remove(name);
+    }
+
+    for (auto &item : items) {
+        AddSession(item.first, item.second.url, item.second.file, true);
+    }
+
+    LOGD("config %s: %zu sessions removed, %zu added", path.c_str(), removals.size(), items.size());
+    return true;
+}
+
+bool SessionManager::Reload()
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        path = configPath_;
+    }
+
+    if (path.empty()) {
+        LOGW("no config loaded");
+        return false;
+    }
+    return LoadConfig(path);
+}
+
+std::vector<SessionManager::SessionInfo> SessionManager::List()
+{
+    std::vector<SessionInfo> infos;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &item : sessions_) {
+        auto &entry = item.second;
+        SessionInfo info{item.first, entry->url, entry->file, entry->state, entry->worker, 0, 0, 0};
+        SinkDeliveryStats stats{};
+        // the session is only touched by its control worker until it runs
+        if (info.state == State::RUNNING && entry->session->GetSinkDeliveryStats(stats)) {
+            info.queuedFrames = stats.depth;
+            info.queuedBytes = stats.queuedBytes;
+            info.droppedFrames = stats.dropped;
+        }
+        infos.push_back(info);
+    }
+    return infos;
+}
+
+size_t SessionManager::ResidentBytes()
+{
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (!file) {
+        return 0;
+    }
+
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    int n = fscanf(file, "%lu %lu", &size, &resident);
+    fclose(file);
+    return n == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+std::string SessionManager::HandleCommand(const std::string &command)
+{
+    std::istringstream fields(command);
+    std::string verb;
+    fields >> verb;
+
+    if (verb == "add") {
+        std::string name, url, file;
+        if (!(fields >> name >> url >> file)) {
+            return "error: usage: add <name> <url> <file>\n";
+        }
+        return Add(name, url, file) ? "ok\n" : "error: cannot add " + name + "\n";
+    }
+
+    if (verb == "remove") {
+        std::string name;
+        if (!(fields >> name)) {
+            return "error: usage: remove <name>\n";
+        }
+        return Remove(name) ? "ok\n" : "error: no session " + name + "\n";
+    }
+
+    if (verb == "reload") {
+        return Reload() ? "ok\n" : "error: reload failed\n";
+    }
+
+    if (verb == "list") {
+        auto infos = List();
+        std::ostringstream out;
+        out << "# name state worker queued_frames queued_bytes dropped_frames url file\n";
+        for (auto &info : infos) {
+            out << info.name << ' ' << StateName(info.state) << ' ' << info.worker << ' ' << info.queuedFrames << ' '
+                << info.queuedBytes << ' ' << info.droppedFrames << ' ' << info.url << ' ' << info.file << '\n';
+        }
+
+        // what the sessions share (pools, reactor buffers, codec state) is only known for the whole process
+        size_t rss = ResidentBytes();
+        out << "# sessions " << infos.size() << " rss_bytes " << rss << " rss_bytes_per_session "
+            << (infos.empty() ? 0 : rss / infos.size()) << '\n';
+        return out.str();
+    }
+
+    return "error: unknown command `" + verb + "`, expected add, remove, list or reload\n";
+}
+
+bool SessionManager::StartControlServer(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(controlMutex_);
+    if (controlThread_) {
+        LOGW("control server is already running");
+        return true;
+    }
+
+    struct sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        LOGE("invalid control socket path %s", path.c_str());
+        return false;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOGE("socket failed: %s", strerror(errno));
+        return false;
+    }
+
+    // a socket file left by a previous run would fail the bind
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        LOGE("listen on %s failed: %s", path.c_str(), strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    controlPath_ = path;
+    controlFd_ = fd;
+    serving_ = true;
+    controlThread_ = std::make_unique<std::thread>(&SessionManager::ServeControl, this);
+    LOGD("control socket %s", path.c_str());
+    return true;
+}
+
+void SessionManager::StopControlServer()
+{
+    std::lock_guard<std::mutex> lock(controlMutex_);
+    if (!controlThread_) {
+        return;
+    }
+
+    serving_ = false;
+    if (controlThread_->joinable()) {
+        controlThread_->join();
+    }
+    controlThread_.reset();
+    close(controlFd_);
+    controlFd_ = -1;
+    unlink(controlPath_.c_str());
+}
+
+void SessionManager::ServeControl()
+{
+    while (serving_) {
+        struct pollfd pfd {
+            controlFd_, POLLIN, 0
+        };
+        if (poll(&pfd, 1, CONTROL_POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+
+        int fd = accept4(controlFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        HandleControlClient(fd);
+        close(fd);
+    }
+}
+
+void SessionManager::HandleControlClient(int fd)
+{
+    struct timeval timeout {
+        0, CONTROL_CLIENT_TIMEOUT_MS * 1000
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // one command, ended by a newline or by the client shutting down its side
+    std::string command;
+    char buffer[512];
+    while (command.find('\n') == std::string::npos && command.size() < CONTROL_COMMAND_SIZE_MAX) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            return;
+        }
+        if (n == 0) {
+            break;
+        }
+        command.append(buffer, n);
+    }
+
+    std::string response = HandleCommand(command.substr(0, command.find('\n')));
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            LOGW("send control response failed: %s", strerror(errno));
+            return;
+        }
+        sent += n;
+    }
+}
+
+void SessionManager::Stop()
+{
+    StopControlServer();
+
+    std::map<std::string, std::shared_ptr<Session>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions.swap(sessions_);
+    }
+
+    for (auto &item : sessions) {
+        auto entry = item.second;
+        controlPool_->Post(entry->worker, [entry]() { entry->session->Stop(); });
+    }
+    sessions.clear();
+
+    // the control pool runs the stops before its workers exit, drain tasks left after that find their sinks stopped
+    controlPool_->Stop();
+    deliveryPool_->Stop();
+}
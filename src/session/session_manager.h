@@ -0,0 +1,98 @@
+//
+// Copyright © 2024 SHAO Liming <lmshao@163.com>. All rights reserved.
+//
+
+#ifndef HALFWAY_MEDIA_SESSION_MANAGER_H
+#define HALFWAY_MEDIA_SESSION_MANAGER_H
+
+#include "../common/noncopyable.h"
+#include "../common/worker_pool.h"
+#include "rtsp_client_session.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Records many RTSP cameras with a thread count that follows the core count, not the camera count.
+/// A session is sharded to worker `hash(name) % workers`: its frames are muxed by that worker of the delivery pool
+/// (DeliveryMode::POOLED), its RTP sockets live on the UdpReactor loop of the same index, and Init/Start/Stop run in
+/// order on that worker of the control pool, so a camera that is slow to answer never stalls the recordings.
+///
+/// Sessions are added and removed at runtime, from a config file (one `name url file` per line, `#` comments) or
+/// from a unix control socket taking one command per connection:
+///   add <name> <url> <file> | remove <name> | list | reload
+class SessionManager : public NonCopyable {
+public:
+    /// 0 sizes the pools to the core count
+    explicit SessionManager(size_t workers = 0);
+    ~SessionManager();
+
+    bool Add(const std::string &name, const std::string &url, const std::string &file);
+    bool Remove(const std::string &name);
+
+    /// Adds the sessions of the file that are not running and removes those added by an earlier load that are no
+    /// longer in it, a changed url or file restarts the session. Sessions added otherwise are left alone.
+    bool LoadConfig(const std::string &path);
+    bool Reload();
+
+    enum class State { STARTING, RUNNING, FAILED };
+
+    struct SessionInfo {
+        std::string name;
+        std::string url;
+        std::string file;
+        State state;
+        size_t worker;
+        size_t queuedFrames;
+        size_t queuedBytes; // frames received but not yet written to the file
+        uint64_t droppedFrames;
+    };
+    std::vector<SessionInfo> List();
+
+    /// Resident set of the process from /proc/self/statm, 0 if unknown
+    static size_t ResidentBytes();
+
+    /// Text answer to one control command, e.g. "list"
+    std::string HandleCommand(const std::string &command);
+
+    bool StartControlServer(const std::string &path);
+    void StopControlServer();
+
+    /// Stops every session, then the workers
+    void Stop();
+
+private:
+    struct Session {
+        std::string url;
+        std::string file;
+        size_t worker;
+        bool fromConfig;
+        std::atomic<State> state{State::STARTING};
+        std::shared_ptr<RtspClientSession> session;
+    };
+
+    bool AddSession(const std::string &name, const std::string &url, const std::string &file, bool fromConfig);
+    void ServeControl();
+    void HandleControlClient(int fd);
+
+private:
+    std::shared_ptr<WorkerPool> deliveryPool_;
+    std::unique_ptr<WorkerPool> controlPool_;
+
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<Session>> sessions_;
+    std::string configPath_;
+
+    std::mutex controlMutex_;
+    std::string controlPath_;
+    int controlFd_ = -1;
+    std::atomic<bool> serving_{false};
+    std::unique_ptr<std::thread> controlThread_;
+};
+
+#endif // HALFWAY_MEDIA_SESSION_MANAGER_H